@@ -0,0 +1,154 @@
+#ifndef ADAPTIVE_H
+#define ADAPTIVE_H
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <fmt/core.h>
+#include <limits>
+#include <memory_resource>
+#include <vector>
+
+#include "framebuffer.h"
+#include "scheduler.h"
+
+
+struct AdaptiveSettings {
+  float    errorThreshold = 0.02f; // relative standard error of the pixel mean at which a pixel counts as converged
+  uint32_t minSamples     = 8;     // uniform samples per pixel before the variance estimate is trusted, at least 2
+  uint32_t maxSamples     = 256;   // hard cap per pixel
+  float    passBudget     = 1.0f;  // samples spent per adaptive pass, in samples per pixel of the full image
+};
+
+
+// Decides how many samples every pixel gets in the next pass.
+// The first pass brings every pixel to minSamples. Every later pass spends a fixed budget of
+// passBudget * width * height samples on the pixels whose error is still above the threshold, in proportion to their
+// error, so the samples that flat converged regions no longer take go to the noisy ones. Error is measured in
+// luminance relative to the pixel mean and is clamped from below by its tile's mean error, so a pixel whose first
+// few samples happened to agree is not abandoned while its neighbourhood is still noisy.
+class AdaptiveSampler {
+public:
+  AdaptiveSampler(const AccumulationBuffer &accumulation, AdaptiveSettings settings = {}) :
+      settings(settings), accumulation(accumulation),
+      tiles(MakeTiles(accumulation.Width(), accumulation.Height(), accumulation.TileSize(), TileOrder::Scanline)),
+      plan(static_cast<size_t>(accumulation.Width()) * accumulation.Height(), 0), error(plan.size(), 0) {}
+
+  AdaptiveSettings settings;
+
+  // Fills the sample plan for the next pass and returns the number of samples it contains, 0 once every pixel has
+  // converged or reached maxSamples
+  uint64_t PlanPass() {
+    const int width  = accumulation.Width();
+    uint64_t  budget = 0;
+    if (firstPass) {
+      const uint32_t minSamples = std::max(2u, settings.minSamples);
+      firstPass                 = false;
+      std::fill(plan.begin(), plan.end(), minSamples);
+      budget = static_cast<uint64_t>(plan.size()) * minSamples;
+      planned += budget;
+      return budget;
+    }
+
+    // Error per pixel, raised to the mean error of its tile
+    double activeError = 0;
+    activePixels       = 0;
+    for (const Tile &tile: tiles) {
+      double tileError = 0;
+      for (int y = tile.y0; y < tile.y1; y++) {
+        for (int x = tile.x0; x < tile.x1; x++) {
+          error[x + static_cast<size_t>(y) * width] = PixelError(x, y);
+          tileError += error[x + static_cast<size_t>(y) * width];
+        }
+      }
+      const float tileMean = static_cast<float>(tileError / tile.PixelCount());
+      for (int y = tile.y0; y < tile.y1; y++) {
+        for (int x = tile.x0; x < tile.x1; x++) {
+          float &pixelError = error[x + static_cast<size_t>(y) * width];
+          pixelError        = std::max(pixelError, tileMean);
+          if (pixelError <= settings.errorThreshold || accumulation.SampleCount(x, y) >= settings.maxSamples) {
+            pixelError = 0;
+            continue;
+          }
+          activeError += pixelError;
+          activePixels++;
+        }
+      }
+    }
+
+    std::fill(plan.begin(), plan.end(), 0);
+    if (activePixels == 0) {
+      return 0;
+    }
+    const double passSamples = settings.passBudget * static_cast<double>(plan.size());
+    for (int y = 0; y < accumulation.Height(); y++) {
+      for (int x = 0; x < width; x++) {
+        const size_t index = x + static_cast<size_t>(y) * width;
+        if (error[index] == 0) {
+          continue;
+        }
+        const uint32_t remaining = settings.maxSamples - accumulation.SampleCount(x, y);
+        const double   share     = std::ceil(passSamples * error[index] / activeError);
+        plan[index]              = static_cast<uint32_t>(std::min<double>(remaining, share));
+        budget += plan[index];
+      }
+    }
+    planned += budget;
+    return budget;
+  }
+
+  uint32_t SamplesThisPass(int x, int y) const { return plan[x + static_cast<size_t>(y) * accumulation.Width()]; }
+
+  // True once the last PlanPass() gave no pixel of `tile`, a tile of the accumulation buffer, any samples. Then every
+  // pixel of it has converged or reached maxSamples, and as none of them changes no later pass plans samples for the
+  // tile either: it is final.
+  bool TileFinished(const Tile &tile) const {
+    if (firstPass) {
+      return false;
+    }
+    for (int y = tile.y0; y < tile.y1; y++) {
+      for (int x = tile.x0; x < tile.x1; x++) {
+        if (SamplesThisPass(x, y) > 0) {
+          return false;
+        }
+      }
+    }
+    return true;
+  }
+
+  // Relative standard error of the luminance mean of a pixel
+  float PixelError(int x, int y) const {
+    const uint32_t count = accumulation.SampleCount(x, y);
+    if (count < 2) {
+      return std::numeric_limits<float>::infinity();
+    }
+    const float standardError = std::sqrt(accumulation.LuminanceVariance(x, y) / static_cast<float>(count));
+    return standardError / std::max(Luminance(accumulation.Mean(x, y)), MIN_LUMINANCE);
+  }
+
+  uint64_t PlannedSamples() const { return planned; }
+
+  // Pixels still above the threshold after the last PlanPass()
+  size_t ActivePixels() const { return activePixels; }
+
+  void PrintStatistics() const {
+    const double pixels  = static_cast<double>(plan.size());
+    const double average = static_cast<double>(planned) / pixels;
+    fmt::println(
+      "adaptive sampling: {} samples, {:.1f} spp average, {:.2f}x fewer than {} spp uniform", planned, average,
+      settings.maxSamples / average, settings.maxSamples);
+  }
+
+private:
+  // Keeps the relative error of near black pixels from dominating the budget
+  static constexpr float MIN_LUMINANCE = 1e-2f;
+
+  const AccumulationBuffer &accumulation;
+  std::pmr::vector<Tile>    tiles;
+  std::vector<uint32_t>     plan;
+  std::vector<float>        error;
+  uint64_t                  planned      = 0;
+  size_t                    activePixels = 0;
+  bool                      firstPass    = true;
+};
+
+#endif // ADAPTIVE_H
@@ -0,0 +1,135 @@
+#ifndef ARENA_H
+#define ARENA_H
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory_resource>
+#include <vector>
+
+#include "threadpool.h"
+
+
+// Bump allocator for transient data. Allocating moves an offset through a list of blocks and deallocate() does nothing;
+// memory comes back all at once, with Reset() at the end of a frame or with Rewind() to a Mark() taken when a path or a
+// tile started. Blocks are kept across resets, so once an arena has grown to the largest frame it no longer calls its
+// upstream resource. As a std::pmr::memory_resource it backs any std::pmr container. Not thread safe, every thread
+// allocates from its own arena (see ThreadArenas).
+class alignas(64) Arena : public std::pmr::memory_resource {
+public:
+  struct Marker {
+    size_t block;
+    size_t offset;
+  };
+
+  explicit Arena(
+    size_t blockSize = size_t(64) << 10, std::pmr::memory_resource *upstream = std::pmr::new_delete_resource()) :
+      blockSize(blockSize), upstream(upstream), blocks(upstream) {}
+
+  Arena(const Arena &)            = delete;
+  Arena &operator=(const Arena &) = delete;
+
+  ~Arena() override {
+    for (const Block &block: blocks) {
+      upstream->deallocate(block.data, block.size, BLOCK_ALIGNMENT);
+    }
+  }
+
+  Marker Mark() const { return {current, offset}; }
+
+  // Releases everything allocated since `marker` was taken
+  void Rewind(Marker marker) {
+    current = marker.block;
+    offset  = marker.offset;
+  }
+
+  void Reset() { Rewind({0, 0}); }
+
+  // Bytes held in blocks, the high water mark of the arena
+  size_t Capacity() const {
+    size_t capacity = 0;
+    for (const Block &block: blocks) {
+      capacity += block.size;
+    }
+    return capacity;
+  }
+
+  // Blocks requested from the upstream resource so far; stops growing once the arena is warm
+  uint64_t UpstreamAllocations() const { return upstreamAllocations; }
+
+private:
+  static constexpr size_t BLOCK_ALIGNMENT = 64;
+
+  struct Block {
+    std::byte *data;
+    size_t     size;
+  };
+
+  void *do_allocate(size_t bytes, size_t alignment) override {
+    // Blocks behind the current one are skipped when the request does not fit, they are used again after a reset
+    for (; current < blocks.size(); current++, offset = 0) {
+      const Block    &block = blocks[current];
+      const uintptr_t base  = reinterpret_cast<uintptr_t>(block.data);
+      const size_t    begin = ((base + offset + alignment - 1) & ~(alignment - 1)) - base;
+      if (begin + bytes <= block.size) {
+        offset = begin + bytes;
+        return block.data + begin;
+      }
+    }
+    const size_t size = std::max(blockSize, bytes + std::max(alignment, BLOCK_ALIGNMENT));
+    blocks.push_back({static_cast<std::byte *>(upstream->allocate(size, BLOCK_ALIGNMENT)), size});
+    upstreamAllocations++;
+    return do_allocate(bytes, alignment);
+  }
+
+  void do_deallocate(void *, size_t, size_t) override {}
+
+  bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override { return this == &other; }
+
+  size_t                     blockSize;
+  std::pmr::memory_resource *upstream;
+  std::pmr::vector<Block>    blocks;
+  size_t                     current             = 0;
+  size_t                     offset              = 0;
+  uint64_t                   upstreamAllocations = 0;
+};
+
+
+// Releases everything allocated from the arena while the scope was alive, e.g. per path or per tile
+class ArenaScope {
+public:
+  explicit ArenaScope(Arena &arena) : arena(arena), marker(arena.Mark()) {}
+
+  ArenaScope(const ArenaScope &)            = delete;
+  ArenaScope &operator=(const ArenaScope &) = delete;
+
+  ~ArenaScope() { arena.Rewind(marker); }
+
+private:
+  Arena        &arena;
+  Arena::Marker marker;
+};
+
+
+// One arena per worker of a ThreadPool and one for the thread that waits on it, indexed like
+// ThreadPool::CurrentThreadIndex(). ResetAll() is the frame boundary and is called while the pool is idle.
+class ThreadArenas {
+public:
+  explicit ThreadArenas(const ThreadPool &pool) : pool(pool), arenas(pool.ThreadCount() + 1) {}
+
+  Arena &operator[](unsigned threadIndex) { return arenas[threadIndex]; }
+
+  // Arena of the calling thread
+  Arena &Local() { return arenas[pool.CurrentThreadIndex()]; }
+
+  void ResetAll() {
+    for (Arena &arena: arenas) {
+      arena.Reset();
+    }
+  }
+
+private:
+  const ThreadPool  &pool;
+  std::vector<Arena> arenas;
+};
+
+#endif // ARENA_H
@@ -0,0 +1,603 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fmt/core.h>
+#include <glm/glm.hpp>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "arena.h"
+#include "camera.h"
+#include "framebuffer.h"
+#include "instancing.h"
+#include "integrator.h"
+#include "material.h"
+#include "random.h"
+#include "ray.h"
+#include "raypacket.h"
+#include "sampler.h"
+#include "scene.h"
+#include "scheduler.h"
+#include "simd.h"
+#include "sphere.h"
+#include "spherekernels.h"
+#include "threadpool.h"
+#include "tracermath.h"
+#include "wavefront.h"
+
+// Micro benchmarks of the intersection, traversal, ray generation, ray packet, sampler and math code, and macro
+// benchmarks rendering whole frames of fixed scenes at a fixed sample count. Every result is a throughput, higher is
+// better, taken as the best of a few repetitions. With --json the results and the machine context are written out so
+// runs can be diffed, and --baseline compares against such a file and fails when a benchmark lost more than
+// --threshold of its throughput.
+//
+//   path-tracer-bench [--filter <substring>] [--repetitions <count>] [--json <file>] [--baseline <file>]
+//                     [--threshold <fraction>]
+
+
+// Keeps the compiler from dropping a computation whose result is otherwise unused
+template<typename T>
+inline void DoNotOptimize(const T &value) {
+  asm volatile("" : : "r,m"(value) : "memory");
+}
+
+
+struct BenchmarkResult {
+  std::string name;
+  std::string unit;
+  double      value;   // throughput in `unit`
+  uint64_t    items;   // work items of the best repetition
+  double      seconds; // duration of the best repetition
+};
+
+
+class BenchmarkRunner {
+public:
+  std::string_view             filter;
+  int                          repetitions = 5;
+  double                       minSeconds  = 0.1; // per repetition, the iteration count is grown until it is reached
+  std::vector<BenchmarkResult> results;
+
+  // `function(iterations)` runs the benchmark body `iterations` times and returns the number of items it processed.
+  // The reported value is items per second times `scale`, e.g. 1e-6 for millions per second.
+  template<typename Function>
+  void Run(std::string_view name, std::string_view unit, double scale, Function &&function) {
+    if (name.find(filter) == std::string_view::npos) {
+      return;
+    }
+    int64_t iterations = 1;
+    double  seconds    = Time(function, iterations).second;
+    while (seconds < minSeconds) {
+      const double growth = std::min(10.0, 1.5 * minSeconds / std::max(seconds, 1e-9));
+      iterations          = std::max(iterations + 1, static_cast<int64_t>(iterations * growth));
+      seconds             = Time(function, iterations).second;
+    }
+
+    BenchmarkResult best = {std::string(name), std::string(unit), 0, 0, 0};
+    for (int repetition = 0; repetition < repetitions; repetition++) {
+      const auto [items, elapsed] = Time(function, iterations);
+      const double value          = static_cast<double>(items) / elapsed * scale;
+      if (value > best.value) {
+        best.value   = value;
+        best.items   = items;
+        best.seconds = elapsed;
+      }
+    }
+    fmt::println("{:<40} {:>12.3f} {}", best.name, best.value, best.unit);
+    results.push_back(best);
+  }
+
+  bool WriteJson(const std::string &path) const {
+    FILE *file = std::fopen(path.c_str(), "w");
+    if (!file) {
+      fmt::println("cannot write {}", path);
+      return false;
+    }
+    fmt::print(file, "{{\n  \"context\": {{\n");
+    fmt::print(file, "    \"compiler\": \"{}\",\n", __VERSION__);
+    fmt::print(file, "    \"simd\": \"{}\",\n", SimdLevelName(GetSphereKernels().level));
+    fmt::print(file, "    \"threads\": {},\n", std::max(1u, std::thread::hardware_concurrency()));
+    fmt::print(file, "    \"repetitions\": {}\n  }},\n  \"benchmarks\": [\n", repetitions);
+    for (size_t i = 0; i < results.size(); i++) {
+      const BenchmarkResult &result = results[i];
+      fmt::print(
+        file, "    {{\"name\": \"{}\", \"unit\": \"{}\", \"value\": {:.6g}, \"items\": {}, \"seconds\": {:.6g}}}{}\n",
+        result.name, result.unit, result.value, result.items, result.seconds, i + 1 < results.size() ? "," : "");
+    }
+    fmt::print(file, "  ]\n}}\n");
+    return std::fclose(file) == 0;
+  }
+
+  // Prints the change of every benchmark also present in a file written by WriteJson() and returns the number of
+  // benchmarks that got slower by more than `threshold`
+  int CompareWithBaseline(const std::string &path, double threshold) const {
+    FILE *file = std::fopen(path.c_str(), "r");
+    if (!file) {
+      fmt::println("cannot read {}", path);
+      return -1;
+    }
+    int  regressions = 0;
+    char line[1024];
+    while (std::fgets(line, sizeof(line), file)) {
+      // WriteJson() puts every benchmark on its own line
+      char   name[256];
+      double value;
+      if (std::sscanf(line, " {\"name\": \"%255[^\"]\", \"unit\": \"%*[^\"]\", \"value\": %lf", name, &value) != 2) {
+        continue;
+      }
+      const auto result = std::find_if(
+        results.begin(), results.end(), [&](const BenchmarkResult &result) { return result.name == name; });
+      if (result == results.end() || value <= 0) {
+        continue;
+      }
+      const double change    = result->value / value - 1.0;
+      const bool   regressed = change < -threshold;
+      regressions += regressed ? 1 : 0;
+      fmt::println("{:<40} {:>+8.1f}%{}", name, change * 100.0, regressed ? "  REGRESSION" : "");
+    }
+    std::fclose(file);
+    return regressions;
+  }
+
+private:
+  template<typename Function>
+  static std::pair<uint64_t, double> Time(Function &function, int64_t iterations) {
+    const auto                          start   = std::chrono::steady_clock::now();
+    const uint64_t                      items   = function(iterations);
+    const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    return {items, elapsed.count()};
+  }
+};
+
+
+// Rays from random points inside `box` towards random points inside it
+inline std::vector<Ray> RandomRays(size_t count, const AABB &box, uint64_t seed) {
+  Pcg32            random(seed);
+  std::vector<Ray> rays(count);
+  auto             point = [&] {
+    return box.min + glm::vec3(random.NextFloat(), random.NextFloat(), random.NextFloat()) * (box.max - box.min);
+  };
+  for (Ray &ray: rays) {
+    const glm::vec3 origin = point();
+    ray                    = {origin, glm::normalize(point() - origin + glm::vec3(1e-3f))};
+  }
+  return rays;
+}
+
+// Small spheres spread through a cube of side `extent` above a large ground sphere
+inline void AddRandomSpheres(Scene &scene, size_t count, float extent, uint64_t seed) {
+  Pcg32 random(seed);
+  for (size_t i = 0; i < count; i++) {
+    const glm::vec3 position = (glm::vec3(random.NextFloat(), random.NextFloat(), random.NextFloat()) - 0.5f) * extent;
+    scene.AddSphere({0.05f + 0.2f * random.NextFloat(), position + glm::vec3(0, 0, extent)});
+  }
+  scene.AddSphere({1000.0f, {0, 1000.0f + extent, extent}});
+}
+
+
+void IntersectionBenchmarks(BenchmarkRunner &runner) {
+  const AABB             box  = {glm::vec3(-1), glm::vec3(1)};
+  const std::vector<Ray> rays = RandomRays(1024, box, 1);
+
+  runner.Run("intersect/sphere_scalar", "Mrays/s", 1e-6, [&](int64_t iterations) {
+    const Sphere sphere = {0.5f, glm::vec3(0)};
+    for (int64_t i = 0; i < iterations; i++) {
+      for (const Ray &ray: rays) {
+        DoNotOptimize(Intersect(sphere, ray.origin, ray.direction));
+      }
+    }
+    return iterations * rays.size();
+  });
+
+  // One ray against a leaf sized and a cache sized block of spheres with the SIMD kernel of this machine
+  for (const size_t sphereCount: {8, 256}) {
+    Scene scene;
+    AddRandomSpheres(scene, sphereCount - 1, 2.0f, 2);
+    const SphereArrays   spheres = scene.Arrays();
+    const SphereKernels &kernels = GetSphereKernels();
+    runner.Run(
+      fmt::format("intersect/kernel_{}_{}_spheres", SimdLevelName(kernels.level), sphereCount), "Mrays/s", 1e-6,
+      [&](int64_t iterations) {
+        for (int64_t i = 0; i < iterations; i++) {
+          for (const Ray &ray: rays) {
+            DoNotOptimize(
+              kernels.closestHit(ray, spheres, 0, spheres.count, RAY_EPSILON, std::numeric_limits<float>::infinity()));
+          }
+        }
+        return iterations * rays.size();
+      });
+  }
+}
+
+
+void TraversalBenchmarks(BenchmarkRunner &runner, ThreadPool &pool) {
+  constexpr float        extent = 40.0f;
+  const AABB             box    = {glm::vec3(-0.5f, -0.5f, 0.5f) * extent, glm::vec3(0.5f, 0.5f, 1.5f) * extent};
+  const std::vector<Ray> rays   = RandomRays(1 << 14, box, 3);
+
+  Scene scene;
+  AddRandomSpheres(scene, 100000, extent, 4);
+  for (const auto &[layout, name]: {
+         std::pair{BVHLayout::Binary, "binary"}, std::pair{BVHLayout::Wide4, "wide4"},
+         std::pair{BVHLayout::Wide8, "wide8"}}) {
+    scene.BuildAccelerationStructure(&pool, layout);
+    const SceneView view = scene.View();
+    runner.Run(fmt::format("traverse/closest_100k_{}", name), "Mrays/s", 1e-6, [&](int64_t iterations) {
+      for (int64_t i = 0; i < iterations; i++) {
+        for (const Ray &ray: rays) {
+          DoNotOptimize(view.ClosestHit(ray));
+        }
+      }
+      return iterations * rays.size();
+    });
+    runner.Run(fmt::format("traverse/any_100k_{}", name), "Mrays/s", 1e-6, [&](int64_t iterations) {
+      for (int64_t i = 0; i < iterations; i++) {
+        for (const Ray &ray: rays) {
+          DoNotOptimize(view.AnyHit(ray));
+        }
+      }
+      return iterations * rays.size();
+    });
+  }
+
+  // The same number of spheres as 100 rotated and scaled instances of one 1000 sphere geometry
+  Scene asset;
+  Pcg32 random(5);
+  for (int i = 0; i < 1000; i++) {
+    const glm::vec3 position = glm::vec3(random.NextFloat(), random.NextFloat(), random.NextFloat()) * 2.0f - 1.0f;
+    asset.AddSphere({0.02f + 0.08f * random.NextFloat(), position * 2.0f});
+  }
+  InstancedScene instanced;
+  const uint32_t geometry = instanced.AddGeometry(std::move(asset));
+  for (int i = 0; i < 100; i++) {
+    const glm::vec3 position = box.min + glm::vec3(random.NextFloat(), random.NextFloat(), random.NextFloat()) *
+                                           (box.max - box.min);
+    const float     angle    = 2.0f * PI * random.NextFloat();
+    const float     scale    = 1.0f + random.NextFloat();
+    glm::mat4       objectToWorld(scale);
+    objectToWorld[0][0] = objectToWorld[2][2] = scale * std::cos(angle);
+    objectToWorld[2][0]                       = scale * std::sin(angle);
+    objectToWorld[0][2]                       = -scale * std::sin(angle);
+    objectToWorld[3]                          = glm::vec4(position, 1.0f);
+    instanced.AddInstance(geometry, objectToWorld);
+  }
+  instanced.BuildAccelerationStructure(&pool);
+  const SceneView view = instanced.View();
+  runner.Run("traverse/closest_100k_instanced", "Mrays/s", 1e-6, [&](int64_t iterations) {
+    for (int64_t i = 0; i < iterations; i++) {
+      for (const Ray &ray: rays) {
+        DoNotOptimize(view.ClosestHit(ray));
+      }
+    }
+    return iterations * rays.size();
+  });
+  runner.Run("traverse/any_100k_instanced", "Mrays/s", 1e-6, [&](int64_t iterations) {
+    for (int64_t i = 0; i < iterations; i++) {
+      for (const Ray &ray: rays) {
+        DoNotOptimize(view.AnyHit(ray));
+      }
+    }
+    return iterations * rays.size();
+  });
+}
+
+
+// A frame of animation: a tenth of the 100k spheres drift by up to a few radii, then the hierarchy is brought up to
+// date by a full build or by a refit that rebuilds only the subtrees the motion degraded
+void AnimationBenchmarks(BenchmarkRunner &runner, ThreadPool &pool) {
+  constexpr float extent = 40.0f;
+  for (const bool update: {false, true}) {
+    Scene scene;
+    AddRandomSpheres(scene, 100000, extent, 4);
+    scene.BuildAccelerationStructure(&pool);
+    Pcg32 random(6);
+    runner.Run(update ? "bvh/update_100k" : "bvh/full_build_100k", "frames/s", 1.0, [&](int64_t iterations) {
+      for (int64_t i = 0; i < iterations; i++) {
+        for (size_t sphere = 0; sphere < scene.Size(); sphere += 10) {
+          Sphere          moved = scene.View().GetSphere(sphere);
+          const glm::vec3 drift = glm::vec3(random.NextFloat(), random.NextFloat(), random.NextFloat()) - 0.5f;
+          moved.position += drift * 0.5f;
+          scene.SetSphere(sphere, moved);
+        }
+        if (update) {
+          scene.UpdateAccelerationStructure(&pool);
+        } else {
+          scene.BuildAccelerationStructure(&pool);
+        }
+      }
+      return iterations;
+    });
+  }
+}
+
+void CameraBenchmarks(BenchmarkRunner &runner) {
+  const Camera camera(45.0f, 1920, 1080);
+  const auto   pixels = static_cast<uint64_t>(camera.imageWidth) * camera.imageHeight;
+
+  runner.Run("camera/ray_generation_1080p", "Mrays/s", 1e-6, [&](int64_t iterations) {
+    const RayGenerator generator = camera.GetRayGenerator();
+    for (int64_t i = 0; i < iterations; i++) {
+      generator.ForEachRay([](int, int, const Ray &ray) { DoNotOptimize(ray); });
+    }
+    return iterations * pixels;
+  });
+  runner.Run("camera/transformed_rays_1080p", "Mrays/s", 1e-6, [&](int64_t iterations) {
+    for (int64_t i = 0; i < iterations; i++) {
+      DoNotOptimize(camera.GetTransformedRays().data());
+    }
+    return iterations * pixels;
+  });
+  runner.Run("camera/transformed_rays_1080p_arena", "Mrays/s", 1e-6, [&](int64_t iterations) {
+    Arena arena;
+    for (int64_t i = 0; i < iterations; i++) {
+      arena.Reset();
+      DoNotOptimize(camera.GetTransformedRays(&arena).data());
+    }
+    return iterations * pixels;
+  });
+}
+
+
+// Primary visibility of a camera looking into a cloud of spheres, one ray at a time and as 2x2, 4x4 and 8x8 packets
+template<int Side>
+void PacketBenchmark(BenchmarkRunner &runner, const SceneView &view, const RayGenerator &generator) {
+  const uint64_t pixels = static_cast<uint64_t>(generator.imageWidth) * generator.imageHeight;
+  runner.Run(fmt::format("primary/packet_{}x{}_10k", Side, Side), "Mrays/s", 1e-6, [&](int64_t iterations) {
+    RayPacket<Side>  packet;
+    PacketHits<Side> hits;
+    for (int64_t i = 0; i < iterations; i++) {
+      for (int y = 0; y < generator.imageHeight; y += Side) {
+        for (int x = 0; x < generator.imageWidth; x += Side) {
+          generator.GeneratePacket(x, y, packet);
+          view.ClosestHit(packet, hits);
+          DoNotOptimize(hits.index[0]);
+        }
+      }
+    }
+    return iterations * pixels;
+  });
+}
+
+void PrimaryBenchmarks(BenchmarkRunner &runner) {
+  Scene scene;
+  AddRandomSpheres(scene, 10000, 20.0f, 6);
+  scene.BuildAccelerationStructure();
+  const SceneView    view      = scene.View();
+  const Camera       camera(45.0f, 256, 128);
+  const RayGenerator generator = camera.GetRayGenerator();
+  const uint64_t     pixels    = static_cast<uint64_t>(camera.imageWidth) * camera.imageHeight;
+
+  runner.Run("primary/single_10k", "Mrays/s", 1e-6, [&](int64_t iterations) {
+    for (int64_t i = 0; i < iterations; i++) {
+      generator.ForEachRay([&](int, int, const Ray &ray) { DoNotOptimize(view.ClosestHit(ray)); });
+    }
+    return iterations * pixels;
+  });
+  PacketBenchmark<2>(runner, view, generator);
+  PacketBenchmark<4>(runner, view, generator);
+  PacketBenchmark<8>(runner, view, generator);
+}
+
+
+// Sample values per second of every sampler, for the pixel position and five bounces of each sample of a 64x64 block
+void SamplerBenchmarks(BenchmarkRunner &runner) {
+  constexpr uint32_t side    = 64;
+  constexpr uint32_t samples = 16;
+  constexpr uint32_t pairs   = 6;
+  BlueNoiseMask::Instance();
+  for (SamplerType type:
+       {SamplerType::Independent, SamplerType::Stratified, SamplerType::Sobol, SamplerType::BlueNoise}) {
+    runner.Run(fmt::format("sampler/{}_2d", SamplerTypeName(type)), "Msamples/s", 1e-6, [&](int64_t iterations) {
+      for (int64_t i = 0; i < iterations; i++) {
+        for (uint32_t y = 0; y < side; y++) {
+          for (uint32_t x = 0; x < side; x++) {
+            for (uint32_t sample = 0; sample < samples; sample++) {
+              PixelSampler sampler(type, x, y, sample);
+              for (uint32_t pair = 0; pair < pairs; pair++) {
+                DoNotOptimize(sampler.Next2D());
+              }
+            }
+          }
+        }
+      }
+      return iterations * side * side * samples * pairs;
+    });
+  }
+}
+
+
+// The same operations through tracermath.h and glm on identical data
+void MathBenchmarks(BenchmarkRunner &runner) {
+  constexpr size_t       count = 1024;
+  Pcg32                  random(5);
+  std::vector<glm::vec4> glmVectors(count);
+  std::vector<vec4f>     vectors(count);
+  for (size_t i = 0; i < count; i++) {
+    glmVectors[i] = {random.NextFloat(), random.NextFloat(), random.NextFloat(), 1.0f};
+    vectors[i]    = vec4f(glmVectors[i].x, glmVectors[i].y, glmVectors[i].z, glmVectors[i].w);
+  }
+  glm::mat4 glmMatrix(1.0f);
+  mat4f     matrix = Identity<4, 4, float>();
+  for (int row = 0; row < 4; row++) {
+    for (int column = 0; column < 4; column++) {
+      const float value      = random.NextFloat();
+      glmMatrix[column][row] = value; // glm is column major
+      matrix(row, column)    = value;
+    }
+  }
+
+  runner.Run("math/mat4_vec4_glm", "Mops/s", 1e-6, [&](int64_t iterations) {
+    for (int64_t i = 0; i < iterations; i++) {
+      for (const glm::vec4 &vector: glmVectors) {
+        DoNotOptimize(glmMatrix * vector);
+      }
+    }
+    return iterations * count;
+  });
+  runner.Run("math/mat4_vec4_tracermath", "Mops/s", 1e-6, [&](int64_t iterations) {
+    for (int64_t i = 0; i < iterations; i++) {
+      for (const vec4f &vector: vectors) {
+        DoNotOptimize(matrix * vector);
+      }
+    }
+    return iterations * count;
+  });
+
+  runner.Run("math/mat4_mat4_glm", "Mops/s", 1e-6, [&](int64_t iterations) {
+    glm::mat4 product = glmMatrix;
+    for (int64_t i = 0; i < iterations * static_cast<int64_t>(count); i++) {
+      product = product * glmMatrix;
+      DoNotOptimize(product);
+    }
+    return iterations * count;
+  });
+  runner.Run("math/mat4_mat4_tracermath", "Mops/s", 1e-6, [&](int64_t iterations) {
+    mat4f product = matrix;
+    for (int64_t i = 0; i < iterations * static_cast<int64_t>(count); i++) {
+      product = product * matrix;
+      DoNotOptimize(product);
+    }
+    return iterations * count;
+  });
+
+  runner.Run("math/vec3_cross_normalize_glm", "Mops/s", 1e-6, [&](int64_t iterations) {
+    for (int64_t i = 0; i < iterations; i++) {
+      for (size_t j = 0; j + 1 < count; j++) {
+        DoNotOptimize(glm::normalize(glm::cross(glm::vec3(glmVectors[j]), glm::vec3(glmVectors[j + 1]))));
+      }
+    }
+    return iterations * (count - 1);
+  });
+  runner.Run("math/vec3_cross_normalize_tracermath", "Mops/s", 1e-6, [&](int64_t iterations) {
+    for (int64_t i = 0; i < iterations; i++) {
+      for (size_t j = 0; j + 1 < count; j++) {
+        DoNotOptimize(Normalize(Cross(vectors[j].swizzle<0, 1, 2>(), vectors[j + 1].swizzle<0, 1, 2>())));
+      }
+    }
+    return iterations * (count - 1);
+  });
+}
+
+
+// Full frames at a fixed sample count, without adaptive sampling, through both integrators
+void FrameBenchmarks(BenchmarkRunner &runner, ThreadPool &pool) {
+  constexpr int      width   = 128;
+  constexpr int      height  = 64;
+  constexpr uint32_t samples = 8;
+
+  struct NamedScene {
+    const char *name;
+    Scene       scene;
+  };
+  NamedScene scenes[3] = {{"demo", {}}, {"spheres_10k", {}}, {"materials_10k", {}}};
+  scenes[0].scene.AddSphere({0.5f, {0, 0, 3}});
+  scenes[0].scene.AddSphere({100.0f, {0, 100.5f, 3}});
+  AddRandomSpheres(scenes[1].scene, 10000, 20.0f, 6);
+  // The same cloud with the spheres cycling through one material of every type, so the shade stage sees mixed hits
+  Scene &mixed = scenes[2].scene;
+  AddRandomSpheres(mixed, 10000, 20.0f, 6);
+  const uint32_t materials[] = {
+    0, mixed.AddMaterial({MaterialType::Conductor, {0.95f, 0.64f, 0.54f}, 0.2f}),
+    mixed.AddMaterial({MaterialType::Dielectric, glm::vec3(1.0f), 0.0f, 1.5f}),
+    mixed.AddMaterial({MaterialType::Emissive, glm::vec3(4.0f)})};
+  for (size_t i = 0; i < mixed.Size(); i++) {
+    mixed.material[i] = materials[i % std::size(materials)];
+  }
+
+  const Sky          sky;
+  const Camera       camera(45.0f, width, height);
+  const RayGenerator generator = camera.GetRayGenerator();
+  TileScheduler      scheduler(pool, 16, TileOrder::Morton);
+  for (NamedScene &named: scenes) {
+    named.scene.BuildAccelerationStructure(&pool);
+    const SceneView view = named.scene.View();
+
+    runner.Run(
+      fmt::format("frame/{}_{}x{}_{}spp", named.name, width, height, samples), "Msamples/s", 1e-6,
+      [&](int64_t iterations) {
+        for (int64_t i = 0; i < iterations; i++) {
+          AccumulationBuffer accumulation(width, height, scheduler.tileSize);
+          scheduler.Render(width, height, [&](const Tile &tile, unsigned) {
+            for (int y = tile.y0; y < tile.y1; y++) {
+              for (int x = tile.x0; x < tile.x1; x++) {
+                for (uint32_t sample = 0; sample < samples; sample++) {
+                  PixelSampler    sampler(SamplerType::Sobol, x, y, sample);
+                  const glm::vec2 jitter = sampler.Next2D();
+                  const Ray       ray    = generator(x + jitter.x - 0.5f, y + jitter.y - 0.5f);
+                  accumulation.AddSample(x, y, TraceRadiance(view, sky, ray, sampler));
+                }
+              }
+            }
+          });
+          DoNotOptimize(accumulation.Mean(width / 2, height / 2));
+        }
+        return iterations * width * height * samples;
+      });
+
+    runner.Run(
+      fmt::format("frame/{}_{}x{}_{}spp_wavefront", named.name, width, height, samples), "Msamples/s", 1e-6,
+      [&](int64_t iterations) {
+        WavefrontIntegrator integrator(view, sky, pool);
+        for (int64_t i = 0; i < iterations; i++) {
+          AccumulationBuffer accumulation(width, height, scheduler.tileSize);
+          integrator.RenderPass(generator, accumulation, [](int, int) { return samples; });
+          DoNotOptimize(accumulation.Mean(width / 2, height / 2));
+        }
+        return iterations * width * height * samples;
+      });
+  }
+}
+
+
+int main(int argc, char **argv) {
+  BenchmarkRunner  runner;
+  std::string_view jsonPath;
+  std::string_view baselinePath;
+  double           threshold = 0.10;
+  for (int i = 1; i < argc; i += 2) {
+    const std::string_view argument = argv[i];
+    if (i + 1 < argc && argument == "--filter") {
+      runner.filter = argv[i + 1];
+    } else if (i + 1 < argc && argument == "--repetitions") {
+      runner.repetitions = std::max(1, std::atoi(argv[i + 1]));
+    } else if (i + 1 < argc && argument == "--json") {
+      jsonPath = argv[i + 1];
+    } else if (i + 1 < argc && argument == "--baseline") {
+      baselinePath = argv[i + 1];
+    } else if (i + 1 < argc && argument == "--threshold") {
+      threshold = std::atof(argv[i + 1]);
+    } else {
+      fmt::println(
+        "usage: {} [--filter <substring>] [--repetitions <count>] [--json <file>] [--baseline <file>] "
+        "[--threshold <fraction>]",
+        argv[0]);
+      return 1;
+    }
+  }
+
+  ThreadPool pool;
+  IntersectionBenchmarks(runner);
+  TraversalBenchmarks(runner, pool);
+  AnimationBenchmarks(runner, pool);
+  CameraBenchmarks(runner);
+  PrimaryBenchmarks(runner);
+  SamplerBenchmarks(runner);
+  MathBenchmarks(runner);
+  FrameBenchmarks(runner, pool);
+
+  if (!jsonPath.empty() && !runner.WriteJson(std::string(jsonPath))) {
+    return 1;
+  }
+  if (!baselinePath.empty()) {
+    fmt::println("\nchange against {}:", baselinePath);
+    if (runner.CompareWithBaseline(std::string(baselinePath), threshold) != 0) {
+      return 1;
+    }
+  }
+  return 0;
+}
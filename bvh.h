@@ -0,0 +1,756 @@
+#ifndef BVH_H
+#define BVH_H
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <fmt/core.h>
+#include <glm/glm.hpp>
+#include <limits>
+#include <memory>
+#include <numeric>
+#include <span>
+#include <utility>
+#include <vector>
+
+#include "ray.h"
+#include "raypacket.h"
+#include "threadpool.h"
+
+// Relative costs of visiting an inner node and intersecting one primitive, used by the surface area heuristic
+constexpr float SAH_TRAVERSAL_COST    = 1.0f;
+constexpr float SAH_INTERSECTION_COST = 0.5f;
+
+
+struct AABB {
+  glm::vec3 min = glm::vec3(std::numeric_limits<float>::infinity());
+  glm::vec3 max = glm::vec3(-std::numeric_limits<float>::infinity());
+
+  void Grow(const glm::vec3 &point) {
+    min = glm::min(min, point);
+    max = glm::max(max, point);
+  }
+
+  void Grow(const AABB &other) {
+    min = glm::min(min, other.min);
+    max = glm::max(max, other.max);
+  }
+
+  bool Empty() const { return min.x > max.x; }
+
+  glm::vec3 Centroid() const { return (min + max) * 0.5f; }
+
+  float SurfaceArea() const {
+    if (Empty()) {
+      return 0;
+    }
+    const glm::vec3 extent = max - min;
+    return 2.0f * (extent.x * extent.y + extent.y * extent.z + extent.z * extent.x);
+  }
+};
+
+// Ray with the reciprocal direction precomputed for slab tests
+struct TraversalRay {
+  glm::vec3 origin;
+  glm::vec3 direction;
+  glm::vec3 inverseDirection;
+
+  explicit TraversalRay(const Ray &ray) :
+      origin(ray.origin), direction(ray.direction), inverseDirection(1.0f / ray.direction) {}
+};
+
+// Returned by the slab test when the box is missed; hits always return a finite entry distance no greater than tMax
+constexpr float AABB_MISS = std::numeric_limits<float>::infinity();
+
+// Entry distance of the ray into the box, or AABB_MISS if it misses the box within (tMin, tMax)
+inline float
+IntersectAABB(const glm::vec3 &boxMin, const glm::vec3 &boxMax, const TraversalRay &ray, float tMin, float tMax) {
+  const float tx0   = (boxMin.x - ray.origin.x) * ray.inverseDirection.x;
+  const float tx1   = (boxMax.x - ray.origin.x) * ray.inverseDirection.x;
+  const float ty0   = (boxMin.y - ray.origin.y) * ray.inverseDirection.y;
+  const float ty1   = (boxMax.y - ray.origin.y) * ray.inverseDirection.y;
+  const float tz0   = (boxMin.z - ray.origin.z) * ray.inverseDirection.z;
+  const float tz1   = (boxMax.z - ray.origin.z) * ray.inverseDirection.z;
+  const float enter = std::max(std::max(std::min(tx0, tx1), std::min(ty0, ty1)), std::max(std::min(tz0, tz1), tMin));
+  const float exit  = std::min(std::min(std::max(tx0, tx1), std::max(ty0, ty1)), std::min(std::max(tz0, tz1), tMax));
+  return enter <= exit ? enter : AABB_MISS;
+}
+
+
+// Flattened node, 32 bytes. Nodes are stored depth first: the left child of an inner node directly follows it.
+struct BVHNode {
+  glm::vec3 boundsMin;
+  uint32_t  leftOrFirst; // inner node: index of the right child, leaf: first primitive
+  glm::vec3 boundsMax;
+  uint32_t  count; // primitives in a leaf, 0 for inner nodes
+
+  bool IsLeaf() const { return count > 0; }
+};
+static_assert(sizeof(BVHNode) == 32);
+
+struct BVHStatistics {
+  double   buildMilliseconds = 0;
+  uint32_t nodeCount         = 0;
+  uint32_t leafCount         = 0;
+  uint32_t maxDepth          = 0;
+  float    sahCost           = 0;
+};
+
+template<>
+struct fmt::formatter<BVHStatistics> {
+  constexpr auto parse(fmt::format_parse_context &ctx) { return ctx.begin(); }
+
+  template<typename FormatContext>
+  auto format(const BVHStatistics &statistics, FormatContext &ctx) const {
+    return fmt::format_to(
+      ctx.out(), "BVH: {{build: {:.3f} ms, nodes: {}, leaves: {}, depth: {}, SAH cost: {:.3f}}}",
+      statistics.buildMilliseconds, statistics.nodeCount, statistics.leafCount, statistics.maxDepth,
+      statistics.sahCost);
+  }
+};
+
+// What the last BVH::Update() did
+struct BVHUpdateStatistics {
+  double   refitMilliseconds   = 0;
+  double   rebuildMilliseconds = 0;
+  uint32_t rebuiltSubtrees     = 0;
+  uint32_t rebuiltPrimitives   = 0;
+  float    refitSahCost        = 0; // after the refit, before the rebuilds
+  float    sahCost             = 0;
+};
+
+template<>
+struct fmt::formatter<BVHUpdateStatistics> {
+  constexpr auto parse(fmt::format_parse_context &ctx) { return ctx.begin(); }
+
+  template<typename FormatContext>
+  auto format(const BVHUpdateStatistics &statistics, FormatContext &ctx) const {
+    return fmt::format_to(
+      ctx.out(),
+      "BVH update: {{refit: {:.3f} ms, rebuild: {:.3f} ms, rebuilt: {} subtrees of {} primitives, SAH cost: {:.3f} "
+      "refit, {:.3f} final}}",
+      statistics.refitMilliseconds, statistics.rebuildMilliseconds, statistics.rebuiltSubtrees,
+      statistics.rebuiltPrimitives, statistics.refitSahCost, statistics.sahCost);
+  }
+};
+
+
+// Read only traversal over flattened nodes, which may live in a BVH or in a memory mapped scene file
+struct BVHView {
+  static constexpr int MAX_TRAVERSAL_STACK_SIZE = 64;
+
+  std::span<const BVHNode> nodes;
+
+  bool Empty() const { return nodes.empty(); }
+
+  AABB NodeBounds(size_t index) const { return {nodes[index].boundsMin, nodes[index].boundsMax}; }
+
+  // Closest hit traversal, near child first. `leaf(first, count, tMax)` intersects the primitives of a leaf and
+  // returns the distance of the closest hit so far, which then prunes the remaining nodes.
+  template<typename LeafFunction>
+  float TraverseClosest(const Ray &ray, float tMin, float tMax, LeafFunction &&leaf) const {
+    if (nodes.empty()) {
+      return tMax;
+    }
+    const TraversalRay traversalRay(ray);
+    if (IntersectAABB(nodes[0].boundsMin, nodes[0].boundsMax, traversalRay, tMin, tMax) == AABB_MISS) {
+      return tMax;
+    }
+
+    // Entry distances are kept next to the postponed nodes, so nodes behind a closer hit are dropped when popped
+    uint32_t stack[MAX_TRAVERSAL_STACK_SIZE];
+    float    stackDistance[MAX_TRAVERSAL_STACK_SIZE];
+    int      stackSize = 0;
+    uint32_t current   = 0;
+    while (true) {
+      const BVHNode &node = nodes[current];
+      if (node.IsLeaf()) {
+        tMax = leaf(node.leftOrFirst, node.count, tMax);
+      } else {
+        uint32_t near  = current + 1;
+        uint32_t far   = node.leftOrFirst;
+        float    tNear = IntersectAABB(nodes[near].boundsMin, nodes[near].boundsMax, traversalRay, tMin, tMax);
+        float    tFar  = IntersectAABB(nodes[far].boundsMin, nodes[far].boundsMax, traversalRay, tMin, tMax);
+        if (tFar < tNear) {
+          std::swap(near, far);
+          std::swap(tNear, tFar);
+        }
+        if (tNear != AABB_MISS) {
+          if (tFar != AABB_MISS) {
+            stack[stackSize]         = far;
+            stackDistance[stackSize] = tFar;
+            stackSize++;
+          }
+          current = near;
+          continue;
+        }
+      }
+      do {
+        if (stackSize == 0) {
+          return tMax;
+        }
+        stackSize--;
+      } while (stackDistance[stackSize] > tMax);
+      current = stack[stackSize];
+    }
+  }
+
+  // Occlusion traversal, `leaf(first, count)` returns true as soon as a leaf blocks the ray
+  template<typename LeafFunction>
+  bool TraverseAny(const Ray &ray, float tMin, float tMax, LeafFunction &&leaf) const {
+    if (nodes.empty()) {
+      return false;
+    }
+    const TraversalRay traversalRay(ray);
+    uint32_t           stack[MAX_TRAVERSAL_STACK_SIZE];
+    int                stackSize = 0;
+    stack[stackSize++]           = 0;
+    while (stackSize > 0) {
+      const BVHNode &node = nodes[stack[--stackSize]];
+      if (IntersectAABB(node.boundsMin, node.boundsMax, traversalRay, tMin, tMax) == AABB_MISS) {
+        continue;
+      }
+      if (node.IsLeaf()) {
+        if (leaf(node.leftOrFirst, node.count)) {
+          return true;
+        }
+      } else {
+        stack[stackSize++] = node.leftOrFirst;
+        stack[stackSize++] = static_cast<uint32_t>(&node - nodes.data()) + 1;
+      }
+    }
+    return false;
+  }
+
+  // Closest hit traversal for a packet. A node outside the packet frustum is culled without looking at single rays;
+  // otherwise it is entered when at least one ray reaches its box before its current hit in tHit, which inactive lanes
+  // keep below tMin. `leaf(first, count)` intersects the primitives with the whole packet and lowers tHit. Returns the
+  // number of nodes the frustum culled.
+  template<int Side, typename LeafFunction>
+  uint32_t TraversePacket(const RayPacket<Side> &packet, float tMin, const float *tHit, LeafFunction &&leaf) const {
+    if (nodes.empty()) {
+      return 0;
+    }
+    // Children are ordered by their centers along the central direction, the near child goes on top of the stack
+    auto distance = [&](uint32_t index) {
+      return glm::dot(nodes[index].boundsMin + nodes[index].boundsMax, packet.frustum.direction);
+    };
+
+    uint32_t stack[MAX_TRAVERSAL_STACK_SIZE];
+    int      stackSize = 0;
+    uint32_t culled    = 0;
+    stack[stackSize++] = 0;
+    while (stackSize > 0) {
+      const uint32_t current = stack[--stackSize];
+      const BVHNode &node    = nodes[current];
+      if (packet.frustum.Culls(node.boundsMin, node.boundsMax)) {
+        culled++;
+        continue;
+      }
+      if (!packet.AnyRayHitsBox(node.boundsMin, node.boundsMax, tMin, tHit)) {
+        continue;
+      }
+      if (node.IsLeaf()) {
+        leaf(node.leftOrFirst, node.count);
+        continue;
+      }
+      uint32_t near = current + 1;
+      uint32_t far  = node.leftOrFirst;
+      if (distance(far) < distance(near)) {
+        std::swap(near, far);
+      }
+      stack[stackSize++] = far;
+      stack[stackSize++] = near;
+    }
+    return culled;
+  }
+};
+
+
+// Bounding volume hierarchy built top down with binned SAH.
+// Leaves reference the ranges [leftOrFirst, leftOrFirst + count) of `primitiveIndices`.
+// Moving primitives are handled by Update(), which refits the boxes and rebuilds only the subtrees that degraded. To
+// tell those apart every node keeps its SAH cost relative to its own box from when it was built, which does not change
+// when a subtree merely translates or scales as a whole.
+struct BVH {
+  static constexpr int   BIN_COUNT                = 16;
+  static constexpr int   MAX_LEAF_SIZE            = 8; // one AVX2 sphere kernel call
+  static constexpr int   PARALLEL_SUBTREE_SIZE    = 4096;
+  static constexpr int   PARALLEL_BINNING_SIZE    = 1 << 16;
+  static constexpr int   MAX_TRAVERSAL_STACK_SIZE = BVHView::MAX_TRAVERSAL_STACK_SIZE;
+  static constexpr int   PARALLEL_REFIT_NODES     = 1 << 13; // smaller trees are refitted on the calling thread
+  static constexpr int   PARALLEL_REFIT_DEPTH     = 6;       // levels whose subtrees are refitted as separate tasks
+  static constexpr float REBUILD_THRESHOLD        = 1.5f;    // relative SAH cost growth that rebuilds a subtree
+
+  std::vector<BVHNode>  nodes;
+  std::vector<uint32_t> primitiveIndices;
+  BVHStatistics         statistics;
+  BVHUpdateStatistics   updateStatistics;
+
+  bool Empty() const { return nodes.empty(); }
+
+  void Clear() {
+    nodes.clear();
+    primitiveIndices.clear();
+    builtCost.clear();
+    statistics       = {};
+    updateStatistics = {};
+  }
+
+  // Large subtrees and the binning of large nodes are spread over `pool` when one is given
+  void Build(std::span<const AABB> primitiveBounds, ThreadPool *pool = nullptr) {
+    const auto start = std::chrono::steady_clock::now();
+    Clear();
+    if (primitiveBounds.empty()) {
+      return;
+    }
+
+    BuildContext context = {primitiveBounds, {}, pool};
+    context.centroids.resize(primitiveBounds.size());
+    for (size_t i = 0; i < primitiveBounds.size(); i++) {
+      context.centroids[i] = primitiveBounds[i].Centroid();
+    }
+    primitiveIndices.resize(primitiveBounds.size());
+    std::iota(primitiveIndices.begin(), primitiveIndices.end(), 0);
+
+    const std::unique_ptr<BuildNode> root =
+      BuildRecursive(context, 0, static_cast<uint32_t>(primitiveIndices.size()), 1);
+
+    nodes.reserve(2 * primitiveIndices.size() / MAX_LEAF_SIZE + 1);
+    Flatten(*root, 1);
+    statistics.nodeCount = static_cast<uint32_t>(nodes.size());
+    statistics.sahCost   = ComputeSAHCost();
+    ComputeSubtreeCosts();
+    builtCost.resize(nodes.size());
+    for (size_t i = 0; i < nodes.size(); i++) {
+      builtCost[i] = RelativeCost(i);
+    }
+
+    const std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+    statistics.buildMilliseconds                            = elapsed.count();
+  }
+
+  // Expected cost of a random ray through the root, relative to intersecting a single primitive
+  float ComputeSAHCost() const {
+    if (nodes.empty()) {
+      return 0;
+    }
+    const float rootArea = NodeBounds(0).SurfaceArea();
+    if (rootArea <= 0) {
+      return 0;
+    }
+    float cost = 0;
+    for (size_t i = 0; i < nodes.size(); i++) {
+      const float area = NodeBounds(i).SurfaceArea();
+      cost += nodes[i].IsLeaf() ? area * nodes[i].count * SAH_INTERSECTION_COST : area * SAH_TRAVERSAL_COST;
+    }
+    return cost / rootArea;
+  }
+
+  // For primitives that moved since the last Build() or Update(): refits every box to `primitiveBounds` bottom up, in
+  // parallel on `pool` for large trees, then rebuilds the subtrees whose relative SAH cost grew past `rebuildThreshold`
+  // times their cost when built. A rebuilt subtree reorders its range of primitiveIndices, and
+  // `reordered(first, previous)` is called for each such range with the indices it held before, so callers that keep
+  // their primitives in BVH order can move them along. Node indices change when anything is rebuilt.
+  template<typename ReorderFunction>
+  void Update(
+    std::span<const AABB> primitiveBounds, ThreadPool *pool, float rebuildThreshold, ReorderFunction &&reordered) {
+    if (nodes.empty()) {
+      return;
+    }
+    const auto start = std::chrono::steady_clock::now();
+    updateStatistics = {};
+    subtreeCost.resize(nodes.size());
+    RefitRecursive(primitiveBounds, nodes.size() >= PARALLEL_REFIT_NODES ? pool : nullptr, 0, 0);
+    updateStatistics.refitSahCost = RelativeCost(0);
+    const auto refitEnd           = std::chrono::steady_clock::now();
+
+    rebuildRoots.clear();
+    SelectRebuilds(0, 1, rebuildThreshold);
+    if (!rebuildRoots.empty()) {
+      RebuildSubtrees(primitiveBounds, pool, reordered);
+    }
+    statistics.sahCost       = RelativeCost(0);
+    updateStatistics.sahCost = statistics.sahCost;
+
+    const std::chrono::duration<double, std::milli> refit   = refitEnd - start;
+    const std::chrono::duration<double, std::milli> rebuild = std::chrono::steady_clock::now() - refitEnd;
+    updateStatistics.refitMilliseconds                      = refit.count();
+    updateStatistics.rebuildMilliseconds                    = rebuild.count();
+  }
+
+  AABB NodeBounds(size_t index) const { return View().NodeBounds(index); }
+
+  BVHView View() const { return {nodes}; }
+
+  template<typename LeafFunction>
+  float TraverseClosest(const Ray &ray, float tMin, float tMax, LeafFunction &&leaf) const {
+    return View().TraverseClosest(ray, tMin, tMax, std::forward<LeafFunction>(leaf));
+  }
+
+  template<typename LeafFunction>
+  bool TraverseAny(const Ray &ray, float tMin, float tMax, LeafFunction &&leaf) const {
+    return View().TraverseAny(ray, tMin, tMax, std::forward<LeafFunction>(leaf));
+  }
+
+private:
+  struct BuildNode {
+    AABB                       bounds;
+    uint32_t                   first = 0;
+    uint32_t                   count = 0;
+    std::unique_ptr<BuildNode> children[2];
+  };
+
+  struct BuildContext {
+    std::span<const AABB>  bounds;
+    std::vector<glm::vec3> centroids;
+    ThreadPool            *pool;
+  };
+
+  struct Bin {
+    AABB     bounds;
+    uint32_t count = 0;
+  };
+
+  struct Split {
+    int   axis = -1;
+    int   bin  = 0;
+    float cost = std::numeric_limits<float>::infinity();
+  };
+
+  using Bins = std::array<std::array<Bin, BIN_COUNT>, 3>;
+
+  void FillBins(
+    const BuildContext &context, uint32_t first, uint32_t last, const AABB &centroidBounds, const glm::vec3 &scale,
+    Bins &bins) const {
+    for (uint32_t i = first; i < last; i++) {
+      const uint32_t primitive = primitiveIndices[i];
+      for (int axis = 0; axis < 3; axis++) {
+        const int bin = std::min(
+          BIN_COUNT - 1, static_cast<int>((context.centroids[primitive][axis] - centroidBounds.min[axis]) * scale[axis]));
+        bins[axis][bin].count++;
+        bins[axis][bin].bounds.Grow(context.bounds[primitive]);
+      }
+    }
+  }
+
+  Split FindSplit(
+    const BuildContext &context, uint32_t first, uint32_t count, const AABB &bounds, const AABB &centroidBounds,
+    glm::vec3 &scale) const {
+    const glm::vec3 extent = centroidBounds.max - centroidBounds.min;
+    for (int axis = 0; axis < 3; axis++) {
+      scale[axis] = extent[axis] > 0 ? BIN_COUNT / extent[axis] : 0;
+    }
+
+    Bins bins = {};
+    if (context.pool && count >= PARALLEL_BINNING_SIZE) {
+      const int64_t     grainSize = PARALLEL_BINNING_SIZE / 4;
+      std::vector<Bins> partial((count + grainSize - 1) / grainSize);
+      ParallelFor(*context.pool, 0, count, grainSize, [&](int64_t begin, int64_t end) {
+        partial[begin / grainSize] = {};
+        FillBins(context, first + begin, first + end, centroidBounds, scale, partial[begin / grainSize]);
+      });
+      for (const Bins &chunk: partial) {
+        for (int axis = 0; axis < 3; axis++) {
+          for (int bin = 0; bin < BIN_COUNT; bin++) {
+            bins[axis][bin].count += chunk[axis][bin].count;
+            bins[axis][bin].bounds.Grow(chunk[axis][bin].bounds);
+          }
+        }
+      }
+    } else {
+      FillBins(context, first, first + count, centroidBounds, scale, bins);
+    }
+
+    // Sweep the bins from both sides to get the area and count of every candidate split plane
+    Split       best;
+    const float parentArea = bounds.SurfaceArea();
+    for (int axis = 0; axis < 3; axis++) {
+      if (extent[axis] <= 0) {
+        continue;
+      }
+      std::array<float, BIN_COUNT - 1>    leftArea, rightArea;
+      std::array<uint32_t, BIN_COUNT - 1> leftCount, rightCount;
+      AABB                                leftBox, rightBox;
+      uint32_t                            leftSum = 0, rightSum = 0;
+      for (int i = 0; i < BIN_COUNT - 1; i++) {
+        leftSum += bins[axis][i].count;
+        leftCount[i] = leftSum;
+        leftBox.Grow(bins[axis][i].bounds);
+        leftArea[i] = leftBox.SurfaceArea();
+
+        rightSum += bins[axis][BIN_COUNT - 1 - i].count;
+        rightCount[BIN_COUNT - 2 - i] = rightSum;
+        rightBox.Grow(bins[axis][BIN_COUNT - 1 - i].bounds);
+        rightArea[BIN_COUNT - 2 - i] = rightBox.SurfaceArea();
+      }
+      for (int i = 0; i < BIN_COUNT - 1; i++) {
+        if (leftCount[i] == 0 || rightCount[i] == 0) {
+          continue;
+        }
+        const float cost = SAH_TRAVERSAL_COST + SAH_INTERSECTION_COST *
+                                                  (leftArea[i] * leftCount[i] + rightArea[i] * rightCount[i]) /
+                                                  parentArea;
+        if (cost < best.cost) {
+          best = {axis, i + 1, cost};
+        }
+      }
+    }
+    return best;
+  }
+
+  std::unique_ptr<BuildNode> BuildRecursive(BuildContext &context, uint32_t first, uint32_t count, uint32_t depth) {
+    auto node   = std::make_unique<BuildNode>();
+    node->first = first;
+    node->count = count;
+    AABB centroidBounds;
+    for (uint32_t i = first; i < first + count; i++) {
+      node->bounds.Grow(context.bounds[primitiveIndices[i]]);
+      centroidBounds.Grow(context.centroids[primitiveIndices[i]]);
+    }
+    // The traversal stacks hold at most one entry per level
+    if (count == 1 || depth >= MAX_TRAVERSAL_STACK_SIZE - 1) {
+      return node;
+    }
+
+    glm::vec3   scale;
+    const Split split = FindSplit(context, first, count, node->bounds, centroidBounds, scale);
+
+    uint32_t leftCount;
+    if (split.axis < 0) {
+      // All centroids coincide, SAH cannot separate them
+      if (count <= MAX_LEAF_SIZE) {
+        return node;
+      }
+      leftCount = count / 2;
+    } else {
+      if (count <= MAX_LEAF_SIZE && split.cost >= count * SAH_INTERSECTION_COST) {
+        return node;
+      }
+      const int       axis   = split.axis;
+      const uint32_t *middle = std::partition(
+        primitiveIndices.data() + first, primitiveIndices.data() + first + count, [&](uint32_t primitive) {
+          const int bin = std::min(
+            BIN_COUNT - 1,
+            static_cast<int>((context.centroids[primitive][axis] - centroidBounds.min[axis]) * scale[axis]));
+          return bin < split.bin;
+        });
+      leftCount = static_cast<uint32_t>(middle - (primitiveIndices.data() + first));
+    }
+
+    if (context.pool && count >= PARALLEL_SUBTREE_SIZE) {
+      TaskGroup group(*context.pool);
+      group.Run([&] { node->children[0] = BuildRecursive(context, first, leftCount, depth + 1); });
+      node->children[1] = BuildRecursive(context, first + leftCount, count - leftCount, depth + 1);
+      group.Wait();
+    } else {
+      node->children[0] = BuildRecursive(context, first, leftCount, depth + 1);
+      node->children[1] = BuildRecursive(context, first + leftCount, count - leftCount, depth + 1);
+    }
+    return node;
+  }
+
+  uint32_t Flatten(const BuildNode &buildNode, uint32_t depth) {
+    const uint32_t index = static_cast<uint32_t>(nodes.size());
+    nodes.push_back({buildNode.bounds.min, buildNode.first, buildNode.bounds.max, buildNode.count});
+    statistics.maxDepth = std::max(statistics.maxDepth, depth);
+    if (!buildNode.children[0]) {
+      statistics.leafCount++;
+      return index;
+    }
+    nodes[index].count = 0;
+    Flatten(*buildNode.children[0], depth + 1);
+    nodes[index].leftOrFirst = Flatten(*buildNode.children[1], depth + 1);
+    return index;
+  }
+
+  // Subtree root of a partial rebuild, see SelectRebuilds()
+  struct Rebuild {
+    uint32_t node;
+    uint32_t depth;
+    uint32_t first = 0;
+    uint32_t count = 0;
+  };
+
+  std::vector<float>    builtCost;   // per node, RelativeCost() when the node was built
+  std::vector<float>    subtreeCost; // per node, SAH cost of its subtree not yet divided by its area
+  std::vector<Rebuild>  rebuildRoots;
+  std::vector<BVHNode>  previousNodes;
+  std::vector<float>    previousBuiltCost;
+  std::vector<uint32_t> previousIndices;
+  std::vector<glm::vec3> centroids;
+
+  // SAH cost of the subtree relative to a ray through the node's own box
+  float RelativeCost(size_t index) const {
+    const float area = NodeBounds(index).SurfaceArea();
+    return area > 0 ? subtreeCost[index] / area : 0.0f;
+  }
+
+  // Children follow their parent in the depth first order, so a backwards sweep sees them first
+  void ComputeSubtreeCosts() {
+    subtreeCost.resize(nodes.size());
+    for (size_t i = nodes.size(); i-- > 0;) {
+      const BVHNode &node = nodes[i];
+      const float    area = NodeBounds(i).SurfaceArea();
+      if (node.IsLeaf()) {
+        subtreeCost[i] = area * node.count * SAH_INTERSECTION_COST;
+      } else {
+        subtreeCost[i] = area * SAH_TRAVERSAL_COST + subtreeCost[i + 1] + subtreeCost[node.leftOrFirst];
+      }
+    }
+  }
+
+  void RefitRecursive(std::span<const AABB> primitiveBounds, ThreadPool *pool, uint32_t index, uint32_t depth) {
+    BVHNode &node = nodes[index];
+    AABB     bounds;
+    if (node.IsLeaf()) {
+      for (uint32_t i = node.leftOrFirst; i < node.leftOrFirst + node.count; i++) {
+        bounds.Grow(primitiveBounds[primitiveIndices[i]]);
+      }
+      node.boundsMin     = bounds.min;
+      node.boundsMax     = bounds.max;
+      subtreeCost[index] = bounds.SurfaceArea() * node.count * SAH_INTERSECTION_COST;
+      return;
+    }
+    const uint32_t left  = index + 1;
+    const uint32_t right = node.leftOrFirst;
+    if (pool && depth < PARALLEL_REFIT_DEPTH) {
+      TaskGroup group(*pool);
+      group.Run([&] { RefitRecursive(primitiveBounds, pool, left, depth + 1); });
+      RefitRecursive(primitiveBounds, pool, right, depth + 1);
+      group.Wait();
+    } else {
+      RefitRecursive(primitiveBounds, pool, left, depth + 1);
+      RefitRecursive(primitiveBounds, pool, right, depth + 1);
+    }
+    bounds = NodeBounds(left);
+    bounds.Grow(NodeBounds(right));
+    node.boundsMin     = bounds.min;
+    node.boundsMax     = bounds.max;
+    subtreeCost[index] = bounds.SurfaceArea() * SAH_TRAVERSAL_COST + subtreeCost[left] + subtreeCost[right];
+  }
+
+  bool Degraded(uint32_t index, float threshold) const { return RelativeCost(index) > threshold * builtCost[index]; }
+
+  // Top down search for the subtrees to rebuild, in depth first order. A degraded node whose degradation lies in a
+  // single inner child leaves the choice to that child, so one bad corner does not rebuild everything above it;
+  // otherwise the node is rebuilt as a whole. Leaves have no structure of their own to degrade, their boxes growing
+  // apart shows up in their parent.
+  void SelectRebuilds(uint32_t index, uint32_t depth, float threshold) {
+    const BVHNode &node = nodes[index];
+    if (node.IsLeaf()) {
+      return;
+    }
+    const uint32_t left  = index + 1;
+    const uint32_t right = node.leftOrFirst;
+    if (!Degraded(index, threshold)) {
+      SelectRebuilds(left, depth + 1, threshold);
+      SelectRebuilds(right, depth + 1, threshold);
+      return;
+    }
+    const bool leftDegraded  = Degraded(left, threshold);
+    const bool rightDegraded = Degraded(right, threshold);
+    if (leftDegraded != rightDegraded && !nodes[leftDegraded ? left : right].IsLeaf()) {
+      SelectRebuilds(leftDegraded ? left : right, depth + 1, threshold);
+      return;
+    }
+    rebuildRoots.push_back({index, depth});
+  }
+
+  // First primitive and primitive count under a node, its leftmost and rightmost leaves bound the range
+  std::pair<uint32_t, uint32_t> SubtreeRange(uint32_t index) const {
+    uint32_t leftmost = index;
+    while (!nodes[leftmost].IsLeaf()) {
+      leftmost++;
+    }
+    uint32_t rightmost = index;
+    while (!nodes[rightmost].IsLeaf()) {
+      rightmost = nodes[rightmost].leftOrFirst;
+    }
+    const uint32_t first = nodes[leftmost].leftOrFirst;
+    return {first, nodes[rightmost].leftOrFirst + nodes[rightmost].count - first};
+  }
+
+  template<typename ReorderFunction>
+  void RebuildSubtrees(std::span<const AABB> primitiveBounds, ThreadPool *pool, ReorderFunction &&reordered) {
+    BuildContext context = {primitiveBounds, std::move(centroids), pool};
+    context.centroids.resize(primitiveBounds.size());
+    previousIndices.clear();
+    for (Rebuild &rebuild: rebuildRoots) {
+      const auto [first, count] = SubtreeRange(rebuild.node);
+      rebuild.first             = first;
+      rebuild.count             = count;
+      for (uint32_t i = rebuild.first; i < rebuild.first + rebuild.count; i++) {
+        context.centroids[primitiveIndices[i]] = primitiveBounds[primitiveIndices[i]].Centroid();
+        previousIndices.push_back(primitiveIndices[i]);
+      }
+      updateStatistics.rebuiltSubtrees++;
+      updateStatistics.rebuiltPrimitives += rebuild.count;
+    }
+    // The build trees stay local so the BVH remains copyable
+    std::vector<std::unique_ptr<BuildNode>> roots(rebuildRoots.size());
+    if (pool) {
+      TaskGroup group(*pool);
+      for (size_t i = 0; i < rebuildRoots.size(); i++) {
+        group.Run([&, i] {
+          roots[i] = BuildRecursive(context, rebuildRoots[i].first, rebuildRoots[i].count, rebuildRoots[i].depth);
+        });
+      }
+      group.Wait();
+    } else {
+      for (size_t i = 0; i < rebuildRoots.size(); i++) {
+        roots[i] = BuildRecursive(context, rebuildRoots[i].first, rebuildRoots[i].count, rebuildRoots[i].depth);
+      }
+    }
+    centroids = std::move(context.centroids);
+
+    // Copy the tree into a fresh depth first layout with the rebuilt subtrees spliced in. Their nodes are marked with
+    // a negative built cost until the costs of the new layout are known.
+    nodes.swap(previousNodes);
+    builtCost.swap(previousBuiltCost);
+    nodes.clear();
+    builtCost.clear();
+    statistics.leafCount = 0;
+    statistics.maxDepth  = 0;
+    size_t nextRebuild   = 0;
+    Splice(0, 1, roots, nextRebuild);
+    statistics.nodeCount = static_cast<uint32_t>(nodes.size());
+    ComputeSubtreeCosts();
+    for (size_t i = 0; i < nodes.size(); i++) {
+      if (builtCost[i] < 0) {
+        builtCost[i] = RelativeCost(i);
+      }
+    }
+
+    size_t offset = 0;
+    for (Rebuild &rebuild: rebuildRoots) {
+      reordered(rebuild.first, std::span<const uint32_t>(previousIndices).subspan(offset, rebuild.count));
+      offset += rebuild.count;
+    }
+  }
+
+  // Copies node `index` of previousNodes and its subtree to the end of `nodes`, returning its new index
+  uint32_t Splice(
+    uint32_t index, uint32_t depth, std::span<const std::unique_ptr<BuildNode>> roots, size_t &nextRebuild) {
+    if (nextRebuild < rebuildRoots.size() && rebuildRoots[nextRebuild].node == index) {
+      const uint32_t first = static_cast<uint32_t>(nodes.size());
+      Flatten(*roots[nextRebuild++], depth);
+      builtCost.resize(nodes.size(), -1.0f);
+      return first;
+    }
+    const uint32_t newIndex = static_cast<uint32_t>(nodes.size());
+    const BVHNode  node     = previousNodes[index];
+    nodes.push_back(node);
+    builtCost.push_back(previousBuiltCost[index]);
+    statistics.maxDepth = std::max(statistics.maxDepth, depth);
+    if (node.IsLeaf()) {
+      statistics.leafCount++;
+      return newIndex;
+    }
+    Splice(index + 1, depth + 1, roots, nextRebuild);
+    nodes[newIndex].leftOrFirst = Splice(node.leftOrFirst, depth + 1, roots, nextRebuild);
+    return newIndex;
+  }
+};
+
+#endif // BVH_H
@@ -0,0 +1,233 @@
+#ifndef CAMERA_H
+#define CAMERA_H
+#include <cmath>
+#include <fmt/core.h>
+#include <glm/glm.hpp>
+#include <limits>
+#include <memory_resource>
+#include <numbers>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "formatters.h"
+#include "ray.h"
+#include "raypacket.h"
+
+// Single precision, for the shading code; the angle conversions below work in the precision they are given
+constexpr float PI = std::numbers::pi_v<float>;
+
+
+template<typename T>
+T Degrees(T radian) {
+  return radian * T(180) / std::numbers::pi_v<T>;
+}
+template<typename T>
+T Radians(T degrees) {
+  return degrees / T(180) * std::numbers::pi_v<T>;
+}
+
+template<typename T = float>
+glm::mat<3, 3, T> ComputeCameraMatrix(const T verticalFOVDegrees, const T imageWidth, const T imageHeight) {
+  // Convert vertical FOV from degrees to radians
+  const T halfVerticalFOVRadians = Radians(verticalFOVDegrees) / T(2);
+
+  // Compute image plane distance and horizontal FOV
+  const T halfImageWidth  = imageWidth / T(2);
+  const T halfImageHeight = imageHeight / T(2);
+  const T baseDistance =
+    halfImageHeight / std::tan(halfVerticalFOVRadians); // distance of image plane from camera origin
+  const T halfHorizontalFOVRadians = std::atan2(halfImageWidth, baseDistance);
+
+  // Compute camera matrix parameters
+  const T fy = (imageHeight - T(1)) / (T(2) * std::tan(halfVerticalFOVRadians));
+  const T fx = (imageWidth - T(1)) / (T(2) * std::tan(halfHorizontalFOVRadians));
+
+  // Compute the image center
+  const T cx = (imageWidth - T(1)) / T(2);
+  const T cy = (imageHeight - T(1)) / T(2);
+
+  // glm is column major, so each brace below is a column of K = [[fx, 0, cx], [0, fy, cy], [0, 0, 1]]
+  return {{fx, T(0), T(0)}, {T(0), fy, T(0)}, {cx, cy, T(1)}};
+}
+
+
+// Produces primary rays on demand instead of materializing a full frame of them.
+// The camera-to-world rotation and the inverse camera matrix are folded into three world space vectors, so the
+// direction through pixel (x, y) is `base + x * stepX + y * stepY` followed by a single normalize. T is the precision
+// of the generated rays; the vectors are folded in that precision too.
+template<typename T>
+struct RayGeneratorT {
+  using Vec3 = glm::vec<3, T>;
+
+  Vec3 origin;
+  Vec3 base;  // unnormalized direction through pixel (0, 0)
+  Vec3 stepX; // direction increment per pixel column
+  Vec3 stepY; // direction increment per pixel row
+  int  imageWidth;
+  int  imageHeight;
+
+  // The camera matrices may be in a different precision than the rays, they are converted first
+  template<typename U>
+  RayGeneratorT(
+    const glm::mat<3, 3, U> &cameraMatrixInverse, const glm::mat<4, 4, U> &transform, int imageWidth, int imageHeight) :
+      imageWidth(imageWidth), imageHeight(imageHeight) {
+    const glm::mat<3, 3, T> pixelToWorld =
+      glm::mat<3, 3, T>(glm::mat<3, 3, U>(transform)) * glm::mat<3, 3, T>(cameraMatrixInverse);
+    origin = Vec3(transform[3]); // last column as vec3
+    stepX  = pixelToWorld[0];
+    stepY  = pixelToWorld[1];
+    base   = pixelToWorld[2];
+  }
+
+  // Ray through continuous pixel coordinates, so callers can jitter inside the pixel
+  RayT<T> operator()(float x, float y) const {
+    return {origin, glm::normalize(base + static_cast<T>(x) * stepX + static_cast<T>(y) * stepY)};
+  }
+
+  // Calls `function(x, y, ray)` for every pixel of the half open tile [x0, x1) x [y0, y1)
+  template<typename Function>
+  void ForEachRayInTile(int x0, int y0, int x1, int y1, Function &&function) const {
+    for (int y = y0; y < y1; y++) {
+      const Vec3 rowBase = base + static_cast<T>(y) * stepY;
+      for (int x = x0; x < x1; x++) {
+        function(x, y, RayT<T>{origin, glm::normalize(rowBase + static_cast<T>(x) * stepX)});
+      }
+    }
+  }
+
+  template<typename Function>
+  void ForEachRay(Function &&function) const {
+    ForEachRayInTile(0, 0, imageWidth, imageHeight, std::forward<Function>(function));
+  }
+
+  // Fills the lanes set in `active` with the rays through the continuous pixel coordinates (pixelX[i], pixelY[i]), the
+  // same rays operator() returns, and bounds them with the packet frustum. Packets are traced in float only.
+  template<int Side>
+    requires std::is_same_v<T, float>
+  void GeneratePacket(const float *pixelX, const float *pixelY, uint64_t active, RayPacket<Side> &packet) const {
+    // Widened by a fraction of a pixel so that rounding in the plane normals never culls a box an edge ray touches
+    constexpr float FRUSTUM_MARGIN = 1e-2f;
+
+    float minX = std::numeric_limits<float>::infinity(), maxX = -minX;
+    float minY = minX, maxY = maxX;
+    for (int i = 0; i < RayPacket<Side>::SIZE; i++) {
+      if (((active >> i) & 1) == 0) {
+        packet.SetRay(i, {origin, glm::normalize(base)});
+        continue;
+      }
+      packet.SetRay(i, (*this)(pixelX[i], pixelY[i]));
+      minX = std::min(minX, pixelX[i]);
+      maxX = std::max(maxX, pixelX[i]);
+      minY = std::min(minY, pixelY[i]);
+      maxY = std::max(maxY, pixelY[i]);
+    }
+    minX -= FRUSTUM_MARGIN;
+    minY -= FRUSTUM_MARGIN;
+    maxX += FRUSTUM_MARGIN;
+    maxY += FRUSTUM_MARGIN;
+    const Vec3 corners[4] = {
+      base + minX * stepX + minY * stepY, base + maxX * stepX + minY * stepY, base + maxX * stepX + maxY * stepY,
+      base + minX * stepX + maxY * stepY};
+    packet.origin  = origin;
+    packet.frustum = PacketFrustum(origin, corners);
+    packet.active  = active;
+  }
+
+  // Unjittered packet through the pixel centers of the Side x Side block whose top left pixel is (x0, y0). Lanes past
+  // the image edge stay inactive.
+  template<int Side>
+    requires std::is_same_v<T, float>
+  void GeneratePacket(int x0, int y0, RayPacket<Side> &packet) const {
+    float    pixelX[RayPacket<Side>::SIZE], pixelY[RayPacket<Side>::SIZE];
+    uint64_t active = 0;
+    for (int i = 0; i < RayPacket<Side>::SIZE; i++) {
+      pixelX[i] = static_cast<float>(x0 + i % Side);
+      pixelY[i] = static_cast<float>(y0 + i / Side);
+      if (x0 + i % Side < imageWidth && y0 + i / Side < imageHeight) {
+        active |= uint64_t(1) << i;
+      }
+    }
+    GeneratePacket(pixelX, pixelY, active, packet);
+  }
+};
+
+using RayGenerator  = RayGeneratorT<float>;
+using RayGeneratorD = RayGeneratorT<double>;
+
+
+// Pinhole camera whose matrices are kept in precision T. A double camera keeps the translation of a camera far from
+// the origin exact, float and double ray generators can be taken from either.
+template<typename T>
+struct CameraT {
+  using Mat3 = glm::mat<3, 3, T>;
+  using Mat4 = glm::mat<4, 4, T>;
+
+  T    verticalFov;
+  int  imageWidth;
+  int  imageHeight;
+  Mat3 cameraMatrix;
+  Mat3 cameraMatrixInverse;
+  Mat4 transform;
+
+  CameraT(T verticalFov, int imageWidth, int imageHeight) :
+      verticalFov(verticalFov), imageWidth(imageWidth), imageHeight(imageHeight) {
+    cameraMatrix        = ComputeCameraMatrix<T>(verticalFov, imageWidth, imageHeight);
+    cameraMatrixInverse = glm::inverse(cameraMatrix);
+    transform           = Mat4(1);
+  }
+
+  template<typename U = T>
+  RayGeneratorT<U> GetRayGenerator() const {
+    return {cameraMatrixInverse, transform, imageWidth, imageHeight};
+  }
+
+  template<typename U = T>
+  RayGeneratorT<U> GetLocalRayGenerator() const {
+    return {cameraMatrixInverse, Mat4(1), imageWidth, imageHeight};
+  }
+
+  // Full frame ray buffers, kept for debugging only. The render path uses GetRayGenerator(). Passing an Arena as
+  // `resource` keeps repeated calls off the global allocator.
+  std::pmr::vector<RayT<T>> GetRaysInLocalFrame(
+    std::pmr::memory_resource *resource = std::pmr::get_default_resource()) const {
+    return CollectRays(GetLocalRayGenerator(), resource);
+  }
+
+  std::pmr::vector<RayT<T>> GetTransformedRays(
+    std::pmr::memory_resource *resource = std::pmr::get_default_resource()) const {
+    return CollectRays(GetRayGenerator(), resource);
+  }
+
+private:
+  std::pmr::vector<RayT<T>> CollectRays(const RayGeneratorT<T> &generator, std::pmr::memory_resource *resource) const {
+    std::pmr::vector<RayT<T>> rays(imageWidth * imageHeight, resource);
+    generator.ForEachRay([&](int x, int y, const RayT<T> &ray) { rays[x + y * imageWidth] = ray; });
+    return rays;
+  }
+};
+
+using Camera  = CameraT<float>;
+using CameraD = CameraT<double>;
+
+template<typename T>
+struct fmt::formatter<CameraT<T>> {
+  // Parse format specifier (not used here)
+  constexpr auto parse(fmt::format_parse_context &ctx) { return ctx.begin(); }
+
+  // Format the struct as a string
+  template<typename FormatContext>
+  auto format(const CameraT<T> &camera, FormatContext &ctx) const {
+    fmt::format_to(ctx.out(), "Camera: {{\n");
+    fmt::format_to(ctx.out(), "\tverticalFov = {}\n", camera.verticalFov);
+    fmt::format_to(ctx.out(), "\timageWidth = {}\n", camera.imageWidth);
+    fmt::format_to(ctx.out(), "\timageHeight = {}\n", camera.imageHeight);
+    fmt::format_to(ctx.out(), "\tcameraMatrix = {}\n", camera.cameraMatrix);
+    fmt::format_to(ctx.out(), "\tcameraMatrixInverse = {}\n", camera.cameraMatrixInverse);
+    fmt::format_to(ctx.out(), "\ttransform = {}\n", camera.transform);
+    fmt::format_to(ctx.out(), "}}");
+    return ctx.out();
+  }
+};
+
+#endif // CAMERA_H
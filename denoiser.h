@@ -0,0 +1,414 @@
+#ifndef DENOISER_H
+#define DENOISER_H
+#include <algorithm>
+#include <bit>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <fmt/core.h>
+#include <glm/glm.hpp>
+#include <memory_resource>
+#include <utility>
+#include <vector>
+
+#include "framebuffer.h"
+#include "profiler.h"
+#include "scheduler.h"
+#include "simd.h"
+#include "threadpool.h"
+
+
+struct DenoiserSettings {
+  int   iterations = 5;    // levels of the filter, the last one has taps 2^(iterations - 1) pixels apart
+  float colorPhi   = 8.0f; // luminance difference tolerated, in standard errors of the pixel mean
+  float depthPhi   = 0.1f; // depth difference tolerated, relative to the depth and per pixel of tap distance
+};
+
+// Normal weight max(0, dot(n_p, n_q))^128, as seven squarings
+constexpr int DENOISER_NORMAL_SQUARINGS = 7;
+
+// B3 spline, the 5x5 kernel is its outer product
+constexpr float ATROUS_KERNEL[5] = {1.0f / 16, 1.0f / 4, 3.0f / 8, 1.0f / 4, 1.0f / 16};
+
+
+// One level of the filter over planar, row major images of the whole frame
+struct AtrousPass {
+  int          width, height;
+  int          step; // pixels between taps
+  float        depthPhi;
+  const float *colorR, *colorG, *colorB; // illumination, the color divided by the albedo
+  const float *variance;                 // variance of the pixel mean of the illumination luminance
+  const float *luminanceScale;           // 1 / (colorPhi * standard error) from the prefiltered variance
+  const float *normalX, *normalY, *normalZ, *depth;
+  float       *outR, *outG, *outB, *outVariance;
+};
+
+
+// e^x for x <= 0, from 2^x split into an exponent and a degree 5 polynomial for the fraction, relative error below
+// 4e-6. Branch free, so the SIMD kernels compute the same up to rounding.
+inline float DenoiserExp(float x) {
+  const float t        = std::max(x, -87.0f) * 1.44269504f;
+  const float whole    = std::floor(t);
+  const float fraction = t - whole;
+  float       p        = 1.8775767e-3f;
+  p                    = p * fraction + 8.9893397e-3f;
+  p                    = p * fraction + 5.5826318e-2f;
+  p                    = p * fraction + 2.4015361e-1f;
+  p                    = p * fraction + 6.9315308e-1f;
+  p                    = p * fraction + 1.0f;
+  return p * std::bit_cast<float>((static_cast<int32_t>(whole) + 127) << 23);
+}
+
+
+// ================================================================================
+// scalar
+// ================================================================================
+inline void AtrousPixel(const AtrousPass &pass, int x, int y) {
+  const size_t center    = static_cast<size_t>(y) * pass.width + x;
+  const float  luminance = Luminance({pass.colorR[center], pass.colorG[center], pass.colorB[center]});
+  const float  centerWeight = ATROUS_KERNEL[2] * ATROUS_KERNEL[2];
+  float        weightSum    = centerWeight;
+  float        sumR         = centerWeight * pass.colorR[center];
+  float        sumG         = centerWeight * pass.colorG[center];
+  float        sumB         = centerWeight * pass.colorB[center];
+  float        sumVariance  = centerWeight * centerWeight * pass.variance[center];
+  for (int dy = -2; dy <= 2; dy++) {
+    const int qy = y + dy * pass.step;
+    if (qy < 0 || qy >= pass.height) {
+      continue;
+    }
+    for (int dx = -2; dx <= 2; dx++) {
+      const int qx = x + dx * pass.step;
+      if ((dx == 0 && dy == 0) || qx < 0 || qx >= pass.width) {
+        continue;
+      }
+      const size_t q = static_cast<size_t>(qy) * pass.width + qx;
+      float        normalWeight =
+        std::max(0.0f, pass.normalX[center] * pass.normalX[q] + pass.normalY[center] * pass.normalY[q] +
+                         pass.normalZ[center] * pass.normalZ[q]);
+      for (int i = 0; i < DENOISER_NORMAL_SQUARINGS; i++) {
+        normalWeight *= normalWeight;
+      }
+      const float tapDistance = static_cast<float>(pass.step * std::max(std::abs(dx), std::abs(dy)));
+      const float depthTerm   = std::abs(pass.depth[center] - pass.depth[q]) /
+                              (std::max(pass.depth[center], pass.depth[q]) * pass.depthPhi * tapDistance + 1e-6f);
+      const float luminanceTerm =
+        std::abs(luminance - Luminance({pass.colorR[q], pass.colorG[q], pass.colorB[q]})) * pass.luminanceScale[center];
+      const float weight =
+        ATROUS_KERNEL[dx + 2] * ATROUS_KERNEL[dy + 2] * normalWeight * DenoiserExp(-(depthTerm + luminanceTerm));
+      weightSum += weight;
+      sumR += weight * pass.colorR[q];
+      sumG += weight * pass.colorG[q];
+      sumB += weight * pass.colorB[q];
+      sumVariance += weight * weight * pass.variance[q];
+    }
+  }
+  pass.outR[center]        = sumR / weightSum;
+  pass.outG[center]        = sumG / weightSum;
+  pass.outB[center]        = sumB / weightSum;
+  pass.outVariance[center] = sumVariance / (weightSum * weightSum);
+}
+
+inline void AtrousRowScalar(const AtrousPass &pass, int y, int x0, int x1) {
+  for (int x = x0; x < x1; x++) {
+    AtrousPixel(pass, x, y);
+  }
+}
+
+
+#if TRACER_SIMD_X86
+// ================================================================================
+// AVX2, 8 lanes
+// ================================================================================
+TRACER_TARGET("avx2,fma")
+inline __m256 DenoiserExpAVX2(__m256 x) {
+  const __m256 t        = _mm256_mul_ps(_mm256_max_ps(x, _mm256_set1_ps(-87.0f)), _mm256_set1_ps(1.44269504f));
+  const __m256 whole    = _mm256_floor_ps(t);
+  const __m256 fraction = _mm256_sub_ps(t, whole);
+  __m256       p        = _mm256_set1_ps(1.8775767e-3f);
+  p                     = _mm256_fmadd_ps(p, fraction, _mm256_set1_ps(8.9893397e-3f));
+  p                     = _mm256_fmadd_ps(p, fraction, _mm256_set1_ps(5.5826318e-2f));
+  p                     = _mm256_fmadd_ps(p, fraction, _mm256_set1_ps(2.4015361e-1f));
+  p                     = _mm256_fmadd_ps(p, fraction, _mm256_set1_ps(6.9315308e-1f));
+  p                     = _mm256_fmadd_ps(p, fraction, _mm256_set1_ps(1.0f));
+  const __m256i exponent =
+    _mm256_slli_epi32(_mm256_add_epi32(_mm256_cvtps_epi32(whole), _mm256_set1_epi32(127)), 23);
+  return _mm256_mul_ps(p, _mm256_castsi256_ps(exponent));
+}
+
+TRACER_TARGET("avx2,fma")
+inline __m256 LuminanceAVX2(__m256 r, __m256 g, __m256 b) {
+  return _mm256_fmadd_ps(
+    r, _mm256_set1_ps(0.2126f), _mm256_fmadd_ps(g, _mm256_set1_ps(0.7152f), _mm256_mul_ps(b, _mm256_set1_ps(0.0722f))));
+}
+
+// Eight pixels at a time where all their taps lie inside the row, the pixels near the left and right borders one by
+// one
+TRACER_TARGET("avx2,fma")
+inline void AtrousRowAVX2(const AtrousPass &pass, int y, int x0, int x1) {
+  const int reach = 2 * pass.step;
+  int       x     = x0;
+  for (; x < x1 && x < reach; x++) {
+    AtrousPixel(pass, x, y);
+  }
+  const __m256 signMask = _mm256_set1_ps(-0.0f);
+  const __m256 zero     = _mm256_setzero_ps();
+  for (; x + 8 <= x1 && x + 7 + reach < pass.width; x += 8) {
+    const size_t center       = static_cast<size_t>(y) * pass.width + x;
+    const __m256 normalX      = _mm256_loadu_ps(pass.normalX + center);
+    const __m256 normalY      = _mm256_loadu_ps(pass.normalY + center);
+    const __m256 normalZ      = _mm256_loadu_ps(pass.normalZ + center);
+    const __m256 depth        = _mm256_loadu_ps(pass.depth + center);
+    const __m256 scale        = _mm256_loadu_ps(pass.luminanceScale + center);
+    const __m256 centerWeight = _mm256_set1_ps(ATROUS_KERNEL[2] * ATROUS_KERNEL[2]);
+    __m256       sumR         = _mm256_mul_ps(centerWeight, _mm256_loadu_ps(pass.colorR + center));
+    __m256       sumG         = _mm256_mul_ps(centerWeight, _mm256_loadu_ps(pass.colorG + center));
+    __m256       sumB         = _mm256_mul_ps(centerWeight, _mm256_loadu_ps(pass.colorB + center));
+    __m256       sumVariance  = _mm256_mul_ps(
+      _mm256_mul_ps(centerWeight, centerWeight), _mm256_loadu_ps(pass.variance + center));
+    __m256       weightSum    = centerWeight;
+    const __m256 luminance    = LuminanceAVX2(
+      _mm256_loadu_ps(pass.colorR + center), _mm256_loadu_ps(pass.colorG + center),
+      _mm256_loadu_ps(pass.colorB + center));
+    for (int dy = -2; dy <= 2; dy++) {
+      const int qy = y + dy * pass.step;
+      if (qy < 0 || qy >= pass.height) {
+        continue;
+      }
+      for (int dx = -2; dx <= 2; dx++) {
+        if (dx == 0 && dy == 0) {
+          continue;
+        }
+        const size_t q            = static_cast<size_t>(qy) * pass.width + x + dx * pass.step;
+        __m256       normalWeight = _mm256_max_ps(
+          zero, _mm256_fmadd_ps(
+                  normalX, _mm256_loadu_ps(pass.normalX + q),
+                  _mm256_fmadd_ps(
+                    normalY, _mm256_loadu_ps(pass.normalY + q),
+                    _mm256_mul_ps(normalZ, _mm256_loadu_ps(pass.normalZ + q)))));
+        for (int i = 0; i < DENOISER_NORMAL_SQUARINGS; i++) {
+          normalWeight = _mm256_mul_ps(normalWeight, normalWeight);
+        }
+        const float  tapDistance = static_cast<float>(pass.step * std::max(std::abs(dx), std::abs(dy)));
+        const __m256 depthQ      = _mm256_loadu_ps(pass.depth + q);
+        const __m256 depthTerm   = _mm256_div_ps(
+          _mm256_andnot_ps(signMask, _mm256_sub_ps(depth, depthQ)),
+          _mm256_fmadd_ps(
+            _mm256_max_ps(depth, depthQ), _mm256_set1_ps(pass.depthPhi * tapDistance), _mm256_set1_ps(1e-6f)));
+        const __m256 r             = _mm256_loadu_ps(pass.colorR + q);
+        const __m256 g             = _mm256_loadu_ps(pass.colorG + q);
+        const __m256 b             = _mm256_loadu_ps(pass.colorB + q);
+        const __m256 luminanceTerm =
+          _mm256_mul_ps(_mm256_andnot_ps(signMask, _mm256_sub_ps(luminance, LuminanceAVX2(r, g, b))), scale);
+        const __m256 weight = _mm256_mul_ps(
+          _mm256_mul_ps(_mm256_set1_ps(ATROUS_KERNEL[dx + 2] * ATROUS_KERNEL[dy + 2]), normalWeight),
+          DenoiserExpAVX2(_mm256_xor_ps(_mm256_add_ps(depthTerm, luminanceTerm), signMask)));
+        weightSum   = _mm256_add_ps(weightSum, weight);
+        sumR        = _mm256_fmadd_ps(weight, r, sumR);
+        sumG        = _mm256_fmadd_ps(weight, g, sumG);
+        sumB        = _mm256_fmadd_ps(weight, b, sumB);
+        sumVariance = _mm256_fmadd_ps(_mm256_mul_ps(weight, weight), _mm256_loadu_ps(pass.variance + q), sumVariance);
+      }
+    }
+    const __m256 inverse = _mm256_div_ps(_mm256_set1_ps(1.0f), weightSum);
+    _mm256_storeu_ps(pass.outR + center, _mm256_mul_ps(sumR, inverse));
+    _mm256_storeu_ps(pass.outG + center, _mm256_mul_ps(sumG, inverse));
+    _mm256_storeu_ps(pass.outB + center, _mm256_mul_ps(sumB, inverse));
+    _mm256_storeu_ps(pass.outVariance + center, _mm256_mul_ps(sumVariance, _mm256_mul_ps(inverse, inverse)));
+  }
+  for (; x < x1; x++) {
+    AtrousPixel(pass, x, y);
+  }
+}
+#endif // TRACER_SIMD_X86
+
+
+// ================================================================================
+// runtime dispatch
+// ================================================================================
+struct DenoiserKernels {
+  SimdLevel level;
+
+  // Filters pixels [x0, x1) of row y
+  void (*filterRow)(const AtrousPass &pass, int y, int x0, int x1);
+};
+
+// The filter runs over tile rows of 16 pixels, two AVX2 vectors, so AVX-512 takes the AVX2 kernel and SSE2, whose
+// four lanes would spend more on the border pixels than they save, the scalar one
+inline DenoiserKernels SelectDenoiserKernels(SimdLevel level) {
+#if TRACER_SIMD_X86
+  if (level == SimdLevel::AVX2 || level == SimdLevel::AVX512) {
+    return {SimdLevel::AVX2, AtrousRowAVX2};
+  }
+#endif
+  (void) level;
+  return {SimdLevel::Scalar, AtrousRowScalar};
+}
+
+inline const DenoiserKernels &GetDenoiserKernels() {
+  static const DenoiserKernels kernels = SelectDenoiserKernels(DetectSimdLevel());
+  return kernels;
+}
+
+
+// Edge-avoiding à-trous wavelet filter (Dammertz et al. 2010) with the variance guided luminance weight of SVGF
+// (Schied et al. 2017), run on the finished frame before it is tonemapped.
+// The color is divided by the albedo of the first hit, so the filter only blurs illumination and texture and material
+// edges come back sharp when the albedo is multiplied back in. Every level is a 5x5 B3 spline kernel with holes, its
+// taps 2^level pixels apart, and every tap is weighted down by how far its normal, depth and luminance are from the
+// center pixel's. The luminance tolerance scales with the standard error of the pixel mean, so converged pixels keep
+// their value and noisy ones are smoothed; the variance is filtered along with the color to follow it through the
+// levels. Each level runs tile parallel on the pool, every tile row through the SIMD kernel of the CPU.
+class Denoiser {
+public:
+  Denoiser(int width, int height, int tileSize, DenoiserSettings settings = {}) :
+      settings(settings), width(width), height(height),
+      tiles(MakeTiles(width, height, tileSize, TileOrder::Scanline)) {
+    const size_t pixels = static_cast<size_t>(width) * height;
+    for (AlignedVector<float> *plane:
+         {&albedoR, &albedoG, &albedoB, &normalX, &normalY, &normalZ, &depth, &luminanceScale, &colorR[0], &colorG[0],
+          &colorB[0], &variance[0], &colorR[1], &colorG[1], &colorB[1], &variance[1]}) {
+      plane->resize(pixels);
+    }
+  }
+
+  DenoiserSettings settings;
+
+  void Denoise(const AccumulationBuffer &accumulation, const FeatureBuffer &features, ThreadPool &pool) {
+    const auto start = std::chrono::steady_clock::now();
+    ForEachTile(pool, [&](const Tile &tile) { Demodulate(tile, accumulation, features); });
+    for (int level = 0; level < settings.iterations; level++) {
+      ForEachTile(pool, [&](const Tile &tile) { PrefilterVariance(tile); });
+      const AtrousPass pass = {
+        width,
+        height,
+        1 << level,
+        settings.depthPhi,
+        colorR[0].data(),
+        colorG[0].data(),
+        colorB[0].data(),
+        variance[0].data(),
+        luminanceScale.data(),
+        normalX.data(),
+        normalY.data(),
+        normalZ.data(),
+        depth.data(),
+        colorR[1].data(),
+        colorG[1].data(),
+        colorB[1].data(),
+        variance[1].data()};
+      ForEachTile(pool, [&](const Tile &tile) {
+        for (int y = tile.y0; y < tile.y1; y++) {
+          kernels.filterRow(pass, y, tile.x0, tile.x1);
+        }
+      });
+      std::swap(colorR[0], colorR[1]);
+      std::swap(colorG[0], colorG[1]);
+      std::swap(colorB[0], colorB[1]);
+      std::swap(variance[0], variance[1]);
+    }
+    const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    seconds                                     = elapsed.count();
+  }
+
+  // Denoised radiance, the filtered illumination times the albedo. Named like AccumulationBuffer::Mean() so that the
+  // ImageWriter takes either.
+  glm::vec3 Mean(int x, int y) const {
+    const size_t i = static_cast<size_t>(y) * width + x;
+    return glm::vec3(colorR[0][i], colorG[0][i], colorB[0][i]) * glm::vec3(albedoR[i], albedoG[i], albedoB[i]);
+  }
+
+  // Tonemapped row major image, like AccumulationBuffer::Resolve()
+  void Resolve(std::vector<uchar4> &image, float exposure = 1.0f) const {
+    image.resize(static_cast<size_t>(width) * height);
+    for (int y = 0; y < height; y++) {
+      for (int x = 0; x < width; x++) {
+        const glm::vec3 radiance = Mean(x, y);
+        image[x + static_cast<size_t>(y) * width] = {
+          TonemapChannel(radiance.x, exposure), TonemapChannel(radiance.y, exposure),
+          TonemapChannel(radiance.z, exposure), 255};
+      }
+    }
+  }
+
+  void PrintStatistics() const {
+    fmt::println(
+      "denoiser: {} levels, {} kernel, {:.3f} ms", settings.iterations, SimdLevelName(kernels.level), seconds * 1000.0);
+  }
+
+private:
+  // Keeps near black albedos from blowing the illumination up; dividing and multiplying by the same clamped value
+  // gives the color back exactly where the filter changes nothing
+  static constexpr float MIN_ALBEDO = 1e-3f;
+  // Keeps the luminance weight finite where the variance is zero
+  static constexpr float MIN_STANDARD_ERROR = 1e-4f;
+
+  template<typename Function>
+  void ForEachTile(ThreadPool &pool, Function &&function) {
+    ParallelFor(pool, 0, static_cast<int64_t>(tiles.size()), 1, [&](int64_t first, int64_t last) {
+      for (int64_t i = first; i < last; i++) {
+        const ProfileScope scope(ProfileStage::Denoise);
+        function(tiles[i]);
+      }
+    });
+  }
+
+  void Demodulate(const Tile &tile, const AccumulationBuffer &accumulation, const FeatureBuffer &features) {
+    for (int y = tile.y0; y < tile.y1; y++) {
+      for (int x = tile.x0; x < tile.x1; x++) {
+        const size_t       i       = static_cast<size_t>(y) * width + x;
+        const PathFeatures feature = features.Mean(x, y);
+        const glm::vec3    albedo  = glm::max(feature.albedo, glm::vec3(MIN_ALBEDO));
+        const glm::vec3    color   = accumulation.Mean(x, y) / albedo;
+        const uint32_t     count   = accumulation.SampleCount(x, y);
+        const float        scale   = std::max(Luminance(albedo), MIN_ALBEDO);
+        albedoR[i]                 = albedo.x;
+        albedoG[i]                 = albedo.y;
+        albedoB[i]                 = albedo.z;
+        normalX[i]                 = feature.normal.x;
+        normalY[i]                 = feature.normal.y;
+        normalZ[i]                 = feature.normal.z;
+        depth[i]                   = feature.depth;
+        colorR[0][i]               = color.x;
+        colorG[0][i]               = color.y;
+        colorB[0][i]               = color.z;
+        variance[0][i] = count > 0 ? accumulation.LuminanceVariance(x, y) / (count * scale * scale) : 0.0f;
+      }
+    }
+  }
+
+  // 3x3 Gaussian of the variance, which at a few samples per pixel is too noisy to steer the weights on its own
+  void PrefilterVariance(const Tile &tile) {
+    constexpr float GAUSSIAN[2] = {0.5f, 0.25f};
+    for (int y = tile.y0; y < tile.y1; y++) {
+      for (int x = tile.x0; x < tile.x1; x++) {
+        float sum = 0, weightSum = 0;
+        for (int dy = -1; dy <= 1; dy++) {
+          for (int dx = -1; dx <= 1; dx++) {
+            const int qx = x + dx, qy = y + dy;
+            if (qx >= 0 && qx < width && qy >= 0 && qy < height) {
+              const float weight = GAUSSIAN[std::abs(dx)] * GAUSSIAN[std::abs(dy)];
+              sum += weight * variance[0][static_cast<size_t>(qy) * width + qx];
+              weightSum += weight;
+            }
+          }
+        }
+        const float standardError = std::sqrt(std::max(0.0f, sum / weightSum));
+        luminanceScale[static_cast<size_t>(y) * width + x] =
+          1.0f / (settings.colorPhi * std::max(standardError, MIN_STANDARD_ERROR));
+      }
+    }
+  }
+
+  int                    width;
+  int                    height;
+  std::pmr::vector<Tile> tiles;
+  const DenoiserKernels &kernels = GetDenoiserKernels();
+  AlignedVector<float>   albedoR, albedoG, albedoB;
+  AlignedVector<float>   normalX, normalY, normalZ, depth;
+  AlignedVector<float>   luminanceScale;
+  AlignedVector<float>   colorR[2], colorG[2], colorB[2], variance[2]; // ping pong between the levels
+  double                 seconds = 0;
+};
+
+#endif // DENOISER_H
@@ -0,0 +1,885 @@
+#ifndef DISTRIBUTED_H
+#define DISTRIBUTED_H
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <fmt/core.h>
+#include <glm/glm.hpp>
+#include <initializer_list>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <optional>
+#include <poll.h>
+#include <spawn.h>
+#include <span>
+#include <string>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <thread>
+#include <type_traits>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+#include "adaptive.h"
+#include "camera.h"
+#include "framebuffer.h"
+#include "integrator.h"
+#include "profiler.h"
+#include "sampler.h"
+#include "scene.h"
+#include "scenefile.h"
+#include "scheduler.h"
+#include "simd.h"
+#include "threadpool.h"
+
+
+// Coordinator/worker protocol. Every message is a MessageHeader followed by `size` payload bytes. Structures are sent
+// as they are laid out in memory, so like the binary scene cache the protocol is meant for machines of one
+// architecture; the version in the hello keeps mismatched builds apart.
+constexpr uint32_t DISTRIBUTED_PROTOCOL_VERSION = 2;
+
+enum class MessageType : uint32_t {
+  Hello,    // worker to coordinator: WorkerHello
+  Scene,    // coordinator to worker: RenderSetup, then the binary scene cache
+  Job,      // coordinator to worker: JobHeader, then one PixelSamples per pixel of the tile in row order
+  Result,   // worker to coordinator: JobHeader, then one TileSample per pixel of the tile in row order
+  Shutdown, // coordinator to worker, no payload
+};
+
+struct MessageHeader {
+  MessageType type;
+  uint32_t    reserved;
+  uint64_t    size;
+};
+
+struct WorkerHello {
+  uint32_t version;
+  uint32_t threads;
+};
+
+struct RenderSetup {
+  uint32_t samplerType;     // SamplerType
+  uint32_t doublePrecision; // trace the paths in double like --double
+};
+
+// `pass` tells the results of an earlier pass apart, a straggler may deliver one after the pass was finished by others
+struct JobHeader {
+  uint32_t pass;
+  uint32_t job;
+  Tile     tile;
+};
+
+// Samples [first, first + count) of a pixel, the sample index keys the PixelSampler so every process draws the same
+// sequence a single process would
+struct PixelSamples {
+  uint32_t first;
+  uint32_t count;
+};
+
+// Sums over the samples of a pixel, what AccumulationBuffer::AddSamples() and FeatureBuffer::AddSums() take
+struct TileSample {
+  float r, g, b;
+  float luminanceSquared;
+  float albedo[3];
+  float normal[3];
+  float depth;
+};
+
+template<typename T>
+std::span<const uint8_t> MessageBytes(const T &value) {
+  static_assert(std::is_trivially_copyable_v<T>);
+  return {reinterpret_cast<const uint8_t *>(&value), sizeof(T)};
+}
+
+template<typename T>
+std::span<const uint8_t> MessageBytes(std::span<const T> values) {
+  static_assert(std::is_trivially_copyable_v<T>);
+  return {reinterpret_cast<const uint8_t *>(values.data()), values.size_bytes()};
+}
+
+struct Message {
+  MessageType          type;
+  std::vector<uint8_t> payload;
+
+  // Copies a T out of the payload, nullopt when the payload is too short
+  template<typename T>
+  std::optional<T> Get(size_t offset) const {
+    if (offset > payload.size() || payload.size() - offset < sizeof(T)) {
+      return std::nullopt;
+    }
+    T value;
+    std::memcpy(&value, payload.data() + offset, sizeof(T));
+    return value;
+  }
+
+  // Copies `values.size()` Ts out of the payload, false when it holds a different number of bytes
+  template<typename T>
+  bool GetArray(size_t offset, std::span<T> values) const {
+    if (offset > payload.size() || payload.size() - offset != values.size_bytes()) {
+      return false;
+    }
+    std::memcpy(values.data(), payload.data() + offset, values.size_bytes());
+    return true;
+  }
+};
+
+
+// One end of a stream socket. Received bytes are buffered and cut into messages as they complete, so a peer that
+// stalls in the middle of a message never blocks the reader.
+class Connection {
+public:
+  explicit Connection(int descriptor = -1) : descriptor(descriptor) {}
+
+  Connection(Connection &&other) noexcept :
+      descriptor(std::exchange(other.descriptor, -1)), inbox(std::move(other.inbox)) {}
+
+  Connection &operator=(Connection &&other) noexcept {
+    Close();
+    descriptor = std::exchange(other.descriptor, -1);
+    inbox      = std::move(other.inbox);
+    return *this;
+  }
+
+  Connection(const Connection &)            = delete;
+  Connection &operator=(const Connection &) = delete;
+
+  ~Connection() { Close(); }
+
+  int  Descriptor() const { return descriptor; }
+  bool IsOpen() const { return descriptor >= 0; }
+
+  void Close() {
+    if (descriptor >= 0) {
+      close(descriptor);
+      descriptor = -1;
+    }
+  }
+
+  // Sends the concatenation of `parts` as one message, false once the peer is gone
+  bool Send(MessageType type, std::initializer_list<std::span<const uint8_t>> parts) {
+    MessageHeader header = {type, 0, 0};
+    for (const std::span<const uint8_t> part: parts) {
+      header.size += part.size();
+    }
+    if (!SendAll(MessageBytes(header))) {
+      return false;
+    }
+    for (const std::span<const uint8_t> part: parts) {
+      if (!SendAll(part)) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // Reads whatever has arrived, waiting up to `timeoutMilliseconds` (-1 for ever) for the first bytes. Returns false
+  // once the peer closed the connection or it failed; messages that arrived before stay available from Next().
+  bool Receive(int timeoutMilliseconds) {
+    if (descriptor < 0) {
+      return false;
+    }
+    pollfd request = {descriptor, POLLIN, 0};
+    if (poll(&request, 1, timeoutMilliseconds) <= 0) {
+      return true;
+    }
+    constexpr size_t CHUNK = 1 << 16;
+    while (true) {
+      const size_t  size     = inbox.size();
+      inbox.resize(size + CHUNK);
+      const ssize_t received = recv(descriptor, inbox.data() + size, CHUNK, MSG_DONTWAIT);
+      inbox.resize(size + std::max<ssize_t>(received, 0));
+      if (received > 0) {
+        continue;
+      }
+      return received < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR);
+    }
+  }
+
+  // Whether the receive buffer holds a complete message
+  bool HasMessage() const {
+    MessageHeader header;
+    if (inbox.size() < sizeof(header)) {
+      return false;
+    }
+    std::memcpy(&header, inbox.data(), sizeof(header));
+    return inbox.size() - sizeof(header) >= header.size;
+  }
+
+  // Takes the next complete message out of the receive buffer
+  std::optional<Message> Next() {
+    if (!HasMessage()) {
+      return std::nullopt;
+    }
+    MessageHeader header;
+    std::memcpy(&header, inbox.data(), sizeof(header));
+    const auto payload = inbox.begin() + sizeof(header);
+    Message    message = {header.type, std::vector<uint8_t>(payload, payload + header.size)};
+    inbox.erase(inbox.begin(), payload + header.size);
+    return message;
+  }
+
+private:
+  bool SendAll(std::span<const uint8_t> bytes) {
+    while (!bytes.empty() && descriptor >= 0) {
+      const ssize_t sent = send(descriptor, bytes.data(), bytes.size(), MSG_NOSIGNAL);
+      if (sent < 0 && errno == EINTR) {
+        continue;
+      }
+      if (sent <= 0) {
+        return false;
+      }
+      bytes = bytes.subspan(sent);
+    }
+    return bytes.empty();
+  }
+
+  int                  descriptor;
+  std::vector<uint8_t> inbox;
+};
+
+
+// Socket addresses are "unix:<path>" for a Unix domain socket and "<host>:<port>" for TCP
+inline bool IsUnixSocketAddress(const std::string &address) { return address.starts_with("unix:"); }
+
+// Opens a socket for `address` and binds or connects it; prints the reason and returns -1 on failure
+inline int OpenSocket(const std::string &address, bool listening) {
+  if (IsUnixSocketAddress(address)) {
+    const std::string path  = address.substr(5);
+    sockaddr_un       local = {};
+    local.sun_family        = AF_UNIX;
+    if (path.empty() || path.size() >= sizeof(local.sun_path)) {
+      fmt::println("socket {}: path empty or too long", address);
+      return -1;
+    }
+    std::memcpy(local.sun_path, path.c_str(), path.size() + 1);
+    const int socketDescriptor = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listening) {
+      unlink(path.c_str());
+    }
+    const sockaddr *name = reinterpret_cast<const sockaddr *>(&local);
+    if (socketDescriptor < 0 || (listening ? bind(socketDescriptor, name, sizeof(local))
+                                           : connect(socketDescriptor, name, sizeof(local))) != 0) {
+      fmt::println("socket {}: {}", address, std::strerror(errno));
+      if (socketDescriptor >= 0) {
+        close(socketDescriptor);
+      }
+      return -1;
+    }
+    return socketDescriptor;
+  }
+
+  const size_t colon = address.rfind(':');
+  if (colon == std::string::npos) {
+    fmt::println("socket {}: expected unix:<path> or <host>:<port>", address);
+    return -1;
+  }
+  const std::string host  = address.substr(0, colon);
+  const std::string port  = address.substr(colon + 1);
+  addrinfo          hints = {};
+  hints.ai_family         = AF_UNSPEC;
+  hints.ai_socktype       = SOCK_STREAM;
+  hints.ai_flags          = listening ? AI_PASSIVE : 0;
+  addrinfo *results       = nullptr;
+  if (const int error = getaddrinfo(host.empty() ? nullptr : host.c_str(), port.c_str(), &hints, &results)) {
+    fmt::println("socket {}: {}", address, gai_strerror(error));
+    return -1;
+  }
+  int socketDescriptor = -1;
+  int lastError        = 0;
+  for (const addrinfo *result = results; result && socketDescriptor < 0; result = result->ai_next) {
+    socketDescriptor = socket(result->ai_family, result->ai_socktype, result->ai_protocol);
+    if (socketDescriptor < 0) {
+      lastError = errno;
+      continue;
+    }
+    const int enable = 1;
+    setsockopt(socketDescriptor, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+    setsockopt(socketDescriptor, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+    if ((listening ? bind(socketDescriptor, result->ai_addr, result->ai_addrlen)
+                   : connect(socketDescriptor, result->ai_addr, result->ai_addrlen)) != 0) {
+      lastError = errno;
+      close(socketDescriptor);
+      socketDescriptor = -1;
+    }
+  }
+  freeaddrinfo(results);
+  if (socketDescriptor < 0) {
+    fmt::println("socket {}: {}", address, std::strerror(lastError));
+  }
+  return socketDescriptor;
+}
+
+
+// Traces the samples `samples` asks for in every pixel of `tile`, the same samples the per pixel render pass of a
+// single process takes, and sums them and their PathFeatures per pixel into `result`. Both spans are in row order over
+// the tile.
+template<typename Generator>
+void RenderTileSamples(
+  const SceneView &view, const Sky &sky, const Generator &generator, SamplerType samplerType, const Tile &tile,
+  std::span<const PixelSamples> samples, std::span<TileSample> result) {
+  size_t pixel = 0;
+  for (int y = tile.y0; y < tile.y1; y++) {
+    for (int x = tile.x0; x < tile.x1; x++, pixel++) {
+      glm::vec3    radianceSum         = glm::vec3(0);
+      float        luminanceSquaredSum = 0;
+      PathFeatures featureSum;
+      for (uint32_t sample = samples[pixel].first; sample < samples[pixel].first + samples[pixel].count; sample++) {
+        PixelSampler    pixelSampler(samplerType, x, y, sample);
+        const glm::vec2 jitter = pixelSampler.Next2D();
+        ProfileCount(ProfileCounter::PrimaryRays);
+        PathFeatures    features;
+        const glm::vec3 radiance =
+          TraceRadiance(view, sky, generator(x + jitter.x - 0.5f, y + jitter.y - 0.5f), pixelSampler, &features);
+        const float luminance = Luminance(radiance);
+        radianceSum += radiance;
+        luminanceSquaredSum += luminance * luminance;
+        featureSum.albedo += features.albedo;
+        featureSum.normal += features.normal;
+        featureSum.depth += features.depth;
+      }
+      result[pixel] = {
+        radianceSum.x,
+        radianceSum.y,
+        radianceSum.z,
+        luminanceSquaredSum,
+        {featureSum.albedo.x, featureSum.albedo.y, featureSum.albedo.z},
+        {featureSum.normal.x, featureSum.normal.y, featureSum.normal.z},
+        featureSum.depth};
+    }
+  }
+}
+
+
+// Worker side of distributed rendering: connects to the coordinator at `address`, receives the scene once, then
+// renders the jobs it is sent on `pool`, a batch of whatever has arrived at a time, until the coordinator shuts it
+// down or goes away. Returns false when it never got a scene to render.
+inline bool RunRenderWorker(const std::string &address, ThreadPool &pool) {
+  // The coordinator may still be loading its scene
+  constexpr int CONNECT_ATTEMPTS = 300;
+  int           descriptor       = -1;
+  for (int attempt = 0; attempt < CONNECT_ATTEMPTS && descriptor < 0; attempt++) {
+    if (attempt > 0) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+    descriptor = OpenSocket(address, false);
+  }
+  if (descriptor < 0) {
+    return false;
+  }
+  Connection     connection(descriptor);
+  const unsigned threads = pool.ThreadCount() + 1;
+  connection.Send(MessageType::Hello, {MessageBytes(WorkerHello{DISTRIBUTED_PROTOCOL_VERSION, threads})});
+
+  std::optional<Message> sceneMessage;
+  while (!(sceneMessage = connection.Next())) {
+    if (!connection.Receive(-1) && !(sceneMessage = connection.Next())) {
+      fmt::println("worker: {} closed the connection before sending a scene", address);
+      return false;
+    }
+  }
+  const std::optional<RenderSetup> setup = sceneMessage->Get<RenderSetup>(0);
+  if (sceneMessage->type != MessageType::Scene || !setup ||
+      setup->samplerType > static_cast<uint32_t>(SamplerType::BlueNoise)) {
+    fmt::println("worker: unexpected message from {}", address);
+    return false;
+  }
+  AlignedVector<uint8_t> sceneBytes(sceneMessage->payload.begin() + sizeof(RenderSetup), sceneMessage->payload.end());
+  sceneMessage.reset();
+  const MappedScene scene(std::move(sceneBytes), address);
+  if (!scene.IsOpen()) {
+    return false;
+  }
+  const SceneView     &view        = scene.View();
+  const SceneSettings &settings    = scene.Settings();
+  const SamplerType    samplerType = static_cast<SamplerType>(setup->samplerType);
+  const Camera         camera(settings.fov, settings.width, settings.height);
+  const RayGenerator   rayGenerator       = camera.GetRayGenerator();
+  const RayGeneratorD  doubleRayGenerator = camera.GetRayGenerator<double>();
+  const Sky            sky;
+  fmt::println("worker: {} spheres from {}, {} threads", view.Size(), address, threads);
+
+  std::vector<Message>                  jobs;
+  std::vector<std::vector<PixelSamples>> samples;
+  std::vector<std::vector<TileSample>>   results;
+  uint64_t                              rendered = 0;
+  bool                                  open     = true;
+  bool                                  shutdown = false;
+  while (!shutdown) {
+    // Block only while nothing complete has arrived, then take whatever else came with it as one batch
+    open = open && connection.Receive(connection.HasMessage() ? 0 : -1);
+    while (std::optional<Message> message = connection.Next()) {
+      if (message->type == MessageType::Job) {
+        jobs.push_back(std::move(*message));
+      } else if (message->type == MessageType::Shutdown) {
+        shutdown = true;
+      }
+    }
+    if (jobs.empty()) {
+      if (!open) {
+        break;
+      }
+      continue;
+    }
+
+    samples.resize(jobs.size());
+    results.resize(jobs.size());
+    std::vector<std::optional<JobHeader>> headers(jobs.size());
+    for (size_t i = 0; i < jobs.size(); i++) {
+      headers[i]       = jobs[i].Get<JobHeader>(0);
+      const Tile *tile = headers[i] ? &headers[i]->tile : nullptr;
+      if (!tile || tile->x0 < 0 || tile->y0 < 0 || tile->x1 > settings.width || tile->y1 > settings.height ||
+          tile->Width() <= 0 || tile->Height() <= 0) {
+        headers[i].reset();
+        continue;
+      }
+      samples[i].resize(tile->PixelCount());
+      results[i].resize(tile->PixelCount());
+      if (!jobs[i].GetArray<PixelSamples>(sizeof(JobHeader), samples[i])) {
+        headers[i].reset();
+      }
+    }
+    ParallelFor(pool, 0, static_cast<int64_t>(jobs.size()), 1, [&](int64_t first, int64_t last) {
+      for (int64_t i = first; i < last; i++) {
+        if (!headers[i]) {
+          continue;
+        }
+        if (setup->doublePrecision) {
+          RenderTileSamples(view, sky, doubleRayGenerator, samplerType, headers[i]->tile, samples[i], results[i]);
+        } else {
+          RenderTileSamples(view, sky, rayGenerator, samplerType, headers[i]->tile, samples[i], results[i]);
+        }
+      }
+    });
+    for (size_t i = 0; i < jobs.size(); i++) {
+      if (!headers[i]) {
+        fmt::println("worker: dropping a malformed job");
+        continue;
+      }
+      const std::span<const TileSample> result = results[i];
+      if (!connection.Send(MessageType::Result, {MessageBytes(*headers[i]), MessageBytes(result)})) {
+        open = false;
+        break;
+      }
+      rendered++;
+    }
+    jobs.clear();
+  }
+  fmt::println("worker: rendered {} tiles", rendered);
+  return true;
+}
+
+
+struct DistributedSettings {
+  std::string address;                   // see OpenSocket()
+  int         spawnWorkers        = 0;   // worker processes of this executable the coordinator starts itself
+  int         expectedWorkers     = 0;   // workers to wait for before the first pass, spawned ones included
+  double      connectSeconds      = 30;  // longest wait for them
+  unsigned    jobsPerThread       = 2;   // jobs kept in flight per worker thread, so no worker idles on the wire
+  double      stragglerFactor     = 4;   // a job out for this many mean job times is also sent to an idle worker
+  double      minStragglerSeconds = 0.5; // but never before it has been out this long
+  double      silentSeconds       = 60;  // a worker with jobs, or one yet to say hello, silent this long is lost
+};
+
+
+// Coordinator side of distributed rendering. Workers connect to `settings.address`, at the start or at any time
+// later, and get the binary scene cache once. Every pass of the adaptive sampler is split into one job per tile that
+// has samples planned, carrying the sample range of each pixel, and the jobs are dealt to the workers. Results are
+// summed into the AccumulationBuffer, so planning, resolving and writing the image stay in the coordinator.
+// A worker that disconnects hands its unfinished jobs back to the queue. Once the queue is empty, idle workers get
+// copies of the jobs that have been out far longer than a job takes on average, and the first result to arrive wins,
+// so a slow or hung worker cannot hold up the pass. With no worker connected the coordinator renders the jobs itself.
+class RenderCoordinator {
+public:
+  struct WorkerStatistics {
+    uint64_t jobs       = 0; // results that were used
+    uint64_t pixels     = 0;
+    uint64_t duplicates = 0; // results that arrived after another copy of their job
+    uint64_t reassigned = 0; // jobs handed back when the worker was lost
+    bool     lost       = false;
+  };
+
+  RenderCoordinator(
+    DistributedSettings settings, ThreadPool &pool, std::vector<uint8_t> sceneBytes, RenderSetup setup) :
+      settings(std::move(settings)), pool(pool), sceneBytes(std::move(sceneBytes)), setup(setup) {}
+
+  RenderCoordinator(const RenderCoordinator &)            = delete;
+  RenderCoordinator &operator=(const RenderCoordinator &) = delete;
+
+  ~RenderCoordinator() { Finish(); }
+
+  // When set, the first hit features of the samples are summed into it along with the color
+  FeatureBuffer *features = nullptr;
+
+  // Listens, spawns the local workers and waits for the expected ones to connect; false when it cannot listen
+  bool Start(const char *executable) {
+    listener = Connection(OpenSocket(settings.address, true));
+    if (!listener.IsOpen() || listen(listener.Descriptor(), SOMAXCONN) != 0) {
+      fmt::println("coordinator: cannot listen on {}", settings.address);
+      return false;
+    }
+    for (int i = 0; i < settings.spawnWorkers; i++) {
+      const std::string connect = "--connect";
+      char             *argv[]  = {const_cast<char *>(executable), const_cast<char *>(connect.c_str()),
+                                   const_cast<char *>(settings.address.c_str()), nullptr};
+      pid_t             process = 0;
+      const int         error   = posix_spawn(&process, "/proc/self/exe", nullptr, nullptr, argv, environ);
+      if (error != 0) {
+        fmt::println("coordinator: cannot start a worker: {}", std::strerror(error));
+        continue;
+      }
+      spawned.push_back(process);
+    }
+
+    const int  expected = std::max(settings.expectedWorkers, settings.spawnWorkers);
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::duration<double>(settings.connectSeconds);
+    while (static_cast<int>(workers.size()) < expected && std::chrono::steady_clock::now() < deadline) {
+      const auto wait    = std::chrono::ceil<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+      pollfd     request = {listener.Descriptor(), POLLIN, 0};
+      if (poll(&request, 1, static_cast<int>(std::max<int64_t>(1, wait.count()))) > 0) {
+        Accept();
+      }
+    }
+    fmt::println(
+      "coordinator: listening on {}, {} of {} workers connected", settings.address, workers.size(), expected);
+    return true;
+  }
+
+  // Renders the pass `sampler` has planned into `accumulation`. `renderLocally(tile, samples, result)` renders a job
+  // in this process, from several threads at once, while no worker that has said hello is connected.
+  template<typename LocalRender>
+  void RenderPass(AccumulationBuffer &accumulation, const AdaptiveSampler &sampler, LocalRender &&renderLocally) {
+    pass++;
+    jobs.clear();
+    pending.clear();
+    for (const Tile &tile: MakeTiles(accumulation.Width(), accumulation.Height(), accumulation.TileSize(), order)) {
+      Job job;
+      job.header = {pass, static_cast<uint32_t>(jobs.size()), tile};
+      job.samples.reserve(tile.PixelCount());
+      uint64_t sampleCount = 0;
+      for (int y = tile.y0; y < tile.y1; y++) {
+        for (int x = tile.x0; x < tile.x1; x++) {
+          job.samples.push_back({accumulation.SampleCount(x, y), sampler.SamplesThisPass(x, y)});
+          sampleCount += sampler.SamplesThisPass(x, y);
+        }
+      }
+      if (sampleCount > 0) {
+        jobs.push_back(std::move(job));
+      }
+    }
+    // Popped from the back, so the first tile in the order goes out first
+    for (size_t i = jobs.size(); i-- > 0;) {
+      pending.push_back(static_cast<uint32_t>(i));
+    }
+
+    size_t remaining = jobs.size();
+    while (remaining > 0) {
+      DropSilentWorkers();
+      Dispatch();
+      // Peers still in their handshake take no jobs, so they do not hold the local rendering back
+      const bool anyReady =
+        std::any_of(workers.begin(), workers.end(), [](const Worker &worker) { return worker.capacity > 0; });
+      const bool local = !anyReady && !pending.empty();
+      if (local) {
+        remaining -= RenderLocally(accumulation, renderLocally);
+      }
+
+      // The timeout bounds how late a straggler is noticed
+      constexpr int POLL_MILLISECONDS = 10;
+      pollRequests.clear();
+      pollRequests.push_back({listener.Descriptor(), POLLIN, 0});
+      for (const Worker &worker: workers) {
+        pollRequests.push_back({worker.connection.Descriptor(), POLLIN, 0});
+      }
+      if (poll(pollRequests.data(), pollRequests.size(), local || remaining == 0 ? 0 : POLL_MILLISECONDS) <= 0) {
+        continue;
+      }
+      const size_t connected = workers.size();
+      if (pollRequests[0].revents & POLLIN) {
+        Accept();
+      }
+      for (size_t i = 0; i < connected; i++) {
+        if (pollRequests[i + 1].revents == 0) {
+          continue;
+        }
+        Worker    &worker = workers[i];
+        const bool open   = worker.connection.Receive(0);
+        worker.lastHeard  = std::chrono::steady_clock::now();
+        while (std::optional<Message> message = worker.connection.Next()) {
+          remaining -= Handle(worker, *message, accumulation);
+        }
+        if (!open) {
+          Drop(worker);
+        }
+      }
+    }
+  }
+
+  // Sends the workers home and waits for the spawned ones to exit
+  void Finish() {
+    for (Worker &worker: workers) {
+      if (worker.connection.IsOpen()) {
+        worker.connection.Send(MessageType::Shutdown, {});
+        worker.connection.Close();
+      }
+    }
+    for (const pid_t process: spawned) {
+      waitpid(process, nullptr, 0);
+    }
+    spawned.clear();
+    if (listener.IsOpen() && IsUnixSocketAddress(settings.address)) {
+      unlink(settings.address.substr(5).c_str());
+    }
+    listener.Close();
+  }
+
+  void PrintStatistics() const {
+    for (size_t i = 0; i < workers.size(); i++) {
+      const WorkerStatistics &s = workers[i].statistics;
+      fmt::println(
+        "worker {:3}: {:6} tiles {:10} pixels {:5} duplicates {:5} reassigned{}", i, s.jobs, s.pixels, s.duplicates,
+        s.reassigned, s.lost ? " (lost)" : "");
+    }
+    fmt::println(
+      "coordinator: {} tiles rendered locally, {} straggler copies sent, mean job {:.3f} ms", localJobs,
+      stragglerCopies, meanJobSeconds * 1000.0);
+  }
+
+  TileOrder order = TileOrder::Morton;
+
+private:
+  struct Job {
+    JobHeader                 header;
+    std::vector<PixelSamples> samples;
+    uint32_t                  copies = 0; // workers it is out at
+    bool                      done   = false;
+  };
+
+  // Jobs of earlier passes stay in flight until their result arrives, a worker is busy with them all the same
+  struct InFlight {
+    uint32_t                              pass;
+    uint32_t                              job;
+    std::chrono::steady_clock::time_point sent;
+  };
+
+  struct Worker {
+    Connection                            connection;
+    uint32_t                              capacity = 0; // jobs given at once, 0 before its hello and once lost
+    std::vector<InFlight>                 inFlight;
+    WorkerStatistics                      statistics;
+    std::chrono::steady_clock::time_point lastHeard = std::chrono::steady_clock::now();
+  };
+
+  void Accept() {
+    const int descriptor = accept(listener.Descriptor(), nullptr, nullptr);
+    if (descriptor >= 0) {
+      const int enable = 1;
+      setsockopt(descriptor, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+      workers.push_back({Connection(descriptor), 0, {}, {}, std::chrono::steady_clock::now()});
+    }
+  }
+
+  // A host that went away without closing its connection only shows by its silence, and so does a peer that connected
+  // but never says hello
+  void DropSilentWorkers() {
+    const auto now = std::chrono::steady_clock::now();
+    for (Worker &worker: workers) {
+      const bool handshaking = worker.connection.IsOpen() && worker.capacity == 0;
+      if ((!worker.inFlight.empty() || handshaking) &&
+          std::chrono::duration<double>(now - worker.lastHeard).count() > settings.silentSeconds) {
+        Drop(worker);
+      }
+    }
+  }
+
+  // Hands out pending jobs to the workers with room, then copies of stragglers to the ones still idle
+  void Dispatch() {
+    for (Worker &worker: workers) {
+      while (worker.inFlight.size() < worker.capacity && !pending.empty()) {
+        const uint32_t job = pending.back();
+        pending.pop_back();
+        Send(worker, job);
+      }
+    }
+    if (!pending.empty()) {
+      return;
+    }
+    const auto   now       = std::chrono::steady_clock::now();
+    const double threshold = std::max(settings.minStragglerSeconds, settings.stragglerFactor * meanJobSeconds);
+    for (Worker &worker: workers) {
+      if (worker.capacity == 0 || !worker.inFlight.empty()) {
+        continue;
+      }
+      // The oldest job out at a single worker that has exceeded the threshold
+      const InFlight *oldest = nullptr;
+      for (const Worker &other: workers) {
+        for (const InFlight &flight: other.inFlight) {
+          if (flight.pass != pass) {
+            continue;
+          }
+          const Job &job = jobs[flight.job];
+          if (!job.done && job.copies == 1 && std::chrono::duration<double>(now - flight.sent).count() > threshold &&
+              (!oldest || flight.sent < oldest->sent)) {
+            oldest = &flight;
+          }
+        }
+      }
+      if (!oldest) {
+        return;
+      }
+      stragglerCopies++;
+      Send(worker, oldest->job);
+    }
+  }
+
+  void Send(Worker &worker, uint32_t job) {
+    const std::span<const PixelSamples> samples = jobs[job].samples;
+    jobs[job].copies++;
+    worker.inFlight.push_back({pass, job, std::chrono::steady_clock::now()});
+    if (!worker.connection.Send(MessageType::Job, {MessageBytes(jobs[job].header), MessageBytes(samples)})) {
+      Drop(worker);
+    }
+  }
+
+  // Returns the number of jobs the message finished
+  size_t Handle(Worker &worker, const Message &message, AccumulationBuffer &accumulation) {
+    if (message.type == MessageType::Hello) {
+      const std::optional<WorkerHello> hello = message.Get<WorkerHello>(0);
+      if (!hello || hello->version != DISTRIBUTED_PROTOCOL_VERSION) {
+        fmt::println("coordinator: worker speaks another protocol version");
+        Drop(worker);
+        return 0;
+      }
+      if (!worker.connection.Send(MessageType::Scene, {MessageBytes(setup), sceneBytes})) {
+        Drop(worker);
+        return 0;
+      }
+      worker.capacity = std::max(1u, hello->threads * settings.jobsPerThread);
+      return 0;
+    }
+
+    const std::optional<JobHeader> header = message.Get<JobHeader>(0);
+    if (message.type != MessageType::Result || !header) {
+      return 0;
+    }
+    const auto flight = std::find_if(worker.inFlight.begin(), worker.inFlight.end(), [&](const InFlight &f) {
+      return f.pass == header->pass && f.job == header->job;
+    });
+    if (flight == worker.inFlight.end()) {
+      return 0;
+    }
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - flight->sent).count();
+    worker.inFlight.erase(flight);
+    if (header->pass != pass) {
+      worker.statistics.duplicates++; // its pass was finished by others
+      return 0;
+    }
+    Job &job = jobs[header->job];
+    job.copies--;
+    if (job.done) {
+      worker.statistics.duplicates++;
+      return 0;
+    }
+    results.resize(job.samples.size());
+    if (!message.GetArray<TileSample>(sizeof(JobHeader), results)) {
+      fmt::println("coordinator: malformed result");
+      Drop(worker);
+      return 0;
+    }
+    Accumulate(job, results, accumulation);
+    worker.statistics.jobs++;
+    worker.statistics.pixels += job.header.tile.PixelCount();
+    finishedJobs++;
+    meanJobSeconds += (seconds - meanJobSeconds) / static_cast<double>(finishedJobs);
+    return 1;
+  }
+
+  void Accumulate(Job &job, std::span<const TileSample> result, AccumulationBuffer &accumulation) {
+    const Tile &tile  = job.header.tile;
+    size_t      pixel = 0;
+    for (int y = tile.y0; y < tile.y1; y++) {
+      for (int x = tile.x0; x < tile.x1; x++, pixel++) {
+        if (job.samples[pixel].count > 0) {
+          const TileSample &sample = result[pixel];
+          accumulation.AddSamples(
+            x, y, {sample.r, sample.g, sample.b}, sample.luminanceSquared, job.samples[pixel].count);
+          if (features) {
+            const PathFeatures sums = {
+              glm::vec3(sample.albedo[0], sample.albedo[1], sample.albedo[2]),
+              glm::vec3(sample.normal[0], sample.normal[1], sample.normal[2]), sample.depth};
+            features->AddSums(x, y, sums, job.samples[pixel].count);
+          }
+        }
+      }
+    }
+    job.done = true;
+  }
+
+  // Closes the connection and queues the jobs no other worker has
+  void Drop(Worker &worker) {
+    if (worker.statistics.lost) {
+      return;
+    }
+    worker.connection.Close();
+    worker.capacity        = 0;
+    worker.statistics.lost = true;
+    for (const InFlight &flight: worker.inFlight) {
+      if (flight.pass != pass) {
+        continue;
+      }
+      Job &job = jobs[flight.job];
+      if (--job.copies == 0 && !job.done) {
+        pending.push_back(flight.job);
+        worker.statistics.reassigned++;
+      }
+    }
+    worker.inFlight.clear();
+    if (worker.statistics.reassigned > 0 || worker.statistics.jobs > 0) {
+      fmt::println("coordinator: lost a worker, {} jobs reassigned", worker.statistics.reassigned);
+    }
+  }
+
+  // Renders a batch of pending jobs on the pool of this process, returns how many
+  template<typename LocalRender>
+  size_t RenderLocally(AccumulationBuffer &accumulation, LocalRender &renderLocally) {
+    const size_t batch = std::min<size_t>(pending.size(), pool.ThreadCount() + 1);
+    localResults.resize(batch);
+    ParallelFor(pool, 0, static_cast<int64_t>(batch), 1, [&](int64_t first, int64_t last) {
+      for (int64_t i = first; i < last; i++) {
+        const Job &job = jobs[pending[pending.size() - 1 - i]];
+        localResults[i].resize(job.samples.size());
+        renderLocally(job.header.tile, std::span<const PixelSamples>(job.samples), std::span(localResults[i]));
+      }
+    });
+    for (size_t i = 0; i < batch; i++) {
+      Accumulate(jobs[pending.back()], localResults[i], accumulation);
+      pending.pop_back();
+    }
+    localJobs += batch;
+    return batch;
+  }
+
+  DistributedSettings                  settings;
+  ThreadPool                          &pool;
+  std::vector<uint8_t>                 sceneBytes;
+  RenderSetup                          setup;
+  Connection                           listener;
+  std::vector<pid_t>                   spawned;
+  std::vector<Worker>                  workers;
+  std::vector<Job>                     jobs;
+  std::vector<uint32_t>                pending; // jobs waiting for a worker, the next one at the back
+  std::vector<pollfd>                  pollRequests;
+  std::vector<TileSample>              results;
+  std::vector<std::vector<TileSample>> localResults;
+  uint32_t                             pass            = 0;
+  uint64_t                             finishedJobs    = 0;
+  uint64_t                             localJobs       = 0;
+  uint64_t                             stragglerCopies = 0;
+  double                               meanJobSeconds  = 0;
+};
+
+#endif // DISTRIBUTED_H
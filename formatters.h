@@ -0,0 +1,44 @@
+#ifndef FORMATTERS_H
+#define FORMATTERS_H
+#include <fmt/core.h>
+#include <glm/glm.hpp>
+
+#define GLM_ENABLE_EXPERIMENTAL
+#include "glm/gtx/string_cast.hpp"
+
+
+// Specialization of fmt::formatter for glm types
+template<typename T>
+struct fmt::formatter<glm::mat<3, 3, T>> {
+  constexpr auto parse(fmt::format_parse_context &ctx) { return ctx.begin(); }
+
+  template<typename FormatContext>
+  auto format(const glm::mat<3, 3, T> &mat, FormatContext &ctx) const {
+    auto out = ctx.out();
+    return fmt::format_to(out, "{}", glm::to_string(mat));
+  }
+};
+
+template<typename T>
+struct fmt::formatter<glm::mat<4, 4, T>> {
+  constexpr auto parse(fmt::format_parse_context &ctx) { return ctx.begin(); }
+
+  template<typename FormatContext>
+  auto format(const glm::mat<4, 4, T> &mat, FormatContext &ctx) const {
+    auto out = ctx.out();
+    return fmt::format_to(out, "{}", glm::to_string(mat));
+  }
+};
+
+template<typename T>
+struct fmt::formatter<glm::vec<3, T>> {
+  constexpr auto parse(fmt::format_parse_context &ctx) { return ctx.begin(); }
+
+  template<typename FormatContext>
+  auto format(const glm::vec<3, T> &vec, FormatContext &ctx) const {
+    auto out = ctx.out();
+    return fmt::format_to(out, "{}", glm::to_string(vec));
+  }
+};
+
+#endif // FORMATTERS_H
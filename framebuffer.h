@@ -0,0 +1,230 @@
+#ifndef FRAMEBUFFER_H
+#define FRAMEBUFFER_H
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <glm/glm.hpp>
+#include <vector>
+
+#include "simd.h"
+
+
+struct uchar4 {
+  unsigned char r, g, b, a;
+};
+
+
+// Running sum of the samples of one pixel. The sample count is kept next to the sums so a pixel is one 16 byte slot.
+struct AccumulatedPixel {
+  float    r, g, b;
+  uint32_t sampleCount;
+};
+static_assert(sizeof(AccumulatedPixel) == 16);
+
+
+// Rec. 709 luminance of linear RGB
+inline float Luminance(const glm::vec3 &color) { return glm::dot(color, glm::vec3(0.2126f, 0.7152f, 0.0722f)); }
+
+
+// Linear sRGB to 8 bit with an exposure scale and Reinhard tonemapping
+inline unsigned char TonemapChannel(float value, float exposure) {
+  float mapped = std::max(0.0f, value * exposure);
+  mapped       = mapped / (1.0f + mapped);
+  mapped       = mapped <= 0.0031308f ? 12.92f * mapped : 1.055f * std::pow(mapped, 1.0f / 2.4f) - 0.055f;
+  return static_cast<unsigned char>(std::clamp(mapped * 255.0f + 0.5f, 0.0f, 255.0f));
+}
+
+
+// HDR framebuffer that accumulates Monte Carlo samples over any number of passes.
+// Pixels are stored tile by tile with the same tile size as the TileScheduler, so a render task writes one
+// contiguous block and no cache line is shared between two tiles. Samples are written with relaxed atomic stores, so
+// Resolve() can be called from another thread while a pass is running; such a snapshot mixes pixels from the current
+// and the previous pass but is never torn within a channel.
+// Next to the color sums the buffer keeps the sum of squared sample luminance, which gives a running variance estimate
+// per pixel for adaptive sampling.
+class AccumulationBuffer {
+public:
+  AccumulationBuffer(int width, int height, int tileSize) :
+      width(width), height(height), tileSize(tileSize), tilesX((width + tileSize - 1) / tileSize),
+      tilesY((height + tileSize - 1) / tileSize), pixels(static_cast<size_t>(tilesX * tilesY) * tileSize * tileSize),
+      luminanceSquared(pixels.size()) {
+    Clear();
+  }
+
+  int Width() const { return width; }
+  int Height() const { return height; }
+  int TileSize() const { return tileSize; }
+
+  // Completed passes, counted by the caller through FinishPass()
+  uint32_t Passes() const { return passes.load(std::memory_order_relaxed); }
+
+  void FinishPass() { passes.fetch_add(1, std::memory_order_relaxed); }
+
+  void Clear() {
+    std::fill(pixels.begin(), pixels.end(), AccumulatedPixel{0, 0, 0, 0});
+    std::fill(luminanceSquared.begin(), luminanceSquared.end(), 0.0f);
+    passes.store(0, std::memory_order_relaxed);
+  }
+
+  size_t PixelIndex(int x, int y) const {
+    const size_t tile = static_cast<size_t>(y / tileSize) * tilesX + x / tileSize;
+    return tile * tileSize * tileSize + (y % tileSize) * tileSize + x % tileSize;
+  }
+
+  // A pixel must only be written by one thread at a time, which holds when each tile is rendered by one task
+  void AddSample(int x, int y, const glm::vec3 &radiance) {
+    const size_t      index     = PixelIndex(x, y);
+    AccumulatedPixel &pixel     = pixels[index];
+    const float       luminance = Luminance(radiance);
+    Store(luminanceSquared[index], luminanceSquared[index] + luminance * luminance);
+    Store(pixel.r, pixel.r + radiance.x);
+    Store(pixel.g, pixel.g + radiance.y);
+    Store(pixel.b, pixel.b + radiance.z);
+    Store(pixel.sampleCount, pixel.sampleCount + 1);
+  }
+
+  // Adds `count` samples at once from their radiance sum and luminance square sum, e.g. as rendered by another process
+  void AddSamples(int x, int y, const glm::vec3 &radianceSum, float luminanceSquaredSum, uint32_t count) {
+    const size_t      index = PixelIndex(x, y);
+    AccumulatedPixel &pixel = pixels[index];
+    Store(luminanceSquared[index], luminanceSquared[index] + luminanceSquaredSum);
+    Store(pixel.r, pixel.r + radianceSum.x);
+    Store(pixel.g, pixel.g + radianceSum.y);
+    Store(pixel.b, pixel.b + radianceSum.z);
+    Store(pixel.sampleCount, pixel.sampleCount + count);
+  }
+
+  uint32_t SampleCount(int x, int y) const { return Load(pixels[PixelIndex(x, y)].sampleCount); }
+
+  // Mean radiance of a pixel, black until it has a sample
+  glm::vec3 Mean(int x, int y) const {
+    const AccumulatedPixel &pixel = pixels[PixelIndex(x, y)];
+    const uint32_t          count = Load(pixel.sampleCount);
+    if (count == 0) {
+      return glm::vec3(0);
+    }
+    return glm::vec3(Load(pixel.r), Load(pixel.g), Load(pixel.b)) / static_cast<float>(count);
+  }
+
+  // Unbiased sample variance of the luminance of a pixel, 0 until it has two samples
+  float LuminanceVariance(int x, int y) const {
+    const size_t            index = PixelIndex(x, y);
+    const AccumulatedPixel &pixel = pixels[index];
+    const uint32_t          count = Load(pixel.sampleCount);
+    if (count < 2) {
+      return 0;
+    }
+    const float mean   = Luminance({Load(pixel.r), Load(pixel.g), Load(pixel.b)}) / static_cast<float>(count);
+    const float spread = Load(luminanceSquared[index]) - static_cast<float>(count) * mean * mean;
+    return std::max(0.0f, spread / static_cast<float>(count - 1));
+  }
+
+  // Tonemapped row major snapshot of the whole image
+  void Resolve(std::vector<uchar4> &image, float exposure = 1.0f) const {
+    image.resize(static_cast<size_t>(width) * height);
+    ResolveRegion(image, 0, 0, width, height, exposure);
+  }
+
+  // Resolves only the half open rectangle [x0, x1) x [y0, y1) into an image of Width() * Height() pixels, e.g. a tile
+  // that was just finished
+  void ResolveRegion(std::vector<uchar4> &image, int x0, int y0, int x1, int y1, float exposure = 1.0f) const {
+    for (int y = y0; y < y1; y++) {
+      for (int x = x0; x < x1; x++) {
+        const glm::vec3 mean = Mean(x, y);
+        image[x + static_cast<size_t>(y) * width] = {
+          TonemapChannel(mean.x, exposure), TonemapChannel(mean.y, exposure), TonemapChannel(mean.z, exposure), 255};
+      }
+    }
+  }
+
+private:
+  template<typename T>
+  static void Store(T &target, T value) {
+    std::atomic_ref<T>(target).store(value, std::memory_order_relaxed);
+  }
+
+  template<typename T>
+  static T Load(const T &source) {
+    return std::atomic_ref<T>(const_cast<T &>(source)).load(std::memory_order_relaxed);
+  }
+
+  int                             width;
+  int                             height;
+  int                             tileSize;
+  int                             tilesX;
+  int                             tilesY;
+  AlignedVector<AccumulatedPixel> pixels;
+  AlignedVector<float>            luminanceSquared; // same tiled layout as `pixels`
+  std::atomic<uint32_t>           passes{0};
+};
+
+
+// What a path saw at its first hit, the guide of the denoiser. A miss has the sky radiance as albedo, no normal and
+// zero depth.
+struct PathFeatures {
+  glm::vec3 albedo = glm::vec3(0);
+  glm::vec3 normal = glm::vec3(0);
+  float     depth  = 0;
+};
+
+
+// Per pixel sums of the PathFeatures of the samples, in the tiled layout of an AccumulationBuffer with the same tile
+// size, so a render task that writes a tile of one also writes a tile of the other. Unlike the color it is only read
+// once the render is done, so plain stores do.
+class FeatureBuffer {
+public:
+  FeatureBuffer(int width, int height, int tileSize) :
+      width(width), height(height), tileSize(tileSize), tilesX((width + tileSize - 1) / tileSize),
+      pixels(static_cast<size_t>(tilesX) * ((height + tileSize - 1) / tileSize) * tileSize * tileSize) {}
+
+  int Width() const { return width; }
+  int Height() const { return height; }
+
+  void Add(int x, int y, const PathFeatures &features) { AddSums(x, y, features, 1); }
+
+  // Adds `count` samples at once from the sums of their features
+  void AddSums(int x, int y, const PathFeatures &sums, uint32_t count) {
+    FeatureSums &pixel = pixels[PixelIndex(x, y)];
+    pixel.albedo += sums.albedo;
+    pixel.normal += sums.normal;
+    pixel.depth += sums.depth;
+    pixel.sampleCount += count;
+  }
+
+  // Mean over the samples of a pixel; the normal is the mean direction, zero where no sample hit a surface
+  PathFeatures Mean(int x, int y) const {
+    const FeatureSums &pixel = pixels[PixelIndex(x, y)];
+    if (pixel.sampleCount == 0) {
+      return {};
+    }
+    const float  scale  = 1.0f / static_cast<float>(pixel.sampleCount);
+    const float  length = glm::length(pixel.normal);
+    PathFeatures mean   = {pixel.albedo * scale, glm::vec3(0), pixel.depth * scale};
+    if (length > 0) {
+      mean.normal = pixel.normal / length;
+    }
+    return mean;
+  }
+
+private:
+  struct FeatureSums {
+    glm::vec3 albedo      = glm::vec3(0);
+    glm::vec3 normal      = glm::vec3(0);
+    float     depth       = 0;
+    uint32_t  sampleCount = 0;
+  };
+
+  size_t PixelIndex(int x, int y) const {
+    const size_t tile = static_cast<size_t>(y / tileSize) * tilesX + x / tileSize;
+    return tile * tileSize * tileSize + (y % tileSize) * tileSize + x % tileSize;
+  }
+
+  int                        width;
+  int                        height;
+  int                        tileSize;
+  int                        tilesX;
+  AlignedVector<FeatureSums> pixels;
+};
+
+#endif // FRAMEBUFFER_H
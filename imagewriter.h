@@ -0,0 +1,248 @@
+#ifndef IMAGEWRITER_H
+#define IMAGEWRITER_H
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cerrno>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <fcntl.h>
+#include <fmt/core.h>
+#include <glm/glm.hpp>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <sys/mman.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "framebuffer.h"
+#include "profiler.h"
+#include "scheduler.h"
+
+
+enum class ImageFormat {
+  PPM, // binary 8 bit RGB, tonemapped
+  PFM, // 32 bit float RGB, linear radiance, rows stored bottom to top
+};
+
+enum class ImageWriteMode {
+  Background,   // tiles are encoded by the caller and written with pwrite() by an I/O thread
+  MemoryMapped, // tiles are encoded straight into a shared mapping of the file, the kernel writes them back
+};
+
+inline ImageFormat ImageFormatFromPath(std::string_view path) {
+  return path.ends_with(".pfm") ? ImageFormat::PFM : ImageFormat::PPM;
+}
+
+
+// Writes an image tile by tile while it is being rendered.
+// Both formats have a fixed size header and fixed size pixels, so the file is sized up front and every tile row has a
+// known byte offset; tiles can be written in any order and the writer never holds the whole frame. WriteTile() is
+// thread safe and is meant to be called from the render tasks as tiles finish; main does so once the AdaptiveSampler
+// plans no more samples for a tile. The progressive AccumulationBuffer keeps the frame resident all the same, the
+// writer only spares a second full copy and the write at the end. In Background mode WriteTile() only encodes the
+// tile and queues it, and only blocks once more than maxPendingBytes are waiting for the disk.
+class ImageWriter {
+public:
+  ImageWriter(
+    const std::string &path, ImageFormat format, int width, int height,
+    ImageWriteMode mode = ImageWriteMode::Background, size_t maxPendingBytes = size_t(64) << 20) :
+      path(path), format(format), width(width), height(height), maxPendingBytes(maxPendingBytes) {
+    header = Header();
+    size   = header.size() + static_cast<size_t>(width) * height * BytesPerPixel();
+    file   = open(path.c_str(), (mode == ImageWriteMode::MemoryMapped ? O_RDWR : O_WRONLY) | O_CREAT | O_TRUNC, 0644);
+    if (file < 0 || ftruncate(file, static_cast<off_t>(size)) != 0) {
+      Fail("open");
+      return;
+    }
+
+    if (mode == ImageWriteMode::MemoryMapped) {
+      void *mapping = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, file, 0);
+      if (mapping == MAP_FAILED) {
+        Fail("mmap");
+        return;
+      }
+      mapped = static_cast<uint8_t *>(mapping);
+      std::memcpy(mapped, header.data(), header.size());
+      return;
+    }
+    WriteAll(reinterpret_cast<const uint8_t *>(header.data()), header.size(), 0);
+    ioThread = std::thread([this] { WriteQueued(); });
+  }
+
+  ImageWriter(const ImageWriter &)            = delete;
+  ImageWriter &operator=(const ImageWriter &) = delete;
+
+  ~ImageWriter() { Finish(); }
+
+  bool IsOpen() const { return file >= 0 && !failed; }
+
+  ImageFormat Format() const { return format; }
+
+  // Size of the finished file in bytes
+  size_t FileSize() const { return size; }
+
+  // Encodes the mean radiance of the pixels of `tile`, tonemapped with `exposure` for 8 bit formats. The image is an
+  // AccumulationBuffer or anything else with its Mean(x, y), e.g. a Denoiser.
+  template<typename Image>
+  void WriteTile(const Tile &tile, const Image &image, float exposure = 1.0f) {
+    if (!IsOpen()) {
+      return;
+    }
+    const ProfileScope scope(ProfileStage::Output);
+    const size_t rowBytes = static_cast<size_t>(tile.Width()) * BytesPerPixel();
+    if (mapped) {
+      for (int y = tile.y0; y < tile.y1; y++) {
+        EncodeRow(mapped + PixelOffset(tile.x0, y), image, tile.x0, tile.x1, y, exposure);
+      }
+      return;
+    }
+
+    PendingTile pending = {tile, std::vector<uint8_t>(rowBytes * tile.Height())};
+    for (int y = tile.y0; y < tile.y1; y++) {
+      EncodeRow(pending.bytes.data() + (y - tile.y0) * rowBytes, image, tile.x0, tile.x1, y, exposure);
+    }
+    std::unique_lock lock(mutex);
+    queueSpace.wait(lock, [&] { return pendingBytes < maxPendingBytes || failed; });
+    pendingBytes += pending.bytes.size();
+    queue.push_back(std::move(pending));
+    queueReady.notify_one();
+  }
+
+  // Waits for every queued tile, closes the file and returns whether everything was written. Called by the destructor.
+  bool Finish() {
+    if (ioThread.joinable()) {
+      {
+        std::lock_guard lock(mutex);
+        finishing = true;
+      }
+      queueReady.notify_one();
+      ioThread.join();
+    }
+    if (mapped) {
+      if (munmap(mapped, size) != 0) {
+        Fail("munmap");
+      }
+      mapped = nullptr;
+    }
+    if (file >= 0) {
+      if (close(file) != 0) {
+        Fail("close");
+      }
+      file = -1;
+    }
+    return !failed;
+  }
+
+private:
+  struct PendingTile {
+    Tile                 tile;
+    std::vector<uint8_t> bytes; // encoded rows of the tile, top to bottom
+  };
+
+  size_t BytesPerPixel() const { return format == ImageFormat::PFM ? 3 * sizeof(float) : 3; }
+
+  std::string Header() const {
+    if (format == ImageFormat::PPM) {
+      return fmt::format("P6\n{} {}\n255\n", width, height);
+    }
+    // The sign of the scale gives the byte order of the floats
+    return fmt::format("PF\n{} {}\n{}\n", width, height, std::endian::native == std::endian::little ? "-1.0" : "1.0");
+  }
+
+  size_t PixelOffset(int x, int y) const {
+    const size_t row = static_cast<size_t>(format == ImageFormat::PFM ? height - 1 - y : y);
+    return header.size() + (row * width + x) * BytesPerPixel();
+  }
+
+  template<typename Image>
+  void EncodeRow(uint8_t *out, const Image &image, int x0, int x1, int y, float exposure) const {
+    for (int x = x0; x < x1; x++) {
+      const glm::vec3 mean = image.Mean(x, y);
+      if (format == ImageFormat::PFM) {
+        const float rgb[3] = {mean.x, mean.y, mean.z};
+        std::memcpy(out, rgb, sizeof(rgb));
+        out += sizeof(rgb);
+      } else {
+        *out++ = TonemapChannel(mean.x, exposure);
+        *out++ = TonemapChannel(mean.y, exposure);
+        *out++ = TonemapChannel(mean.z, exposure);
+      }
+    }
+  }
+
+  // Body of the I/O thread
+  void WriteQueued() {
+    for (;;) {
+      std::unique_lock lock(mutex);
+      queueReady.wait(lock, [&] { return !queue.empty() || finishing; });
+      if (queue.empty()) {
+        return;
+      }
+      PendingTile pending = std::move(queue.front());
+      queue.pop_front();
+      lock.unlock();
+
+      const ProfileScope scope(ProfileStage::Output);
+      const Tile        &tile     = pending.tile;
+      const size_t       rowBytes = static_cast<size_t>(tile.Width()) * BytesPerPixel();
+      for (int y = tile.y0; y < tile.y1 && !failed; y++) {
+        WriteAll(pending.bytes.data() + (y - tile.y0) * rowBytes, rowBytes, PixelOffset(tile.x0, y));
+      }
+
+      lock.lock();
+      pendingBytes -= pending.bytes.size();
+      queueSpace.notify_all();
+    }
+  }
+
+  void WriteAll(const uint8_t *bytes, size_t count, size_t offset) {
+    while (count > 0) {
+      const ssize_t written = pwrite(file, bytes, count, static_cast<off_t>(offset));
+      if (written < 0 && errno == EINTR) {
+        continue;
+      }
+      if (written <= 0) {
+        Fail("write");
+        return;
+      }
+      bytes += written;
+      offset += written;
+      count -= written;
+    }
+  }
+
+  void Fail(const char *operation) {
+    if (!failed.exchange(true)) {
+      fmt::println("image writer: {} {}: {}", operation, path, std::strerror(errno));
+    }
+    // Wakes render tasks waiting for queue space, the lock orders this after their predicate check
+    { std::lock_guard lock(mutex); }
+    queueSpace.notify_all();
+  }
+
+  std::string    path;
+  ImageFormat    format;
+  int            width;
+  int            height;
+  size_t         maxPendingBytes;
+  std::string    header;
+  size_t         size   = 0;
+  int            file   = -1;
+  uint8_t       *mapped = nullptr;
+
+  std::mutex              mutex;
+  std::condition_variable queueReady;
+  std::condition_variable queueSpace;
+  std::deque<PendingTile> queue;
+  size_t                  pendingBytes = 0;
+  bool                    finishing    = false;
+  std::atomic<bool>       failed       = false;
+  std::thread             ioThread;
+};
+
+#endif // IMAGEWRITER_H
@@ -0,0 +1,162 @@
+#ifndef INSTANCING_H
+#define INSTANCING_H
+#include <algorithm>
+#include <cstdint>
+#include <fmt/core.h>
+#include <glm/glm.hpp>
+#include <span>
+#include <utility>
+#include <vector>
+
+#include "bvh.h"
+#include "scene.h"
+#include "threadpool.h"
+#include "transform.h"
+#include "widebvh.h"
+
+
+// Two level scene: geometries, each a Scene with its own spheres, materials and BVH in object space, and instances
+// that place a geometry in the world with an affine transform. An instance costs sizeof(SceneInstance) bytes however
+// large its geometry is, so an asset repeated many times is stored once.
+// The top level BVH is built over the world bounds of the instances. Adding geometries or instances drops it, and
+// the view of a previous BuildAccelerationStructure() is no longer valid. Animations move instances with
+// SetTransform() and update the geometries they changed with Scene::UpdateAccelerationStructure(), then call
+// UpdateAccelerationStructure() here, which refits the top level the same way.
+struct InstancedScene {
+  std::vector<Scene>         geometries;
+  std::vector<SceneInstance> instances;
+  BVH                        bvh;
+
+  uint32_t AddGeometry(Scene &&geometry) {
+    bvh.Clear();
+    geometries.push_back(std::move(geometry));
+    return static_cast<uint32_t>(geometries.size() - 1);
+  }
+
+  uint32_t AddInstance(uint32_t geometry, const glm::mat4 &objectToWorld) {
+    bvh.Clear();
+    const Transform3x4 transform(objectToWorld);
+    instances.push_back({transform, transform.Inverse(), geometry});
+    return static_cast<uint32_t>(instances.size() - 1);
+  }
+
+  // Places instance `index` anew, the top level BVH is stale until UpdateAccelerationStructure()
+  void SetTransform(size_t index, const glm::mat4 &objectToWorld) {
+    const Transform3x4 transform(objectToWorld);
+    instances[index].objectToWorld = transform;
+    instances[index].worldToObject = transform.Inverse();
+  }
+
+  // Spheres stored, and the spheres the instances place in the world
+  size_t StoredSpheres() const {
+    size_t count = 0;
+    for (const Scene &geometry: geometries) {
+      count += geometry.Size();
+    }
+    return count;
+  }
+
+  size_t InstancedSpheres() const {
+    size_t count = 0;
+    for (const SceneInstance &instance: instances) {
+      count += geometries[instance.geometry].Size();
+    }
+    return count;
+  }
+
+  // World bounds of an instance: the object space root box of its geometry, transformed (Arvo's method)
+  AABB InstanceBounds(const SceneInstance &instance) const {
+    const Scene    &geometry    = geometries[instance.geometry];
+    const glm::vec3 translation = instance.objectToWorld.Translation();
+    AABB            bounds      = {translation, translation};
+    if (geometry.bvh.Empty()) {
+      return bounds;
+    }
+    const AABB box = geometry.bvh.NodeBounds(0);
+    for (int row = 0; row < 3; row++) {
+      for (int column = 0; column < 3; column++) {
+        const float a = instance.objectToWorld.rows[row][column] * box.min[column];
+        const float b = instance.objectToWorld.rows[row][column] * box.max[column];
+        bounds.min[row] += std::min(a, b);
+        bounds.max[row] += std::max(a, b);
+      }
+    }
+    return bounds;
+  }
+
+  // Builds the hierarchies of the geometries that have none yet, then the top level BVH. Like
+  // Scene::BuildAccelerationStructure() it reorders the instances to make the leaves contiguous.
+  void BuildAccelerationStructure(ThreadPool *pool = nullptr, BVHLayout layout = BVHLayout::Binary) {
+    for (Scene &geometry: geometries) {
+      if (geometry.bvh.Empty() && geometry.Size() > 0) {
+        geometry.BuildAccelerationStructure(pool, layout);
+      }
+    }
+    geometryViews.clear();
+    for (const Scene &geometry: geometries) {
+      geometryViews.push_back(geometry.View());
+    }
+
+    std::vector<AABB> bounds(instances.size());
+    for (size_t i = 0; i < instances.size(); i++) {
+      bounds[i] = InstanceBounds(instances[i]);
+    }
+    bvh.Build(bounds, pool);
+    std::vector<SceneInstance> reordered(instances.size());
+    for (size_t i = 0; i < instances.size(); i++) {
+      reordered[i] = instances[bvh.primitiveIndices[i]];
+    }
+    instances.swap(reordered);
+  }
+
+  // Refits the top level BVH to the current instance transforms and geometry bounds, rebuilding only its degraded
+  // subtrees (see BVH::Update()). Rebuilt subtrees reorder their instances like BuildAccelerationStructure() does.
+  // The view changes, so it must be taken again.
+  void UpdateAccelerationStructure(ThreadPool *pool = nullptr, float rebuildThreshold = BVH::REBUILD_THRESHOLD) {
+    if (bvh.Empty()) {
+      BuildAccelerationStructure(pool);
+      return;
+    }
+    geometryViews.clear();
+    for (const Scene &geometry: geometries) {
+      geometryViews.push_back(geometry.View());
+    }
+    instanceBounds.resize(instances.size());
+    for (size_t i = 0; i < instances.size(); i++) {
+      instanceBounds[bvh.primitiveIndices[i]] = InstanceBounds(instances[i]);
+    }
+    bvh.Update(instanceBounds, pool, rebuildThreshold, [&](uint32_t first, std::span<const uint32_t> previous) {
+      reorderSource.resize(instances.size());
+      for (uint32_t i = 0; i < previous.size(); i++) {
+        reorderSource[previous[i]] = first + i;
+      }
+      reorderScratch.resize(previous.size());
+      for (uint32_t i = 0; i < previous.size(); i++) {
+        reorderScratch[i] = instances[reorderSource[bvh.primitiveIndices[first + i]]];
+      }
+      std::copy(reorderScratch.begin(), reorderScratch.end(), instances.begin() + first);
+    });
+  }
+
+  SceneView View() const {
+    SceneView view;
+    view.bvh        = bvh.View();
+    view.instances  = instances;
+    view.geometries = geometryViews.data();
+    return view;
+  }
+
+  void PrintStatistics() const {
+    fmt::println(
+      "instancing: {} geometries, {} instances ({} bytes each), {} spheres stored, {} instanced", geometries.size(),
+      instances.size(), sizeof(SceneInstance), StoredSpheres(), InstancedSpheres());
+  }
+
+private:
+  std::vector<SceneView>     geometryViews;
+  std::vector<AABB>          instanceBounds; // scratch of UpdateAccelerationStructure()
+  std::vector<uint32_t>      reorderSource;
+  std::vector<SceneInstance> reorderScratch;
+};
+
+#endif // INSTANCING_H
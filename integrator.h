@@ -0,0 +1,97 @@
+#ifndef INTEGRATOR_H
+#define INTEGRATOR_H
+#include <cmath>
+#include <glm/glm.hpp>
+#include <optional>
+
+#include "camera.h"
+#include "framebuffer.h"
+#include "material.h"
+#include "profiler.h"
+#include "ray.h"
+#include "sampler.h"
+#include "scene.h"
+
+// The camera looks along +z with image rows growing along +y, so world up is -y
+constexpr glm::vec3 WORLD_UP    = {0, -1, 0};
+constexpr int       MAX_BOUNCES = 4;
+
+
+// Vertical gradient plus a directional sun, standing in for the environment until scenes carry lights.
+// The sun is a delta light that bounce rays can never hit, so it only contributes through shadow rays.
+struct Sky {
+  glm::vec3 horizon       = {1.0f, 1.0f, 1.0f};
+  glm::vec3 zenith        = {0.5f, 0.7f, 1.0f};
+  glm::vec3 sunDirection  = glm::normalize(glm::vec3(0.4f, -1.0f, -0.3f)); // towards the sun
+  glm::vec3 sunIrradiance = {2.0f, 1.9f, 1.7f};
+
+  glm::vec3 Radiance(const glm::vec3 &direction) const {
+    const float height = 0.5f * (glm::dot(direction, WORLD_UP) + 1.0f);
+    return glm::mix(horizon, zenith, height);
+  }
+};
+
+
+// One path sample through the materials of the scene, lit by the sky, with a shadow ray towards the sun at every
+// diffuse hit. Each hit runs the kernel of its material (see SampleSurface()); paths end on emitters, when a kernel
+// absorbs them, or after MAX_BOUNCES. Ray origins and hit points are kept in the precision of the ray, shading is
+// always done in float. Every bounce takes the next dimension pair of `sampler`, the caller has used the first one for
+// the position inside the pixel.
+// `hit` is the closest hit of the primary ray, found by the caller, e.g. for a whole RayPacket at once. `features`, if
+// given, receives what the primary ray saw for the denoiser.
+template<typename T>
+glm::vec3 TraceRadiance(
+  const SceneView &scene, const Sky &sky, RayT<T> ray, std::optional<SceneHitT<T>> hit, PixelSampler &sampler,
+  PathFeatures *features = nullptr) {
+  using Vec3 = glm::vec<3, T>;
+
+  glm::vec3 radiance   = glm::vec3(0);
+  glm::vec3 throughput = glm::vec3(1);
+  for (int bounce = 0; bounce <= MAX_BOUNCES; bounce++) {
+    if (bounce > 0) {
+      hit = scene.ClosestHit(ray);
+    }
+    if (!hit) {
+      const glm::vec3 skyRadiance = sky.Radiance(glm::vec3(ray.direction));
+      if (features && bounce == 0) {
+        *features = {skyRadiance, glm::vec3(0), 0.0f};
+      }
+      return radiance + throughput * skyRadiance;
+    }
+    // Everything but the shadow ray is shading; the next direction is drawn before it, which uses no samples
+    Vec3          point;
+    SurfaceSample surface;
+    {
+      const ProfileScope scope(ProfileStage::Shading);
+      point                      = ray.origin + hit->t * ray.direction;
+      const glm::vec3  normal    = glm::vec3(scene.Normal(*hit, point));
+      const SceneView &geometry  = scene.HitGeometry(*hit);
+      surface                    = SampleSurface(
+        geometry.materials, geometry.material[hit->index], glm::vec3(ray.direction), normal, sky.sunDirection,
+        sampler.Next2D());
+      if (features && bounce == 0) {
+        *features = {geometry.materials.Color(geometry.material[hit->index]), normal, static_cast<float>(hit->t)};
+      }
+    }
+    radiance += throughput * surface.emitted;
+    const glm::vec3 sun = surface.sunWeight * sky.sunIrradiance;
+    if (sun != glm::vec3(0) && !scene.AnyHit(RayT<T>{point, Vec3(sky.sunDirection)})) {
+      radiance += throughput * sun;
+    }
+    if (surface.weight == glm::vec3(0)) {
+      break;
+    }
+    ray = {point, Vec3(surface.direction)};
+    throughput *= surface.weight;
+  }
+  return radiance;
+}
+
+template<typename T>
+glm::vec3 TraceRadiance(
+  const SceneView &scene, const Sky &sky, const RayT<T> &ray, PixelSampler &sampler,
+  PathFeatures *features = nullptr) {
+  return TraceRadiance(scene, sky, ray, scene.ClosestHit(ray), sampler, features);
+}
+
+#endif // INTEGRATOR_H
@@ -1,217 +1,446 @@
-#include <array>
-#include <cmath>
+#include <algorithm>
+#include <bit>
+#include <chrono>
+#include <cstdlib>
 #include <fmt/core.h>
 #include <glm/glm.hpp>
+#include <memory_resource>
+#include <new>
 #include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
 #include <vector>
 
-#define GLM_ENABLE_EXPERIMENTAL
-#include "glm/gtx/string_cast.hpp"
-
-#define PI 3.14159;
-
-constexpr int WIDTH  = 8;
-constexpr int HEIGHT = 4;
-
-
-// Specialization of fmt::formatter for Matrix<R, C>
-template<>
-struct fmt::formatter<glm::mat3> {
-  constexpr auto parse(fmt::format_parse_context &ctx) { return ctx.begin(); }
-
-  template<typename FormatContext>
-  auto format(const glm::mat3 &mat, FormatContext &ctx) const {
-    auto out = ctx.out();
-    return fmt::format_to(out, "{}", glm::to_string(mat));
-  }
-};
-
-template<>
-struct fmt::formatter<glm::mat4> {
-  constexpr auto parse(fmt::format_parse_context &ctx) { return ctx.begin(); }
-
-  template<typename FormatContext>
-  auto format(const glm::mat4 &mat, FormatContext &ctx) const {
-    auto out = ctx.out();
-    return fmt::format_to(out, "{}", glm::to_string(mat));
-  }
-};
-
-template<>
-struct fmt::formatter<glm::vec3> {
-  constexpr auto parse(fmt::format_parse_context &ctx) { return ctx.begin(); }
-
-  template<typename FormatContext>
-  auto format(const glm::mat3 &vec, FormatContext &ctx) const {
-    auto out = ctx.out();
-    return fmt::format_to(out, "{}", glm::to_string(vec));
+#include "adaptive.h"
+#include "arena.h"
+#include "camera.h"
+#include "denoiser.h"
+#include "distributed.h"
+#include "framebuffer.h"
+#include "imagewriter.h"
+#include "instancing.h"
+#include "integrator.h"
+#include "profiler.h"
+#include "ray.h"
+#include "raypacket.h"
+#include "sampler.h"
+#include "scene.h"
+#include "scenefile.h"
+#include "scheduler.h"
+#include "threadpool.h"
+#include "wavefront.h"
+
+#if TRACER_PROFILE
+// Profiling builds count every allocation in globalAllocations to check that the render loop stays off the heap.
+// Array and nothrow forms forward to these.
+void *operator new(size_t size) {
+  globalAllocations.fetch_add(1, std::memory_order_relaxed);
+  if (void *memory = std::malloc(std::max<size_t>(size, 1))) {
+    return memory;
   }
-};
-
-template<typename T>
-T Degrees(T radian) {
-  return radian * 180.0f / PI;
+  throw std::bad_alloc();
 }
-template<typename T>
-T Radians(T degrees) {
-  return degrees / 180.f * PI;
-}
-
-glm::mat3 ComputeCameraMatrix(const float verticalFOVDegrees, const float imageWidth, const float imageHeight) {
-  // Convert vertical FOV from degrees to radians
-  const float halfVerticalFOVRadians = Radians(verticalFOVDegrees) / 2.0f;
 
-  // Compute image plane distance and horizontal FOV
-  const float halfImageWidth  = imageWidth / 2.0f;
-  const float halfImageHeight = imageHeight / 2.0f;
-  const float baseDistance =
-    halfImageHeight / std::tan(halfVerticalFOVRadians); // distance of image plane from camera origin
-  const float halfHorizontalFOVRadians = std::atan2(halfImageWidth, baseDistance);
-
-  // Compute camera matrix parameters
-  const float fy = (imageHeight - 1.0f) / (2.0f * std::tan(halfVerticalFOVRadians));
-  const float fx = (imageWidth - 1.0f) / (2.0f * std::tan(halfHorizontalFOVRadians));
-
-  // Compute the image center
-  const float cx = (imageWidth - 1.0f) / 2.0f;
-  const float cy = (imageHeight - 1.0f) / 2.0f;
-
-  return {{fx, 0, cx}, {0, fy, cy}, {0, 0, 1}};
+void *operator new(size_t size, std::align_val_t alignment) {
+  globalAllocations.fetch_add(1, std::memory_order_relaxed);
+  const size_t align = static_cast<size_t>(alignment);
+  if (void *memory = std::aligned_alloc(align, (std::max<size_t>(size, 1) + align - 1) / align * align)) {
+    return memory;
+  }
+  throw std::bad_alloc();
 }
 
-
-struct uchar4 {
-  unsigned char r, g, b, a;
-};
-
-
-struct Sphere {
-  float     radius;
-  glm::vec3 position;
-};
-
-
-struct Ray {
-  glm::vec3 origin;
-  glm::vec3 direction;
-};
-
-template<>
-struct fmt::formatter<Ray> {
-  constexpr auto parse(fmt::format_parse_context &ctx) { return ctx.begin(); }
-
-  template<typename FormatContext>
-  auto format(const Ray &ray, FormatContext &ctx) const {
-    auto out = ctx.out();
-    return fmt::format_to(out, "Ray: {{origin: {}\tdirection: {}}}", glm::to_string(ray.origin), glm::to_string(ray.direction));
+// GCC takes the free() of a pointer from operator new for a mismatch even inside the replacements
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+void operator delete(void *memory) noexcept { std::free(memory); }
+void operator delete(void *memory, size_t) noexcept { std::free(memory); }
+void operator delete(void *memory, std::align_val_t) noexcept { std::free(memory); }
+void operator delete(void *memory, size_t, std::align_val_t) noexcept { std::free(memory); }
+#pragma GCC diagnostic pop
+#endif
+
+int main(int argc, char **argv) {
+  // --wavefront renders with the stream integrator instead of one path per pixel.
+  // --double generates and intersects the per pixel paths in double precision, for scenes far from the origin; the
+  // wavefront integrator always traces in float.
+  // --packets traces the primary rays of 8x8 pixel blocks as ray packets, the bounces continue per path.
+  // --sampler <independent|stratified|sobol|bluenoise> picks the sample sequence, Sobol by default.
+  // --output <file.ppm|file.pfm> streams every tile to disk as soon as the adaptive sampler has finished it, while the
+  // others keep rendering. With --denoise the tiles are written once the filtered frame exists.
+  // --scene <file> renders a text scene (.scene) or a binary scene cache, which is mapped and used in place. Text
+  // scenes with instances render as a two level scene, the loose spheres being one more instance.
+  // --save-scene <file> writes the scene with its BVH as a binary scene cache, which cannot hold instances.
+  // --trace <file> writes a Chrome trace of the tiles and wavefront stages, in builds with TRACER_PROFILE.
+  // --listen <unix:path|host:port> renders as the coordinator of worker processes, which get the scene once and
+  // render tiles of every pass; --spawn <n> starts n local workers, --workers <n> waits for n workers before the first
+  // pass. Workers trace per pixel paths, --wavefront and --packets only apply to local rendering.
+  // --connect <unix:path|host:port> runs as a worker of the coordinator at that address.
+  // --denoise records albedo, normal and depth at the first hit of every path and filters the finished image with
+  // them, for previews at a few samples per pixel.
+  // --max-samples <n> caps the samples per pixel, 256 by default and at least 2 for the variance estimate.
+  bool                wavefront       = false;
+  bool                doublePrecision = false;
+  bool                packets         = false;
+  bool                denoise         = false;
+  uint32_t            maxSamples      = 0;
+  std::string_view    outputPath;
+  std::string_view    scenePath;
+  std::string_view    saveScenePath;
+  std::string_view    tracePath;
+  SamplerType         samplerType     = SamplerType::Sobol;
+  std::string         connectAddress;
+  DistributedSettings distributed;
+  for (int i = 1; i < argc; i++) {
+    const std::string_view argument = argv[i];
+    wavefront |= argument == "--wavefront";
+    doublePrecision |= argument == "--double";
+    packets |= argument == "--packets";
+    denoise |= argument == "--denoise";
+    if (i + 1 < argc && argument == "--output") {
+      outputPath = argv[++i];
+    } else if (i + 1 < argc && argument == "--scene") {
+      scenePath = argv[++i];
+    } else if (i + 1 < argc && argument == "--save-scene") {
+      saveScenePath = argv[++i];
+    } else if (i + 1 < argc && argument == "--trace") {
+      tracePath = argv[++i];
+    } else if (i + 1 < argc && argument == "--listen") {
+      distributed.address = argv[++i];
+    } else if (i + 1 < argc && argument == "--connect") {
+      connectAddress = argv[++i];
+    } else if (i + 1 < argc && argument == "--spawn") {
+      distributed.spawnWorkers = std::atoi(argv[++i]);
+    } else if (i + 1 < argc && argument == "--workers") {
+      distributed.expectedWorkers = std::atoi(argv[++i]);
+    } else if (i + 1 < argc && argument == "--max-samples") {
+      maxSamples = static_cast<uint32_t>(std::max(2, std::atoi(argv[++i])));
+    } else if (i + 1 < argc && argument == "--sampler") {
+      const std::optional<SamplerType> type = SamplerTypeFromName(argv[++i]);
+      if (!type) {
+        fmt::println("unknown sampler {}", argv[i]);
+        return 1;
+      }
+      samplerType = *type;
+    }
   }
-};
+  Profiler::Instance().tracing = !tracePath.empty();
 
-struct Camera {
-  float     verticalFov;
-  int       imageWidth;
-  int       imageHeight;
-  glm::mat3 cameraMatrix;
-  glm::mat3 cameraMatrixInverse;
-  glm::mat4 transform;
-
-  Camera(float verticalFov, int imageWidth, int imageHeight) :
-      verticalFov(verticalFov), imageWidth(imageWidth), imageHeight(imageHeight) {
-    cameraMatrix        = ComputeCameraMatrix(verticalFov, imageWidth, imageHeight);
-    cameraMatrixInverse = glm::inverse(cameraMatrix);
-    transform           = glm::mat4(1);
+  if (!connectAddress.empty()) {
+    ThreadPool pool;
+    return RunRenderWorker(connectAddress, pool) ? 0 : 1;
   }
 
-  std::vector<Ray> GetRaysInLocalFrame() {
-    std::vector<Ray> rays(imageWidth * imageHeight);
-    for (int y = 0; y < imageHeight; y++) {
-      for (int x = 0; x < imageWidth; x++) {
-        rays[x + y * imageWidth] = {{0, 0, 0}, {glm::normalize(cameraMatrixInverse * glm::vec3{x, y, 1})}};
+  ThreadPool                 pool;
+  SceneSettings              settings;
+  Scene                      scene;
+  InstancedScene             instanced;
+  std::optional<MappedScene> mappedScene;
+  SceneView                  view;
+  if (!scenePath.empty() && !scenePath.ends_with(".scene")) {
+    mappedScene.emplace(std::string(scenePath));
+    if (!mappedScene->IsOpen()) {
+      return 1;
+    }
+    settings = mappedScene->Settings();
+    view     = mappedScene->View();
+  } else {
+    if (scenePath.empty()) {
+      scene.AddSphere({0.5f, {0, 0, 3}});
+      scene.AddSphere({100.0f, {0, 100.5f, 3}});
+    } else if (!LoadSceneText(std::string(scenePath), scene, settings, &instanced)) {
+      return 1;
+    }
+    if (instanced.instances.empty()) {
+      scene.BuildAccelerationStructure(&pool);
+      fmt::println("{}", scene.bvh.statistics);
+      view = scene.View();
+    } else {
+      if (scene.Size() > 0) {
+        instanced.AddInstance(instanced.AddGeometry(std::move(scene)), glm::mat4(1));
       }
+      instanced.BuildAccelerationStructure(&pool);
+      instanced.PrintStatistics();
+      fmt::println("top level {}", instanced.bvh.statistics);
+      view = instanced.View();
     }
-    return rays;
   }
-
-  std::vector<Ray> GetTransformedRays() {
-    glm::vec3        cameraPosition = transform[3]; // last column as vec3
-    std::vector<Ray> rays(imageWidth * imageHeight);
-    for (int y = 0; y < imageHeight; y++) {
-      for (int x = 0; x < imageWidth; x++) {
-        glm::vec3 rayDirection   = glm::normalize(cameraMatrixInverse * glm::vec3{x, y, 1});
-        rays[x + y * imageWidth] = {cameraPosition, glm::mat3(transform) * rayDirection};
-      }
+  if (!saveScenePath.empty() && !instanced.instances.empty()) {
+    fmt::println("cannot save {}: binary scene caches hold no instances", saveScenePath);
+    return 1;
+  }
+  if (!saveScenePath.empty() && !mappedScene && !WriteSceneFile(std::string(saveScenePath), scene, settings)) {
+    return 1;
+  }
+  // Workers get the scene as a binary scene cache, so they skip parsing and building the BVH
+  std::optional<RenderCoordinator> coordinator;
+  if (!distributed.address.empty()) {
+    if (!instanced.instances.empty()) {
+      fmt::println("cannot render {} distributed: binary scene caches hold no instances", scenePath);
+      return 1;
     }
-    return rays;
-  }
-};
-
-template<>
-struct fmt::formatter<Camera> {
-  // Parse format specifier (not used here)
-  constexpr auto parse(fmt::format_parse_context &ctx) { return ctx.begin(); }
-
-  // Format the struct as a string
-  template<typename FormatContext>
-  auto format(const Camera &camera, FormatContext &ctx) const {
-    fmt::format_to(ctx.out(), "Camera: {{\n");
-    fmt::format_to(ctx.out(), "\tverticalFov = {}\n", camera.verticalFov);
-    fmt::format_to(ctx.out(), "\timageWidth = {}\n", camera.imageWidth);
-    fmt::format_to(ctx.out(), "\timageHeight = {}\n", camera.imageHeight);
-    fmt::format_to(ctx.out(), "\tcameraMatrix = {}\n", camera.cameraMatrix);
-    fmt::format_to(ctx.out(), "\tcameraMatrixInverse = {}\n", camera.cameraMatrixInverse);
-    fmt::format_to(ctx.out(), "\ttransform = {}\n", camera.transform);
-    fmt::format_to(ctx.out(), "}}");
-    return ctx.out();
-  }
-};
-
-template<>
-struct fmt::formatter<std::vector<Ray>> {
-  constexpr auto parse(fmt::format_parse_context &ctx) { return ctx.begin(); }
-
-  template<typename FormatContext>
-  auto format(const std::vector<Ray> &rays, FormatContext &ctx) const {
-    auto out = ctx.out();
-    for (auto &ray: rays) {
-      fmt::format_to(out, "{}\n", ray);
+    std::vector<uint8_t> sceneBytes;
+    if (mappedScene) {
+      sceneBytes.assign(mappedScene->Bytes().begin(), mappedScene->Bytes().end());
+    } else {
+      sceneBytes = SceneFileBytes(scene, settings);
+    }
+    const RenderSetup setup = {static_cast<uint32_t>(samplerType), doublePrecision ? 1u : 0u};
+    coordinator.emplace(distributed, pool, std::move(sceneBytes), setup);
+    if (!coordinator->Start(argv[0])) {
+      return 1;
     }
-    return out;
   }
-};
-
-std::optional<float> Intersect(const Sphere &sphere, const glm::vec3 &ray_origin, const glm::vec3 &ray_direction) {
-  const glm::vec3 oc = {
-    ray_origin.x - sphere.position.x, ray_origin.y - sphere.position.y, ray_origin.z - sphere.position.z};
+  const int width  = settings.width;
+  const int height = settings.height;
 
-  const float a =
-    ray_direction.x * ray_direction.x + ray_direction.y * ray_direction.y + ray_direction.z * ray_direction.z;
-  const float b = 2.0f * (oc.x * ray_direction.x + oc.y * ray_direction.y + oc.z * ray_direction.z);
-  const float c = oc.x * oc.x + oc.y * oc.y + oc.z * oc.z - sphere.radius * sphere.radius;
-
-  const float discriminant = b * b - 4 * a * c;
-
-  if (discriminant < 0)
-    return std::nullopt;
-
-  const float t = (-b - std::sqrt(discriminant)) / (2.0f * a);
-  return t > 0 ? t : (-b + std::sqrt(discriminant)) / (2.0f * a);
-}
-
-int main() {
-  std::vector<uchar4> image;
-  image.resize(WIDTH * HEIGHT);
-
-  Camera camera = Camera(45.0f, WIDTH, HEIGHT);
+  Camera camera = Camera(settings.fov, width, height);
   fmt::println("{}", camera.cameraMatrix);
   fmt::println("{}", camera);
-  fmt::println("{}", camera.GetRaysInLocalFrame());
+
+  // Every pass adds samples where the variance estimate says they are needed, so a usable preview exists after the
+  // first pass and keeps converging. Primary rays are generated per pixel straight into the framebuffer, no full frame
+  // ray buffer is held.
+  TileScheduler       scheduler(pool, 16, TileOrder::Morton);
+  AccumulationBuffer  accumulation(width, height, scheduler.tileSize);
+  AdaptiveSampler     sampler(accumulation);
+  if (maxSamples > 0) {
+    sampler.settings.maxSamples = maxSamples;
+    sampler.settings.minSamples = std::min(sampler.settings.minSamples, maxSamples);
+  }
+  // Filled along with the accumulation buffer when denoising, so that every pass records the features of its samples
+  std::optional<FeatureBuffer> features;
+  if (denoise) {
+    features.emplace(width, height, scheduler.tileSize);
+  }
+  std::vector<uchar4> image;
+  const RayGenerator  rayGenerator       = camera.GetRayGenerator();
+  const RayGeneratorD doubleRayGenerator = camera.GetRayGenerator<double>();
+  const Sky           sky;
+  WavefrontIntegrator wavefrontIntegrator(view, sky, pool);
+  wavefrontIntegrator.samplerType = samplerType;
+  wavefrontIntegrator.features    = features ? &*features : nullptr;
+  if (coordinator) {
+    coordinator->features = features ? &*features : nullptr;
+  }
+  fmt::println("sampler: {}", SamplerTypeName(samplerType));
+
+  // The file is mapped, so writing a tile inside the render loop does not allocate
+  std::optional<ImageWriter> writer;
+  std::pmr::vector<Tile>     outputTiles;
+  std::vector<uint8_t>       tileWritten; // per tile of the grid, row major
+  const int                  tilesX = (width + scheduler.tileSize - 1) / scheduler.tileSize;
+  if (!outputPath.empty()) {
+    writer.emplace(
+      std::string(outputPath), ImageFormatFromPath(outputPath), width, height, ImageWriteMode::MemoryMapped);
+    outputTiles = MakeTiles(width, height, scheduler.tileSize, scheduler.order);
+    tileWritten.assign(outputTiles.size(), 0);
+  }
+  // Writes `tile` once the sampler plans no more samples for it. A tile is only ever handled by one thread at a time.
+  auto writeIfFinished = [&](const Tile &tile) {
+    if (!writer || denoise) {
+      return;
+    }
+    const size_t index   = static_cast<size_t>(tile.y0 / scheduler.tileSize) * tilesX + tile.x0 / scheduler.tileSize;
+    uint8_t     &written = tileWritten[index];
+    if (!written && sampler.TileFinished(tile)) {
+      writer->WriteTile(tile, accumulation);
+      written = 1;
+    }
+  };
+  // For the integrators that do not render through the scheduler, between their passes
+  auto writeFinishedTiles = [&] {
+    if (!writer || denoise) {
+      return;
+    }
+    ParallelFor(pool, 0, static_cast<int64_t>(outputTiles.size()), 1, [&](int64_t first, int64_t last) {
+      for (int64_t i = first; i < last; i++) {
+        writeIfFinished(outputTiles[i]);
+      }
+    });
+  };
+
+  auto renderPass = [&](const auto &generator) {
+    scheduler.Render(width, height, [&](const Tile &tile, unsigned) {
+      writeIfFinished(tile);
+      for (int y = tile.y0; y < tile.y1; y++) {
+        for (int x = tile.x0; x < tile.x1; x++) {
+          const uint32_t first = accumulation.SampleCount(x, y);
+          const uint32_t count = sampler.SamplesThisPass(x, y);
+          for (uint32_t sample = first; sample < first + count; sample++) {
+            PixelSampler    pixelSampler(samplerType, x, y, sample);
+            const glm::vec2 jitter = pixelSampler.Next2D();
+            ProfileCount(ProfileCounter::PrimaryRays);
+            const auto ray = [&] {
+              const ProfileScope scope(ProfileStage::RayGeneration);
+              return generator(x + jitter.x - 0.5f, y + jitter.y - 0.5f);
+            }();
+            PathFeatures       pathFeatures;
+            const glm::vec3    radiance =
+              TraceRadiance(view, sky, ray, pixelSampler, features ? &pathFeatures : nullptr);
+            const ProfileScope scope(ProfileStage::Accumulation);
+            accumulation.AddSample(x, y, radiance);
+            if (features) {
+              features->Add(x, y, pathFeatures);
+            }
+          }
+        }
+      }
+    });
+  };
+
+  // Same samples as renderPass, but sample s of all the pixels of a block that still need one is traced as one packet.
+  // The tile size is a multiple of the packet side, so blocks never straddle tiles.
+  constexpr int PACKET_SIDE = 8;
+  constexpr int PACKET_SIZE = PACKET_SIDE * PACKET_SIDE;
+  auto          packetPass  = [&] {
+    scheduler.Render(width, height, [&](const Tile &tile, unsigned threadIndex) {
+      writeIfFinished(tile);
+      Arena                          &arena = scheduler.ThreadArena(threadIndex);
+      const ArenaScope                tileScope(arena);
+      std::pmr::vector<PixelSampler>  samplers(PACKET_SIZE, PixelSampler(samplerType, 0, 0, 0), &arena);
+      RayPacket<PACKET_SIDE>          packet;
+      PacketHits<PACKET_SIDE>         hits;
+      float                           pixelX[PACKET_SIZE], pixelY[PACKET_SIZE];
+      for (int y0 = tile.y0; y0 < tile.y1; y0 += PACKET_SIDE) {
+        for (int x0 = tile.x0; x0 < tile.x1; x0 += PACKET_SIDE) {
+          for (uint32_t pass = 0;; pass++) {
+            uint64_t active = 0;
+            for (int i = 0; i < PACKET_SIZE; i++) {
+              const int x = x0 + i % PACKET_SIDE;
+              const int y = y0 + i / PACKET_SIDE;
+              if (x >= tile.x1 || y >= tile.y1 || pass >= sampler.SamplesThisPass(x, y)) {
+                continue;
+              }
+              // The sample count grows as the samples of earlier iterations are added, so it is the sample index
+              samplers[i]            = PixelSampler(samplerType, x, y, accumulation.SampleCount(x, y));
+              const glm::vec2 jitter = samplers[i].Next2D();
+              pixelX[i]              = x + jitter.x - 0.5f;
+              pixelY[i]              = y + jitter.y - 0.5f;
+              active |= uint64_t(1) << i;
+            }
+            if (active == 0) {
+              break;
+            }
+            ProfileCount(ProfileCounter::PrimaryRays, std::popcount(active));
+            {
+              const ProfileScope scope(ProfileStage::RayGeneration);
+              rayGenerator.GeneratePacket(pixelX, pixelY, active, packet);
+            }
+            view.ClosestHit(packet, hits);
+            for (int i = 0; i < PACKET_SIZE; i++) {
+              if (packet.IsActive(i)) {
+                PathFeatures    pathFeatures;
+                const glm::vec3 radiance = TraceRadiance(
+                  view, sky, packet.GetRay(i), hits.Hit(i), samplers[i], features ? &pathFeatures : nullptr);
+                const ProfileScope scope(ProfileStage::Accumulation);
+                accumulation.AddSample(x0 + i % PACKET_SIDE, y0 + i / PACKET_SIDE, radiance);
+                if (features) {
+                  features->Add(x0 + i % PACKET_SIDE, y0 + i / PACKET_SIDE, pathFeatures);
+                }
+              }
+            }
+          }
+        }
+      }
+    });
+  };
+
+  // Allocations once the first pass has sized every buffer; apart from trace events the loop should add none
+  uint64_t   warmAllocations = 0;
+  const auto renderStart     = std::chrono::steady_clock::now();
+  // Tiles the coordinator renders itself while it has no workers
+  auto renderLocally = [&](const Tile &tile, std::span<const PixelSamples> samples, std::span<TileSample> result) {
+    if (doublePrecision) {
+      RenderTileSamples(view, sky, doubleRayGenerator, samplerType, tile, samples, result);
+    } else {
+      RenderTileSamples(view, sky, rayGenerator, samplerType, tile, samples, result);
+    }
+  };
+
+  while (sampler.PlanPass() > 0) {
+    if (coordinator) {
+      writeFinishedTiles();
+      coordinator->RenderPass(accumulation, sampler, renderLocally);
+    } else if (wavefront) {
+      writeFinishedTiles();
+      wavefrontIntegrator.RenderPass(
+        rayGenerator, accumulation, [&](int x, int y) { return sampler.SamplesThisPass(x, y); });
+    } else if (doublePrecision) {
+      renderPass(doubleRayGenerator);
+    } else if (packets) {
+      packetPass();
+    } else {
+      renderPass(rayGenerator);
+    }
+    accumulation.FinishPass();
+    accumulation.Resolve(image);
+    if (accumulation.Passes() == 1) {
+      warmAllocations = globalAllocations.load(std::memory_order_relaxed);
+    }
+  }
+  const uint64_t loopAllocations = globalAllocations.load(std::memory_order_relaxed) - warmAllocations;
+  // The filter runs once on the finished frame, it replaces the final image and what is written to disk
+  std::optional<Denoiser> denoiser;
+  if (features) {
+    denoiser.emplace(width, height, scheduler.tileSize);
+    denoiser->Denoise(accumulation, *features, pool);
+    denoiser->Resolve(image);
+  }
+  if (writer) {
+    // The tiles that converged in the last pass, or all of them from the denoiser. Written over the pool directly
+    // rather than through the scheduler, whose statistics describe the render.
+    ParallelFor(pool, 0, static_cast<int64_t>(outputTiles.size()), 1, [&](int64_t first, int64_t last) {
+      for (int64_t i = first; i < last; i++) {
+        if (denoiser) {
+          writer->WriteTile(outputTiles[i], *denoiser);
+        } else {
+          writeIfFinished(outputTiles[i]);
+        }
+      }
+    });
+    if (writer->Finish()) {
+      fmt::println("wrote {} ({} bytes)", outputPath, writer->FileSize());
+    }
+  }
+  const std::chrono::duration<double> renderSeconds = std::chrono::steady_clock::now() - renderStart;
+
+  if (coordinator) {
+    coordinator->Finish();
+    coordinator->PrintStatistics();
+  } else if (wavefront) {
+    wavefrontIntegrator.PrintStatistics();
+  } else {
+    scheduler.PrintStatistics();
+  }
+  sampler.PrintStatistics();
+  if (denoiser) {
+    denoiser->PrintStatistics();
+  }
+  fmt::println("{} passes, center pixel {}", accumulation.Passes(), accumulation.Mean(width / 2, height / 2));
+  const unsigned cores = std::max(1u, std::thread::hardware_concurrency());
+  // Samples of every pixel for the histogram of the report, only gathered when there is a report
+  std::vector<uint32_t> sampleCounts;
+  if constexpr (PROFILE_ENABLED) {
+    sampleCounts.reserve(static_cast<size_t>(width) * height);
+    for (int y = 0; y < height; y++) {
+      for (int x = 0; x < width; x++) {
+        sampleCounts.push_back(accumulation.SampleCount(x, y));
+      }
+    }
+  }
+  Profiler::Instance().PrintReport(renderSeconds.count(), cores, sampleCounts);
+  if constexpr (PROFILE_ENABLED) {
+    fmt::println("  {} global allocations in the render loop after the first pass", loopAllocations);
+  }
+  if (!tracePath.empty() && Profiler::Instance().WriteChromeTrace(std::string(tracePath))) {
+    fmt::println("wrote {}", tracePath);
+  }
 
   return 0;
 
-  // std::vector spheres = {
-  //   Sphere{0.5f, {0, 0, -1}},
-  // };
-  //
   // math::Matrix<4, 4> mat = math::Identity<4, 4>();
   // mat(0, 0)              = 2;
   // math::Display(mat);
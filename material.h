@@ -0,0 +1,201 @@
+#ifndef MATERIAL_H
+#define MATERIAL_H
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <glm/glm.hpp>
+#include <optional>
+#include <span>
+#include <string_view>
+#include <type_traits>
+
+#include "camera.h"
+#include "simd.h"
+
+
+enum class MaterialType : uint32_t {
+  Diffuse,    // Lambertian, `color` is the albedo
+  Conductor,  // mirror with Schlick Fresnel, `color` is the reflectance at normal incidence, `roughness` fuzzes it
+  Dielectric, // smooth glass that reflects or refracts by its Fresnel reflectance, `color` tints the transmission
+  Emissive,   // light source, `color` is the emitted radiance; paths end on it
+  Count,
+};
+
+inline const char *MaterialTypeName(MaterialType type) {
+  constexpr const char *names[] = {"diffuse", "conductor", "dielectric", "emissive"};
+  return names[static_cast<int>(type)];
+}
+
+inline std::optional<MaterialType> MaterialTypeFromName(std::string_view name) {
+  for (int type = 0; type < static_cast<int>(MaterialType::Count); type++) {
+    if (name == MaterialTypeName(static_cast<MaterialType>(type))) {
+      return static_cast<MaterialType>(type);
+    }
+  }
+  return std::nullopt;
+}
+
+// Calls `function` with the type as a std::integral_constant, so the callee can instantiate a kernel per type and a
+// batch of hits of one type pays for the dispatch once
+template<typename Function>
+decltype(auto) VisitMaterialType(MaterialType type, Function &&function) {
+  using enum MaterialType;
+  switch (type) {
+    case Conductor:
+      return function(std::integral_constant<MaterialType, Conductor>());
+    case Dielectric:
+      return function(std::integral_constant<MaterialType, Dielectric>());
+    case Emissive:
+      return function(std::integral_constant<MaterialType, Emissive>());
+    case Diffuse:
+    case Count:
+      break;
+  }
+  return function(std::integral_constant<MaterialType, Diffuse>());
+}
+
+
+// Parameters of one material as authored, see MaterialType for what they mean per type
+struct Material {
+  MaterialType type      = MaterialType::Diffuse;
+  glm::vec3    color     = glm::vec3(0.7f);
+  float        roughness = 0.0f;
+  float        ior       = 1.5f;
+};
+
+
+// Read only view of a MaterialTable, like SceneView it points into a table or into a mapped scene file
+struct MaterialView {
+  std::span<const MaterialType> type;
+  std::span<const float>        colorR;
+  std::span<const float>        colorG;
+  std::span<const float>        colorB;
+  std::span<const float>        roughness;
+  std::span<const float>        ior;
+
+  size_t Size() const { return type.size(); }
+
+  glm::vec3 Color(uint32_t index) const { return {colorR[index], colorG[index], colorB[index]}; }
+
+  Material Get(uint32_t index) const { return {type[index], Color(index), roughness[index], ior[index]}; }
+};
+
+
+// Materials in structure of arrays form, referenced by index from the spheres. A kernel only pulls in the fields its
+// type reads. Material 0 is always there, the default diffuse material every sphere starts with.
+struct MaterialTable {
+  AlignedVector<MaterialType> type;
+  AlignedVector<float>        colorR;
+  AlignedVector<float>        colorG;
+  AlignedVector<float>        colorB;
+  AlignedVector<float>        roughness;
+  AlignedVector<float>        ior;
+
+  MaterialTable() { Add(Material()); }
+
+  size_t Size() const { return type.size(); }
+
+  uint32_t Add(const Material &material) {
+    type.push_back(material.type);
+    colorR.push_back(material.color.x);
+    colorG.push_back(material.color.y);
+    colorB.push_back(material.color.z);
+    roughness.push_back(material.roughness);
+    ior.push_back(material.ior);
+    return static_cast<uint32_t>(Size() - 1);
+  }
+
+  MaterialView View() const { return {type, colorR, colorG, colorB, roughness, ior}; }
+};
+
+
+// Cosine weighted direction around `normal` (Duff et al. branchless orthonormal basis)
+inline glm::vec3 SampleCosineHemisphere(const glm::vec3 &normal, float u1, float u2) {
+  const float     sign      = std::copysign(1.0f, normal.z);
+  const float     a         = -1.0f / (sign + normal.z);
+  const float     b         = normal.x * normal.y * a;
+  const glm::vec3 tangent   = {1.0f + sign * normal.x * normal.x * a, sign * b, -sign * normal.x};
+  const glm::vec3 bitangent = {b, sign + normal.y * normal.y * a, -normal.y};
+
+  const float radius = std::sqrt(u1);
+  const float phi    = 2.0f * PI * u2;
+  return radius * std::cos(phi) * tangent + radius * std::sin(phi) * bitangent + std::sqrt(1.0f - u1) * normal;
+}
+
+// Uniform direction on the unit sphere
+inline glm::vec3 SampleUniformSphere(float u1, float u2) {
+  const float z      = 1.0f - 2.0f * u1;
+  const float radius = std::sqrt(std::max(0.0f, 1.0f - z * z));
+  const float phi    = 2.0f * PI * u2;
+  return {radius * std::cos(phi), radius * std::sin(phi), z};
+}
+
+template<typename T>
+T SchlickFresnel(const T &normalReflectance, float cosine) {
+  const float m = 1.0f - cosine;
+  return normalReflectance + (T(1.0f) - normalReflectance) * (m * m * m * m * m);
+}
+
+
+// What a surface does with a path that reached it
+struct SurfaceSample {
+  glm::vec3 emitted   = glm::vec3(0); // radiance the surface emits towards the path
+  glm::vec3 sunWeight = glm::vec3(0); // BRDF times cosine towards the sun, times the sun irradiance gives the
+                                      // reflected sunlight before the shadow ray; zero where the sun is not sampled
+  glm::vec3 direction = glm::vec3(0); // next direction of the path, normalized
+  glm::vec3 weight    = glm::vec3(0); // BSDF times cosine over pdf of `direction`; zero ends the path
+};
+
+// Samples material `index` of type `Type` for a path arriving along `incoming` at a point with the outward geometric
+// normal `normal`. One kernel per type, with no dispatch and no data dependent branches inside; the choices of the
+// glass kernel are selects. The delta BSDFs cannot be hit by the delta sun, so only diffuse surfaces sample it.
+// Opaque surfaces always scatter around the outward normal: a hit from inside one is a self intersection off by
+// rounding, and sending the path back out is what keeps it from being trapped.
+template<MaterialType Type>
+SurfaceSample SampleSurface(
+  const MaterialView &materials, uint32_t index, const glm::vec3 &incoming, const glm::vec3 &normal,
+  const glm::vec3 &sunDirection, glm::vec2 u) {
+  const glm::vec3 color  = materials.Color(index);
+  const float     cosine = glm::dot(incoming, normal);
+  SurfaceSample   sample;
+  if constexpr (Type == MaterialType::Diffuse) {
+    sample.sunWeight = color / PI * std::max(0.0f, glm::dot(normal, sunDirection));
+    sample.direction = SampleCosineHemisphere(normal, u.x, u.y);
+    sample.weight    = color;
+  } else if constexpr (Type == MaterialType::Conductor) {
+    const glm::vec3 mirror = glm::reflect(incoming, normal);
+    sample.direction       = glm::normalize(mirror + materials.roughness[index] * SampleUniformSphere(u.x, u.y));
+    // Fuzz that points below the surface absorbs the path
+    const float above = glm::dot(sample.direction, normal) > 0 ? 1.0f : 0.0f;
+    sample.weight     = above * SchlickFresnel(color, std::abs(cosine));
+  } else if constexpr (Type == MaterialType::Dielectric) {
+    // Leaving the glass flips the normal and the ratio of the indices
+    const glm::vec3 facingNormal = cosine < 0 ? normal : -normal;
+    const float     ior          = materials.ior[index];
+    const float     eta          = cosine < 0 ? 1.0f / ior : ior;
+    const float     cosIncident  = std::abs(cosine);
+    const float     sinSquared   = eta * eta * (1.0f - cosIncident * cosIncident);
+    const float     r0           = (1.0f - ior) / (1.0f + ior);
+    // Total internal reflection makes the reflectance 1
+    const float     reflectance = sinSquared >= 1.0f ? 1.0f : SchlickFresnel(r0 * r0, cosIncident);
+    const glm::vec3 refracted =
+      eta * incoming + (eta * cosIncident - std::sqrt(std::max(0.0f, 1.0f - sinSquared))) * facingNormal;
+    const bool reflect = u.x < reflectance;
+    sample.direction   = glm::normalize(reflect ? glm::reflect(incoming, facingNormal) : refracted);
+    sample.weight      = reflect ? glm::vec3(1.0f) : color;
+  } else if constexpr (Type == MaterialType::Emissive) {
+    sample.emitted = color;
+  }
+  return sample;
+}
+
+// Per hit entry point, dispatching on the type once
+inline SurfaceSample SampleSurface(
+  const MaterialView &materials, uint32_t index, const glm::vec3 &incoming, const glm::vec3 &normal,
+  const glm::vec3 &sunDirection, glm::vec2 u) {
+  return VisitMaterialType(materials.type[index], [&](auto type) {
+    return SampleSurface<decltype(type)::value>(materials, index, incoming, normal, sunDirection, u);
+  });
+}
+
+#endif // MATERIAL_H
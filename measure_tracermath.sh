@@ -0,0 +1,48 @@
+#!/usr/bin/env bash
+# Compile time and object size of tracermath_build.cpp at -O0 and -O2, best of several runs, against the tracermath.h
+# of the working tree and, when a git revision is given, against the tracermath.h of that revision for comparison.
+# Extra compiler flags are taken from CXXFLAGS.
+# usage: measure_tracermath.sh [compiler] [repetitions] [baseline revision]
+set -euo pipefail
+
+compiler=${1:-c++}
+repetitions=${2:-5}
+baseline=${3:-}
+source_dir=$(cd "$(dirname "$0")" && pwd)
+work_dir=$(mktemp -d)
+trap 'rm -rf "$work_dir"' EXIT
+
+# measure <label> <directory with tracermath.h and tracermath_build.cpp>
+measure() {
+  local label=$1 directory=$2 flags=()
+  # The header from before the swizzle pattern only has the named swizzle members
+  if grep -q DEFINE_SWIZZLE "$directory/tracermath.h"; then
+    flags+=(-DTRACERMATH_MEMBER_SWIZZLES)
+  fi
+  for optimization in -O0 -O2; do
+    local best=""
+    for ((i = 0; i < repetitions; i++)); do
+      local start end
+      start=$(date +%s.%N)
+      # shellcheck disable=SC2086
+      "$compiler" -std=c++20 "$optimization" -Wno-psabi "${flags[@]}" ${CXXFLAGS:-} \
+        -c "$directory/tracermath_build.cpp" -o "$work_dir/build.o"
+      end=$(date +%s.%N)
+      best=$(awk -v best="$best" -v start="$start" -v end="$end" \
+        'BEGIN { elapsed = end - start; print (best == "" || elapsed < best) ? elapsed : best }')
+    done
+    local text object
+    text=$(size -A "$work_dir/build.o" | awk '$1 ~ /^\.text/ { sum += $2 } END { print sum + 0 }')
+    object=$(wc -c < "$work_dir/build.o")
+    printf '%-12s %-4s %10.3f %12d %12d\n' "$label" "$optimization" "$best" "$text" "$object"
+  done
+}
+
+printf '%-12s %-4s %10s %12s %12s\n' header opt seconds '.text bytes' 'object bytes'
+if [[ -n "$baseline" ]]; then
+  mkdir "$work_dir/baseline"
+  git -C "$source_dir" show "$baseline:tracermath.h" > "$work_dir/baseline/tracermath.h"
+  cp "$source_dir/tracermath_build.cpp" "$work_dir/baseline/"
+  measure "$(git -C "$source_dir" rev-parse --short "$baseline")" "$work_dir/baseline"
+fi
+measure "working tree" "$source_dir"
@@ -0,0 +1,270 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <fmt/core.h>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <string>
+#include <vector>
+
+#include "simd.h"
+
+// Hot path counters and stage timers, compiled in with TRACER_PROFILE=1 (the PATH_TRACER_PROFILE CMake option).
+// Without it every ProfileCount() and ProfileScope compiles to nothing.
+#ifndef TRACER_PROFILE
+#define TRACER_PROFILE 0
+#endif
+inline constexpr bool PROFILE_ENABLED = TRACER_PROFILE != 0;
+
+// Calls of the global operator new, counted by the replacement in main.cpp in profiling builds. Once the first pass
+// has warmed up the arenas, queues and buffers, the render loop is expected to leave it unchanged.
+inline std::atomic<uint64_t> globalAllocations = 0;
+
+
+enum class ProfileCounter {
+  PrimaryRays,
+  ClosestHitRays,
+  AnyHitRays,
+  SphereTests,     // spheres tested in the leaves the queries reached
+  SphereHits,      // leaves that reported a hit
+  DoubleFallbacks, // float leaves recomputed in double
+  FrustumCulls,    // BVH nodes and spheres skipped by whole ray packets
+  Count,
+};
+
+// Stages nest: Intersection is part of ClosestHit and AnyHit
+enum class ProfileStage {
+  RayGeneration,
+  ClosestHit,
+  AnyHit,
+  Intersection,
+  Shading,
+  Accumulation,
+  Output,
+  Denoise,
+  Count,
+};
+
+inline const char *ProfileStageName(ProfileStage stage) {
+  constexpr const char *names[] = {
+    "ray generation", "closest hit", "any hit", "  intersection", "shading", "accumulation", "output", "denoise"};
+  return names[static_cast<int>(stage)];
+}
+
+
+// Timestamp counter where there is one, it is several times cheaper to read than steady_clock
+inline uint64_t ProfileTicks() {
+#if TRACER_SIMD_X86
+  return __rdtsc();
+#else
+  return static_cast<uint64_t>(std::chrono::steady_clock::now().time_since_epoch().count());
+#endif
+}
+
+
+// Complete event of the Chrome trace format, in ticks
+struct ProfileTraceEvent {
+  const char *name;
+  uint64_t    start;
+  uint64_t    end;
+  int         x, y; // tile origin, or -1
+};
+
+// Everything one thread records. Each thread only writes its own, so no counter is ever contended.
+struct alignas(64) ThreadProfile {
+  unsigned                                                        thread = 0;
+  std::array<uint64_t, static_cast<size_t>(ProfileCounter::Count)> counters{};
+  std::array<uint64_t, static_cast<size_t>(ProfileStage::Count)>   stageTicks{};
+  std::vector<ProfileTraceEvent>                                  events;
+};
+
+
+// Collects the thread profiles. Totals are read without synchronization, so Report() and WriteChromeTrace() belong
+// after the render, once the threads are idle.
+class Profiler {
+public:
+  bool tracing = false; // record a trace event per tile
+
+  static Profiler &Instance() {
+    static Profiler profiler;
+    return profiler;
+  }
+
+  // Profile of the calling thread, registered on first use
+  static ThreadProfile &Local() {
+    thread_local ThreadProfile *profile = Instance().Register();
+    return *profile;
+  }
+
+  uint64_t Total(ProfileCounter counter) const {
+    uint64_t total = 0;
+    std::lock_guard lock(mutex);
+    for (const auto &profile: profiles) {
+      total += profile->counters[static_cast<size_t>(counter)];
+    }
+    return total;
+  }
+
+  double StageSeconds(ProfileStage stage) const {
+    uint64_t total = 0;
+    std::lock_guard lock(mutex);
+    for (const auto &profile: profiles) {
+      total += profile->stageTicks[static_cast<size_t>(stage)];
+    }
+    return static_cast<double>(total) / TicksPerSecond();
+  }
+
+  // Timestamp ticks per second, calibrated against steady_clock since the profiler was created
+  double TicksPerSecond() const {
+    const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - startTime;
+    const uint64_t                      ticks   = ProfileTicks() - startTicks;
+    return elapsed.count() > 0 && ticks > 0 ? ticks / elapsed.count() : 1e9;
+  }
+
+  // Rays per second over `wallSeconds` on `cores` threads, the stage times summed over all threads and a histogram of
+  // `sampleCounts`, the samples of every pixel, in powers of two
+  void PrintReport(double wallSeconds, unsigned cores, std::span<const uint32_t> sampleCounts) const {
+    if constexpr (!PROFILE_ENABLED) {
+      fmt::println("profile: not compiled in, build with -DPATH_TRACER_PROFILE=ON");
+      return;
+    }
+    const uint64_t primary = Total(ProfileCounter::PrimaryRays);
+    const uint64_t closest = Total(ProfileCounter::ClosestHitRays);
+    const uint64_t any     = Total(ProfileCounter::AnyHitRays);
+    const uint64_t tests   = Total(ProfileCounter::SphereTests);
+    const double   rays    = static_cast<double>(closest + any);
+    fmt::println(
+      "profile: {:.3f} s wall, {} primary, {} closest hit, {} any hit rays, {:.3f} Mrays/s, {:.3f} Mrays/s per core",
+      wallSeconds, primary, closest, any, rays / wallSeconds * 1e-6, rays / wallSeconds / cores * 1e-6);
+    fmt::println(
+      "  {} sphere tests ({:.1f} per ray), {} leaf hits, {} double fallbacks, {} frustum culls", tests,
+      tests / std::max(rays, 1.0), Total(ProfileCounter::SphereHits), Total(ProfileCounter::DoubleFallbacks),
+      Total(ProfileCounter::FrustumCulls));
+    for (int stage = 0; stage < static_cast<int>(ProfileStage::Count); stage++) {
+      const double seconds = StageSeconds(static_cast<ProfileStage>(stage));
+      fmt::println(
+        "  {:<16} {:10.3f} ms {:6.1f}%", ProfileStageName(static_cast<ProfileStage>(stage)), seconds * 1000.0,
+        100.0 * seconds / (wallSeconds * cores));
+    }
+
+    std::vector<uint64_t> histogram;
+    for (const uint32_t count: sampleCounts) {
+      const size_t bucket = std::bit_width(count);
+      histogram.resize(std::max(histogram.size(), bucket + 1));
+      histogram[bucket]++;
+    }
+    fmt::println("  samples per pixel:");
+    for (size_t bucket = 0; bucket < histogram.size(); bucket++) {
+      if (histogram[bucket] > 0) {
+        const uint64_t low = bucket == 0 ? 0 : uint64_t(1) << (bucket - 1);
+        fmt::println("    [{:5}, {:5}] {:8} pixels", low, bucket == 0 ? 0 : 2 * low - 1, histogram[bucket]);
+      }
+    }
+  }
+
+  // Writes the recorded events as a Chrome trace (chrome://tracing, Perfetto), one row per thread
+  bool WriteChromeTrace(const std::string &path) const {
+    FILE *file = std::fopen(path.c_str(), "w");
+    if (!file) {
+      fmt::println("cannot write {}", path);
+      return false;
+    }
+    const double microseconds = 1e6 / TicksPerSecond();
+    bool         first        = true;
+    fmt::print(file, "{{\"traceEvents\": [\n");
+    std::lock_guard lock(mutex);
+    for (const auto &profile: profiles) {
+      for (const ProfileTraceEvent &event: profile->events) {
+        fmt::print(
+          file,
+          "{}  {{\"name\": \"{}\", \"ph\": \"X\", \"pid\": 0, \"tid\": {}, \"ts\": {:.3f}, \"dur\": {:.3f}, "
+          "\"args\": {{\"x\": {}, \"y\": {}}}}}",
+          first ? "" : ",\n", event.name, profile->thread, (event.start - startTicks) * microseconds,
+          (event.end - event.start) * microseconds, event.x, event.y);
+        first = false;
+      }
+    }
+    fmt::print(file, "\n]}}\n");
+    return std::fclose(file) == 0;
+  }
+
+private:
+  Profiler() : startTicks(ProfileTicks()), startTime(std::chrono::steady_clock::now()) {}
+
+  ThreadProfile *Register() {
+    std::lock_guard lock(mutex);
+    profiles.push_back(std::make_unique<ThreadProfile>());
+    profiles.back()->thread = static_cast<unsigned>(profiles.size() - 1);
+    return profiles.back().get();
+  }
+
+  uint64_t                                    startTicks;
+  std::chrono::steady_clock::time_point       startTime;
+  mutable std::mutex                          mutex;
+  std::vector<std::unique_ptr<ThreadProfile>> profiles;
+};
+
+
+inline void ProfileCount(ProfileCounter counter, uint64_t amount = 1) {
+  if constexpr (PROFILE_ENABLED) {
+    Profiler::Local().counters[static_cast<size_t>(counter)] += amount;
+  }
+}
+
+// Adds the lifetime of the scope to a stage of the calling thread
+class ProfileScope {
+public:
+  explicit ProfileScope(ProfileStage stage) : stage(stage) {
+    if constexpr (PROFILE_ENABLED) {
+      start = ProfileTicks();
+    }
+  }
+
+  ProfileScope(const ProfileScope &)            = delete;
+  ProfileScope &operator=(const ProfileScope &) = delete;
+
+  ~ProfileScope() {
+    if constexpr (PROFILE_ENABLED) {
+      Profiler::Local().stageTicks[static_cast<size_t>(stage)] += ProfileTicks() - start;
+    }
+  }
+
+private:
+  ProfileStage stage;
+  uint64_t     start = 0;
+};
+
+// Records the lifetime of the scope as a trace event of the calling thread while tracing is on
+class ProfileTraceScope {
+public:
+  explicit ProfileTraceScope(const char *name, int x = -1, int y = -1) : name(name), x(x), y(y) {
+    if constexpr (PROFILE_ENABLED) {
+      start = ProfileTicks();
+    }
+  }
+
+  ProfileTraceScope(const ProfileTraceScope &)            = delete;
+  ProfileTraceScope &operator=(const ProfileTraceScope &) = delete;
+
+  ~ProfileTraceScope() {
+    if constexpr (PROFILE_ENABLED) {
+      if (Profiler::Instance().tracing) {
+        Profiler::Local().events.push_back({name, start, ProfileTicks(), x, y});
+      }
+    }
+  }
+
+private:
+  const char *name;
+  int         x, y;
+  uint64_t    start = 0;
+};
+
+#endif // PROFILER_H
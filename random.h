@@ -0,0 +1,40 @@
+#ifndef RANDOM_H
+#define RANDOM_H
+#include <cstdint>
+
+
+// Finalizer of splitmix64, turns structured keys like (pixel, pass) into well mixed seeds
+inline uint64_t MixBits(uint64_t value) {
+  value ^= value >> 30;
+  value *= 0xbf58476d1ce4e5b9ull;
+  value ^= value >> 27;
+  value *= 0x94d049bb133111ebull;
+  value ^= value >> 31;
+  return value;
+}
+
+
+// PCG32 generator (XSH RR variant): 16 bytes of state, cheap enough to create one per pixel sample
+struct Pcg32 {
+  uint64_t state;
+  uint64_t increment;
+
+  explicit Pcg32(uint64_t seed, uint64_t sequence = 0) : state(0), increment((sequence << 1) | 1) {
+    NextUInt();
+    state += seed;
+    NextUInt();
+  }
+
+  uint32_t NextUInt() {
+    const uint64_t previous = state;
+    state                   = previous * 6364136223846793005ull + increment;
+    const uint32_t xorShift = static_cast<uint32_t>(((previous >> 18) ^ previous) >> 27);
+    const uint32_t rotation = static_cast<uint32_t>(previous >> 59);
+    return (xorShift >> rotation) | (xorShift << ((-rotation) & 31));
+  }
+
+  // Uniform in [0, 1), built from the top 24 bits so the result is never rounded up to 1
+  float NextFloat() { return static_cast<float>(NextUInt() >> 8) * 0x1p-24f; }
+};
+
+#endif // RANDOM_H
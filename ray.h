@@ -0,0 +1,53 @@
+#ifndef RAY_H
+#define RAY_H
+#include <fmt/core.h>
+#include <glm/glm.hpp>
+#include <vector>
+
+#include "formatters.h"
+
+
+// Ray in single or double precision. Float rays are the default, double rays are used for renders of scenes with large
+// coordinates and for the intersections that are too ill-conditioned in float.
+template<typename T>
+struct RayT {
+  glm::vec<3, T> origin;
+  glm::vec<3, T> direction;
+
+  template<typename U>
+  explicit operator RayT<U>() const {
+    return {glm::vec<3, U>(origin), glm::vec<3, U>(direction)};
+  }
+};
+
+using Ray  = RayT<float>;
+using RayD = RayT<double>;
+
+template<typename T>
+struct fmt::formatter<RayT<T>> {
+  constexpr auto parse(fmt::format_parse_context &ctx) { return ctx.begin(); }
+
+  template<typename FormatContext>
+  auto format(const RayT<T> &ray, FormatContext &ctx) const {
+    auto out = ctx.out();
+    return fmt::format_to(
+      out, "Ray: {{origin: {}\tdirection: {}}}", glm::to_string(ray.origin), glm::to_string(ray.direction));
+  }
+};
+
+// Any allocator, so that the std::pmr ray buffers of CameraT format too
+template<typename T, typename Allocator>
+struct fmt::formatter<std::vector<RayT<T>, Allocator>> {
+  constexpr auto parse(fmt::format_parse_context &ctx) { return ctx.begin(); }
+
+  template<typename FormatContext>
+  auto format(const std::vector<RayT<T>, Allocator> &rays, FormatContext &ctx) const {
+    auto out = ctx.out();
+    for (auto &ray: rays) {
+      fmt::format_to(out, "{}\n", ray);
+    }
+    return out;
+  }
+};
+
+#endif // RAY_H
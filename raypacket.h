@@ -0,0 +1,153 @@
+#ifndef RAYPACKET_H
+#define RAYPACKET_H
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <glm/glm.hpp>
+
+#include "ray.h"
+#include "simd.h"
+#include "spherekernels.h"
+
+
+// Four planes through a common ray origin that enclose every ray of a packet, unit normals pointing inwards. A box or
+// sphere that lies entirely on the outer side of one plane cannot be hit by any ray of the packet.
+struct PacketFrustum {
+  glm::vec3 origin;
+  glm::vec3 direction; // central direction, not normalized
+  glm::vec3 normals[4];
+
+  PacketFrustum() = default;
+
+  // `corners` are the directions of the four edges of the frustum, in order around it
+  PacketFrustum(const glm::vec3 &origin, const glm::vec3 (&corners)[4]) :
+      origin(origin), direction(corners[0] + corners[1] + corners[2] + corners[3]) {
+    for (int i = 0; i < 4; i++) {
+      normals[i] = glm::normalize(glm::cross(corners[i], corners[(i + 1) % 4]));
+      if (glm::dot(normals[i], direction) < 0) {
+        normals[i] = -normals[i];
+      }
+    }
+  }
+
+  bool Culls(const glm::vec3 &boxMin, const glm::vec3 &boxMax) const {
+    for (const glm::vec3 &normal: normals) {
+      // The box corner furthest along the normal is the last one to leave the plane's inner side
+      const glm::vec3 corner = {
+        normal.x > 0 ? boxMax.x : boxMin.x, normal.y > 0 ? boxMax.y : boxMin.y, normal.z > 0 ? boxMax.z : boxMin.z};
+      if (glm::dot(normal, corner - origin) < 0) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  bool CullsSphere(const glm::vec3 &center, float radius) const {
+    const glm::vec3 toCenter = center - origin;
+    for (const glm::vec3 &normal: normals) {
+      if (glm::dot(normal, toCenter) < -radius) {
+        return true;
+      }
+    }
+    return false;
+  }
+};
+
+
+// Side x Side rays in structure of arrays form, lane i belonging to pixel (i % Side, i / Side) of a block. The rays
+// leave one origin, as the primary rays of a pinhole camera do, and `frustum` bounds them all. Lanes whose bit is clear
+// in `active`, e.g. pixels past the image edge or pixels that need no more samples, are skipped by every query.
+template<int Side>
+struct RayPacket {
+  static_assert(Side == 2 || Side == 4 || Side == 8, "packets are 2x2, 4x4 or 8x8 rays");
+  static constexpr int SIZE = Side * Side;
+
+  alignas(64) float originX[SIZE];
+  alignas(64) float originY[SIZE];
+  alignas(64) float originZ[SIZE];
+  alignas(64) float directionX[SIZE];
+  alignas(64) float directionY[SIZE];
+  alignas(64) float directionZ[SIZE];
+  alignas(64) float inverseDirectionX[SIZE];
+  alignas(64) float inverseDirectionY[SIZE];
+  alignas(64) float inverseDirectionZ[SIZE];
+  glm::vec3     origin;
+  PacketFrustum frustum;
+  uint64_t      active = 0;
+
+  bool IsActive(int lane) const { return (active >> lane) & 1; }
+
+  int ActiveCount() const { return std::popcount(active); }
+
+  Ray GetRay(int lane) const {
+    return {{originX[lane], originY[lane], originZ[lane]}, {directionX[lane], directionY[lane], directionZ[lane]}};
+  }
+
+  void SetRay(int lane, const Ray &ray) {
+    originX[lane]           = ray.origin.x;
+    originY[lane]           = ray.origin.y;
+    originZ[lane]           = ray.origin.z;
+    directionX[lane]        = ray.direction.x;
+    directionY[lane]        = ray.direction.y;
+    directionZ[lane]        = ray.direction.z;
+    inverseDirectionX[lane] = 1.0f / ray.direction.x;
+    inverseDirectionY[lane] = 1.0f / ray.direction.y;
+    inverseDirectionZ[lane] = 1.0f / ray.direction.z;
+  }
+
+  // Lanes [begin, begin + 32) for the sphere kernels
+  RayArrays Arrays(int begin) const {
+    return {
+      originX + begin, originY + begin, originZ + begin, directionX + begin, directionY + begin, directionZ + begin};
+  }
+
+  // Whether any ray enters the box within (tMin, tHit[lane]). Inactive lanes must carry a tHit below tMin.
+  // Same slab test as IntersectAABB(), four lanes at a time with SSE2, which every x86-64 CPU has.
+  bool AnyRayHitsBox(const glm::vec3 &boxMin, const glm::vec3 &boxMax, float tMin, const float *tHit) const {
+    const glm::vec3 toMin = boxMin - origin;
+    const glm::vec3 toMax = boxMax - origin;
+#if TRACER_SIMD_X86
+    const __m128 minX = _mm_set1_ps(toMin.x), minY = _mm_set1_ps(toMin.y), minZ = _mm_set1_ps(toMin.z);
+    const __m128 maxX = _mm_set1_ps(toMax.x), maxY = _mm_set1_ps(toMax.y), maxZ = _mm_set1_ps(toMax.z);
+    const __m128 minimum = _mm_set1_ps(tMin);
+    __m128       hit     = _mm_setzero_ps();
+    for (int i = 0; i < SIZE; i += 4) {
+      const __m128 inverseX = _mm_load_ps(inverseDirectionX + i);
+      const __m128 inverseY = _mm_load_ps(inverseDirectionY + i);
+      const __m128 inverseZ = _mm_load_ps(inverseDirectionZ + i);
+      const __m128 tx0      = _mm_mul_ps(minX, inverseX);
+      const __m128 tx1      = _mm_mul_ps(maxX, inverseX);
+      const __m128 ty0      = _mm_mul_ps(minY, inverseY);
+      const __m128 ty1      = _mm_mul_ps(maxY, inverseY);
+      const __m128 tz0      = _mm_mul_ps(minZ, inverseZ);
+      const __m128 tz1      = _mm_mul_ps(maxZ, inverseZ);
+      const __m128 enter    = _mm_max_ps(
+        _mm_max_ps(_mm_min_ps(tx0, tx1), _mm_min_ps(ty0, ty1)), _mm_max_ps(_mm_min_ps(tz0, tz1), minimum));
+      const __m128 exit = _mm_min_ps(
+        _mm_min_ps(_mm_max_ps(tx0, tx1), _mm_max_ps(ty0, ty1)),
+        _mm_min_ps(_mm_max_ps(tz0, tz1), _mm_loadu_ps(tHit + i)));
+      hit = _mm_or_ps(hit, _mm_cmple_ps(enter, exit));
+    }
+    return _mm_movemask_ps(hit) != 0;
+#else
+    for (int i = 0; i < SIZE; i++) {
+      const float tx0   = toMin.x * inverseDirectionX[i];
+      const float tx1   = toMax.x * inverseDirectionX[i];
+      const float ty0   = toMin.y * inverseDirectionY[i];
+      const float ty1   = toMax.y * inverseDirectionY[i];
+      const float tz0   = toMin.z * inverseDirectionZ[i];
+      const float tz1   = toMax.z * inverseDirectionZ[i];
+      const float enter =
+        std::max(std::max(std::min(tx0, tx1), std::min(ty0, ty1)), std::max(std::min(tz0, tz1), tMin));
+      const float exit =
+        std::min(std::min(std::max(tx0, tx1), std::max(ty0, ty1)), std::min(std::max(tz0, tz1), tHit[i]));
+      if (enter <= exit) {
+        return true;
+      }
+    }
+    return false;
+#endif
+  }
+};
+
+#endif // RAYPACKET_H
@@ -0,0 +1,275 @@
+#ifndef SAMPLER_H
+#define SAMPLER_H
+#include <array>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <glm/glm.hpp>
+#include <optional>
+#include <string_view>
+#include <vector>
+
+#include "random.h"
+
+
+// How the sample values of a path are chosen. Each pixel sample draws a stream of 2D dimension pairs: pair 0 is the
+// position inside the pixel, every bounce takes the next pair for its direction. A thin lens would take the pair after
+// the pixel position; the camera is a pinhole, so there is none.
+enum class SamplerType {
+  Independent, // PCG32 per pixel sample, white noise
+  Stratified,  // a jittered 4x4 grid per pair, permuted anew for every block of 16 samples of a pixel
+  Sobol,       // the Sobol (0, 2) sequence, Owen scrambled per pixel and shuffled per pair
+  BlueNoise,   // one Owen scrambled Sobol sequence for the frame, rotated per pixel by a blue noise mask
+};
+
+inline const char *SamplerTypeName(SamplerType type) {
+  constexpr const char *names[] = {"independent", "stratified", "sobol", "bluenoise"};
+  return names[static_cast<int>(type)];
+}
+
+inline std::optional<SamplerType> SamplerTypeFromName(std::string_view name) {
+  for (int type = 0; type <= static_cast<int>(SamplerType::BlueNoise); type++) {
+    if (name == SamplerTypeName(static_cast<SamplerType>(type))) {
+      return static_cast<SamplerType>(type);
+    }
+  }
+  return std::nullopt;
+}
+
+
+inline uint32_t ReverseBits(uint32_t value) {
+  value = ((value >> 1) & 0x55555555u) | ((value & 0x55555555u) << 1);
+  value = ((value >> 2) & 0x33333333u) | ((value & 0x33333333u) << 2);
+  value = ((value >> 4) & 0x0f0f0f0fu) | ((value & 0x0f0f0f0fu) << 4);
+  value = ((value >> 8) & 0x00ff00ffu) | ((value & 0x00ff00ffu) << 8);
+  return (value >> 16) | (value << 16);
+}
+
+inline uint32_t HashCombine(uint32_t a, uint32_t b) {
+  return static_cast<uint32_t>(MixBits((static_cast<uint64_t>(a) << 32) | b));
+}
+
+// Bijective hash in which every bit only depends on itself and the bits below it (Laine and Karras 2011, with the
+// constants of Burley 2020)
+inline uint32_t LaineKarrasPermutation(uint32_t value, uint32_t seed) {
+  value ^= value * 0x3d20adeau;
+  value += seed;
+  value *= (seed >> 16) | 1;
+  value ^= value * 0x05526c56u;
+  value ^= value * 0x53a22864u;
+  return value;
+}
+
+// Owen scrambling of a 32 bit fraction: every bit is flipped depending on the bits above it, which keeps the
+// stratification of a (t, m, s) net while decorrelating it (Burley 2020, "Practical Hash-based Owen Scrambling")
+inline uint32_t NestedUniformScramble(uint32_t value, uint32_t seed) {
+  return ReverseBits(LaineKarrasPermutation(ReverseBits(value), seed));
+}
+
+// Uniform in [0, 1) from the top 24 bits of a 32 bit fraction, like Pcg32::NextFloat()
+inline float FractionToFloat(uint32_t fraction) { return static_cast<float>(fraction >> 8) * 0x1p-24f; }
+
+
+// Second Sobol dimension (primitive polynomial x + 1) as four tables, one per byte of the index: the XOR of the
+// generator matrix columns selected by every byte value. The first dimension is the van der Corput sequence, whose
+// matrix is the bit reversal.
+inline constexpr std::array<std::array<uint32_t, 256>, 4> SOBOL_TABLES_1 = [] {
+  std::array<uint32_t, 32> columns{};
+  columns[0] = 1u << 31;
+  for (size_t i = 1; i < columns.size(); i++) {
+    columns[i] = columns[i - 1] ^ (columns[i - 1] >> 1);
+  }
+  std::array<std::array<uint32_t, 256>, 4> tables{};
+  for (size_t byte = 0; byte < 4; byte++) {
+    for (uint32_t value = 0; value < 256; value++) {
+      for (int bit = 0; bit < 8; bit++) {
+        tables[byte][value] ^= (value >> bit) & 1 ? columns[8 * byte + bit] : 0;
+      }
+    }
+  }
+  return tables;
+}();
+
+// Point `index` of the Sobol (0, 2) sequence as two 32 bit fractions
+inline glm::uvec2 Sobol2D(uint32_t index) {
+  const uint32_t y = SOBOL_TABLES_1[0][index & 0xff] ^ SOBOL_TABLES_1[1][(index >> 8) & 0xff] ^
+                     SOBOL_TABLES_1[2][(index >> 16) & 0xff] ^ SOBOL_TABLES_1[3][index >> 24];
+  return {ReverseBits(index), y};
+}
+
+// Point `index` of a Sobol (0, 2) sequence that is shuffled and Owen scrambled by `seed`. Shuffling the index keeps
+// the points of every power of two prefix but decorrelates sequences with different seeds, so any number of pairs can
+// be padded together.
+inline glm::uvec2 ScrambledSobol2D(uint32_t index, uint32_t seed) {
+  const glm::uvec2 point = Sobol2D(NestedUniformScramble(index, seed));
+  return {NestedUniformScramble(point.x, HashCombine(seed, 1)), NestedUniformScramble(point.y, HashCombine(seed, 2))};
+}
+
+
+// Tileable 64x64 blue noise mask made with void and cluster (Ulichney 1993). Thresholding it at any level gives evenly
+// spread pixels, so per pixel offsets taken from it push the error of neighbouring pixels apart and what is left reads
+// as high frequency noise (Georgiev and Fajardo 2016). The mask is made once, on first use, in a few tens of ms.
+class BlueNoiseMask {
+public:
+  static constexpr int SIZE = 64;
+
+  static const BlueNoiseMask &Instance() {
+    static const BlueNoiseMask mask;
+    return mask;
+  }
+
+  // Rank of the pixel as a 32 bit fraction, the ranks of the mask spread evenly over [0, 1)
+  uint32_t Fraction(uint32_t x, uint32_t y) const { return fractions[(y % SIZE) * SIZE + x % SIZE]; }
+
+private:
+  static constexpr int      PIXELS = SIZE * SIZE;
+  static constexpr float    SIGMA  = 1.9f;
+  static constexpr uint64_t SEED   = 0x6a09e667f3bcc908ull;
+
+  BlueNoiseMask() : fractions(PIXELS) {
+    // Gaussian energy of every toroidal offset, a pixel's energy is the sum over the set pixels
+    std::vector<float> kernel(PIXELS);
+    for (int dy = 0; dy < SIZE; dy++) {
+      for (int dx = 0; dx < SIZE; dx++) {
+        const float x          = static_cast<float>(std::min(dx, SIZE - dx));
+        const float y          = static_cast<float>(std::min(dy, SIZE - dy));
+        kernel[dy * SIZE + dx] = std::exp(-(x * x + y * y) / (2 * SIGMA * SIGMA));
+      }
+    }
+    std::vector<float>   energy(PIXELS, 0.0f);
+    std::vector<uint8_t> set(PIXELS, 0);
+    auto toggle = [&](int pixel) {
+      const float sign = set[pixel] ? -1.0f : 1.0f;
+      set[pixel] ^= 1;
+      for (int y = 0; y < SIZE; y++) {
+        const float *row = &kernel[((y - pixel / SIZE) & (SIZE - 1)) * SIZE];
+        for (int x = 0; x < SIZE; x++) {
+          energy[y * SIZE + x] += sign * row[(x - pixel % SIZE) & (SIZE - 1)];
+        }
+      }
+    };
+    // Highest energy set pixel, or lowest energy unset pixel
+    auto extreme = [&](bool tightestCluster) {
+      int best = -1;
+      for (int pixel = 0; pixel < PIXELS; pixel++) {
+        if (set[pixel] == tightestCluster &&
+            (best < 0 || (tightestCluster ? energy[pixel] > energy[best] : energy[pixel] < energy[best]))) {
+          best = pixel;
+        }
+      }
+      return best;
+    };
+
+    // Random initial pattern, relaxed by moving the tightest cluster into the largest void until that is a no-op
+    Pcg32 random(SEED);
+    int   ones = 0;
+    for (; ones < PIXELS / 10;) {
+      const int pixel = static_cast<int>(random.NextUInt() % PIXELS);
+      if (!set[pixel]) {
+        toggle(pixel);
+        ones++;
+      }
+    }
+    for (;;) {
+      const int cluster = extreme(true);
+      toggle(cluster);
+      const int hole = extreme(false);
+      toggle(hole);
+      if (hole == cluster) {
+        break;
+      }
+    }
+
+    // Ranks below the initial pattern by removing clusters, the rest by filling voids. Past half of the pixels the
+    // largest void of the ones is the tightest cluster of the zeros, so one rule covers both of the upper phases.
+    std::vector<uint32_t>      ranks(PIXELS);
+    const std::vector<float>   prototypeEnergy = energy;
+    const std::vector<uint8_t> prototype       = set;
+    for (int rank = ones - 1; rank >= 0; rank--) {
+      const int cluster = extreme(true);
+      toggle(cluster);
+      ranks[cluster] = static_cast<uint32_t>(rank);
+    }
+    energy = prototypeEnergy;
+    set    = prototype;
+    for (int rank = ones; rank < PIXELS; rank++) {
+      const int hole = extreme(false);
+      toggle(hole);
+      ranks[hole] = static_cast<uint32_t>(rank);
+    }
+    for (int pixel = 0; pixel < PIXELS; pixel++) {
+      fractions[pixel] = static_cast<uint32_t>(((2 * static_cast<uint64_t>(ranks[pixel]) + 1) << 31) / PIXELS);
+    }
+  }
+
+  std::vector<uint32_t> fractions;
+};
+
+
+// The sample stream of one pixel sample. Next2D() returns dimension pairs 0, 1, 2, ... of sample `index` of the pixel,
+// so consecutive passes that continue a pixel's sample index also continue its sequence. Generation has no data
+// dependent branches; the switch over the type goes the same way for a whole frame.
+class PixelSampler {
+public:
+  PixelSampler(SamplerType type, uint32_t x, uint32_t y, uint32_t index) :
+      type(type), x(x), y(y), index(index), seed(HashCombine(x, y)),
+      random(MixBits((static_cast<uint64_t>(y) << 32) | x), index) {
+    if (type == SamplerType::BlueNoise) {
+      mask = &BlueNoiseMask::Instance();
+    }
+  }
+
+  glm::vec2 Next2D() {
+    const uint32_t pair = dimension++;
+    switch (type) {
+      case SamplerType::Independent:
+        return {random.NextFloat(), random.NextFloat()};
+      case SamplerType::Stratified: {
+        // The stratum is the Owen scrambled 4 bit radical inverse of the index in the block, a new permutation of the
+        // 16 cells for every block. The radical inverse puts the first samples of a block into different rows.
+        const uint32_t scramble = HashCombine(HashCombine(seed, pair), index / STRATA);
+        const uint32_t stratum  = NestedUniformScramble(ReverseBits(index % STRATA), scramble) >> 28;
+        const float    u        = random.NextFloat();
+        const float    v        = random.NextFloat();
+        return {
+          std::min((stratum % STRATA_SIDE + u) / STRATA_SIDE, ONE_MINUS_EPSILON),
+          std::min((stratum / STRATA_SIDE + v) / STRATA_SIDE, ONE_MINUS_EPSILON)};
+      }
+      case SamplerType::Sobol: {
+        const glm::uvec2 point = ScrambledSobol2D(index, HashCombine(seed, pair));
+        return {FractionToFloat(point.x), FractionToFloat(point.y)};
+      }
+      case SamplerType::BlueNoise: {
+        // Toroidal shift of the whole point set, wrapping in 32 bit fixed point. The mask is read at offsets along the
+        // R2 sequence, so the two coordinates and every pair see a differently shifted mask.
+        const glm::uvec2 point = ScrambledSobol2D(index, HashCombine(FRAME_SEED, pair));
+        const uint32_t   k     = 2 * pair + 1;
+        return {
+          FractionToFloat(point.x + mask->Fraction(x + MaskOffset(k, R2_X), y + MaskOffset(k, R2_Y))),
+          FractionToFloat(point.y + mask->Fraction(x + MaskOffset(k + 1, R2_X), y + MaskOffset(k + 1, R2_Y)))};
+      }
+    }
+    return glm::vec2(0);
+  }
+
+private:
+  static constexpr uint32_t STRATA_SIDE       = 4;
+  static constexpr uint32_t STRATA            = STRATA_SIDE * STRATA_SIDE;
+  static constexpr float    ONE_MINUS_EPSILON = 0x1.fffffep-1f;
+  static constexpr uint32_t FRAME_SEED        = 0x9e3779b9u;
+  static constexpr uint32_t R2_X              = 0xc13fa9a9u; // 0.7548776662 and 0.5698402910 in 32 bit fixed point
+  static constexpr uint32_t R2_Y              = 0x91e10da6u;
+
+  // Top bits of the k-th R2 point, a mask coordinate
+  static uint32_t MaskOffset(uint32_t k, uint32_t alpha) { return (k * alpha) >> 26; }
+
+  SamplerType          type;
+  uint32_t             x, y;
+  uint32_t             index;
+  uint32_t             seed;
+  uint32_t             dimension = 0;
+  Pcg32                random; // jitter inside strata, and everything for Independent
+  const BlueNoiseMask *mask = nullptr;
+};
+
+#endif // SAMPLER_H
@@ -0,0 +1,769 @@
+#ifndef SCENE_H
+#define SCENE_H
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <glm/glm.hpp>
+#include <limits>
+#include <optional>
+#include <span>
+#include <utility>
+#include <vector>
+
+#include "bvh.h"
+#include "material.h"
+#include "profiler.h"
+#include "ray.h"
+#include "raypacket.h"
+#include "simd.h"
+#include "sphere.h"
+#include "spherekernels.h"
+#include "threadpool.h"
+#include "transform.h"
+#include "widebvh.h"
+
+// Offset along the ray that keeps secondary rays from hitting the surface they start on
+constexpr float RAY_EPSILON = 1e-4f;
+
+// Float intersections whose estimated error in t is larger than this are recomputed in double
+constexpr float MAX_FLOAT_INTERSECTION_ERROR = 0.1f * RAY_EPSILON;
+
+
+template<typename T>
+struct SceneHitT {
+  T        t;
+  uint32_t index;        // sphere, of the instance's geometry in a top level view
+  uint32_t instance = 0; // only set by top level views
+};
+
+using SceneHit  = SceneHitT<float>;
+using SceneHitD = SceneHitT<double>;
+
+// Closest hits of a RayPacket, only the lanes active in the packet are meaningful
+template<int Side>
+struct PacketHits {
+  alignas(64) float t[RayPacket<Side>::SIZE];
+  alignas(64) int32_t index[RayPacket<Side>::SIZE]; // -1 on a miss
+  alignas(64) uint32_t instance[RayPacket<Side>::SIZE];
+
+  std::optional<SceneHit> Hit(int lane) const {
+    if (index[lane] < 0) {
+      return std::nullopt;
+    }
+    return SceneHit{t[lane], static_cast<uint32_t>(index[lane]), instance[lane]};
+  }
+};
+
+
+// Float bounds enclosing a double value, so float box tests never reject what the double test would accept
+inline float FloatBelow(double value) {
+  const float rounded = static_cast<float>(value);
+  return rounded > value ? std::nextafter(rounded, -std::numeric_limits<float>::infinity()) : rounded;
+}
+
+inline float FloatAbove(double value) {
+  const float rounded = static_cast<float>(value);
+  return rounded < value ? std::nextafter(rounded, std::numeric_limits<float>::infinity()) : rounded;
+}
+
+
+// Placement of a geometry in a top level view. Both directions of the transform are kept: rays go into object space
+// through `worldToObject`, normals come back through its transpose.
+struct SceneInstance {
+  Transform3x4 objectToWorld;
+  Transform3x4 worldToObject;
+  uint32_t     geometry; // index into SceneView::geometries
+};
+
+
+// Read only view of the spheres, materials and hierarchy of a scene, which does all the ray queries. It points either
+// into a Scene or into a memory mapped scene file, so it stays valid only as long as that storage is unchanged.
+// Queries scan every sphere while there is no hierarchy. The wide layouts are only available when viewing a Scene.
+// Queries take float or double rays. Double rays are intersected in double throughout, with the BVH traversed by a
+// float copy of the ray. Float queries use the SIMD kernels and recompute a leaf in double only when its hit is
+// ill-conditioned in float, which in practice only happens for rays starting far from small spheres.
+// A top level view (see InstancedScene) holds no spheres but instances of geometry views, and its BVH is built over
+// the world bounds of the instances. Its queries carry the ray into the object space of every instance leaf they
+// reach and continue in the geometry there; hits report the instance, and Normal() and HitGeometry() resolve them.
+struct SceneView {
+  std::span<const float>    centerX;
+  std::span<const float>    centerY;
+  std::span<const float>    centerZ;
+  std::span<const float>    radius;
+  std::span<const float>    radiusSquared;
+  std::span<const uint32_t> material; // index into `materials` per sphere
+  MaterialView              materials;
+  BVHView                   bvh;
+  const WideBVH<4>         *bvh4           = nullptr;
+  const WideBVH<8>         *bvh8           = nullptr;
+  BVHLayout                 layout         = BVHLayout::Binary;
+  bool                      doubleFallback = true; // recompute ill-conditioned float intersections in double
+  std::span<const SceneInstance> instances;           // top level views only
+  const SceneView               *geometries = nullptr; // the views the instances place
+
+  size_t Size() const { return centerX.size(); }
+
+  MaterialType MaterialTypeOf(uint32_t index) const { return materials.type[material[index]]; }
+
+  // View whose spheres and materials `hit.index` refers to
+  template<typename T>
+  const SceneView &HitGeometry(const SceneHitT<T> &hit) const {
+    return instances.empty() ? *this : geometries[instances[hit.instance].geometry];
+  }
+
+  MaterialType MaterialTypeOf(const SceneHit &hit) const { return HitGeometry(hit).MaterialTypeOf(hit.index); }
+
+  Sphere GetSphere(size_t index) const { return {radius[index], {centerX[index], centerY[index], centerZ[index]}}; }
+
+  template<typename T>
+  glm::vec<3, T> Normal(uint32_t index, const glm::vec<3, T> &point) const {
+    const glm::vec<3, T> center = {centerX[index], centerY[index], centerZ[index]};
+    return (point - center) / static_cast<T>(radius[index]);
+  }
+
+  // World space outward normal at the hit `point`, normalized
+  template<typename T>
+  glm::vec<3, T> Normal(const SceneHitT<T> &hit, const glm::vec<3, T> &point) const {
+    if (instances.empty()) {
+      return Normal(hit.index, point);
+    }
+    const SceneInstance  &instance = instances[hit.instance];
+    const SceneView      &geometry = geometries[instance.geometry];
+    const glm::vec<3, T> normal    = geometry.Normal(hit.index, instance.worldToObject.Point(point));
+    return glm::normalize(instance.worldToObject.TransposedVector(normal));
+  }
+
+  // Whether the float intersection of a ray from `origin` with a sphere may be off by more than
+  // MAX_FLOAT_INTERSECTION_ERROR. The constant term of the quadratic, |oc|^2 - r^2, carries a rounding error of
+  // eps / 2 * |oc|^2 that cancels catastrophically when the ray starts many radii away; divided by twice the root of
+  // the discriminant (about r for all but grazing hits) it estimates the error in t.
+  bool IllConditioned(const glm::vec3 &origin, uint32_t index) const {
+    const glm::vec3 oc       = origin - glm::vec3{centerX[index], centerY[index], centerZ[index]};
+    const float     roundoff = 0.5f * std::numeric_limits<float>::epsilon() * glm::dot(oc, oc);
+    return roundoff > 2.0f * MAX_FLOAT_INTERSECTION_ERROR * radius[index];
+  }
+
+  // Calls `function` with the hierarchy of the selected layout
+  template<typename Function>
+  auto Traverse(Function &&function) const {
+    switch (layout) {
+      case BVHLayout::Wide4:
+        if (bvh4) {
+          return function(*bvh4);
+        }
+        break;
+      case BVHLayout::Wide8:
+        if (bvh8) {
+          return function(*bvh8);
+        }
+        break;
+      case BVHLayout::Binary:
+        break;
+    }
+    return function(bvh);
+  }
+
+  SphereArrays Arrays() const {
+    return {centerX.data(), centerY.data(), centerZ.data(), radiusSquared.data(), Size()};
+  }
+
+  // Ray directions must be normalized
+  std::optional<SceneHit> ClosestHit(
+    const Ray &ray, float tMin = RAY_EPSILON, float tMax = std::numeric_limits<float>::infinity()) const {
+    const ProfileScope scope(ProfileStage::ClosestHit);
+    ProfileCount(ProfileCounter::ClosestHitRays);
+    return FindClosest(ray, tMin, tMax);
+  }
+
+  // Double precision closest hit, the hit point is exact enough for scenes far from the origin
+  std::optional<SceneHitD> ClosestHit(
+    const RayD &ray, double tMin = RAY_EPSILON, double tMax = std::numeric_limits<double>::infinity()) const {
+    const ProfileScope scope(ProfileStage::ClosestHit);
+    ProfileCount(ProfileCounter::ClosestHitRays);
+    return FindClosest(ray, tMin, tMax);
+  }
+
+  // Closest hits of the active rays of a packet, see BVHView::TraversePacket(). Always uses the binary hierarchy.
+  // Leaves first drop the spheres outside the packet frustum, then test the others against 32 rays per kernel call.
+  // Like the single ray query, a lane whose closest hit in a leaf is ill-conditioned recomputes that leaf in double.
+  // The instances of a top level view transform every ray differently, so there the lanes are traced one by one.
+  template<int Side>
+  void ClosestHit(
+    const RayPacket<Side> &packet, PacketHits<Side> &hits, float tMin = RAY_EPSILON,
+    float tMax = std::numeric_limits<float>::infinity()) const {
+    constexpr int        SIZE    = RayPacket<Side>::SIZE;
+    const ProfileScope   scope(ProfileStage::ClosestHit);
+    const SphereKernels &kernels = GetSphereKernels();
+    ProfileCount(ProfileCounter::ClosestHitRays, packet.ActiveCount());
+
+    for (int i = 0; i < SIZE; i++) {
+      hits.t[i]        = packet.IsActive(i) ? tMax : -std::numeric_limits<float>::infinity();
+      hits.index[i]    = -1;
+      hits.instance[i] = 0;
+    }
+    if (!instances.empty()) {
+      for (uint64_t active = packet.active; active != 0; active &= active - 1) {
+        const int lane = std::countr_zero(active);
+        if (const std::optional<SceneHit> hit = FindClosest(packet.GetRay(lane), tMin, tMax)) {
+          hits.t[lane]        = hit->t;
+          hits.index[lane]    = static_cast<int32_t>(hit->index);
+          hits.instance[lane] = hit->instance;
+        }
+      }
+      return;
+    }
+    uint64_t culled = 0;
+    auto     leaf   = [&](uint32_t first, uint32_t count) {
+      const ProfileScope leafScope(ProfileStage::Intersection);
+      // The double fallback starts from the hit a lane had before the leaf. It is saved when the kernel first updates
+      // the lane, from a copy of the block's t taken before the call; the index is still in place at that point.
+      float    beforeT[SIZE];
+      int32_t  beforeIndex[SIZE];
+      uint64_t hitLanes = 0;
+      for (uint32_t sphere = first; sphere < first + count; sphere++) {
+        const glm::vec3 center = {centerX[sphere], centerY[sphere], centerZ[sphere]};
+        if (packet.frustum.CullsSphere(center, radius[sphere])) {
+          culled++;
+          continue;
+        }
+        ProfileCount(ProfileCounter::SphereTests, packet.ActiveCount());
+        for (int begin = 0; begin < SIZE; begin += 32) {
+          if (((packet.active >> begin) & 0xffffffffu) == 0) {
+            continue;
+          }
+          const int lanes = std::min(SIZE - begin, 32);
+          float     blockT[32];
+          if (doubleFallback) {
+            std::copy_n(hits.t + begin, lanes, blockT);
+          }
+          const uint32_t updated =
+            kernels.intersectRays(center, radiusSquared[sphere], packet.Arrays(begin), lanes, tMin, hits.t + begin);
+          for (uint32_t remaining = updated; remaining != 0; remaining &= remaining - 1) {
+            const int lane = begin + std::countr_zero(remaining);
+            if (doubleFallback && ((hitLanes >> lane) & 1) == 0) {
+              beforeT[lane]     = blockT[lane - begin];
+              beforeIndex[lane] = hits.index[lane];
+            }
+            hits.index[lane] = static_cast<int32_t>(sphere);
+          }
+          hitLanes |= static_cast<uint64_t>(updated) << begin;
+        }
+      }
+      if (!doubleFallback) {
+        return;
+      }
+      for (; hitLanes != 0; hitLanes &= hitLanes - 1) {
+        const int lane = std::countr_zero(hitLanes);
+        if (!IllConditioned(packet.origin, static_cast<uint32_t>(hits.index[lane]))) {
+          continue;
+        }
+        ProfileCount(ProfileCounter::DoubleFallbacks);
+        double  tDouble = beforeT[lane];
+        int32_t closest = beforeIndex[lane];
+        ClosestSphereDouble(static_cast<RayD>(packet.GetRay(lane)), first, first + count, tMin, tDouble, closest);
+        hits.t[lane]     = static_cast<float>(tDouble);
+        hits.index[lane] = closest;
+      }
+    };
+    if (bvh.Empty()) {
+      leaf(0, static_cast<uint32_t>(Size()));
+    } else {
+      culled += bvh.TraversePacket(packet, tMin, hits.t, leaf);
+    }
+    ProfileCount(ProfileCounter::FrustumCulls, culled);
+  }
+
+  // Occlusion query for shadow rays, stops at the first chunk of spheres that contains a hit
+  bool AnyHit(const Ray &ray, float tMin = RAY_EPSILON, float tMax = std::numeric_limits<float>::infinity()) const {
+    const ProfileScope scope(ProfileStage::AnyHit);
+    ProfileCount(ProfileCounter::AnyHitRays);
+    return FindAny(ray, tMin, tMax);
+  }
+
+  bool AnyHit(const RayD &ray, double tMin = RAY_EPSILON, double tMax = std::numeric_limits<double>::infinity()) const {
+    const ProfileScope scope(ProfileStage::AnyHit);
+    ProfileCount(ProfileCounter::AnyHitRays);
+    return FindAny(ray, tMin, tMax);
+  }
+
+private:
+  // The queries without their profiling scopes, which a top level view calls on its geometries
+  std::optional<SceneHit> FindClosest(const Ray &ray, float tMin, float tMax) const {
+    if (!instances.empty()) {
+      return FindClosestInstance(ray, tMin, tMax);
+    }
+    const SphereKernels &kernels = GetSphereKernels();
+    const SphereArrays   spheres = Arrays();
+
+    int32_t closest = -1;
+    auto    leaf    = [&](uint32_t first, uint32_t count, float tClosest) {
+      const ProfileScope leafScope(ProfileStage::Intersection);
+      const SphereHit    hit = kernels.closestHit(ray, spheres, first, first + count, tMin, tClosest);
+      ProfileCount(ProfileCounter::SphereTests, count);
+      if (hit.index < 0) {
+        return tClosest;
+      }
+      ProfileCount(ProfileCounter::SphereHits);
+      if (doubleFallback && IllConditioned(ray.origin, hit.index)) {
+        ProfileCount(ProfileCounter::DoubleFallbacks);
+        double tDouble = tClosest;
+        if (ClosestSphereDouble(static_cast<RayD>(ray), first, first + count, tMin, tDouble, closest)) {
+          return static_cast<float>(tDouble);
+        }
+        return tClosest;
+      }
+      closest = hit.index;
+      return hit.t;
+    };
+    const float t =
+      bvh.Empty() ? leaf(0, static_cast<uint32_t>(Size()), tMax)
+                  : Traverse([&](const auto &hierarchy) { return hierarchy.TraverseClosest(ray, tMin, tMax, leaf); });
+    if (closest < 0) {
+      return std::nullopt;
+    }
+    return SceneHit{t, static_cast<uint32_t>(closest)};
+  }
+
+  std::optional<SceneHitD> FindClosest(const RayD &ray, double tMin, double tMax) const {
+    if (!instances.empty()) {
+      return FindClosestInstance(ray, tMin, tMax);
+    }
+    int32_t closest  = -1;
+    double  tClosest = tMax;
+    auto    leaf     = [&](uint32_t first, uint32_t count, float) {
+      const ProfileScope leafScope(ProfileStage::Intersection);
+      ProfileCount(ProfileCounter::SphereTests, count);
+      if (ClosestSphereDouble(ray, first, first + count, tMin, tClosest, closest)) {
+        ProfileCount(ProfileCounter::SphereHits);
+      }
+      return FloatAbove(tClosest);
+    };
+    if (bvh.Empty()) {
+      leaf(0, static_cast<uint32_t>(Size()), 0);
+    } else {
+      const Ray traversalRay = static_cast<Ray>(ray);
+      Traverse([&](const auto &hierarchy) {
+        return hierarchy.TraverseClosest(traversalRay, FloatBelow(tMin), FloatAbove(tMax), leaf);
+      });
+    }
+    if (closest < 0) {
+      return std::nullopt;
+    }
+    return SceneHitD{tClosest, static_cast<uint32_t>(closest)};
+  }
+
+  // Stops at the first chunk of spheres that contains a hit
+  bool FindAny(const Ray &ray, float tMin, float tMax) const {
+    if (!instances.empty()) {
+      return FindAnyInstance(ray, tMin, tMax);
+    }
+    const SphereKernels &kernels = GetSphereKernels();
+    const SphereArrays   spheres = Arrays();
+
+    auto leaf = [&](uint32_t first, uint32_t count) {
+      const ProfileScope leafScope(ProfileStage::Intersection);
+      const SphereHit    hit = kernels.closestHit(ray, spheres, first, first + count, tMin, tMax);
+      ProfileCount(ProfileCounter::SphereTests, count);
+      if (hit.index < 0) {
+        return false;
+      }
+      ProfileCount(ProfileCounter::SphereHits);
+      if (doubleFallback && IllConditioned(ray.origin, hit.index)) {
+        ProfileCount(ProfileCounter::DoubleFallbacks);
+        double  tDouble = tMax;
+        int32_t index   = -1;
+        return ClosestSphereDouble(static_cast<RayD>(ray), first, first + count, tMin, tDouble, index);
+      }
+      return true;
+    };
+    if (!bvh.Empty()) {
+      return Traverse([&](const auto &hierarchy) { return hierarchy.TraverseAny(ray, tMin, tMax, leaf); });
+    }
+
+    constexpr size_t chunkSize = 256;
+    for (size_t begin = 0; begin < Size(); begin += chunkSize) {
+      const size_t end = std::min(Size(), begin + chunkSize);
+      if (leaf(static_cast<uint32_t>(begin), static_cast<uint32_t>(end - begin))) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  bool FindAny(const RayD &ray, double tMin, double tMax) const {
+    if (!instances.empty()) {
+      return FindAnyInstance(ray, tMin, tMax);
+    }
+    auto leaf = [&](uint32_t first, uint32_t count) {
+      const ProfileScope leafScope(ProfileStage::Intersection);
+      double             tClosest = tMax;
+      int32_t            index    = -1;
+      ProfileCount(ProfileCounter::SphereTests, count);
+      const bool hit = ClosestSphereDouble(ray, first, first + count, tMin, tClosest, index);
+      if (hit) {
+        ProfileCount(ProfileCounter::SphereHits);
+      }
+      return hit;
+    };
+    if (bvh.Empty()) {
+      return leaf(0, static_cast<uint32_t>(Size()));
+    }
+    const Ray traversalRay = static_cast<Ray>(ray);
+    return Traverse([&](const auto &hierarchy) {
+      return hierarchy.TraverseAny(traversalRay, FloatBelow(tMin), FloatAbove(tMax), leaf);
+    });
+  }
+
+  // Ray in the object space of an instance, normalized, and the object space length of a unit of world distance by
+  // which distances along it are scaled
+  template<typename T>
+  static std::pair<RayT<T>, T> ObjectRay(const SceneInstance &instance, const RayT<T> &ray) {
+    const glm::vec<3, T> direction = instance.worldToObject.Vector(ray.direction);
+    const T              scale     = glm::length(direction);
+    return {{instance.worldToObject.Point(ray.origin), direction / scale}, scale};
+  }
+
+  // Instance leaves take the ray into object space and query the geometry there. The leaves are visited in float like
+  // the sphere leaves are, double rays only use the float copy for the traversal.
+  template<typename T>
+  std::optional<SceneHitT<T>> FindClosestInstance(const RayT<T> &ray, T tMin, T tMax) const {
+    std::optional<SceneHitT<T>> closest;
+    T                           tClosest = tMax;
+    auto                        leaf     = [&](uint32_t first, uint32_t count, float) {
+      for (uint32_t i = first; i < first + count; i++) {
+        const auto [objectRay, scale] = ObjectRay(instances[i], ray);
+        const std::optional<SceneHitT<T>> hit =
+          geometries[instances[i].geometry].FindClosest(objectRay, tMin * scale, tClosest * scale);
+        if (hit) {
+          tClosest = hit->t / scale;
+          closest  = SceneHitT<T>{tClosest, hit->index, i};
+        }
+      }
+      return FloatAbove(tClosest);
+    };
+    if (bvh.Empty()) {
+      leaf(0, static_cast<uint32_t>(instances.size()), 0);
+    } else {
+      bvh.TraverseClosest(static_cast<Ray>(ray), FloatBelow(tMin), FloatAbove(tMax), leaf);
+    }
+    return closest;
+  }
+
+  template<typename T>
+  bool FindAnyInstance(const RayT<T> &ray, T tMin, T tMax) const {
+    auto leaf = [&](uint32_t first, uint32_t count) {
+      for (uint32_t i = first; i < first + count; i++) {
+        const auto [objectRay, scale] = ObjectRay(instances[i], ray);
+        if (geometries[instances[i].geometry].FindAny(objectRay, tMin * scale, tMax * scale)) {
+          return true;
+        }
+      }
+      return false;
+    };
+    if (bvh.Empty()) {
+      return leaf(0, static_cast<uint32_t>(instances.size()));
+    }
+    return bvh.TraverseAny(static_cast<Ray>(ray), FloatBelow(tMin), FloatAbove(tMax), leaf);
+  }
+
+  // Scalar double precision closest hit among the spheres [begin, end), for any direction length. Lowers tClosest and
+  // sets closest when a nearer hit than tClosest is found, and returns whether it found one.
+  bool ClosestSphereDouble(
+    const RayD &ray, size_t begin, size_t end, double tMin, double &tClosest, int32_t &closest) const {
+    const double a     = glm::dot(ray.direction, ray.direction);
+    bool         found = false;
+    for (size_t i = begin; i < end; i++) {
+      const glm::dvec3 oc           = ray.origin - glm::dvec3(centerX[i], centerY[i], centerZ[i]);
+      const double     r            = radius[i];
+      const double     halfB        = glm::dot(oc, ray.direction);
+      const double     discriminant = halfB * halfB - a * (glm::dot(oc, oc) - r * r);
+      if (discriminant < 0) {
+        continue;
+      }
+      const double root = std::sqrt(discriminant);
+      const double t0   = (-halfB - root) / a;
+      const double t1   = (-halfB + root) / a;
+      const double t    = t0 > tMin ? t0 : t1;
+      if (t > tMin && t < tClosest) {
+        tClosest = t;
+        closest  = static_cast<int32_t>(i);
+        found    = true;
+      }
+    }
+    return found;
+  }
+};
+
+
+// Spheres stored as separate aligned arrays, so the intersection loop only pulls in the fields it reads.
+// Removing spheres never shrinks the arrays and Clear() keeps their capacity, so scenes that are refilled every frame
+// stop allocating once they reach their peak size.
+// Every sphere references a material of `materials` by index, material 0 unless one is given.
+// Queries scan every sphere until BuildAccelerationStructure() is called; editing the spheres drops the hierarchy,
+// except for moving them with SetSphere(), after which UpdateAccelerationStructure() refits it for the next frame.
+// The binary BVH is always built; the wide layouts are collapsed from it when selected.
+// Queries are answered by View(), see SceneView.
+struct Scene {
+  AlignedVector<float>    centerX;
+  AlignedVector<float>    centerY;
+  AlignedVector<float>    centerZ;
+  AlignedVector<float>    radius;
+  AlignedVector<float>    radiusSquared;
+  AlignedVector<uint32_t> material;
+  MaterialTable           materials;
+  BVH                     bvh;
+  WideBVH<4>              bvh4;
+  WideBVH<8>              bvh8;
+  BVHLayout               layout         = BVHLayout::Binary;
+  bool                    doubleFallback = true; // recompute ill-conditioned float intersections in double
+
+  size_t Size() const { return centerX.size(); }
+
+  void Reserve(size_t count) {
+    centerX.reserve(count);
+    centerY.reserve(count);
+    centerZ.reserve(count);
+    radius.reserve(count);
+    radiusSquared.reserve(count);
+    material.reserve(count);
+  }
+
+  // Removes the spheres, the materials stay
+  void Clear() {
+    ClearAccelerationStructure();
+    centerX.clear();
+    centerY.clear();
+    centerZ.clear();
+    radius.clear();
+    radiusSquared.clear();
+    material.clear();
+  }
+
+  uint32_t AddMaterial(const Material &added) { return materials.Add(added); }
+
+  uint32_t AddSphere(const Sphere &sphere, uint32_t materialIndex = 0) {
+    ClearAccelerationStructure();
+    if (Size() == centerX.capacity()) {
+      Reserve(std::max<size_t>(64, Size() * 2));
+    }
+    centerX.push_back(sphere.position.x);
+    centerY.push_back(sphere.position.y);
+    centerZ.push_back(sphere.position.z);
+    radius.push_back(sphere.radius);
+    radiusSquared.push_back(sphere.radius * sphere.radius);
+    material.push_back(materialIndex);
+    return static_cast<uint32_t>(Size() - 1);
+  }
+
+  // Grows the arrays at most once for the whole batch
+  void AddSpheres(std::span<const Sphere> spheres, uint32_t materialIndex = 0) {
+    if (Size() + spheres.size() > centerX.capacity()) {
+      Reserve(std::max(Size() + spheres.size(), Size() * 2));
+    }
+    for (const Sphere &sphere: spheres) {
+      AddSphere(sphere, materialIndex);
+    }
+  }
+
+  // Moves the last sphere into the hole, so the index of the previously last sphere changes
+  void RemoveSphere(size_t index) {
+    ClearAccelerationStructure();
+    const size_t last = Size() - 1;
+    centerX[index]       = centerX[last];
+    centerY[index]       = centerY[last];
+    centerZ[index]       = centerZ[last];
+    radius[index]        = radius[last];
+    radiusSquared[index] = radiusSquared[last];
+    material[index]      = material[last];
+    centerX.pop_back();
+    centerY.pop_back();
+    centerZ.pop_back();
+    radius.pop_back();
+    radiusSquared.pop_back();
+    material.pop_back();
+  }
+
+  // Removes every sphere for which `predicate(index)` holds in a single pass, keeping the order of the rest
+  template<typename Predicate>
+  size_t RemoveSpheresIf(Predicate &&predicate) {
+    ClearAccelerationStructure();
+    size_t kept = 0;
+    for (size_t i = 0; i < Size(); i++) {
+      if (predicate(i)) {
+        continue;
+      }
+      centerX[kept]       = centerX[i];
+      centerY[kept]       = centerY[i];
+      centerZ[kept]       = centerZ[i];
+      radius[kept]        = radius[i];
+      radiusSquared[kept] = radiusSquared[i];
+      material[kept]      = material[i];
+      kept++;
+    }
+    const size_t removed = Size() - kept;
+    centerX.resize(kept);
+    centerY.resize(kept);
+    centerZ.resize(kept);
+    radius.resize(kept);
+    radiusSquared.resize(kept);
+    material.resize(kept);
+    return removed;
+  }
+
+  Sphere GetSphere(size_t index) const { return {radius[index], {centerX[index], centerY[index], centerZ[index]}}; }
+
+  // Moves or resizes a sphere in place. The hierarchy is kept but its boxes are stale, and queries may miss the sphere,
+  // until UpdateAccelerationStructure().
+  void SetSphere(size_t index, const Sphere &sphere) {
+    centerX[index]       = sphere.position.x;
+    centerY[index]       = sphere.position.y;
+    centerZ[index]       = sphere.position.z;
+    radius[index]        = sphere.radius;
+    radiusSquared[index] = sphere.radius * sphere.radius;
+  }
+
+  SceneView View() const {
+    return {
+      centerX, centerY, centerZ, radius, radiusSquared, material, materials.View(), bvh.View(), &bvh4, &bvh8, layout,
+      doubleFallback, {}, nullptr};
+  }
+
+  template<typename T>
+  glm::vec<3, T> Normal(uint32_t index, const glm::vec<3, T> &point) const {
+    return View().Normal(index, point);
+  }
+
+  bool IllConditioned(const glm::vec3 &origin, uint32_t index) const { return View().IllConditioned(origin, index); }
+
+  SphereArrays Arrays() const { return View().Arrays(); }
+
+  std::optional<SceneHit> ClosestHit(
+    const Ray &ray, float tMin = RAY_EPSILON, float tMax = std::numeric_limits<float>::infinity()) const {
+    return View().ClosestHit(ray, tMin, tMax);
+  }
+
+  std::optional<SceneHitD> ClosestHit(
+    const RayD &ray, double tMin = RAY_EPSILON, double tMax = std::numeric_limits<double>::infinity()) const {
+    return View().ClosestHit(ray, tMin, tMax);
+  }
+
+  template<int Side>
+  void ClosestHit(
+    const RayPacket<Side> &packet, PacketHits<Side> &hits, float tMin = RAY_EPSILON,
+    float tMax = std::numeric_limits<float>::infinity()) const {
+    View().ClosestHit(packet, hits, tMin, tMax);
+  }
+
+  bool AnyHit(const Ray &ray, float tMin = RAY_EPSILON, float tMax = std::numeric_limits<float>::infinity()) const {
+    return View().AnyHit(ray, tMin, tMax);
+  }
+
+  bool AnyHit(const RayD &ray, double tMin = RAY_EPSILON, double tMax = std::numeric_limits<double>::infinity()) const {
+    return View().AnyHit(ray, tMin, tMax);
+  }
+
+  AABB SphereBounds(size_t index) const {
+    const glm::vec3 center = {centerX[index], centerY[index], centerZ[index]};
+    return {center - radius[index], center + radius[index]};
+  }
+
+  void ClearAccelerationStructure() {
+    bvh.Clear();
+    bvh4.Clear();
+    bvh8.Clear();
+  }
+
+  // Builds the BVH and reorders the spheres so that every leaf covers a contiguous range of the arrays, which the
+  // SIMD kernels then consume directly. Sphere indices change; bvh.primitiveIndices maps new slots to old indices.
+  void BuildAccelerationStructure(ThreadPool *pool = nullptr, BVHLayout bvhLayout = BVHLayout::Binary) {
+    ClearAccelerationStructure();
+    layout = bvhLayout;
+    std::vector<AABB> bounds(Size());
+    for (size_t i = 0; i < Size(); i++) {
+      bounds[i] = SphereBounds(i);
+    }
+    bvh.Build(bounds, pool);
+
+    auto permute = [&]<typename T>(AlignedVector<T> &values) {
+      AlignedVector<T> reordered(values.size());
+      for (size_t i = 0; i < values.size(); i++) {
+        reordered[i] = values[bvh.primitiveIndices[i]];
+      }
+      values.swap(reordered);
+    };
+    permute(centerX);
+    permute(centerY);
+    permute(centerZ);
+    permute(radius);
+    permute(radiusSquared);
+    permute(material);
+
+    if (layout == BVHLayout::Wide4) {
+      bvh4.Build(bvh);
+    } else if (layout == BVHLayout::Wide8) {
+      bvh8.Build(bvh);
+    }
+  }
+
+  // Brings the hierarchy up to date after SetSphere(), for animations that move the spheres every frame: refits it and
+  // rebuilds only the subtrees that degraded past `rebuildThreshold`, see BVH::Update(). The spheres of a rebuilt
+  // subtree are reordered within its range, so their current indices, the ones SetSphere() takes, change.
+  // bvh.primitiveIndices maps every slot to the index the sphere had before the last full build, which stays stable
+  // across updates; callers that animate by those ids find the current slot through it. Builds the hierarchy when
+  // there is none.
+  void UpdateAccelerationStructure(ThreadPool *pool = nullptr, float rebuildThreshold = BVH::REBUILD_THRESHOLD) {
+    if (bvh.Empty()) {
+      BuildAccelerationStructure(pool, layout);
+      return;
+    }
+    primitiveBounds.resize(Size());
+    auto computeBounds = [&](int64_t first, int64_t last) {
+      for (int64_t i = first; i < last; i++) {
+        primitiveBounds[bvh.primitiveIndices[i]] = SphereBounds(i);
+      }
+    };
+    if (pool) {
+      ParallelFor(*pool, 0, static_cast<int64_t>(Size()), 1 << 14, computeBounds);
+    } else {
+      computeBounds(0, static_cast<int64_t>(Size()));
+    }
+
+    bvh.Update(primitiveBounds, pool, rebuildThreshold, [&](uint32_t first, std::span<const uint32_t> previous) {
+      // The range still holds the spheres in their previous order
+      reorderSource.resize(Size());
+      for (uint32_t i = 0; i < previous.size(); i++) {
+        reorderSource[previous[i]] = first + i;
+      }
+      auto permute = [&]<typename T>(AlignedVector<T> &values, std::vector<T> &scratch) {
+        scratch.resize(previous.size());
+        for (uint32_t i = 0; i < previous.size(); i++) {
+          scratch[i] = values[reorderSource[bvh.primitiveIndices[first + i]]];
+        }
+        std::copy(scratch.begin(), scratch.end(), values.begin() + first);
+      };
+      permute(centerX, floatScratch);
+      permute(centerY, floatScratch);
+      permute(centerZ, floatScratch);
+      permute(radius, floatScratch);
+      permute(radiusSquared, floatScratch);
+      permute(material, materialScratch);
+    });
+
+    if (layout == BVHLayout::Wide4) {
+      bvh4.Build(bvh);
+    } else if (layout == BVHLayout::Wide8) {
+      bvh8.Build(bvh);
+    }
+  }
+
+private:
+  // Scratch of UpdateAccelerationStructure(), kept to not allocate every frame
+  std::vector<AABB>     primitiveBounds;
+  std::vector<uint32_t> reorderSource;
+  std::vector<float>    floatScratch;
+  std::vector<uint32_t> materialScratch;
+};
+
+#endif // SCENE_H
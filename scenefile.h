@@ -0,0 +1,496 @@
+#ifndef SCENEFILE_H
+#define SCENEFILE_H
+#include <algorithm>
+#include <bit>
+#include <cerrno>
+#include <charconv>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <fmt/core.h>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <type_traits>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+#include "bvh.h"
+#include "instancing.h"
+#include "material.h"
+#include "random.h"
+#include "scene.h"
+#include "simd.h"
+#include "sphere.h"
+
+
+// Camera and image parameters that travel with a scene
+struct SceneSettings {
+  float   fov    = 45.0f;
+  int32_t width  = 8;
+  int32_t height = 4;
+};
+
+
+// Text scene description, one statement per line, `#` starts a comment:
+//   camera <fov in degrees>
+//   image <width> <height>
+//   material <name> diffuse <r> <g> <b>
+//   material <name> conductor <r> <g> <b> <roughness>
+//   material <name> dielectric <r> <g> <b> <index of refraction>
+//   material <name> emissive <r> <g> <b>
+//   sphere <radius> <x> <y> <z> [<material name>]
+//   geometry <name>
+//   end
+//   instance <geometry name> <m00> <m01> <m02> <m03> <m10> <m11> <m12> <m13> <m20> <m21> <m22> <m23>
+// A material is defined before the spheres that use it; spheres without one get the default diffuse material.
+// Spheres and materials are appended to `scene`; the acceleration structure is left to the caller.
+// The spheres between `geometry` and `end` go into a geometry of `instanced` instead, in its own object space, and
+// every `instance` statement places the last geometry of that name with the rows of a 3x4 object to world matrix.
+// Without `instanced` these statements are errors.
+inline bool
+LoadSceneText(const std::string &path, Scene &scene, SceneSettings &settings, InstancedScene *instanced = nullptr) {
+  FILE *file = std::fopen(path.c_str(), "rb");
+  if (!file) {
+    fmt::println("scene {}: {}", path, std::strerror(errno));
+    return false;
+  }
+  std::string text;
+  char        buffer[1 << 16];
+  for (size_t read; (read = std::fread(buffer, 1, sizeof(buffer), file)) > 0;) {
+    text.append(buffer, read);
+  }
+  std::fclose(file);
+
+  struct NamedMaterial {
+    std::string_view name;
+    Material         material;
+    uint32_t         index; // in `scene`
+  };
+  std::vector<Sphere>                                 spheres;
+  std::vector<uint32_t>                               sphereMaterials;
+  std::vector<NamedMaterial>                          materialNames;
+  std::vector<std::pair<std::string_view, uint32_t>> geometryNames;
+  std::optional<uint32_t>                             openGeometry; // between `geometry` and `end`
+  // Per materialNames entry, its index in the open geometry, or 0 until a sphere of the geometry uses it
+  std::vector<uint32_t> geometryMaterials;
+  size_t                lineNumber = 0;
+  for (size_t begin = 0; begin < text.size();) {
+    const size_t           end       = std::min(text.find('\n', begin), text.size());
+    const std::string_view statement = std::string_view(text).substr(begin, end - begin);
+    std::string_view       line      = statement;
+    begin                            = end + 1;
+    lineNumber++;
+    line = line.substr(0, line.find('#'));
+
+    // Splits off the next whitespace separated token
+    auto next = [&line]() {
+      const size_t first = line.find_first_not_of(" \t\r");
+      if (first == std::string_view::npos) {
+        line = {};
+        return std::string_view();
+      }
+      line                          = line.substr(first);
+      const size_t           length = std::min(line.find_first_of(" \t\r"), line.size());
+      const std::string_view token  = line.substr(0, length);
+      line                          = line.substr(length);
+      return token;
+    };
+    auto number = [&next]<typename T>(T &value) {
+      const std::string_view token  = next();
+      const auto             result = std::from_chars(token.data(), token.data() + token.size(), value);
+      return !token.empty() && result.ec == std::errc() && result.ptr == token.data() + token.size();
+    };
+
+    const std::string_view keyword = next();
+    if (keyword.empty()) {
+      continue;
+    }
+    bool valid = false;
+    if (keyword == "camera") {
+      valid = number(settings.fov);
+    } else if (keyword == "image") {
+      valid = number(settings.width) && number(settings.height) && settings.width > 0 && settings.height > 0;
+    } else if (keyword == "material") {
+      const std::string_view            name = next();
+      const std::optional<MaterialType> type = MaterialTypeFromName(next());
+      Material                          material;
+      valid = !name.empty() && type && number(material.color.x) && number(material.color.y) &&
+              number(material.color.z);
+      if (valid) {
+        material.type = *type;
+        if (material.type == MaterialType::Conductor) {
+          valid = number(material.roughness);
+        } else if (material.type == MaterialType::Dielectric) {
+          valid = number(material.ior) && material.ior > 0;
+        }
+      }
+      if (valid) {
+        materialNames.push_back({name, material, scene.AddMaterial(material)});
+        geometryMaterials.push_back(0);
+      }
+    } else if (keyword == "sphere") {
+      Sphere sphere;
+      valid = number(sphere.radius) && number(sphere.position.x) && number(sphere.position.y) &&
+              number(sphere.position.z);
+      const NamedMaterial   *named = nullptr;
+      const std::string_view name  = next();
+      if (valid && !name.empty()) {
+        // The latest definition of a name wins
+        const auto found = std::find_if(
+          materialNames.rbegin(), materialNames.rend(), [&](const auto &entry) { return entry.name == name; });
+        valid = found != materialNames.rend();
+        named = valid ? &*found : nullptr;
+      }
+      if (valid && openGeometry) {
+        // Geometries carry their own material tables, a material is copied into one when a sphere first uses it
+        Scene   &geometry = instanced->geometries[*openGeometry];
+        uint32_t material = 0;
+        if (named) {
+          uint32_t &copied = geometryMaterials[named - materialNames.data()];
+          copied           = copied != 0 ? copied : geometry.AddMaterial(named->material);
+          material         = copied;
+        }
+        geometry.AddSphere(sphere, material);
+      } else if (valid) {
+        spheres.push_back(sphere);
+        sphereMaterials.push_back(named ? named->index : 0);
+      }
+    } else if (keyword == "geometry") {
+      const std::string_view name = next();
+      valid                       = instanced && !openGeometry && !name.empty();
+      if (valid) {
+        openGeometry = instanced->AddGeometry(Scene());
+        geometryNames.emplace_back(name, *openGeometry);
+        geometryMaterials.assign(materialNames.size(), 0);
+      }
+    } else if (keyword == "end") {
+      valid = openGeometry.has_value();
+      openGeometry.reset();
+    } else if (keyword == "instance") {
+      const std::string_view name  = next();
+      const auto             found = std::find_if(
+        geometryNames.rbegin(), geometryNames.rend(), [&](const auto &entry) { return entry.first == name; });
+      glm::mat4 objectToWorld(1);
+      valid = instanced && !openGeometry && found != geometryNames.rend();
+      for (int row = 0; row < 3 && valid; row++) {
+        for (int column = 0; column < 4 && valid; column++) {
+          valid = number(objectToWorld[column][row]);
+        }
+      }
+      valid = valid && glm::determinant(glm::mat3(objectToWorld)) != 0;
+      if (valid) {
+        instanced->AddInstance(found->second, objectToWorld);
+      }
+    }
+    if (!valid || !next().empty()) {
+      fmt::println("scene {}:{}: cannot parse '{}'", path, lineNumber, statement);
+      return false;
+    }
+  }
+  if (openGeometry) {
+    fmt::println("scene {}: geometry without end", path);
+    return false;
+  }
+  scene.Reserve(scene.Size() + spheres.size());
+  for (size_t i = 0; i < spheres.size(); i++) {
+    scene.AddSphere(spheres[i], sphereMaterials[i]);
+  }
+  return true;
+}
+
+
+// Binary scene cache: a fixed header followed by the sphere arrays, the material table and the flattened BVH nodes,
+// exactly as Scene holds them after BuildAccelerationStructure(). Every section starts on a cache line, so a mapping of
+// the file is used in place by MappedScene without parsing or copying.
+constexpr char     SCENE_FILE_MAGIC[8]   = {'P', 'T', 'S', 'C', 'E', 'N', 'E', '\0'};
+constexpr uint32_t SCENE_FILE_VERSION    = 2; // 2 added the materials
+constexpr uint32_t SCENE_FILE_BYTE_ORDER = 0x01020304;
+constexpr size_t   SCENE_FILE_ALIGNMENT  = 64;
+
+struct SceneFileSection {
+  uint64_t offset;
+  uint64_t size;
+};
+
+struct alignas(SCENE_FILE_ALIGNMENT) SceneFileHeader {
+  char             magic[8];
+  uint32_t         version;
+  uint32_t         byteOrder; // SCENE_FILE_BYTE_ORDER as stored by the writer, rejects files from the other endianness
+  uint64_t         fileSize;
+  uint64_t         checksum; // SceneChecksum() of everything after the header
+  SceneSettings    settings;
+  uint32_t         sphereCount;
+  uint32_t         nodeCount;
+  uint32_t         materialCount;
+  SceneFileSection centerX, centerY, centerZ, radius, radiusSquared, material, nodes;
+  SceneFileSection materialType, materialColorR, materialColorG, materialColorB, materialRoughness, materialIor;
+};
+static_assert(std::is_trivially_copyable_v<SceneFileHeader> && sizeof(SceneFileHeader) % SCENE_FILE_ALIGNMENT == 0);
+
+
+// 64 bit hash of the 8 byte words of `data` in four independent lanes, so validating a mapped file costs little more
+// than faulting its pages in. A trailing partial word is zero padded.
+inline uint64_t SceneChecksum(std::span<const uint8_t> data) {
+  constexpr uint64_t MULTIPLIER = 0x9e3779b97f4a7c15ull;
+  uint64_t           lanes[4]   = {1, 2, 3, 4};
+  const size_t       words      = data.size() / 8;
+  size_t             i          = 0;
+  for (; i + 4 <= words; i += 4) {
+    for (int lane = 0; lane < 4; lane++) {
+      uint64_t word;
+      std::memcpy(&word, data.data() + (i + lane) * 8, 8);
+      lanes[lane] = (lanes[lane] ^ word) * MULTIPLIER;
+      lanes[lane] ^= lanes[lane] >> 29;
+    }
+  }
+  for (; i * 8 < data.size(); i++) {
+    uint64_t word = 0;
+    std::memcpy(&word, data.data() + i * 8, std::min<size_t>(8, data.size() - i * 8));
+    lanes[0] = (lanes[0] ^ word) * MULTIPLIER;
+    lanes[0] ^= lanes[0] >> 29;
+  }
+  return MixBits(lanes[0] ^ MixBits(lanes[1] ^ MixBits(lanes[2] ^ MixBits(lanes[3] ^ data.size()))));
+}
+
+
+// The spheres, materials and binary BVH of `scene` as the bytes of a binary scene cache. Wide layouts are not stored,
+// a mapped scene is always traversed through the binary BVH.
+inline std::vector<uint8_t> SceneFileBytes(const Scene &scene, const SceneSettings &settings) {
+  SceneFileHeader header;
+  std::memset(static_cast<void *>(&header), 0, sizeof(header)); // padding included, so equal scenes give equal files
+  std::memcpy(header.magic, SCENE_FILE_MAGIC, sizeof(SCENE_FILE_MAGIC));
+  header.version       = SCENE_FILE_VERSION;
+  header.byteOrder     = SCENE_FILE_BYTE_ORDER;
+  header.settings      = settings;
+  header.sphereCount   = static_cast<uint32_t>(scene.Size());
+  header.nodeCount     = static_cast<uint32_t>(scene.bvh.nodes.size());
+  header.materialCount = static_cast<uint32_t>(scene.materials.Size());
+
+  size_t end     = sizeof(SceneFileHeader);
+  auto   section = [&](size_t size) {
+    const SceneFileSection placed = {end, size};
+    end += (size + SCENE_FILE_ALIGNMENT - 1) / SCENE_FILE_ALIGNMENT * SCENE_FILE_ALIGNMENT;
+    return placed;
+  };
+  const size_t arrayBytes = scene.Size() * sizeof(float);
+  header.centerX          = section(arrayBytes);
+  header.centerY          = section(arrayBytes);
+  header.centerZ          = section(arrayBytes);
+  header.radius           = section(arrayBytes);
+  header.radiusSquared    = section(arrayBytes);
+  header.material         = section(scene.Size() * sizeof(uint32_t));
+  header.nodes            = section(scene.bvh.nodes.size() * sizeof(BVHNode));
+
+  const size_t materialBytes = scene.materials.Size() * sizeof(float);
+  header.materialType        = section(scene.materials.Size() * sizeof(MaterialType));
+  header.materialColorR      = section(materialBytes);
+  header.materialColorG      = section(materialBytes);
+  header.materialColorB      = section(materialBytes);
+  header.materialRoughness   = section(materialBytes);
+  header.materialIor         = section(materialBytes);
+  header.fileSize            = end;
+
+  std::vector<uint8_t> bytes(end, 0);
+  auto                 copy = [&](const SceneFileSection &target, const void *source) {
+    if (target.size > 0) {
+      std::memcpy(bytes.data() + target.offset, source, target.size);
+    }
+  };
+  copy(header.centerX, scene.centerX.data());
+  copy(header.centerY, scene.centerY.data());
+  copy(header.centerZ, scene.centerZ.data());
+  copy(header.radius, scene.radius.data());
+  copy(header.radiusSquared, scene.radiusSquared.data());
+  copy(header.material, scene.material.data());
+  copy(header.nodes, scene.bvh.nodes.data());
+  copy(header.materialType, scene.materials.type.data());
+  copy(header.materialColorR, scene.materials.colorR.data());
+  copy(header.materialColorG, scene.materials.colorG.data());
+  copy(header.materialColorB, scene.materials.colorB.data());
+  copy(header.materialRoughness, scene.materials.roughness.data());
+  copy(header.materialIor, scene.materials.ior.data());
+  header.checksum = SceneChecksum(std::span(bytes).subspan(sizeof(SceneFileHeader)));
+  std::memcpy(bytes.data(), &header, sizeof(header));
+  return bytes;
+}
+
+inline bool WriteSceneFile(const std::string &path, const Scene &scene, const SceneSettings &settings) {
+  const std::vector<uint8_t> bytes = SceneFileBytes(scene, settings);
+  FILE                      *file  = std::fopen(path.c_str(), "wb");
+  if (!file) {
+    fmt::println("scene {}: {}", path, std::strerror(errno));
+    return false;
+  }
+  const bool written = std::fwrite(bytes.data(), 1, bytes.size(), file) == bytes.size();
+  if (std::fclose(file) != 0 || !written) {
+    fmt::println("scene {}: write failed", path);
+    return false;
+  }
+  return true;
+}
+
+
+// Read only mapping of a binary scene cache. View() points straight into the mapping, so opening a scene costs one
+// mmap() plus, when verifying, one pass over the file for the checksum and the node ranges. Without verification
+// pages are only faulted in as rays reach them.
+class MappedScene {
+public:
+  explicit MappedScene(const std::string &path, bool verify = true) : path(path) {
+    const int file = open(path.c_str(), O_RDONLY);
+    if (file < 0) {
+      Fail(std::strerror(errno));
+      return;
+    }
+    struct stat status;
+    if (fstat(file, &status) != 0 || static_cast<size_t>(status.st_size) < sizeof(SceneFileHeader)) {
+      close(file);
+      Fail("not a scene file");
+      return;
+    }
+    size        = static_cast<size_t>(status.st_size);
+    void *bytes = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, file, 0);
+    close(file);
+    if (bytes == MAP_FAILED) {
+      Fail(std::strerror(errno));
+      return;
+    }
+    mapping = static_cast<const uint8_t *>(bytes);
+    Open(verify);
+  }
+
+  // A scene cache received in memory, e.g. over a socket, used in place like a mapped file. `name` stands in for the
+  // path in error messages.
+  MappedScene(AlignedVector<uint8_t> &&bytes, const std::string &name, bool verify = true) :
+      path(name), owned(std::move(bytes)) {
+    if (owned.size() < sizeof(SceneFileHeader)) {
+      Fail("not a scene file");
+      return;
+    }
+    mapping = owned.data();
+    size    = owned.size();
+    Open(verify);
+  }
+
+  MappedScene(const MappedScene &)            = delete;
+  MappedScene &operator=(const MappedScene &) = delete;
+
+  ~MappedScene() {
+    if (mapping && owned.empty()) {
+      munmap(const_cast<uint8_t *>(mapping), size);
+    }
+  }
+
+  bool IsOpen() const { return mapping && !failed; }
+
+  const SceneView     &View() const { return view; }
+  const SceneSettings &Settings() const { return settings; }
+
+  // The whole cache as stored, to pass it on unchanged
+  std::span<const uint8_t> Bytes() const { return {mapping, size}; }
+
+private:
+  void Open(bool verify) {
+    SceneFileHeader header;
+    std::memcpy(&header, mapping, sizeof(header));
+    if (std::memcmp(header.magic, SCENE_FILE_MAGIC, sizeof(SCENE_FILE_MAGIC)) != 0) {
+      Fail("not a scene file");
+      return;
+    }
+    if (header.version != SCENE_FILE_VERSION || header.byteOrder != SCENE_FILE_BYTE_ORDER) {
+      Fail("written by an incompatible version or byte order");
+      return;
+    }
+    if (header.fileSize != size) {
+      Fail("truncated");
+      return;
+    }
+    if (verify && SceneChecksum({mapping + sizeof(header), size - sizeof(header)}) != header.checksum) {
+      Fail("checksum mismatch");
+      return;
+    }
+
+    settings           = header.settings;
+    view.centerX       = Section<float>(header.centerX, header.sphereCount);
+    view.centerY       = Section<float>(header.centerY, header.sphereCount);
+    view.centerZ       = Section<float>(header.centerZ, header.sphereCount);
+    view.radius        = Section<float>(header.radius, header.sphereCount);
+    view.radiusSquared = Section<float>(header.radiusSquared, header.sphereCount);
+    view.material      = Section<uint32_t>(header.material, header.sphereCount);
+    view.bvh.nodes     = Section<BVHNode>(header.nodes, header.nodeCount);
+
+    MaterialView &materials = view.materials;
+    materials.type          = Section<MaterialType>(header.materialType, header.materialCount);
+    materials.colorR        = Section<float>(header.materialColorR, header.materialCount);
+    materials.colorG        = Section<float>(header.materialColorG, header.materialCount);
+    materials.colorB        = Section<float>(header.materialColorB, header.materialCount);
+    materials.roughness     = Section<float>(header.materialRoughness, header.materialCount);
+    materials.ior           = Section<float>(header.materialIor, header.materialCount);
+    if (verify && !ValidNodes()) {
+      Fail("BVH references nodes or spheres out of range");
+    }
+    if (verify && !ValidMaterials()) {
+      Fail("spheres reference materials out of range");
+    }
+  }
+
+  template<typename T>
+  std::span<const T> Section(const SceneFileSection &section, size_t count) {
+    if (section.size != count * sizeof(T) || section.offset % alignof(T) != 0 || section.offset > size ||
+        section.size > size - section.offset) {
+      Fail("section out of range");
+      return {};
+    }
+    return {reinterpret_cast<const T *>(mapping + section.offset), count};
+  }
+
+  // Every inner node must point forward to a right child and every leaf into the sphere arrays
+  bool ValidNodes() const {
+    const std::span<const BVHNode> nodes = view.bvh.nodes;
+    for (size_t i = 0; i < nodes.size(); i++) {
+      const BVHNode &node = nodes[i];
+      if (node.IsLeaf() ? static_cast<uint64_t>(node.leftOrFirst) + node.count > view.Size()
+                        : node.leftOrFirst <= i + 1 || node.leftOrFirst >= nodes.size()) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // Every sphere must reference a material and every material must have a known type
+  bool ValidMaterials() const {
+    for (const uint32_t material: view.material) {
+      if (material >= view.materials.Size()) {
+        return false;
+      }
+    }
+    for (const MaterialType type: view.materials.type) {
+      if (static_cast<uint32_t>(type) >= static_cast<uint32_t>(MaterialType::Count)) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  void Fail(const char *message) {
+    if (!failed) {
+      fmt::println("scene {}: {}", path, message);
+    }
+    failed = true;
+  }
+
+  std::string            path;
+  AlignedVector<uint8_t> owned; // bytes received in memory, empty for a mapped file
+  const uint8_t         *mapping = nullptr;
+  size_t                 size    = 0;
+  bool                   failed  = false;
+  SceneSettings          settings;
+  SceneView              view;
+};
+
+#endif // SCENEFILE_H
@@ -0,0 +1,189 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <fmt/core.h>
+#include <memory_resource>
+#include <tuple>
+#include <vector>
+
+#include "arena.h"
+#include "profiler.h"
+#include "threadpool.h"
+
+
+// Half open pixel rectangle [x0, x1) x [y0, y1)
+struct Tile {
+  int x0, y0, x1, y1;
+
+  int Width() const { return x1 - x0; }
+  int Height() const { return y1 - y0; }
+  int PixelCount() const { return Width() * Height(); }
+};
+
+enum class TileOrder {
+  Scanline,
+  Morton, // Z-order, keeps consecutive tiles close together in memory and in the scene
+  Spiral, // center outwards, shows the interesting part of a preview first
+};
+
+inline uint32_t MortonCode2D(uint32_t x, uint32_t y) {
+  auto spread = [](uint32_t v) {
+    v &= 0x0000ffff;
+    v = (v | (v << 8)) & 0x00ff00ff;
+    v = (v | (v << 4)) & 0x0f0f0f0f;
+    v = (v | (v << 2)) & 0x33333333;
+    v = (v | (v << 1)) & 0x55555555;
+    return v;
+  };
+  return spread(x) | (spread(y) << 1);
+}
+
+// The list and its sorting scratch are allocated from `resource`, e.g. the frame arena of a TileScheduler
+inline std::pmr::vector<Tile> MakeTiles(
+  int imageWidth, int imageHeight, int tileSize, TileOrder order,
+  std::pmr::memory_resource *resource = std::pmr::get_default_resource()) {
+  const int tilesX = (imageWidth + tileSize - 1) / tileSize;
+  const int tilesY = (imageHeight + tileSize - 1) / tileSize;
+
+  struct KeyedTile {
+    float key0, key1;
+    Tile  tile;
+  };
+  std::pmr::vector<KeyedTile> keyed(resource);
+  keyed.reserve(tilesX * tilesY);
+  for (int ty = 0; ty < tilesY; ty++) {
+    for (int tx = 0; tx < tilesX; tx++) {
+      const Tile tile = {
+        tx * tileSize, ty * tileSize, std::min(imageWidth, (tx + 1) * tileSize),
+        std::min(imageHeight, (ty + 1) * tileSize)};
+      const float dx = tx - (tilesX - 1) / 2.0f;
+      const float dy = ty - (tilesY - 1) / 2.0f;
+      switch (order) {
+        case TileOrder::Scanline:
+          keyed.push_back({static_cast<float>(ty * tilesX + tx), 0, tile});
+          break;
+        case TileOrder::Morton:
+          keyed.push_back({static_cast<float>(MortonCode2D(tx, ty)), 0, tile});
+          break;
+        case TileOrder::Spiral:
+          // ring index first, then angle around the center
+          keyed.push_back({std::max(std::abs(dx), std::abs(dy)), std::atan2(dy, dx), tile});
+          break;
+      }
+    }
+  }
+  // Ties fall back to scanline order. std::stable_sort would give the same order but takes its buffer from the global
+  // allocator on every call.
+  std::sort(keyed.begin(), keyed.end(), [](const KeyedTile &a, const KeyedTile &b) {
+    return std::tie(a.key0, a.key1, a.tile.y0, a.tile.x0) < std::tie(b.key0, b.key1, b.tile.y0, b.tile.x0);
+  });
+
+  std::pmr::vector<Tile> tiles(resource);
+  tiles.reserve(keyed.size());
+  for (const KeyedTile &k: keyed) {
+    tiles.push_back(k.tile);
+  }
+  return tiles;
+}
+
+
+// Dispatches tiles over a ThreadPool. The render function writes its tile straight into the caller's framebuffer;
+// tiles never overlap so no locking is needed.
+// Every thread has an arena for transient data. Render() resets them all when it starts, so whatever the render
+// function allocates from ThreadArena() lives until the next frame unless an ArenaScope releases it earlier.
+class TileScheduler {
+public:
+  struct alignas(64) ThreadStatistics {
+    uint64_t tiles       = 0;
+    uint64_t pixels      = 0;
+    uint64_t stolen      = 0; // tasks this thread took from another thread's queue
+    double   busySeconds = 0;
+  };
+
+  TileScheduler(ThreadPool &pool, int tileSize = 32, TileOrder order = TileOrder::Morton) :
+      tileSize(tileSize), order(order), pool(pool), arenas(pool), statistics(pool.ThreadCount() + 1),
+      stolenBefore(pool.ThreadCount() + 1) {}
+
+  // Calls `render(tile, threadIndex)` once per tile, threadIndex is in [0, ThreadCount()]. The statistics add up over
+  // the calls until ResetStatistics().
+  template<typename Function>
+  void Render(int imageWidth, int imageHeight, Function &&render) {
+    arenas.ResetAll();
+    const std::pmr::vector<Tile> tiles = MakeTiles(imageWidth, imageHeight, tileSize, order, &arenas.Local());
+    for (unsigned i = 0; i <= pool.ThreadCount(); i++) {
+      stolenBefore[i] = pool.Statistics(i).tasksStolen.load(std::memory_order_relaxed);
+    }
+
+    // Deal tiles round robin so every queue starts with work in the requested order
+    std::atomic<int64_t> remaining = static_cast<int64_t>(tiles.size());
+    for (size_t i = 0; i < tiles.size(); i++) {
+      pool.SubmitTo(i % pool.ThreadCount(), [this, &tiles, &render, &remaining, i] {
+        const unsigned threadIndex = pool.CurrentThreadIndex();
+        const auto     start       = std::chrono::steady_clock::now();
+        {
+          const ProfileTraceScope trace("tile", tiles[i].x0, tiles[i].y0);
+          render(tiles[i], threadIndex);
+        }
+        const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+        ThreadStatistics &threadStatistics = statistics[threadIndex];
+        threadStatistics.tiles++;
+        threadStatistics.pixels += tiles[i].PixelCount();
+        threadStatistics.busySeconds += elapsed.count();
+        remaining.fetch_sub(1, std::memory_order_release);
+      });
+    }
+    while (remaining.load(std::memory_order_acquire) > 0) {
+      if (!pool.TryRunOne()) {
+        std::this_thread::yield();
+      }
+    }
+    for (unsigned i = 0; i <= pool.ThreadCount(); i++) {
+      statistics[i].stolen += pool.Statistics(i).tasksStolen.load(std::memory_order_relaxed) - stolenBefore[i];
+    }
+  }
+
+  const std::vector<ThreadStatistics> &Statistics() const { return statistics; }
+
+  void ResetStatistics() { std::fill(statistics.begin(), statistics.end(), ThreadStatistics{}); }
+
+  // Frame arena of a thread, indexed like the threadIndex passed to the render function
+  Arena &ThreadArena(unsigned threadIndex) { return arenas[threadIndex]; }
+
+  // Per thread tile counts and busy time. The spread between the busiest and the idlest thread is the load imbalance.
+  void PrintStatistics() const {
+    const bool rendered =
+      std::any_of(statistics.begin(), statistics.end(), [](const ThreadStatistics &s) { return s.tiles > 0; });
+    if (!rendered) {
+      fmt::println("no tiles rendered");
+      return;
+    }
+    double busiest = 0, total = 0;
+    for (size_t i = 0; i < statistics.size(); i++) {
+      const ThreadStatistics &s = statistics[i];
+      fmt::println(
+        "thread {:3}: {:6} tiles {:10} pixels {:8.3f} ms busy {:6} stolen", i, s.tiles, s.pixels,
+        s.busySeconds * 1000.0, s.stolen);
+      busiest = std::max(busiest, s.busySeconds);
+      total += s.busySeconds;
+    }
+    const size_t activeThreads = pool.ThreadCount() + (statistics.back().tiles > 0 ? 1 : 0);
+    const double mean          = total / activeThreads;
+    fmt::println("load balance (mean / max busy): {:.3f}", busiest > 0 ? mean / busiest : 1.0);
+  }
+
+  int       tileSize;
+  TileOrder order;
+
+private:
+  ThreadPool                   &pool;
+  ThreadArenas                  arenas;
+  std::vector<ThreadStatistics> statistics;
+  std::vector<uint64_t>         stolenBefore; // steal counters of the pool when the current Render() started
+};
+
+#endif // SCHEDULER_H
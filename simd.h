@@ -0,0 +1,101 @@
+#ifndef SIMD_H
+#define SIMD_H
+#include <cstddef>
+#include <new>
+#include <vector>
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define TRACER_SIMD_X86 1
+#include <immintrin.h>
+// Lets a single function use a wider instruction set than the one the translation unit is compiled for
+#define TRACER_TARGET(isa) __attribute__((target(isa)))
+#else
+#define TRACER_SIMD_X86 0
+#define TRACER_TARGET(isa)
+#endif
+
+
+enum class SimdLevel {
+  Scalar,
+  SSE2,
+  AVX2,   // AVX2 + FMA, 8 float lanes
+  AVX512, // AVX-512F, 16 float lanes
+};
+
+inline const char *SimdLevelName(SimdLevel level) {
+  switch (level) {
+    case SimdLevel::Scalar:
+      return "scalar";
+    case SimdLevel::SSE2:
+      return "sse2";
+    case SimdLevel::AVX2:
+      return "avx2";
+    case SimdLevel::AVX512:
+      return "avx512";
+  }
+  return "unknown";
+}
+
+inline int SimdLevelWidth(SimdLevel level) {
+  switch (level) {
+    case SimdLevel::Scalar:
+      return 1;
+    case SimdLevel::SSE2:
+      return 4;
+    case SimdLevel::AVX2:
+      return 8;
+    case SimdLevel::AVX512:
+      return 16;
+  }
+  return 1;
+}
+
+// Widest instruction set the running CPU supports, independent of the flags the binary was compiled with
+inline SimdLevel DetectSimdLevel() {
+#if TRACER_SIMD_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f")) {
+    return SimdLevel::AVX512;
+  }
+  if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+    return SimdLevel::AVX2;
+  }
+  return SimdLevel::SSE2;
+#else
+  return SimdLevel::Scalar;
+#endif
+}
+
+
+// Allocator for arrays the SIMD kernels stream through, aligned to a cache line so that aligned chunks of them do
+// not straddle two lines
+template<typename T, size_t Alignment = 64>
+struct AlignedAllocator {
+  using value_type = T;
+
+  template<typename U>
+  struct rebind {
+    using other = AlignedAllocator<U, Alignment>;
+  };
+
+  AlignedAllocator() = default;
+
+  template<typename U>
+  AlignedAllocator(const AlignedAllocator<U, Alignment> &) {}
+
+  T *allocate(size_t count) {
+    return static_cast<T *>(::operator new(count * sizeof(T), std::align_val_t(Alignment)));
+  }
+
+  void deallocate(T *pointer, size_t) { ::operator delete(pointer, std::align_val_t(Alignment)); }
+
+  template<typename U>
+  bool operator==(const AlignedAllocator<U, Alignment> &) const {
+    return true;
+  }
+};
+
+template<typename T>
+using AlignedVector = std::vector<T, AlignedAllocator<T>>;
+
+#endif // SIMD_H
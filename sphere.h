@@ -0,0 +1,36 @@
+#ifndef SPHERE_H
+#define SPHERE_H
+#include <cmath>
+#include <glm/glm.hpp>
+#include <optional>
+
+
+struct Sphere {
+  float     radius;
+  glm::vec3 position;
+};
+
+
+// Computed in the precision of the ray, the sphere is promoted to it
+template<typename T>
+std::optional<T>
+Intersect(const Sphere &sphere, const glm::vec<3, T> &ray_origin, const glm::vec<3, T> &ray_direction) {
+  const glm::vec<3, T> oc     = ray_origin - glm::vec<3, T>(sphere.position);
+  const T              radius = sphere.radius;
+
+  // Half-b form of the quadratic, the common factors of 2 and 4 cancel out
+  const T a     = glm::dot(ray_direction, ray_direction);
+  const T halfB = glm::dot(oc, ray_direction);
+  const T c     = glm::dot(oc, oc) - radius * radius;
+
+  const T discriminant = halfB * halfB - a * c;
+
+  if (discriminant < 0)
+    return std::nullopt;
+
+  const T root = std::sqrt(discriminant);
+  const T t    = (-halfB - root) / a;
+  return t > 0 ? t : (-halfB + root) / a;
+}
+
+#endif // SPHERE_H
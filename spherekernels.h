@@ -0,0 +1,410 @@
+#ifndef SPHEREKERNELS_H
+#define SPHEREKERNELS_H
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <glm/glm.hpp>
+#include <limits>
+
+#include "ray.h"
+#include "simd.h"
+
+// Batched ray/sphere intersection. All kernels assume normalized ray directions, which makes the quadratic's `a`
+// equal to one: with b = dot(oc, d) and c = dot(oc, oc) - r^2 the roots are -b -/+ sqrt(b^2 - c).
+
+
+// Spheres in structure of arrays form, only the fields the intersection loop reads
+struct SphereArrays {
+  const float *centerX;
+  const float *centerY;
+  const float *centerZ;
+  const float *radiusSquared;
+  size_t       count;
+};
+
+// Up to 32 rays in structure of arrays form
+struct RayArrays {
+  const float *originX;
+  const float *originY;
+  const float *originZ;
+  const float *directionX;
+  const float *directionY;
+  const float *directionZ;
+};
+
+struct SphereHit {
+  float   t     = std::numeric_limits<float>::infinity();
+  int32_t index = -1; // -1 on a miss
+};
+
+
+// Nearest root beyond tMin, or infinity
+template<typename T>
+inline T IntersectNormalized(T ox, T oy, T oz, T dx, T dy, T dz, T cx, T cy, T cz, T radiusSquared, T tMin) {
+  const T ocx          = ox - cx;
+  const T ocy          = oy - cy;
+  const T ocz          = oz - cz;
+  const T b            = ocx * dx + ocy * dy + ocz * dz;
+  const T c            = ocx * ocx + ocy * ocy + ocz * ocz - radiusSquared;
+  const T discriminant = b * b - c;
+  if (discriminant < 0) {
+    return std::numeric_limits<T>::infinity();
+  }
+  const T root = std::sqrt(discriminant);
+  const T t0   = -b - root;
+  const T t1   = -b + root;
+  const T t    = t0 > tMin ? t0 : t1;
+  return t > tMin ? t : std::numeric_limits<T>::infinity();
+}
+
+
+// ================================================================================
+// scalar
+// ================================================================================
+inline SphereHit
+ClosestSphereScalar(const Ray &ray, const SphereArrays &spheres, size_t begin, size_t end, float tMin, float tMax) {
+  SphereHit hit = {tMax, -1};
+  for (size_t i = begin; i < end; i++) {
+    const float t = IntersectNormalized(
+      ray.origin.x, ray.origin.y, ray.origin.z, ray.direction.x, ray.direction.y, ray.direction.z, spheres.centerX[i],
+      spheres.centerY[i], spheres.centerZ[i], spheres.radiusSquared[i], tMin);
+    if (t < hit.t) {
+      hit = {t, static_cast<int32_t>(i)};
+    }
+  }
+  return hit;
+}
+
+inline uint32_t IntersectRaysScalar(
+  const glm::vec3 &center, float radiusSquared, const RayArrays &rays, int count, float tMin, float *tHit,
+  int begin = 0) {
+  uint32_t mask = 0;
+  for (int i = begin; i < count; i++) {
+    const float t = IntersectNormalized(
+      rays.originX[i], rays.originY[i], rays.originZ[i], rays.directionX[i], rays.directionY[i], rays.directionZ[i],
+      center.x, center.y, center.z, radiusSquared, tMin);
+    if (t < tHit[i]) {
+      tHit[i] = t;
+      mask |= 1u << i;
+    }
+  }
+  return mask;
+}
+
+
+#if TRACER_SIMD_X86
+// ================================================================================
+// SSE2, 4 lanes
+// ================================================================================
+inline SphereHit
+ClosestSphereSSE2(const Ray &ray, const SphereArrays &spheres, size_t begin, size_t end, float tMin, float tMax) {
+  const __m128 ox = _mm_set1_ps(ray.origin.x), oy = _mm_set1_ps(ray.origin.y), oz = _mm_set1_ps(ray.origin.z);
+  const __m128 dx = _mm_set1_ps(ray.direction.x), dy = _mm_set1_ps(ray.direction.y),
+               dz = _mm_set1_ps(ray.direction.z);
+  const __m128 minimum   = _mm_set1_ps(tMin);
+  const __m128 zero      = _mm_setzero_ps();
+  __m128       bestT     = _mm_set1_ps(tMax);
+  __m128i      bestIndex = _mm_set1_epi32(-1);
+  __m128i      index     = _mm_add_epi32(_mm_set1_epi32(static_cast<int32_t>(begin)), _mm_setr_epi32(0, 1, 2, 3));
+
+  size_t i = begin;
+  for (; i + 4 <= end; i += 4) {
+    const __m128 ocx = _mm_sub_ps(ox, _mm_loadu_ps(spheres.centerX + i));
+    const __m128 ocy = _mm_sub_ps(oy, _mm_loadu_ps(spheres.centerY + i));
+    const __m128 ocz = _mm_sub_ps(oz, _mm_loadu_ps(spheres.centerZ + i));
+    const __m128 b = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ocx, dx), _mm_mul_ps(ocy, dy)), _mm_mul_ps(ocz, dz));
+    const __m128 c = _mm_sub_ps(
+      _mm_add_ps(_mm_add_ps(_mm_mul_ps(ocx, ocx), _mm_mul_ps(ocy, ocy)), _mm_mul_ps(ocz, ocz)),
+      _mm_loadu_ps(spheres.radiusSquared + i));
+    const __m128 discriminant = _mm_sub_ps(_mm_mul_ps(b, b), c);
+    const __m128 root         = _mm_sqrt_ps(_mm_max_ps(discriminant, zero));
+    const __m128 negativeB    = _mm_sub_ps(zero, b);
+    const __m128 t0           = _mm_sub_ps(negativeB, root);
+    const __m128 t1           = _mm_add_ps(negativeB, root);
+    const __m128 nearMask     = _mm_cmpgt_ps(t0, minimum);
+    const __m128 t            = _mm_or_ps(_mm_and_ps(nearMask, t0), _mm_andnot_ps(nearMask, t1));
+    const __m128 hit          = _mm_and_ps(
+      _mm_cmpge_ps(discriminant, zero), _mm_and_ps(_mm_cmpgt_ps(t, minimum), _mm_cmplt_ps(t, bestT)));
+
+    bestT     = _mm_or_ps(_mm_and_ps(hit, t), _mm_andnot_ps(hit, bestT));
+    bestIndex = _mm_or_si128(
+      _mm_and_si128(_mm_castps_si128(hit), index), _mm_andnot_si128(_mm_castps_si128(hit), bestIndex));
+    index = _mm_add_epi32(index, _mm_set1_epi32(4));
+  }
+
+  alignas(16) float   laneT[4];
+  alignas(16) int32_t laneIndex[4];
+  _mm_store_ps(laneT, bestT);
+  _mm_store_si128(reinterpret_cast<__m128i *>(laneIndex), bestIndex);
+  SphereHit hit = ClosestSphereScalar(ray, spheres, i, end, tMin, tMax);
+  for (int lane = 0; lane < 4; lane++) {
+    if (laneIndex[lane] >= 0 && laneT[lane] < hit.t) {
+      hit = {laneT[lane], laneIndex[lane]};
+    }
+  }
+  return hit;
+}
+
+inline uint32_t IntersectRaysSSE2(
+  const glm::vec3 &center, float radiusSquared, const RayArrays &rays, int count, float tMin, float *tHit) {
+  const __m128 cx = _mm_set1_ps(center.x), cy = _mm_set1_ps(center.y), cz = _mm_set1_ps(center.z);
+  const __m128 r2      = _mm_set1_ps(radiusSquared);
+  const __m128 minimum = _mm_set1_ps(tMin);
+  const __m128 zero    = _mm_setzero_ps();
+
+  uint32_t mask = 0;
+  int      i    = 0;
+  for (; i + 4 <= count; i += 4) {
+    const __m128 dx  = _mm_loadu_ps(rays.directionX + i);
+    const __m128 dy  = _mm_loadu_ps(rays.directionY + i);
+    const __m128 dz  = _mm_loadu_ps(rays.directionZ + i);
+    const __m128 ocx = _mm_sub_ps(_mm_loadu_ps(rays.originX + i), cx);
+    const __m128 ocy = _mm_sub_ps(_mm_loadu_ps(rays.originY + i), cy);
+    const __m128 ocz = _mm_sub_ps(_mm_loadu_ps(rays.originZ + i), cz);
+    const __m128 b   = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ocx, dx), _mm_mul_ps(ocy, dy)), _mm_mul_ps(ocz, dz));
+    const __m128 c =
+      _mm_sub_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(ocx, ocx), _mm_mul_ps(ocy, ocy)), _mm_mul_ps(ocz, ocz)), r2);
+    const __m128 discriminant = _mm_sub_ps(_mm_mul_ps(b, b), c);
+    const __m128 root         = _mm_sqrt_ps(_mm_max_ps(discriminant, zero));
+    const __m128 negativeB    = _mm_sub_ps(zero, b);
+    const __m128 t0           = _mm_sub_ps(negativeB, root);
+    const __m128 t1           = _mm_add_ps(negativeB, root);
+    const __m128 nearMask     = _mm_cmpgt_ps(t0, minimum);
+    const __m128 t            = _mm_or_ps(_mm_and_ps(nearMask, t0), _mm_andnot_ps(nearMask, t1));
+    const __m128 current      = _mm_loadu_ps(tHit + i);
+    const __m128 hit          = _mm_and_ps(
+      _mm_cmpge_ps(discriminant, zero), _mm_and_ps(_mm_cmpgt_ps(t, minimum), _mm_cmplt_ps(t, current)));
+
+    _mm_storeu_ps(tHit + i, _mm_or_ps(_mm_and_ps(hit, t), _mm_andnot_ps(hit, current)));
+    mask |= static_cast<uint32_t>(_mm_movemask_ps(hit)) << i;
+  }
+  return mask | IntersectRaysScalar(center, radiusSquared, rays, count, tMin, tHit, i);
+}
+
+
+// ================================================================================
+// AVX2 + FMA, 8 lanes
+// ================================================================================
+TRACER_TARGET("avx2,fma")
+inline SphereHit
+ClosestSphereAVX2(const Ray &ray, const SphereArrays &spheres, size_t begin, size_t end, float tMin, float tMax) {
+  const __m256 ox = _mm256_set1_ps(ray.origin.x), oy = _mm256_set1_ps(ray.origin.y), oz = _mm256_set1_ps(ray.origin.z);
+  const __m256 dx = _mm256_set1_ps(ray.direction.x), dy = _mm256_set1_ps(ray.direction.y),
+               dz = _mm256_set1_ps(ray.direction.z);
+  const __m256 minimum   = _mm256_set1_ps(tMin);
+  const __m256 zero      = _mm256_setzero_ps();
+  __m256       bestT     = _mm256_set1_ps(tMax);
+  __m256i      bestIndex = _mm256_set1_epi32(-1);
+  __m256i      index =
+    _mm256_add_epi32(_mm256_set1_epi32(static_cast<int32_t>(begin)), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+
+  size_t i = begin;
+  for (; i + 8 <= end; i += 8) {
+    const __m256 ocx = _mm256_sub_ps(ox, _mm256_loadu_ps(spheres.centerX + i));
+    const __m256 ocy = _mm256_sub_ps(oy, _mm256_loadu_ps(spheres.centerY + i));
+    const __m256 ocz = _mm256_sub_ps(oz, _mm256_loadu_ps(spheres.centerZ + i));
+    const __m256 b   = _mm256_fmadd_ps(ocz, dz, _mm256_fmadd_ps(ocy, dy, _mm256_mul_ps(ocx, dx)));
+    const __m256 c   = _mm256_sub_ps(
+      _mm256_fmadd_ps(ocz, ocz, _mm256_fmadd_ps(ocy, ocy, _mm256_mul_ps(ocx, ocx))),
+      _mm256_loadu_ps(spheres.radiusSquared + i));
+    const __m256 discriminant = _mm256_fmsub_ps(b, b, c);
+    const __m256 root         = _mm256_sqrt_ps(_mm256_max_ps(discriminant, zero));
+    const __m256 negativeB    = _mm256_sub_ps(zero, b);
+    const __m256 t0           = _mm256_sub_ps(negativeB, root);
+    const __m256 t1           = _mm256_add_ps(negativeB, root);
+    const __m256 t            = _mm256_blendv_ps(t1, t0, _mm256_cmp_ps(t0, minimum, _CMP_GT_OQ));
+    const __m256 hit          = _mm256_and_ps(
+      _mm256_cmp_ps(discriminant, zero, _CMP_GE_OQ),
+      _mm256_and_ps(_mm256_cmp_ps(t, minimum, _CMP_GT_OQ), _mm256_cmp_ps(t, bestT, _CMP_LT_OQ)));
+
+    bestT     = _mm256_blendv_ps(bestT, t, hit);
+    bestIndex = _mm256_castps_si256(
+      _mm256_blendv_ps(_mm256_castsi256_ps(bestIndex), _mm256_castsi256_ps(index), hit));
+    index = _mm256_add_epi32(index, _mm256_set1_epi32(8));
+  }
+
+  alignas(32) float   laneT[8];
+  alignas(32) int32_t laneIndex[8];
+  _mm256_store_ps(laneT, bestT);
+  _mm256_store_si256(reinterpret_cast<__m256i *>(laneIndex), bestIndex);
+  SphereHit hit = ClosestSphereScalar(ray, spheres, i, end, tMin, tMax);
+  for (int lane = 0; lane < 8; lane++) {
+    if (laneIndex[lane] >= 0 && laneT[lane] < hit.t) {
+      hit = {laneT[lane], laneIndex[lane]};
+    }
+  }
+  return hit;
+}
+
+TRACER_TARGET("avx2,fma")
+inline uint32_t IntersectRaysAVX2(
+  const glm::vec3 &center, float radiusSquared, const RayArrays &rays, int count, float tMin, float *tHit) {
+  const __m256 cx = _mm256_set1_ps(center.x), cy = _mm256_set1_ps(center.y), cz = _mm256_set1_ps(center.z);
+  const __m256 r2      = _mm256_set1_ps(radiusSquared);
+  const __m256 minimum = _mm256_set1_ps(tMin);
+  const __m256 zero    = _mm256_setzero_ps();
+
+  uint32_t mask = 0;
+  int      i    = 0;
+  for (; i + 8 <= count; i += 8) {
+    const __m256 dx  = _mm256_loadu_ps(rays.directionX + i);
+    const __m256 dy  = _mm256_loadu_ps(rays.directionY + i);
+    const __m256 dz  = _mm256_loadu_ps(rays.directionZ + i);
+    const __m256 ocx = _mm256_sub_ps(_mm256_loadu_ps(rays.originX + i), cx);
+    const __m256 ocy = _mm256_sub_ps(_mm256_loadu_ps(rays.originY + i), cy);
+    const __m256 ocz = _mm256_sub_ps(_mm256_loadu_ps(rays.originZ + i), cz);
+    const __m256 b   = _mm256_fmadd_ps(ocz, dz, _mm256_fmadd_ps(ocy, dy, _mm256_mul_ps(ocx, dx)));
+    const __m256 c = _mm256_sub_ps(_mm256_fmadd_ps(ocz, ocz, _mm256_fmadd_ps(ocy, ocy, _mm256_mul_ps(ocx, ocx))), r2);
+    const __m256 discriminant = _mm256_fmsub_ps(b, b, c);
+    const __m256 root         = _mm256_sqrt_ps(_mm256_max_ps(discriminant, zero));
+    const __m256 negativeB    = _mm256_sub_ps(zero, b);
+    const __m256 t0           = _mm256_sub_ps(negativeB, root);
+    const __m256 t1           = _mm256_add_ps(negativeB, root);
+    const __m256 t            = _mm256_blendv_ps(t1, t0, _mm256_cmp_ps(t0, minimum, _CMP_GT_OQ));
+    const __m256 current      = _mm256_loadu_ps(tHit + i);
+    const __m256 hit          = _mm256_and_ps(
+      _mm256_cmp_ps(discriminant, zero, _CMP_GE_OQ),
+      _mm256_and_ps(_mm256_cmp_ps(t, minimum, _CMP_GT_OQ), _mm256_cmp_ps(t, current, _CMP_LT_OQ)));
+
+    _mm256_storeu_ps(tHit + i, _mm256_blendv_ps(current, t, hit));
+    mask |= static_cast<uint32_t>(_mm256_movemask_ps(hit)) << i;
+  }
+  return mask | IntersectRaysScalar(center, radiusSquared, rays, count, tMin, tHit, i);
+}
+
+
+// ================================================================================
+// AVX-512F, 16 lanes
+// ================================================================================
+TRACER_TARGET("avx512f")
+inline SphereHit
+ClosestSphereAVX512(const Ray &ray, const SphereArrays &spheres, size_t begin, size_t end, float tMin, float tMax) {
+  const __m512 ox = _mm512_set1_ps(ray.origin.x), oy = _mm512_set1_ps(ray.origin.y), oz = _mm512_set1_ps(ray.origin.z);
+  const __m512 dx = _mm512_set1_ps(ray.direction.x), dy = _mm512_set1_ps(ray.direction.y),
+               dz = _mm512_set1_ps(ray.direction.z);
+  const __m512 minimum   = _mm512_set1_ps(tMin);
+  const __m512 zero      = _mm512_setzero_ps();
+  __m512       bestT     = _mm512_set1_ps(tMax);
+  __m512i      bestIndex = _mm512_set1_epi32(-1);
+  __m512i      index     = _mm512_add_epi32(
+    _mm512_set1_epi32(static_cast<int32_t>(begin)),
+    _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15));
+
+  size_t i = begin;
+  for (; i + 16 <= end; i += 16) {
+    const __m512 ocx = _mm512_sub_ps(ox, _mm512_loadu_ps(spheres.centerX + i));
+    const __m512 ocy = _mm512_sub_ps(oy, _mm512_loadu_ps(spheres.centerY + i));
+    const __m512 ocz = _mm512_sub_ps(oz, _mm512_loadu_ps(spheres.centerZ + i));
+    const __m512 b   = _mm512_fmadd_ps(ocz, dz, _mm512_fmadd_ps(ocy, dy, _mm512_mul_ps(ocx, dx)));
+    const __m512 c   = _mm512_sub_ps(
+      _mm512_fmadd_ps(ocz, ocz, _mm512_fmadd_ps(ocy, ocy, _mm512_mul_ps(ocx, ocx))),
+      _mm512_loadu_ps(spheres.radiusSquared + i));
+    const __m512    discriminant = _mm512_fmsub_ps(b, b, c);
+    const __m512    root         = _mm512_sqrt_ps(_mm512_max_ps(discriminant, zero));
+    const __m512    negativeB    = _mm512_sub_ps(zero, b);
+    const __m512    t0           = _mm512_sub_ps(negativeB, root);
+    const __m512    t1           = _mm512_add_ps(negativeB, root);
+    const __m512    t   = _mm512_mask_blend_ps(_mm512_cmp_ps_mask(t0, minimum, _CMP_GT_OQ), t1, t0);
+    const __mmask16 hit = _mm512_cmp_ps_mask(discriminant, zero, _CMP_GE_OQ) &
+                          _mm512_cmp_ps_mask(t, minimum, _CMP_GT_OQ) & _mm512_cmp_ps_mask(t, bestT, _CMP_LT_OQ);
+
+    bestT     = _mm512_mask_blend_ps(hit, bestT, t);
+    bestIndex = _mm512_mask_blend_epi32(hit, bestIndex, index);
+    index     = _mm512_add_epi32(index, _mm512_set1_epi32(16));
+  }
+
+  alignas(64) float   laneT[16];
+  alignas(64) int32_t laneIndex[16];
+  _mm512_store_ps(laneT, bestT);
+  _mm512_store_si512(laneIndex, bestIndex);
+  SphereHit hit = ClosestSphereScalar(ray, spheres, i, end, tMin, tMax);
+  for (int lane = 0; lane < 16; lane++) {
+    if (laneIndex[lane] >= 0 && laneT[lane] < hit.t) {
+      hit = {laneT[lane], laneIndex[lane]};
+    }
+  }
+  return hit;
+}
+
+TRACER_TARGET("avx512f")
+inline uint32_t IntersectRaysAVX512(
+  const glm::vec3 &center, float radiusSquared, const RayArrays &rays, int count, float tMin, float *tHit) {
+  const __m512 cx = _mm512_set1_ps(center.x), cy = _mm512_set1_ps(center.y), cz = _mm512_set1_ps(center.z);
+  const __m512 r2      = _mm512_set1_ps(radiusSquared);
+  const __m512 minimum = _mm512_set1_ps(tMin);
+  const __m512 zero    = _mm512_setzero_ps();
+
+  uint32_t mask = 0;
+  int      i    = 0;
+  for (; i + 16 <= count; i += 16) {
+    const __m512 dx  = _mm512_loadu_ps(rays.directionX + i);
+    const __m512 dy  = _mm512_loadu_ps(rays.directionY + i);
+    const __m512 dz  = _mm512_loadu_ps(rays.directionZ + i);
+    const __m512 ocx = _mm512_sub_ps(_mm512_loadu_ps(rays.originX + i), cx);
+    const __m512 ocy = _mm512_sub_ps(_mm512_loadu_ps(rays.originY + i), cy);
+    const __m512 ocz = _mm512_sub_ps(_mm512_loadu_ps(rays.originZ + i), cz);
+    const __m512 b   = _mm512_fmadd_ps(ocz, dz, _mm512_fmadd_ps(ocy, dy, _mm512_mul_ps(ocx, dx)));
+    const __m512 c = _mm512_sub_ps(_mm512_fmadd_ps(ocz, ocz, _mm512_fmadd_ps(ocy, ocy, _mm512_mul_ps(ocx, ocx))), r2);
+    const __m512    discriminant = _mm512_fmsub_ps(b, b, c);
+    const __m512    root         = _mm512_sqrt_ps(_mm512_max_ps(discriminant, zero));
+    const __m512    negativeB    = _mm512_sub_ps(zero, b);
+    const __m512    t0           = _mm512_sub_ps(negativeB, root);
+    const __m512    t1           = _mm512_add_ps(negativeB, root);
+    const __m512    t       = _mm512_mask_blend_ps(_mm512_cmp_ps_mask(t0, minimum, _CMP_GT_OQ), t1, t0);
+    const __m512    current = _mm512_loadu_ps(tHit + i);
+    const __mmask16 hit     = _mm512_cmp_ps_mask(discriminant, zero, _CMP_GE_OQ) &
+                          _mm512_cmp_ps_mask(t, minimum, _CMP_GT_OQ) & _mm512_cmp_ps_mask(t, current, _CMP_LT_OQ);
+
+    _mm512_storeu_ps(tHit + i, _mm512_mask_blend_ps(hit, current, t));
+    mask |= static_cast<uint32_t>(hit) << i;
+  }
+  return mask | IntersectRaysScalar(center, radiusSquared, rays, count, tMin, tHit, i);
+}
+#endif // TRACER_SIMD_X86
+
+
+// ================================================================================
+// runtime dispatch
+// ================================================================================
+struct SphereKernels {
+  SimdLevel level;
+
+  // Nearest sphere in [begin, end) hit by a single ray within (tMin, tMax)
+  SphereHit (*closestHit)(const Ray &ray, const SphereArrays &spheres, size_t begin, size_t end, float tMin, float tMax);
+
+  // Intersects up to 32 rays with one sphere. tHit holds the current closest distance per ray and is lowered where the
+  // sphere is closer; the returned mask has bit i set for every ray that was updated.
+  uint32_t (*intersectRays)(
+    const glm::vec3 &center, float radiusSquared, const RayArrays &rays, int count, float tMin, float *tHit);
+};
+
+inline uint32_t IntersectRaysScalarDispatch(
+  const glm::vec3 &center, float radiusSquared, const RayArrays &rays, int count, float tMin, float *tHit) {
+  return IntersectRaysScalar(center, radiusSquared, rays, count, tMin, tHit);
+}
+
+// Kernels for `level`, or for the widest level below it that exists on this platform
+inline SphereKernels SelectSphereKernels(SimdLevel level) {
+#if TRACER_SIMD_X86
+  switch (level) {
+    case SimdLevel::AVX512:
+      return {SimdLevel::AVX512, ClosestSphereAVX512, IntersectRaysAVX512};
+    case SimdLevel::AVX2:
+      return {SimdLevel::AVX2, ClosestSphereAVX2, IntersectRaysAVX2};
+    case SimdLevel::SSE2:
+      return {SimdLevel::SSE2, ClosestSphereSSE2, IntersectRaysSSE2};
+    case SimdLevel::Scalar:
+      break;
+  }
+#endif
+  (void) level;
+  return {SimdLevel::Scalar, ClosestSphereScalar, IntersectRaysScalarDispatch};
+}
+
+// Kernels for the widest instruction set of the running CPU, detected once
+inline const SphereKernels &GetSphereKernels() {
+  static const SphereKernels kernels = SelectSphereKernels(DetectSimdLevel());
+  return kernels;
+}
+
+#endif // SPHEREKERNELS_H
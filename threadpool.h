@@ -0,0 +1,279 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstddef>
+#include <deque>
+#include <memory_resource>
+#include <mutex>
+#include <new>
+#include <optional>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+
+// Move only callable queued by ThreadPool. Unlike std::function it stores captures of up to INLINE_SIZE bytes in place,
+// which covers the tasks of the tile scheduler and ParallelFor, so submitting them does not allocate; larger callables
+// are moved to the heap.
+class Task {
+public:
+  static constexpr size_t INLINE_SIZE = 48;
+
+  Task() = default;
+
+  template<typename Function>
+    requires(!std::is_same_v<std::decay_t<Function>, Task> && std::is_invocable_v<std::decay_t<Function> &>)
+  Task(Function &&function) {
+    using Stored = std::decay_t<Function>;
+    if constexpr (
+      sizeof(Stored) <= INLINE_SIZE && alignof(Stored) <= alignof(std::max_align_t) &&
+      std::is_nothrow_move_constructible_v<Stored>) {
+      new (storage) Stored(std::forward<Function>(function));
+      operations = &INLINE_OPERATIONS<Stored>;
+    } else {
+      new (storage) Stored *(new Stored(std::forward<Function>(function)));
+      operations = &HEAP_OPERATIONS<Stored>;
+    }
+  }
+
+  Task(Task &&other) noexcept { MoveFrom(other); }
+
+  Task &operator=(Task &&other) noexcept {
+    if (this != &other) {
+      Destroy();
+      MoveFrom(other);
+    }
+    return *this;
+  }
+
+  ~Task() { Destroy(); }
+
+  explicit operator bool() const { return operations != nullptr; }
+
+  void operator()() { operations->invoke(storage); }
+
+private:
+  struct Operations {
+    void (*invoke)(std::byte *storage);
+    void (*move)(std::byte *to, std::byte *from); // also destroys `from`
+    void (*destroy)(std::byte *storage);
+  };
+
+  template<typename Stored>
+  static constexpr Operations INLINE_OPERATIONS = {
+    [](std::byte *storage) { (*std::launder(reinterpret_cast<Stored *>(storage)))(); },
+    [](std::byte *to, std::byte *from) {
+      Stored *stored = std::launder(reinterpret_cast<Stored *>(from));
+      new (to) Stored(std::move(*stored));
+      stored->~Stored();
+    },
+    [](std::byte *storage) { std::launder(reinterpret_cast<Stored *>(storage))->~Stored(); }};
+
+  template<typename Stored>
+  static constexpr Operations HEAP_OPERATIONS = {
+    [](std::byte *storage) { (**std::launder(reinterpret_cast<Stored **>(storage)))(); },
+    [](std::byte *to, std::byte *from) { new (to) Stored *(*std::launder(reinterpret_cast<Stored **>(from))); },
+    [](std::byte *storage) { delete *std::launder(reinterpret_cast<Stored **>(storage)); }};
+
+  void MoveFrom(Task &other) {
+    if (other.operations) {
+      other.operations->move(storage, other.storage);
+      operations = std::exchange(other.operations, nullptr);
+    }
+  }
+
+  void Destroy() {
+    if (operations) {
+      operations->destroy(storage);
+      operations = nullptr;
+    }
+  }
+
+  alignas(std::max_align_t) std::byte storage[INLINE_SIZE];
+  const Operations *operations = nullptr;
+};
+
+
+// Work stealing thread pool. Every worker owns a queue it consumes from the front; idle workers steal from the back of
+// the other queues so that a worker that drew cheap tasks keeps busy helping the others.
+class ThreadPool {
+public:
+  struct alignas(64) WorkerStatistics {
+    std::atomic<uint64_t> tasksExecuted = 0;
+    std::atomic<uint64_t> tasksStolen   = 0;
+  };
+
+  explicit ThreadPool(unsigned threadCount = std::max(1u, std::thread::hardware_concurrency())) :
+      queues(threadCount), statistics(threadCount + 1) {
+    workers.reserve(threadCount);
+    for (unsigned index = 0; index < threadCount; index++) {
+      workers.emplace_back([this, index] { WorkerLoop(index); });
+    }
+  }
+
+  ~ThreadPool() {
+    {
+      std::lock_guard lock(sleepMutex);
+      stopping = true;
+    }
+    sleepCondition.notify_all();
+    for (std::thread &worker: workers) {
+      worker.join();
+    }
+  }
+
+  ThreadPool(const ThreadPool &)            = delete;
+  ThreadPool &operator=(const ThreadPool &) = delete;
+
+  unsigned ThreadCount() const { return static_cast<unsigned>(workers.size()); }
+
+  // Index of the calling worker in [0, ThreadCount()), or ThreadCount() for threads outside of the pool
+  unsigned CurrentThreadIndex() const { return currentPool == this ? currentIndex : ThreadCount(); }
+
+  // Statistics are indexed like CurrentThreadIndex(), the last slot belongs to the thread that waits on the pool
+  const WorkerStatistics &Statistics(unsigned threadIndex) const { return statistics[threadIndex]; }
+
+  // Queues a task on the calling worker's own queue, or deals it round robin when called from outside the pool
+  void Submit(Task task) {
+    const unsigned index = CurrentThreadIndex();
+    SubmitTo(index < ThreadCount() ? index : nextQueue.fetch_add(1, std::memory_order_relaxed) % ThreadCount(),
+             std::move(task));
+  }
+
+  void SubmitTo(unsigned queueIndex, Task task) {
+    {
+      std::lock_guard lock(queues[queueIndex].mutex);
+      queues[queueIndex].tasks.push_back(std::move(task));
+    }
+    pendingTasks.fetch_add(1, std::memory_order_release);
+    {
+      std::lock_guard lock(sleepMutex);
+    }
+    sleepCondition.notify_one();
+  }
+
+  // Runs one queued task on the calling thread, used by threads that wait on work they submitted
+  bool TryRunOne() {
+    const unsigned index = CurrentThreadIndex();
+    auto           task  = Pop(index < ThreadCount() ? index : 0, index);
+    if (!task) {
+      return false;
+    }
+    (*task)();
+    return true;
+  }
+
+private:
+  // The pool resource recycles the blocks the deque frees, so a queue stops allocating once it has held its largest
+  // backlog. Both are guarded by the mutex.
+  struct alignas(64) WorkQueue {
+    std::mutex                             mutex;
+    std::pmr::unsynchronized_pool_resource blocks;
+    std::pmr::deque<Task>                  tasks{&blocks};
+  };
+
+  std::optional<Task> Pop(unsigned queueIndex, unsigned statisticsIndex) {
+    if (pendingTasks.load(std::memory_order_acquire) == 0) {
+      return std::nullopt;
+    }
+    for (unsigned offset = 0; offset < queues.size(); offset++) {
+      WorkQueue       &queue = queues[(queueIndex + offset) % queues.size()];
+      std::unique_lock lock(queue.mutex);
+      if (queue.tasks.empty()) {
+        continue;
+      }
+      // The owner takes from the front to keep submission order, thieves take from the back
+      Task task;
+      if (offset == 0) {
+        task = std::move(queue.tasks.front());
+        queue.tasks.pop_front();
+      } else {
+        task = std::move(queue.tasks.back());
+        queue.tasks.pop_back();
+        statistics[statisticsIndex].tasksStolen.fetch_add(1, std::memory_order_relaxed);
+      }
+      lock.unlock();
+      pendingTasks.fetch_sub(1, std::memory_order_relaxed);
+      statistics[statisticsIndex].tasksExecuted.fetch_add(1, std::memory_order_relaxed);
+      return task;
+    }
+    return std::nullopt;
+  }
+
+  void WorkerLoop(unsigned index) {
+    currentPool  = this;
+    currentIndex = index;
+    while (true) {
+      if (auto task = Pop(index, index)) {
+        (*task)();
+        continue;
+      }
+      std::unique_lock lock(sleepMutex);
+      sleepCondition.wait(lock, [this] { return stopping || pendingTasks.load(std::memory_order_acquire) > 0; });
+      if (stopping) {
+        return;
+      }
+    }
+  }
+
+  static inline thread_local const ThreadPool *currentPool  = nullptr;
+  static inline thread_local unsigned          currentIndex = 0;
+
+  std::vector<WorkQueue>        queues;
+  std::vector<WorkerStatistics> statistics;
+  std::vector<std::thread>      workers;
+  std::atomic<unsigned>         nextQueue    = 0;
+  std::atomic<int64_t>          pendingTasks = 0;
+  std::mutex                    sleepMutex;
+  std::condition_variable       sleepCondition;
+  bool                          stopping = false;
+};
+
+
+// Fork/join helper on top of ThreadPool. Wait() executes queued tasks instead of blocking, so groups can be nested
+// inside pool tasks without starving the workers.
+class TaskGroup {
+public:
+  explicit TaskGroup(ThreadPool &pool) : pool(pool) {}
+
+  ~TaskGroup() { Wait(); }
+
+  template<typename Function>
+  void Run(Function &&function) {
+    pending.fetch_add(1, std::memory_order_relaxed);
+    pool.Submit([this, function = std::forward<Function>(function)]() mutable {
+      function();
+      pending.fetch_sub(1, std::memory_order_release);
+    });
+  }
+
+  void Wait() {
+    while (pending.load(std::memory_order_acquire) > 0) {
+      if (!pool.TryRunOne()) {
+        std::this_thread::yield();
+      }
+    }
+  }
+
+private:
+  ThreadPool          &pool;
+  std::atomic<int64_t> pending = 0;
+};
+
+
+// Calls `function(begin, end)` on chunks of at most `grainSize` indices of [begin, end) across the pool
+template<typename Function>
+void ParallelFor(ThreadPool &pool, int64_t begin, int64_t end, int64_t grainSize, Function &&function) {
+  TaskGroup group(pool);
+  for (int64_t chunkBegin = begin; chunkBegin < end; chunkBegin += grainSize) {
+    const int64_t chunkEnd = std::min(end, chunkBegin + grainSize);
+    group.Run([&function, chunkBegin, chunkEnd] { function(chunkBegin, chunkEnd); });
+  }
+  group.Wait();
+}
+
+#endif // THREADPOOL_H
@@ -1,8 +1,12 @@
 #ifndef TRACERMATH_H
 #define TRACERMATH_H
+#include <algorithm>
 #include <array>
+#include <cmath>
+#include <cstddef>
 #include <cstdint>
-#include <vector>
+#include <type_traits>
+#include <utility>
 
 #ifdef DOUBLEPRECISION
 typedef double Scalar;
@@ -10,429 +14,375 @@ typedef double Scalar;
 typedef float Scalar;
 #endif
 
+// With TRACER_PAD_VEC3 defined, 3 component vectors carry a fourth zero lane and are aligned like 4 component ones, so
+// their arithmetic compiles to full width SSE/NEON instructions at the cost of 33% more memory
+#ifdef TRACER_PAD_VEC3
+inline constexpr bool PAD_VEC3 = true;
+#else
+inline constexpr bool PAD_VEC3 = false;
+#endif
+
+// Lanes actually stored for an N component vector
+template <uint8_t N>
+inline constexpr std::size_t VectorLanes = (PAD_VEC3 && N == 3) ? 4 : N;
+
+// Vectors whose storage is a power of two in size are aligned to it, so they load into one register
+template <typename T, uint8_t N>
+inline constexpr std::size_t VectorAlignment =
+    (VectorLanes<N> & (VectorLanes<N> - 1)) == 0 ? sizeof(T) * VectorLanes<N> : alignof(T);
+
+// Compile time string naming the components of a swizzle, usable as a template argument: swizzle<"xzy">()
+template <std::size_t Length>
+struct SwizzlePattern {
+  char name[Length] = {};
+
+  constexpr SwizzlePattern(const char (&text)[Length]) {
+    for (std::size_t i = 0; i < Length; i++) {
+      name[i] = text[i];
+    }
+  }
+
+  static constexpr std::size_t Size() { return Length - 1; }
+
+  // Position of component i in its set (xyzw, rgba or stpq), 4 for any other character
+  constexpr std::size_t Index(std::size_t i) const {
+    switch (name[i]) {
+      case 'x':
+      case 'r':
+      case 's':
+        return 0;
+      case 'y':
+      case 'g':
+      case 't':
+        return 1;
+      case 'z':
+      case 'b':
+      case 'p':
+        return 2;
+      case 'w':
+      case 'a':
+      case 'q':
+        return 3;
+      default:
+        return 4;
+    }
+  }
+
+  constexpr bool Valid() const {
+    if (Size() == 0 || Size() > 4) {
+      return false;
+    }
+    for (std::size_t i = 0; i < Size(); i++) {
+      if (Index(i) > 3) {
+        return false;
+      }
+    }
+    return true;
+  }
+};
+
+// Small fixed size vector. Arithmetic operators are constexpr loops over all stored lanes; the loops have a constant
+// trip count and no dependencies between lanes, so the compiler unrolls them into SIMD instructions and keeps the
+// results of chains like `a * b + c` in registers, without any temporaries in memory.
+// Padding lanes are kept at zero: division only touches the first N lanes, so dividing by zero puts no NaN into them,
+// and comparison ignores them.
 template <typename T, uint8_t N>
 struct Vector {
-  std::array<T, N> data;
-  Vector() { data.fill(0); }
+  static constexpr std::size_t LANES = VectorLanes<N>;
 
-  Vector(const std::array<T, N>& data) : data{data} {}
+  alignas(VectorAlignment<T, N>) std::array<T, LANES> data;
 
-  Vector(T value) { data.fill(value); }
+  constexpr Vector() : data{} {}
 
-  Vector(const Vector<T, N-1>& t, T value) {
-    std::copy(t.data.begin(), t.data.end(), data.begin());
+  constexpr Vector(const std::array<T, N>& values) : data{} {
+    for (std::size_t i = 0; i < N; i++) {
+      data[i] = values[i];
+    }
+  }
+
+  constexpr Vector(T value) : data{} {
+    for (std::size_t i = 0; i < N; i++) {
+      data[i] = value;
+    }
+  }
+
+  constexpr Vector(const Vector<T, N-1>& t, T value) : data{} {
+    for (std::size_t i = 0; i < N - 1; i++) {
+      data[i] = t.data[i];
+    }
     data[N-1] = value;
   }
 
-  Vector(T x, T y)
+  constexpr Vector(T x, T y)
     requires(N == 2)
       : data{x, y} {}
 
-  Vector(T x, T y, T z)
+  constexpr Vector(T x, T y, T z)
     requires(N == 3)
       : data{x, y, z} {}
 
-  Vector(T x, T y, T z, T w)
+  constexpr Vector(T x, T y, T z, T w)
     requires(N == 4)
       : data{x, y, z, w} {}
 
-  T& x() { return data[0]; }
-  const T& x() const { return data[0]; }
+  constexpr T& operator[](std::size_t i) { return data[i]; }
+  constexpr const T& operator[](std::size_t i) const { return data[i]; }
+
+  constexpr T& x() { return data[0]; }
+  constexpr const T& x() const { return data[0]; }
 
-  T& y() { return data[1]; }
-  const T& y() const { return data[1]; }
+  constexpr T& y() { return data[1]; }
+  constexpr const T& y() const { return data[1]; }
 
-  T& z()
+  constexpr T& z()
     requires(N > 2)
   {
     return data[2];
   }
-  const T& z() const
+  constexpr const T& z() const
     requires(N > 2)
   {
     return data[2];
   }
 
-  T& w()
+  constexpr T& w()
     requires(N > 3)
   {
     return data[3];
   }
-  const T& w() const
+  constexpr const T& w() const
     requires(N > 3)
   {
     return data[3];
   }
 
+  constexpr bool operator==(const Vector& other) const {
+    for (std::size_t i = 0; i < N; i++) {
+      if (data[i] != other.data[i]) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // ================================================================================
+  // arithmetic
+  // ================================================================================
+  constexpr Vector& operator+=(const Vector& other) {
+    for (std::size_t i = 0; i < LANES; i++) {
+      data[i] += other.data[i];
+    }
+    return *this;
+  }
+
+  constexpr Vector& operator-=(const Vector& other) {
+    for (std::size_t i = 0; i < LANES; i++) {
+      data[i] -= other.data[i];
+    }
+    return *this;
+  }
+
+  constexpr Vector& operator*=(const Vector& other) {
+    for (std::size_t i = 0; i < LANES; i++) {
+      data[i] *= other.data[i];
+    }
+    return *this;
+  }
+
+  constexpr Vector& operator/=(const Vector& other) {
+    for (std::size_t i = 0; i < N; i++) {
+      data[i] /= other.data[i];
+    }
+    return *this;
+  }
+
+  constexpr Vector& operator*=(T scale) {
+    for (std::size_t i = 0; i < LANES; i++) {
+      data[i] *= scale;
+    }
+    return *this;
+  }
+
+  constexpr Vector& operator/=(T divisor) {
+    for (std::size_t i = 0; i < N; i++) {
+      data[i] /= divisor;
+    }
+    return *this;
+  }
+
+  constexpr Vector operator-() const {
+    Vector result;
+    for (std::size_t i = 0; i < LANES; i++) {
+      result.data[i] = -data[i];
+    }
+    return result;
+  }
+
   // ================================================================================
   // swizzle
   // ================================================================================
-  // Generic swizzle function using parameter pack.
+  // Swizzle by lane indices, e.g. v.swizzle<0, 2, 1>()
   template <std::size_t... Indices>
-  auto swizzle() const {
+  constexpr Vector<T, sizeof...(Indices)> swizzle() const {
     static_assert((... && (Indices < N)), "Swizzle index out of range");
-    return Vector(std::array<T, sizeof...(Indices)>{data[Indices]...});
-  }
-
-#define DEFINE_SWIZZLE(name, X, ...) \
-  auto name() const                  \
-    requires(N > X)                  \
-  {                                  \
-    return swizzle<__VA_ARGS__>();   \
-  }
-
-  // 2d
-  DEFINE_SWIZZLE(xx, 1, 0, 0)
-  DEFINE_SWIZZLE(xy, 1, 0, 1)
-  DEFINE_SWIZZLE(xz, 2, 0, 2)
-  DEFINE_SWIZZLE(xw, 3, 0, 3)
-
-  DEFINE_SWIZZLE(yx, 1, 1, 0)
-  DEFINE_SWIZZLE(yy, 1, 1, 1)
-  DEFINE_SWIZZLE(yz, 2, 1, 2)
-  DEFINE_SWIZZLE(yw, 3, 1, 3)
-
-  DEFINE_SWIZZLE(zx, 2, 2, 0)
-  DEFINE_SWIZZLE(zy, 2, 2, 1)
-  DEFINE_SWIZZLE(zz, 2, 2, 2)
-  DEFINE_SWIZZLE(zw, 3, 2, 3)
-
-  DEFINE_SWIZZLE(wx, 3, 3, 0)
-  DEFINE_SWIZZLE(wy, 3, 3, 1)
-  DEFINE_SWIZZLE(wz, 3, 3, 2)
-  DEFINE_SWIZZLE(ww, 3, 3, 3)
-
-  // 3d
-  DEFINE_SWIZZLE(xxx, 1, 0, 0, 0)
-  DEFINE_SWIZZLE(xxy, 1, 0, 0, 1)
-  DEFINE_SWIZZLE(xxz, 2, 0, 0, 2)
-  DEFINE_SWIZZLE(xxw, 3, 0, 0, 3)
-  DEFINE_SWIZZLE(xyx, 1, 0, 1, 0)
-  DEFINE_SWIZZLE(xyy, 1, 0, 1, 1)
-  DEFINE_SWIZZLE(xyz, 2, 0, 1, 2)
-  DEFINE_SWIZZLE(xyw, 3, 0, 1, 3)
-  DEFINE_SWIZZLE(xzx, 2, 0, 2, 0)
-  DEFINE_SWIZZLE(xzy, 2, 0, 2, 1)
-  DEFINE_SWIZZLE(xzz, 2, 0, 2, 2)
-  DEFINE_SWIZZLE(xzw, 3, 0, 2, 3)
-  DEFINE_SWIZZLE(xwx, 3, 0, 3, 0)
-  DEFINE_SWIZZLE(xwy, 3, 0, 3, 1)
-  DEFINE_SWIZZLE(xwz, 3, 0, 3, 2)
-  DEFINE_SWIZZLE(xww, 3, 0, 3, 3)
-
-  DEFINE_SWIZZLE(yxx, 1, 1, 0, 0)
-  DEFINE_SWIZZLE(yxy, 1, 1, 0, 1)
-  DEFINE_SWIZZLE(yxz, 2, 1, 0, 2)
-  DEFINE_SWIZZLE(yxw, 3, 1, 0, 3)
-  DEFINE_SWIZZLE(yyx, 1, 1, 1, 0)
-  DEFINE_SWIZZLE(yyy, 1, 1, 1, 1)
-  DEFINE_SWIZZLE(yyz, 2, 1, 1, 2)
-  DEFINE_SWIZZLE(yyw, 3, 1, 1, 3)
-  DEFINE_SWIZZLE(yzx, 2, 1, 2, 0)
-  DEFINE_SWIZZLE(yzy, 2, 1, 2, 1)
-  DEFINE_SWIZZLE(yzz, 2, 1, 2, 2)
-  DEFINE_SWIZZLE(yzw, 3, 1, 2, 3)
-  DEFINE_SWIZZLE(ywx, 3, 1, 3, 0)
-  DEFINE_SWIZZLE(ywy, 3, 1, 3, 1)
-  DEFINE_SWIZZLE(ywz, 3, 1, 3, 2)
-  DEFINE_SWIZZLE(yww, 3, 1, 3, 3)
-
-  DEFINE_SWIZZLE(zxx, 2, 2, 0, 0)
-  DEFINE_SWIZZLE(zxy, 2, 2, 0, 1)
-  DEFINE_SWIZZLE(zxz, 2, 2, 0, 2)
-  DEFINE_SWIZZLE(zxw, 3, 2, 0, 3)
-  DEFINE_SWIZZLE(zyx, 2, 2, 1, 0)
-  DEFINE_SWIZZLE(zyy, 2, 2, 1, 1)
-  DEFINE_SWIZZLE(zyz, 2, 2, 1, 2)
-  DEFINE_SWIZZLE(zyw, 3, 2, 1, 3)
-  DEFINE_SWIZZLE(zzx, 2, 2, 2, 0)
-  DEFINE_SWIZZLE(zzy, 2, 2, 2, 1)
-  DEFINE_SWIZZLE(zzz, 2, 2, 2, 2)
-  DEFINE_SWIZZLE(zzw, 3, 2, 2, 3)
-  DEFINE_SWIZZLE(zwx, 3, 2, 3, 0)
-  DEFINE_SWIZZLE(zwy, 3, 2, 3, 1)
-  DEFINE_SWIZZLE(zwz, 3, 2, 3, 2)
-  DEFINE_SWIZZLE(zww, 3, 2, 3, 3)
-
-  DEFINE_SWIZZLE(wxx, 3, 3, 0, 0)
-  DEFINE_SWIZZLE(wxy, 3, 3, 0, 1)
-  DEFINE_SWIZZLE(wxz, 3, 3, 0, 2)
-  DEFINE_SWIZZLE(wxw, 3, 3, 0, 3)
-  DEFINE_SWIZZLE(wyx, 3, 3, 1, 0)
-  DEFINE_SWIZZLE(wyy, 3, 3, 1, 1)
-  DEFINE_SWIZZLE(wyz, 3, 3, 1, 2)
-  DEFINE_SWIZZLE(wyw, 3, 3, 1, 3)
-  DEFINE_SWIZZLE(wzx, 3, 3, 2, 0)
-  DEFINE_SWIZZLE(wzy, 3, 3, 2, 1)
-  DEFINE_SWIZZLE(wzz, 3, 3, 2, 2)
-  DEFINE_SWIZZLE(wzw, 3, 3, 2, 3)
-  DEFINE_SWIZZLE(wwx, 3, 3, 3, 0)
-  DEFINE_SWIZZLE(wwy, 3, 3, 3, 1)
-  DEFINE_SWIZZLE(wwz, 3, 3, 3, 2)
-  DEFINE_SWIZZLE(www, 3, 3, 3, 3)
-
-  // 4d
-  DEFINE_SWIZZLE(xxxx, 1, 0, 0, 0, 0)
-  DEFINE_SWIZZLE(xxxy, 1, 0, 0, 0, 1)
-  DEFINE_SWIZZLE(xxxz, 2, 0, 0, 0, 2)
-  DEFINE_SWIZZLE(xxxw, 3, 0, 0, 0, 3)
-  DEFINE_SWIZZLE(xxyx, 1, 0, 0, 1, 0)
-  DEFINE_SWIZZLE(xxyy, 1, 0, 0, 1, 1)
-  DEFINE_SWIZZLE(xxyz, 2, 0, 0, 1, 2)
-  DEFINE_SWIZZLE(xxyw, 3, 0, 0, 1, 3)
-  DEFINE_SWIZZLE(xxzx, 2, 0, 0, 2, 0)
-  DEFINE_SWIZZLE(xxzy, 2, 0, 0, 2, 1)
-  DEFINE_SWIZZLE(xxzz, 2, 0, 0, 2, 2)
-  DEFINE_SWIZZLE(xxzw, 3, 0, 0, 2, 3)
-  DEFINE_SWIZZLE(xxwx, 3, 0, 0, 3, 0)
-  DEFINE_SWIZZLE(xxwy, 3, 0, 0, 3, 1)
-  DEFINE_SWIZZLE(xxwz, 3, 0, 0, 3, 2)
-  DEFINE_SWIZZLE(xxww, 3, 0, 0, 3, 3)
-  DEFINE_SWIZZLE(xyxx, 1, 0, 1, 0, 0)
-  DEFINE_SWIZZLE(xyxy, 1, 0, 1, 0, 1)
-  DEFINE_SWIZZLE(xyxz, 2, 0, 1, 0, 2)
-  DEFINE_SWIZZLE(xyxw, 3, 0, 1, 0, 3)
-  DEFINE_SWIZZLE(xyyx, 1, 0, 1, 1, 0)
-  DEFINE_SWIZZLE(xyyy, 1, 0, 1, 1, 1)
-  DEFINE_SWIZZLE(xyyz, 2, 0, 1, 1, 2)
-  DEFINE_SWIZZLE(xyyw, 3, 0, 1, 1, 3)
-  DEFINE_SWIZZLE(xyzx, 2, 0, 1, 2, 0)
-  DEFINE_SWIZZLE(xyzy, 2, 0, 1, 2, 1)
-  DEFINE_SWIZZLE(xyzz, 2, 0, 1, 2, 2)
-  DEFINE_SWIZZLE(xyzw, 3, 0, 1, 2, 3)
-  DEFINE_SWIZZLE(xywx, 3, 0, 1, 3, 0)
-  DEFINE_SWIZZLE(xywy, 3, 0, 1, 3, 1)
-  DEFINE_SWIZZLE(xywz, 3, 0, 1, 3, 2)
-  DEFINE_SWIZZLE(xyww, 3, 0, 1, 3, 3)
-  DEFINE_SWIZZLE(xzxx, 2, 0, 2, 0, 0)
-  DEFINE_SWIZZLE(xzxy, 2, 0, 2, 0, 1)
-  DEFINE_SWIZZLE(xzxz, 2, 0, 2, 0, 2)
-  DEFINE_SWIZZLE(xzxw, 3, 0, 2, 0, 3)
-  DEFINE_SWIZZLE(xzyx, 2, 0, 2, 1, 0)
-  DEFINE_SWIZZLE(xzyy, 2, 0, 2, 1, 1)
-  DEFINE_SWIZZLE(xzyz, 2, 0, 2, 1, 2)
-  DEFINE_SWIZZLE(xzyw, 3, 0, 2, 1, 3)
-  DEFINE_SWIZZLE(xzzx, 2, 0, 2, 2, 0)
-  DEFINE_SWIZZLE(xzzy, 2, 0, 2, 2, 1)
-  DEFINE_SWIZZLE(xzzz, 2, 0, 2, 2, 2)
-  DEFINE_SWIZZLE(xzzw, 3, 0, 2, 2, 3)
-  DEFINE_SWIZZLE(xzwx, 3, 0, 2, 3, 0)
-  DEFINE_SWIZZLE(xzwy, 3, 0, 2, 3, 1)
-  DEFINE_SWIZZLE(xzwz, 3, 0, 2, 3, 2)
-  DEFINE_SWIZZLE(xzww, 3, 0, 2, 3, 3)
-  DEFINE_SWIZZLE(xwxx, 3, 0, 3, 0, 0)
-  DEFINE_SWIZZLE(xwxy, 3, 0, 3, 0, 1)
-  DEFINE_SWIZZLE(xwxz, 3, 0, 3, 0, 2)
-  DEFINE_SWIZZLE(xwxw, 3, 0, 3, 0, 3)
-  DEFINE_SWIZZLE(xwyx, 3, 0, 3, 1, 0)
-  DEFINE_SWIZZLE(xwyy, 3, 0, 3, 1, 1)
-  DEFINE_SWIZZLE(xwyz, 3, 0, 3, 1, 2)
-  DEFINE_SWIZZLE(xwyw, 3, 0, 3, 1, 3)
-  DEFINE_SWIZZLE(xwzx, 3, 0, 3, 2, 0)
-  DEFINE_SWIZZLE(xwzy, 3, 0, 3, 2, 1)
-  DEFINE_SWIZZLE(xwzz, 3, 0, 3, 2, 2)
-  DEFINE_SWIZZLE(xwzw, 3, 0, 3, 2, 3)
-  DEFINE_SWIZZLE(xwwx, 3, 0, 3, 3, 0)
-  DEFINE_SWIZZLE(xwwy, 3, 0, 3, 3, 1)
-  DEFINE_SWIZZLE(xwwz, 3, 0, 3, 3, 2)
-  DEFINE_SWIZZLE(xwww, 3, 0, 3, 3, 3)
-
-  DEFINE_SWIZZLE(yxxx, 1, 1, 0, 0, 0)
-  DEFINE_SWIZZLE(yxxy, 1, 1, 0, 0, 1)
-  DEFINE_SWIZZLE(yxxz, 2, 1, 0, 0, 2)
-  DEFINE_SWIZZLE(yxxw, 3, 1, 0, 0, 3)
-  DEFINE_SWIZZLE(yxyx, 1, 1, 0, 1, 0)
-  DEFINE_SWIZZLE(yxyy, 1, 1, 0, 1, 1)
-  DEFINE_SWIZZLE(yxyz, 2, 1, 0, 1, 2)
-  DEFINE_SWIZZLE(yxyw, 3, 1, 0, 1, 3)
-  DEFINE_SWIZZLE(yxzx, 2, 1, 0, 2, 0)
-  DEFINE_SWIZZLE(yxzy, 2, 1, 0, 2, 1)
-  DEFINE_SWIZZLE(yxzz, 2, 1, 0, 2, 2)
-  DEFINE_SWIZZLE(yxzw, 3, 1, 0, 2, 3)
-  DEFINE_SWIZZLE(yxwx, 3, 1, 0, 3, 0)
-  DEFINE_SWIZZLE(yxwy, 3, 1, 0, 3, 1)
-  DEFINE_SWIZZLE(yxwz, 3, 1, 0, 3, 2)
-  DEFINE_SWIZZLE(yxww, 3, 1, 0, 3, 3)
-  DEFINE_SWIZZLE(yyxx, 1, 1, 1, 0, 0)
-  DEFINE_SWIZZLE(yyxy, 1, 1, 1, 0, 1)
-  DEFINE_SWIZZLE(yyxz, 2, 1, 1, 0, 2)
-  DEFINE_SWIZZLE(yyxw, 3, 1, 1, 0, 3)
-  DEFINE_SWIZZLE(yyyx, 1, 1, 1, 1, 0)
-  DEFINE_SWIZZLE(yyyy, 1, 1, 1, 1, 1)
-  DEFINE_SWIZZLE(yyyz, 2, 1, 1, 1, 2)
-  DEFINE_SWIZZLE(yyyw, 3, 1, 1, 1, 3)
-  DEFINE_SWIZZLE(yyzx, 2, 1, 1, 2, 0)
-  DEFINE_SWIZZLE(yyzy, 2, 1, 1, 2, 1)
-  DEFINE_SWIZZLE(yyzz, 2, 1, 1, 2, 2)
-  DEFINE_SWIZZLE(yyzw, 3, 1, 1, 2, 3)
-  DEFINE_SWIZZLE(yywx, 3, 1, 1, 3, 0)
-  DEFINE_SWIZZLE(yywy, 3, 1, 1, 3, 1)
-  DEFINE_SWIZZLE(yywz, 3, 1, 1, 3, 2)
-  DEFINE_SWIZZLE(yyww, 3, 1, 1, 3, 3)
-  DEFINE_SWIZZLE(yzxx, 2, 1, 2, 0, 0)
-  DEFINE_SWIZZLE(yzxy, 2, 1, 2, 0, 1)
-  DEFINE_SWIZZLE(yzxz, 2, 1, 2, 0, 2)
-  DEFINE_SWIZZLE(yzxw, 3, 1, 2, 0, 3)
-  DEFINE_SWIZZLE(yzyx, 2, 1, 2, 1, 0)
-  DEFINE_SWIZZLE(yzyy, 2, 1, 2, 1, 1)
-  DEFINE_SWIZZLE(yzyz, 2, 1, 2, 1, 2)
-  DEFINE_SWIZZLE(yzyw, 3, 1, 2, 1, 3)
-  DEFINE_SWIZZLE(yzzx, 2, 1, 2, 2, 0)
-  DEFINE_SWIZZLE(yzzy, 2, 1, 2, 2, 1)
-  DEFINE_SWIZZLE(yzzz, 2, 1, 2, 2, 2)
-  DEFINE_SWIZZLE(yzzw, 3, 1, 2, 2, 3)
-  DEFINE_SWIZZLE(yzwx, 3, 1, 2, 3, 0)
-  DEFINE_SWIZZLE(yzwy, 3, 1, 2, 3, 1)
-  DEFINE_SWIZZLE(yzwz, 3, 1, 2, 3, 2)
-  DEFINE_SWIZZLE(yzww, 3, 1, 2, 3, 3)
-  DEFINE_SWIZZLE(ywxx, 3, 1, 3, 0, 0)
-  DEFINE_SWIZZLE(ywxy, 3, 1, 3, 0, 1)
-  DEFINE_SWIZZLE(ywxz, 3, 1, 3, 0, 2)
-  DEFINE_SWIZZLE(ywxw, 3, 1, 3, 0, 3)
-  DEFINE_SWIZZLE(ywyx, 3, 1, 3, 1, 0)
-  DEFINE_SWIZZLE(ywyy, 3, 1, 3, 1, 1)
-  DEFINE_SWIZZLE(ywyz, 3, 1, 3, 1, 2)
-  DEFINE_SWIZZLE(ywyw, 3, 1, 3, 1, 3)
-  DEFINE_SWIZZLE(ywzx, 3, 1, 3, 2, 0)
-  DEFINE_SWIZZLE(ywzy, 3, 1, 3, 2, 1)
-  DEFINE_SWIZZLE(ywzz, 3, 1, 3, 2, 2)
-  DEFINE_SWIZZLE(ywzw, 3, 1, 3, 2, 3)
-  DEFINE_SWIZZLE(ywwx, 3, 1, 3, 3, 0)
-  DEFINE_SWIZZLE(ywwy, 3, 1, 3, 3, 1)
-  DEFINE_SWIZZLE(ywwz, 3, 1, 3, 3, 2)
-  DEFINE_SWIZZLE(ywww, 3, 1, 3, 3, 3)
-
-  DEFINE_SWIZZLE(zxxx, 2, 2, 0, 0, 0)
-  DEFINE_SWIZZLE(zxxy, 2, 2, 0, 0, 1)
-  DEFINE_SWIZZLE(zxxz, 2, 2, 0, 0, 2)
-  DEFINE_SWIZZLE(zxxw, 3, 2, 0, 0, 3)
-  DEFINE_SWIZZLE(zxyx, 2, 2, 0, 1, 0)
-  DEFINE_SWIZZLE(zxyy, 2, 2, 0, 1, 1)
-  DEFINE_SWIZZLE(zxyz, 2, 2, 0, 1, 2)
-  DEFINE_SWIZZLE(zxyw, 3, 2, 0, 1, 3)
-  DEFINE_SWIZZLE(zxzx, 2, 2, 0, 2, 0)
-  DEFINE_SWIZZLE(zxzy, 2, 2, 0, 2, 1)
-  DEFINE_SWIZZLE(zxzz, 2, 2, 0, 2, 2)
-  DEFINE_SWIZZLE(zxzw, 3, 2, 0, 2, 3)
-  DEFINE_SWIZZLE(zxwx, 3, 2, 0, 3, 0)
-  DEFINE_SWIZZLE(zxwy, 3, 2, 0, 3, 1)
-  DEFINE_SWIZZLE(zxwz, 3, 2, 0, 3, 2)
-  DEFINE_SWIZZLE(zxww, 3, 2, 0, 3, 3)
-  DEFINE_SWIZZLE(zyxx, 2, 2, 1, 0, 0)
-  DEFINE_SWIZZLE(zyxy, 2, 2, 1, 0, 1)
-  DEFINE_SWIZZLE(zyxz, 2, 2, 1, 0, 2)
-  DEFINE_SWIZZLE(zyxw, 3, 2, 1, 0, 3)
-  DEFINE_SWIZZLE(zyyx, 2, 2, 1, 1, 0)
-  DEFINE_SWIZZLE(zyyy, 2, 2, 1, 1, 1)
-  DEFINE_SWIZZLE(zyyz, 2, 2, 1, 1, 2)
-  DEFINE_SWIZZLE(zyyw, 3, 2, 1, 1, 3)
-  DEFINE_SWIZZLE(zyzx, 2, 2, 1, 2, 0)
-  DEFINE_SWIZZLE(zyzy, 2, 2, 1, 2, 1)
-  DEFINE_SWIZZLE(zyzz, 2, 2, 1, 2, 2)
-  DEFINE_SWIZZLE(zyzw, 3, 2, 1, 2, 3)
-  DEFINE_SWIZZLE(zywx, 3, 2, 1, 3, 0)
-  DEFINE_SWIZZLE(zywy, 3, 2, 1, 3, 1)
-  DEFINE_SWIZZLE(zywz, 3, 2, 1, 3, 2)
-  DEFINE_SWIZZLE(zyww, 3, 2, 1, 3, 3)
-  DEFINE_SWIZZLE(zzxx, 2, 2, 2, 0, 0)
-  DEFINE_SWIZZLE(zzxy, 2, 2, 2, 0, 1)
-  DEFINE_SWIZZLE(zzxz, 2, 2, 2, 0, 2)
-  DEFINE_SWIZZLE(zzxw, 3, 2, 2, 0, 3)
-  DEFINE_SWIZZLE(zzyx, 2, 2, 2, 1, 0)
-  DEFINE_SWIZZLE(zzyy, 2, 2, 2, 1, 1)
-  DEFINE_SWIZZLE(zzyz, 2, 2, 2, 1, 2)
-  DEFINE_SWIZZLE(zzyw, 3, 2, 2, 1, 3)
-  DEFINE_SWIZZLE(zzzx, 2, 2, 2, 2, 0)
-  DEFINE_SWIZZLE(zzzy, 2, 2, 2, 2, 1)
-  DEFINE_SWIZZLE(zzzz, 2, 2, 2, 2, 2)
-  DEFINE_SWIZZLE(zzzw, 3, 2, 2, 2, 3)
-  DEFINE_SWIZZLE(zzwx, 3, 2, 2, 3, 0)
-  DEFINE_SWIZZLE(zzwy, 3, 2, 2, 3, 1)
-  DEFINE_SWIZZLE(zzwz, 3, 2, 2, 3, 2)
-  DEFINE_SWIZZLE(zzww, 3, 2, 2, 3, 3)
-  DEFINE_SWIZZLE(zwxx, 3, 2, 3, 0, 0)
-  DEFINE_SWIZZLE(zwxy, 3, 2, 3, 0, 1)
-  DEFINE_SWIZZLE(zwxz, 3, 2, 3, 0, 2)
-  DEFINE_SWIZZLE(zwxw, 3, 2, 3, 0, 3)
-  DEFINE_SWIZZLE(zwyx, 3, 2, 3, 1, 0)
-  DEFINE_SWIZZLE(zwyy, 3, 2, 3, 1, 1)
-  DEFINE_SWIZZLE(zwyz, 3, 2, 3, 1, 2)
-  DEFINE_SWIZZLE(zwyw, 3, 2, 3, 1, 3)
-  DEFINE_SWIZZLE(zwzx, 3, 2, 3, 2, 0)
-  DEFINE_SWIZZLE(zwzy, 3, 2, 3, 2, 1)
-  DEFINE_SWIZZLE(zwzz, 3, 2, 3, 2, 2)
-  DEFINE_SWIZZLE(zwzw, 3, 2, 3, 2, 3)
-  DEFINE_SWIZZLE(zwwx, 3, 2, 3, 3, 0)
-  DEFINE_SWIZZLE(zwwy, 3, 2, 3, 3, 1)
-  DEFINE_SWIZZLE(zwwz, 3, 2, 3, 3, 2)
-  DEFINE_SWIZZLE(zwww, 3, 2, 3, 3, 3)
-
-  DEFINE_SWIZZLE(wxxx, 3, 3, 0, 0, 0)
-  DEFINE_SWIZZLE(wxxy, 3, 3, 0, 0, 1)
-  DEFINE_SWIZZLE(wxxz, 3, 3, 0, 0, 2)
-  DEFINE_SWIZZLE(wxxw, 3, 3, 0, 0, 3)
-  DEFINE_SWIZZLE(wxyx, 3, 3, 0, 1, 0)
-  DEFINE_SWIZZLE(wxyy, 3, 3, 0, 1, 1)
-  DEFINE_SWIZZLE(wxyz, 3, 3, 0, 1, 2)
-  DEFINE_SWIZZLE(wxyw, 3, 3, 0, 1, 3)
-  DEFINE_SWIZZLE(wxzx, 3, 3, 0, 2, 0)
-  DEFINE_SWIZZLE(wxzy, 3, 3, 0, 2, 1)
-  DEFINE_SWIZZLE(wxzz, 3, 3, 0, 2, 2)
-  DEFINE_SWIZZLE(wxzw, 3, 3, 0, 2, 3)
-  DEFINE_SWIZZLE(wxwx, 3, 3, 0, 3, 0)
-  DEFINE_SWIZZLE(wxwy, 3, 3, 0, 3, 1)
-  DEFINE_SWIZZLE(wxwz, 3, 3, 0, 3, 2)
-  DEFINE_SWIZZLE(wxww, 3, 3, 0, 3, 3)
-  DEFINE_SWIZZLE(wyxx, 3, 3, 1, 0, 0)
-  DEFINE_SWIZZLE(wyxy, 3, 3, 1, 0, 1)
-  DEFINE_SWIZZLE(wyxz, 3, 3, 1, 0, 2)
-  DEFINE_SWIZZLE(wyxw, 3, 3, 1, 0, 3)
-  DEFINE_SWIZZLE(wyyx, 3, 3, 1, 1, 0)
-  DEFINE_SWIZZLE(wyyy, 3, 3, 1, 1, 1)
-  DEFINE_SWIZZLE(wyyz, 3, 3, 1, 1, 2)
-  DEFINE_SWIZZLE(wyyw, 3, 3, 1, 1, 3)
-  DEFINE_SWIZZLE(wyzx, 3, 3, 1, 2, 0)
-  DEFINE_SWIZZLE(wyzy, 3, 3, 1, 2, 1)
-  DEFINE_SWIZZLE(wyzz, 3, 3, 1, 2, 2)
-  DEFINE_SWIZZLE(wyzw, 3, 3, 1, 2, 3)
-  DEFINE_SWIZZLE(wywx, 3, 3, 1, 3, 0)
-  DEFINE_SWIZZLE(wywy, 3, 3, 1, 3, 1)
-  DEFINE_SWIZZLE(wywz, 3, 3, 1, 3, 2)
-  DEFINE_SWIZZLE(wyww, 3, 3, 1, 3, 3)
-  DEFINE_SWIZZLE(wzxx, 3, 3, 2, 0, 0)
-  DEFINE_SWIZZLE(wzxy, 3, 3, 2, 0, 1)
-  DEFINE_SWIZZLE(wzxz, 3, 3, 2, 0, 2)
-  DEFINE_SWIZZLE(wzxw, 3, 3, 2, 0, 3)
-  DEFINE_SWIZZLE(wzyx, 3, 3, 2, 1, 0)
-  DEFINE_SWIZZLE(wzyy, 3, 3, 2, 1, 1)
-  DEFINE_SWIZZLE(wzyz, 3, 3, 2, 1, 2)
-  DEFINE_SWIZZLE(wzyw, 3, 3, 2, 1, 3)
-  DEFINE_SWIZZLE(wzzx, 3, 3, 2, 2, 0)
-  DEFINE_SWIZZLE(wzzy, 3, 3, 2, 2, 1)
-  DEFINE_SWIZZLE(wzzz, 3, 3, 2, 2, 2)
-  DEFINE_SWIZZLE(wzzw, 3, 3, 2, 2, 3)
-  DEFINE_SWIZZLE(wzwx, 3, 3, 2, 3, 0)
-  DEFINE_SWIZZLE(wzwy, 3, 3, 2, 3, 1)
-  DEFINE_SWIZZLE(wzwz, 3, 3, 2, 3, 2)
-  DEFINE_SWIZZLE(wzww, 3, 3, 2, 3, 3)
-  DEFINE_SWIZZLE(wwxx, 3, 3, 3, 0, 0)
-  DEFINE_SWIZZLE(wwxy, 3, 3, 3, 0, 1)
-  DEFINE_SWIZZLE(wwxz, 3, 3, 3, 0, 2)
-  DEFINE_SWIZZLE(wwxw, 3, 3, 3, 0, 3)
-  DEFINE_SWIZZLE(wwyx, 3, 3, 3, 1, 0)
-  DEFINE_SWIZZLE(wwyy, 3, 3, 3, 1, 1)
-  DEFINE_SWIZZLE(wwyz, 3, 3, 3, 1, 2)
-  DEFINE_SWIZZLE(wwyw, 3, 3, 3, 1, 3)
-  DEFINE_SWIZZLE(wwzx, 3, 3, 3, 2, 0)
-  DEFINE_SWIZZLE(wwzy, 3, 3, 3, 2, 1)
-  DEFINE_SWIZZLE(wwzz, 3, 3, 3, 2, 2)
-  DEFINE_SWIZZLE(wwzw, 3, 3, 3, 2, 3)
-  DEFINE_SWIZZLE(wwwx, 3, 3, 3, 3, 0)
-  DEFINE_SWIZZLE(wwwy, 3, 3, 3, 3, 1)
-  DEFINE_SWIZZLE(wwwz, 3, 3, 3, 3, 2)
-  DEFINE_SWIZZLE(wwww, 3, 3, 3, 3, 3)
+#if defined(__has_builtin)
+#if __has_builtin(__builtin_shufflevector)
+    // A full float4 shuffle is a single instruction (shufps, or a NEON permute), which the compiler does not reliably
+    // find through the array copy below. The vector extension type keeps this free of intrinsic headers.
+    if constexpr (std::is_same_v<T, float> && LANES == 4 && sizeof...(Indices) == 4) {
+      if (!std::is_constant_evaluated()) {
+        typedef float Float4 __attribute__((vector_size(16)));
+        Float4 value;
+        __builtin_memcpy(&value, data.data(), sizeof(value));
+        const Float4 shuffled = __builtin_shufflevector(value, value, Indices...);
+        Vector<T, 4> result;
+        __builtin_memcpy(result.data.data(), &shuffled, sizeof(shuffled));
+        return result;
+      }
+    }
+#endif
+#endif
+    return Vector<T, sizeof...(Indices)>(std::array<T, sizeof...(Indices)>{data[Indices]...});
+  }
+
+  // Swizzle by component names, e.g. v.swizzle<"xzy">() or v.swizzle<"bgra">(). The name is parsed at compile time
+  // into the index form, so there is a single template behind every swizzle instead of one member per name.
+  template <SwizzlePattern Pattern>
+  constexpr auto swizzle() const {
+    static_assert(Pattern.Valid(), "Swizzle names 1 to 4 of the components xyzw, rgba or stpq");
+    return [this]<std::size_t... I>(std::index_sequence<I...>) {
+      return swizzle<Pattern.Index(I)...>();
+    }(std::make_index_sequence<Pattern.Size()>{});
+  }
 };
 
+template <typename T, uint8_t N>
+constexpr Vector<T, N> operator+(Vector<T, N> a, const Vector<T, N>& b) {
+  return a += b;
+}
+
+template <typename T, uint8_t N>
+constexpr Vector<T, N> operator-(Vector<T, N> a, const Vector<T, N>& b) {
+  return a -= b;
+}
+
+template <typename T, uint8_t N>
+constexpr Vector<T, N> operator*(Vector<T, N> a, const Vector<T, N>& b) {
+  return a *= b;
+}
+
+template <typename T, uint8_t N>
+constexpr Vector<T, N> operator/(Vector<T, N> a, const Vector<T, N>& b) {
+  return a /= b;
+}
+
+template <typename T, uint8_t N>
+constexpr Vector<T, N> operator*(Vector<T, N> v, T scale) {
+  return v *= scale;
+}
+
+template <typename T, uint8_t N>
+constexpr Vector<T, N> operator*(T scale, Vector<T, N> v) {
+  return v *= scale;
+}
+
+template <typename T, uint8_t N>
+constexpr Vector<T, N> operator/(Vector<T, N> v, T divisor) {
+  return v /= divisor;
+}
+
+template <typename T, uint8_t N>
+constexpr T Dot(const Vector<T, N>& a, const Vector<T, N>& b) {
+  T sum = 0;
+  for (std::size_t i = 0; i < N; i++) {
+    sum += a.data[i] * b.data[i];
+  }
+  return sum;
+}
+
+template <typename T>
+constexpr Vector<T, 3> Cross(const Vector<T, 3>& a, const Vector<T, 3>& b) {
+  return {a.data[1] * b.data[2] - a.data[2] * b.data[1], a.data[2] * b.data[0] - a.data[0] * b.data[2],
+          a.data[0] * b.data[1] - a.data[1] * b.data[0]};
+}
+
+template <typename T, uint8_t N>
+constexpr T LengthSquared(const Vector<T, N>& v) {
+  return Dot(v, v);
+}
+
+template <typename T, uint8_t N>
+T Length(const Vector<T, N>& v) {
+  return std::sqrt(Dot(v, v));
+}
+
+// Multiplies by the reciprocal length, one division per vector instead of one per component. The reciprocal of a zero
+// vector's length is infinite, so the padding lanes are cleared again afterwards.
+template <typename T, uint8_t N>
+Vector<T, N> Normalize(const Vector<T, N>& v) {
+  Vector<T, N> result = v * (T(1) / std::sqrt(Dot(v, v)));
+  for (std::size_t i = N; i < Vector<T, N>::LANES; i++) {
+    result.data[i] = 0;
+  }
+  return result;
+}
+
+template <typename T, uint8_t N>
+constexpr Vector<T, N> Min(const Vector<T, N>& a, const Vector<T, N>& b) {
+  Vector<T, N> result;
+  for (std::size_t i = 0; i < Vector<T, N>::LANES; i++) {
+    result.data[i] = a.data[i] < b.data[i] ? a.data[i] : b.data[i];
+  }
+  return result;
+}
+
+template <typename T, uint8_t N>
+constexpr Vector<T, N> Max(const Vector<T, N>& a, const Vector<T, N>& b) {
+  Vector<T, N> result;
+  for (std::size_t i = 0; i < Vector<T, N>::LANES; i++) {
+    result.data[i] = a.data[i] > b.data[i] ? a.data[i] : b.data[i];
+  }
+  return result;
+}
+
+template <typename T, uint8_t N>
+constexpr Vector<T, N> Abs(const Vector<T, N>& v) {
+  Vector<T, N> result;
+  for (std::size_t i = 0; i < Vector<T, N>::LANES; i++) {
+    result.data[i] = v.data[i] < 0 ? -v.data[i] : v.data[i];
+  }
+  return result;
+}
+
+// a * b + c. Written as one expression per lane, so with FMA enabled (-mfma, or -ffp-contract=fast on other targets)
+// it contracts into fused multiply adds.
+template <typename T, uint8_t N>
+constexpr Vector<T, N> Fma(const Vector<T, N>& a, const Vector<T, N>& b, const Vector<T, N>& c) {
+  Vector<T, N> result;
+  for (std::size_t i = 0; i < Vector<T, N>::LANES; i++) {
+    result.data[i] = a.data[i] * b.data[i] + c.data[i];
+  }
+  return result;
+}
+
+template <typename T, uint8_t N>
+constexpr T MinComponent(const Vector<T, N>& v) {
+  T result = v.data[0];
+  for (std::size_t i = 1; i < N; i++) {
+    result = std::min(result, v.data[i]);
+  }
+  return result;
+}
+
+template <typename T, uint8_t N>
+constexpr T MaxComponent(const Vector<T, N>& v) {
+  T result = v.data[0];
+  for (std::size_t i = 1; i < N; i++) {
+    result = std::max(result, v.data[i]);
+  }
+  return result;
+}
+
 typedef Vector<int, 2> vec2i;
 typedef Vector<int, 3> vec3i;
 typedef Vector<int, 4> vec4i;
@@ -449,19 +399,246 @@ typedef Vector<Scalar, 2> vec2;
 typedef Vector<Scalar, 3> vec3;
 typedef Vector<Scalar, 4> vec4;
 
-template <uint8_t R, uint8_t C>
+// ================================================================================
+// matrix
+// ================================================================================
+// Fixed size R x C matrix stored row major in a std::array, so it lives on the stack and every operation can run at
+// compile time. Vectors are columns: `m * v` transforms v, and `a * b` applies b first.
+template <uint8_t R, uint8_t C, typename T = Scalar>
 struct Matrix {
-  std::vector<Scalar> data;
-  uint8_t numRows = R;
-  uint8_t numCols = C;
-
-  Matrix() {
-    data = std::vector<Scalar>(R * C, 0);
-    for (int i = 0; i < R * C; i++) {
-      for (int j = 0; j < R * C; j++) {
+  std::array<T, R * C> data;
+
+  constexpr Matrix() : data{} {}
+
+  // Elements in row major order
+  constexpr explicit Matrix(const std::array<T, R * C>& data) : data{data} {}
+
+  static constexpr Matrix Identity()
+    requires(R == C)
+  {
+    Matrix identity;
+    for (std::size_t i = 0; i < R; i++) {
+      identity(i, i) = 1;
+    }
+    return identity;
+  }
+
+  static constexpr Matrix FromRows(const std::array<Vector<T, C>, R>& rows) {
+    Matrix matrix;
+    for (std::size_t row = 0; row < R; row++) {
+      for (std::size_t col = 0; col < C; col++) {
+        matrix(row, col) = rows[row][col];
       }
     }
+    return matrix;
+  }
+
+  static constexpr Matrix FromColumns(const std::array<Vector<T, R>, C>& columns) {
+    Matrix matrix;
+    for (std::size_t row = 0; row < R; row++) {
+      for (std::size_t col = 0; col < C; col++) {
+        matrix(row, col) = columns[col][row];
+      }
+    }
+    return matrix;
+  }
+
+  constexpr T& operator()(std::size_t row, std::size_t col) { return data[row * C + col]; }
+  constexpr const T& operator()(std::size_t row, std::size_t col) const { return data[row * C + col]; }
+
+  constexpr Vector<T, C> Row(std::size_t row) const {
+    Vector<T, C> result;
+    for (std::size_t col = 0; col < C; col++) {
+      result[col] = (*this)(row, col);
+    }
+    return result;
+  }
+
+  constexpr Vector<T, R> Column(std::size_t col) const {
+    Vector<T, R> result;
+    for (std::size_t row = 0; row < R; row++) {
+      result[row] = (*this)(row, col);
+    }
+    return result;
+  }
+
+  constexpr bool operator==(const Matrix&) const = default;
+
+  constexpr Matrix& operator+=(const Matrix& other) {
+    for (std::size_t i = 0; i < R * C; i++) {
+      data[i] += other.data[i];
+    }
+    return *this;
+  }
+
+  constexpr Matrix& operator-=(const Matrix& other) {
+    for (std::size_t i = 0; i < R * C; i++) {
+      data[i] -= other.data[i];
+    }
+    return *this;
+  }
+
+  constexpr Matrix& operator*=(T scale) {
+    for (T& value : data) {
+      value *= scale;
+    }
+    return *this;
   }
 };
 
+template <uint8_t R, uint8_t C, typename T>
+constexpr Matrix<R, C, T> operator+(Matrix<R, C, T> a, const Matrix<R, C, T>& b) {
+  return a += b;
+}
+
+template <uint8_t R, uint8_t C, typename T>
+constexpr Matrix<R, C, T> operator-(Matrix<R, C, T> a, const Matrix<R, C, T>& b) {
+  return a -= b;
+}
+
+template <uint8_t R, uint8_t C, typename T>
+constexpr Matrix<R, C, T> operator*(Matrix<R, C, T> m, T scale) {
+  return m *= scale;
+}
+
+template <uint8_t R, uint8_t C, typename T>
+constexpr Matrix<R, C, T> operator*(T scale, Matrix<R, C, T> m) {
+  return m *= scale;
+}
+
+template <uint8_t R, uint8_t K, uint8_t C, typename T>
+constexpr Matrix<R, C, T> operator*(const Matrix<R, K, T>& a, const Matrix<K, C, T>& b) {
+  Matrix<R, C, T> result;
+  for (std::size_t row = 0; row < R; row++) {
+    for (std::size_t k = 0; k < K; k++) {
+      const T scale = a(row, k);
+      for (std::size_t col = 0; col < C; col++) {
+        result(row, col) += scale * b(k, col);
+      }
+    }
+  }
+  return result;
+}
+
+template <uint8_t R, uint8_t C, typename T>
+constexpr Vector<T, R> operator*(const Matrix<R, C, T>& m, const Vector<T, C>& v) {
+  Vector<T, R> result;
+  for (std::size_t row = 0; row < R; row++) {
+    T sum = 0;
+    for (std::size_t col = 0; col < C; col++) {
+      sum += m(row, col) * v[col];
+    }
+    result[row] = sum;
+  }
+  return result;
+}
+
+// Row vector times matrix, i.e. transpose(m) * v
+template <uint8_t R, uint8_t C, typename T>
+constexpr Vector<T, C> operator*(const Vector<T, R>& v, const Matrix<R, C, T>& m) {
+  Vector<T, C> result;
+  for (std::size_t row = 0; row < R; row++) {
+    for (std::size_t col = 0; col < C; col++) {
+      result[col] += v[row] * m(row, col);
+    }
+  }
+  return result;
+}
+
+template <uint8_t R, uint8_t C, typename T = Scalar>
+constexpr Matrix<R, C, T> Identity()
+  requires(R == C)
+{
+  return Matrix<R, C, T>::Identity();
+}
+
+template <uint8_t R, uint8_t C, typename T>
+constexpr Matrix<C, R, T> Transpose(const Matrix<R, C, T>& m) {
+  Matrix<C, R, T> result;
+  for (std::size_t row = 0; row < R; row++) {
+    for (std::size_t col = 0; col < C; col++) {
+      result(col, row) = m(row, col);
+    }
+  }
+  return result;
+}
+
+template <typename T>
+constexpr T Determinant(const Matrix<2, 2, T>& m) {
+  return m(0, 0) * m(1, 1) - m(0, 1) * m(1, 0);
+}
+
+template <typename T>
+constexpr T Determinant(const Matrix<3, 3, T>& m) {
+  return m(0, 0) * (m(1, 1) * m(2, 2) - m(1, 2) * m(2, 1)) - m(0, 1) * (m(1, 0) * m(2, 2) - m(1, 2) * m(2, 0)) +
+         m(0, 2) * (m(1, 0) * m(2, 1) - m(1, 1) * m(2, 0));
+}
+
+// Inverse through the adjugate. Singular matrices divide by a zero determinant, so callers that can meet them check
+// Determinant() first.
+template <typename T>
+constexpr Matrix<3, 3, T> Inverse(const Matrix<3, 3, T>& m) {
+  const T inverseDeterminant = T(1) / Determinant(m);
+  return Matrix<3, 3, T>({
+      (m(1, 1) * m(2, 2) - m(1, 2) * m(2, 1)) * inverseDeterminant,
+      (m(0, 2) * m(2, 1) - m(0, 1) * m(2, 2)) * inverseDeterminant,
+      (m(0, 1) * m(1, 2) - m(0, 2) * m(1, 1)) * inverseDeterminant,
+      (m(1, 2) * m(2, 0) - m(1, 0) * m(2, 2)) * inverseDeterminant,
+      (m(0, 0) * m(2, 2) - m(0, 2) * m(2, 0)) * inverseDeterminant,
+      (m(0, 2) * m(1, 0) - m(0, 0) * m(1, 2)) * inverseDeterminant,
+      (m(1, 0) * m(2, 1) - m(1, 1) * m(2, 0)) * inverseDeterminant,
+      (m(0, 1) * m(2, 0) - m(0, 0) * m(2, 1)) * inverseDeterminant,
+      (m(0, 0) * m(1, 1) - m(0, 1) * m(1, 0)) * inverseDeterminant,
+  });
+}
+
+// Inverse through 2x2 sub-determinants of the top and bottom row pairs (Laplace expansion), the same factorization
+// glm uses
+template <typename T>
+constexpr Matrix<4, 4, T> Inverse(const Matrix<4, 4, T>& m) {
+  const T s0 = m(0, 0) * m(1, 1) - m(1, 0) * m(0, 1);
+  const T s1 = m(0, 0) * m(1, 2) - m(1, 0) * m(0, 2);
+  const T s2 = m(0, 0) * m(1, 3) - m(1, 0) * m(0, 3);
+  const T s3 = m(0, 1) * m(1, 2) - m(1, 1) * m(0, 2);
+  const T s4 = m(0, 1) * m(1, 3) - m(1, 1) * m(0, 3);
+  const T s5 = m(0, 2) * m(1, 3) - m(1, 2) * m(0, 3);
+
+  const T c5 = m(2, 2) * m(3, 3) - m(3, 2) * m(2, 3);
+  const T c4 = m(2, 1) * m(3, 3) - m(3, 1) * m(2, 3);
+  const T c3 = m(2, 1) * m(3, 2) - m(3, 1) * m(2, 2);
+  const T c2 = m(2, 0) * m(3, 3) - m(3, 0) * m(2, 3);
+  const T c1 = m(2, 0) * m(3, 2) - m(3, 0) * m(2, 2);
+  const T c0 = m(2, 0) * m(3, 1) - m(3, 0) * m(2, 1);
+
+  const T inverseDeterminant = T(1) / (s0 * c5 - s1 * c4 + s2 * c3 + s3 * c2 - s4 * c1 + s5 * c0);
+  return Matrix<4, 4, T>({
+      (m(1, 1) * c5 - m(1, 2) * c4 + m(1, 3) * c3) * inverseDeterminant,
+      (-m(0, 1) * c5 + m(0, 2) * c4 - m(0, 3) * c3) * inverseDeterminant,
+      (m(3, 1) * s5 - m(3, 2) * s4 + m(3, 3) * s3) * inverseDeterminant,
+      (-m(2, 1) * s5 + m(2, 2) * s4 - m(2, 3) * s3) * inverseDeterminant,
+
+      (-m(1, 0) * c5 + m(1, 2) * c2 - m(1, 3) * c1) * inverseDeterminant,
+      (m(0, 0) * c5 - m(0, 2) * c2 + m(0, 3) * c1) * inverseDeterminant,
+      (-m(3, 0) * s5 + m(3, 2) * s2 - m(3, 3) * s1) * inverseDeterminant,
+      (m(2, 0) * s5 - m(2, 2) * s2 + m(2, 3) * s1) * inverseDeterminant,
+
+      (m(1, 0) * c4 - m(1, 1) * c2 + m(1, 3) * c0) * inverseDeterminant,
+      (-m(0, 0) * c4 + m(0, 1) * c2 - m(0, 3) * c0) * inverseDeterminant,
+      (m(3, 0) * s4 - m(3, 1) * s2 + m(3, 3) * s0) * inverseDeterminant,
+      (-m(2, 0) * s4 + m(2, 1) * s2 - m(2, 3) * s0) * inverseDeterminant,
+
+      (-m(1, 0) * c3 + m(1, 1) * c1 - m(1, 2) * c0) * inverseDeterminant,
+      (m(0, 0) * c3 - m(0, 1) * c1 + m(0, 2) * c0) * inverseDeterminant,
+      (-m(3, 0) * s3 + m(3, 1) * s1 - m(3, 2) * s0) * inverseDeterminant,
+      (m(2, 0) * s3 - m(2, 1) * s1 + m(2, 2) * s0) * inverseDeterminant,
+  });
+}
+
+typedef Matrix<3, 3> mat3;
+typedef Matrix<4, 4> mat4;
+typedef Matrix<3, 3, float> mat3f;
+typedef Matrix<4, 4, float> mat4f;
+typedef Matrix<3, 3, double> mat3d;
+typedef Matrix<4, 4, double> mat4d;
+
 #endif  // TRACERMATH_H
@@ -0,0 +1,58 @@
+// Build cost benchmark of tracermath.h, compiled on its own by measure_tracermath.sh (the tracermath-build-benchmark
+// target) to track its compile time and object size. Not linked into anything.
+// The same code compiles against the header from before the swizzle pattern, whose swizzles are named members:
+// TRACERMATH_MEMBER_SWIZZLES selects that spelling. Whole classes are not explicitly instantiated, the old header
+// cannot instantiate all of its swizzle members.
+#include "tracermath.h"
+
+#ifdef TRACERMATH_MEMBER_SWIZZLES
+#define SWIZZLE(v, name) (v).name()
+#else
+#define SWIZZLE(v, name) (v).template swizzle<#name>()
+#endif
+
+// Arithmetic, comparison and the common functions every vector type goes through
+template <typename T, uint8_t N>
+T Arithmetic(Vector<T, N> a, const Vector<T, N>& b, T s) {
+  a += b * s - b / s;
+  a *= b;
+  a /= Max(b, Vector<T, N>(T(1)));
+  const Vector<T, N> n = Normalize(Min(a, -b));
+  return Dot(a, n) + Length(b) + LengthSquared(a) + (a == b ? T(1) : T(0));
+}
+
+// A spread of swizzles of every length, with repeated components, that both headers provide
+template <typename T>
+T Swizzles(const Vector<T, 2>& v) {
+  const Vector<T, 2> a = SWIZZLE(v, xy) + SWIZZLE(v, yx) + SWIZZLE(v, xx) + SWIZZLE(v, yy);
+  return Dot(a, a);
+}
+
+template <typename T>
+T Swizzles(const Vector<T, 3>& v) {
+  const Vector<T, 3> a = SWIZZLE(v, xyz) + SWIZZLE(v, xzy) + SWIZZLE(v, yxz) + SWIZZLE(v, yzx) + SWIZZLE(v, zxy) +
+                         SWIZZLE(v, zyx) + SWIZZLE(v, xxz) + SWIZZLE(v, zzy);
+  const Vector<T, 2> b = SWIZZLE(v, xz) + SWIZZLE(v, zy) + SWIZZLE(v, yy);
+  return Dot(a, a) + Dot(b, b);
+}
+
+template <typename T>
+T Swizzles(const Vector<T, 4>& v) {
+  const Vector<T, 4> a = SWIZZLE(v, wzyx) + SWIZZLE(v, xxzz) + SWIZZLE(v, yxwz) + SWIZZLE(v, zwxy) +
+                         SWIZZLE(v, xyzw) + SWIZZLE(v, wwxx) + SWIZZLE(v, yyyy) + SWIZZLE(v, zxwy);
+  const Vector<T, 3> b = SWIZZLE(v, xzy) + SWIZZLE(v, wyx) + SWIZZLE(v, zzw);
+  const Vector<T, 2> c = SWIZZLE(v, yx) + SWIZZLE(v, zw) + SWIZZLE(v, wx);
+  return Dot(a, a) + Dot(b, b) + Dot(c, c);
+}
+
+// The distinct vector types; vec2, vec3 and vec4 are aliases of the float or double ones
+#define TRACERMATH_BUILD_INSTANTIATE(T, N)                     \
+  template T Arithmetic(Vector<T, N>, const Vector<T, N>&, T); \
+  template T Swizzles(const Vector<T, N>&);
+
+TRACERMATH_BUILD_INSTANTIATE(float, 2)
+TRACERMATH_BUILD_INSTANTIATE(float, 3)
+TRACERMATH_BUILD_INSTANTIATE(float, 4)
+TRACERMATH_BUILD_INSTANTIATE(double, 2)
+TRACERMATH_BUILD_INSTANTIATE(double, 3)
+TRACERMATH_BUILD_INSTANTIATE(double, 4)
@@ -0,0 +1,61 @@
+#ifndef TRANSFORM_H
+#define TRANSFORM_H
+#include <glm/glm.hpp>
+
+
+// Affine transform stored as the top three rows of a 4x4 matrix, 48 bytes instead of 64; the bottom row is always
+// (0, 0, 0, 1). Points and vectors are transformed in the precision they come in, so double rays stay double.
+struct Transform3x4 {
+  glm::vec4 rows[3] = {{1, 0, 0, 0}, {0, 1, 0, 0}, {0, 0, 1, 0}};
+
+  Transform3x4() = default;
+
+  // glm matrices are column major, `matrix[column][row]`
+  explicit Transform3x4(const glm::mat4 &matrix) {
+    for (int row = 0; row < 3; row++) {
+      rows[row] = {matrix[0][row], matrix[1][row], matrix[2][row], matrix[3][row]};
+    }
+  }
+
+  glm::mat4 Matrix() const {
+    glm::mat4 matrix(1);
+    for (int row = 0; row < 3; row++) {
+      for (int column = 0; column < 4; column++) {
+        matrix[column][row] = rows[row][column];
+      }
+    }
+    return matrix;
+  }
+
+  glm::vec3 Translation() const { return {rows[0].w, rows[1].w, rows[2].w}; }
+
+  // The linear part must be invertible
+  Transform3x4 Inverse() const {
+    const glm::mat3 linear      = glm::inverse(glm::mat3(Matrix()));
+    const glm::vec3 translation = -(linear * Translation());
+    return Transform3x4(glm::mat4(
+      glm::vec4(linear[0], 0), glm::vec4(linear[1], 0), glm::vec4(linear[2], 0), glm::vec4(translation, 1)));
+  }
+
+  template<typename T>
+  glm::vec<3, T> Point(const glm::vec<3, T> &point) const {
+    return Vector(point) + glm::vec<3, T>(Translation());
+  }
+
+  template<typename T>
+  glm::vec<3, T> Vector(const glm::vec<3, T> &vector) const {
+    return {
+      glm::dot(glm::vec<3, T>(rows[0]), vector), glm::dot(glm::vec<3, T>(rows[1]), vector),
+      glm::dot(glm::vec<3, T>(rows[2]), vector)};
+  }
+
+  // Transpose of the linear part times `vector`. Applied by the inverse of a transform it carries normals along with
+  // the transform; the result is not normalized.
+  template<typename T>
+  glm::vec<3, T> TransposedVector(const glm::vec<3, T> &vector) const {
+    return glm::vec<3, T>(rows[0]) * vector.x + glm::vec<3, T>(rows[1]) * vector.y +
+           glm::vec<3, T>(rows[2]) * vector.z;
+  }
+};
+
+#endif // TRANSFORM_H
@@ -0,0 +1,464 @@
+#ifndef WAVEFRONT_H
+#define WAVEFRONT_H
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <fmt/core.h>
+#include <glm/glm.hpp>
+#include <memory_resource>
+#include <optional>
+#include <vector>
+
+#include "arena.h"
+#include "bvh.h"
+#include "camera.h"
+#include "framebuffer.h"
+#include "integrator.h"
+#include "material.h"
+#include "profiler.h"
+#include "ray.h"
+#include "sampler.h"
+#include "scene.h"
+#include "scheduler.h"
+#include "simd.h"
+#include "threadpool.h"
+
+
+inline uint32_t MortonCode3D(uint32_t x, uint32_t y, uint32_t z) {
+  auto spread = [](uint32_t v) {
+    v &= 0x000003ff;
+    v = (v | (v << 16)) & 0x030000ff;
+    v = (v | (v << 8)) & 0x0300f00f;
+    v = (v | (v << 4)) & 0x030c30c3;
+    v = (v | (v << 2)) & 0x09249249;
+    return v;
+  };
+  return spread(x) | (spread(y) << 1) | (spread(z) << 2);
+}
+
+// Sign bits of the direction, rays in the same octant visit BVH children in the same order
+inline uint32_t DirectionOctant(const glm::vec3 &direction) {
+  return (direction.x < 0 ? 1u : 0u) | (direction.y < 0 ? 2u : 0u) | (direction.z < 0 ? 4u : 0u);
+}
+
+
+// Paths in flight, one slot per path. `sample` is the slot of the pixel sample a path adds its radiance to.
+struct PathQueue {
+  AlignedVector<float>  originX, originY, originZ;
+  AlignedVector<float>  directionX, directionY, directionZ;
+  AlignedVector<float>  throughputR, throughputG, throughputB;
+  std::vector<PixelSampler> sampler;
+  std::vector<uint32_t>     sample;
+
+  size_t Size() const { return sample.size(); }
+
+  void Resize(size_t size) {
+    for (AlignedVector<float> *values:
+         {&originX, &originY, &originZ, &directionX, &directionY, &directionZ, &throughputR, &throughputG,
+          &throughputB}) {
+      values->resize(size);
+    }
+    sampler.resize(size, PixelSampler(SamplerType::Independent, 0, 0, 0));
+    sample.resize(size);
+  }
+
+  Ray GetRay(size_t i) const {
+    return {{originX[i], originY[i], originZ[i]}, {directionX[i], directionY[i], directionZ[i]}};
+  }
+
+  void SetRay(size_t i, const Ray &ray) {
+    originX[i]    = ray.origin.x;
+    originY[i]    = ray.origin.y;
+    originZ[i]    = ray.origin.z;
+    directionX[i] = ray.direction.x;
+    directionY[i] = ray.direction.y;
+    directionZ[i] = ray.direction.z;
+  }
+
+  glm::vec3 Throughput(size_t i) const { return {throughputR[i], throughputG[i], throughputB[i]}; }
+
+  void SetThroughput(size_t i, const glm::vec3 &throughput) {
+    throughputR[i] = throughput.x;
+    throughputG[i] = throughput.y;
+    throughputB[i] = throughput.z;
+  }
+
+  void Copy(size_t to, const PathQueue &from, size_t index) {
+    SetRay(to, from.GetRay(index));
+    SetThroughput(to, from.Throughput(index));
+    sampler[to] = from.sampler[index];
+    sample[to] = from.sample[index];
+  }
+};
+
+
+// Shadow rays towards the sun, one slot per path of the current bounce. A zero contribution marks an empty slot.
+struct ShadowQueue {
+  AlignedVector<float> originX, originY, originZ;
+  AlignedVector<float> contributionR, contributionG, contributionB;
+
+  void Resize(size_t size) {
+    for (AlignedVector<float> *values: {&originX, &originY, &originZ, &contributionR, &contributionG, &contributionB}) {
+      values->resize(size);
+    }
+  }
+};
+
+
+struct WavefrontStatistics {
+  uint64_t paths             = 0;
+  uint64_t extensionRays     = 0;
+  uint64_t shadowRays        = 0;
+  double   generateSeconds   = 0;
+  double   sortSeconds       = 0;
+  double   extendSeconds     = 0;
+  double   shadeSeconds      = 0;
+  double   shadowSeconds     = 0;
+  double   accumulateSeconds = 0;
+};
+
+
+// Stream path tracer computing the same estimate as TraceRadiance(), one bounce of a whole batch of paths at a time.
+// Each bounce runs as separate batched stages over structure of arrays queues:
+//   generate   primary rays for up to batchSize pixel samples
+//   sort       surviving bounce rays by direction octant, then by the Morton code of their origin cell
+//   extend     closest hit of every path
+//   shade      sky on misses; on hits the material kernel, giving a shadow ray towards the sun and the next direction
+//   shadow     occlusion of the shadow rays, adding the sunlight of the unoccluded ones
+// Sorting turns the incoherent bounce rays into runs that traverse the same part of the BVH and touch the same spheres.
+// The shade stage groups the paths by what they hit, the misses and then one group per MaterialType, and runs each
+// group as one batch through the kernel of its type, so no hit pays for a dispatch.
+class WavefrontIntegrator {
+public:
+  WavefrontIntegrator(const SceneView &scene, const Sky &sky, ThreadPool &pool, size_t batchSize = 1 << 16) :
+      batchSize(batchSize), scene(scene), sky(sky), pool(pool) {}
+
+  size_t         batchSize;
+  bool           sortRays    = true;
+  SamplerType    samplerType = SamplerType::Sobol;
+  FeatureBuffer *features    = nullptr; // receives the PathFeatures of every sample when set
+
+  // Adds `samplesForPixel(x, y)` samples to every pixel. Samples are numbered from the pixel's current sample count and
+  // drawn from the same PixelSampler stream as the per pixel path, so both integrators trace the same primary rays.
+  template<typename SampleCountFunction>
+  void RenderPass(
+    const RayGenerator &generator, AccumulationBuffer &accumulation, SampleCountFunction &&samplesForPixel) {
+    frameArena.Reset();
+    const std::pmr::vector<Tile> tiles = MakeTiles(
+      accumulation.Width(), accumulation.Height(), accumulation.TileSize(), TileOrder::Scanline, &frameArena);
+    samplePixels.clear();
+    for (const Tile &tile: tiles) {
+      for (int y = tile.y0; y < tile.y1; y++) {
+        for (int x = tile.x0; x < tile.x1; x++) {
+          const uint32_t first = accumulation.SampleCount(x, y);
+          const uint32_t count = samplesForPixel(x, y);
+          for (uint32_t sample = first; sample < first + count; sample++) {
+            samplePixels.push_back({x, y, sample});
+          }
+        }
+      }
+    }
+    for (size_t begin = 0; begin < samplePixels.size(); begin += batchSize) {
+      RenderBatch(generator, accumulation, begin, std::min(samplePixels.size(), begin + batchSize));
+    }
+  }
+
+  const WavefrontStatistics &Statistics() const { return statistics; }
+
+  void PrintStatistics() const {
+    const WavefrontStatistics &s = statistics;
+    const double total = s.generateSeconds + s.sortSeconds + s.extendSeconds + s.shadeSeconds + s.shadowSeconds +
+                         s.accumulateSeconds;
+    fmt::println(
+      "wavefront: {} paths, {} extension rays, {} shadow rays, {:.3f} ms ({:.2f} Mrays/s)", s.paths, s.extensionRays,
+      s.shadowRays, total * 1000.0, total > 0 ? (s.extensionRays + s.shadowRays) / total * 1e-6 : 0.0);
+    fmt::println(
+      "  generate {:.3f} ms, sort {:.3f} ms, extend {:.3f} ms, shade {:.3f} ms, shadow {:.3f} ms, accumulate {:.3f} ms",
+      s.generateSeconds * 1000.0, s.sortSeconds * 1000.0, s.extendSeconds * 1000.0, s.shadeSeconds * 1000.0,
+      s.shadowSeconds * 1000.0, s.accumulateSeconds * 1000.0);
+  }
+
+private:
+  static constexpr int64_t  GRAIN_SIZE   = 256;
+  static constexpr uint32_t ORIGIN_CELLS = 64; // per axis, so a sort key is 3 octant bits and 18 Morton bits
+  static constexpr size_t   SHADE_GROUPS = 1 + static_cast<size_t>(MaterialType::Count); // misses, then the types
+
+  struct SamplePixel {
+    int      x, y;
+    uint32_t sample;
+  };
+
+  void RenderBatch(const RayGenerator &generator, AccumulationBuffer &accumulation, size_t begin, size_t end) {
+    const size_t count = end - begin;
+    paths.Resize(count);
+    nextPaths.Resize(count);
+    shadows.Resize(count);
+    hitT.resize(count);
+    hitIndex.resize(count);
+    hitInstance.resize(count);
+    alive.resize(count);
+    radiance.assign(count, glm::vec3(0));
+    if (features) {
+      sampleFeatures.resize(count);
+    }
+    statistics.paths += count;
+    ProfileCount(ProfileCounter::PrimaryRays, count);
+
+    Timed("generate", statistics.generateSeconds, [&] {
+      ParallelFor(pool, 0, count, GRAIN_SIZE, [&](int64_t first, int64_t last) {
+        for (int64_t i = first; i < last; i++) {
+          const SamplePixel &pixel = samplePixels[begin + i];
+          PixelSampler       sampler(samplerType, pixel.x, pixel.y, pixel.sample);
+          const glm::vec2    jitter = sampler.Next2D();
+          {
+            const ProfileScope scope(ProfileStage::RayGeneration);
+            paths.SetRay(i, generator(pixel.x + jitter.x - 0.5f, pixel.y + jitter.y - 0.5f));
+          }
+          paths.SetThroughput(i, glm::vec3(1));
+          paths.sampler[i] = sampler;
+          paths.sample[i] = static_cast<uint32_t>(i);
+        }
+      });
+    });
+
+    size_t active = count;
+    for (int bounce = 0; bounce <= MAX_BOUNCES && active > 0; bounce++) {
+      // Primary rays leave the generator in tile order, which is already coherent
+      if (bounce > 0) {
+        Timed("sort", statistics.sortSeconds, [&] { active = CompactAndSort(active); });
+      }
+      statistics.extensionRays += active;
+
+      Timed("extend", statistics.extendSeconds, [&] {
+        ParallelFor(pool, 0, active, GRAIN_SIZE, [&](int64_t first, int64_t last) {
+          for (int64_t i = first; i < last; i++) {
+            const std::optional<SceneHit> hit = scene.ClosestHit(paths.GetRay(i));
+            hitT[i]                           = hit ? hit->t : 0;
+            hitIndex[i]                       = hit ? static_cast<int32_t>(hit->index) : -1;
+            hitInstance[i]                    = hit ? hit->instance : 0;
+          }
+        });
+      });
+
+      Timed("shade", statistics.shadeSeconds, [&] {
+        GroupByMaterial(active);
+        ParallelFor(pool, 0, groupBegin[1], GRAIN_SIZE, [&](int64_t first, int64_t last) {
+          for (int64_t k = first; k < last; k++) {
+            ShadeMiss(shadeOrder[k], bounce);
+          }
+        });
+        for (int type = 0; type < static_cast<int>(MaterialType::Count); type++) {
+          VisitMaterialType(static_cast<MaterialType>(type), [&](auto materialType) {
+            ParallelFor(pool, groupBegin[type + 1], groupBegin[type + 2], GRAIN_SIZE, [&](int64_t first, int64_t last) {
+              for (int64_t k = first; k < last; k++) {
+                ShadeHit<decltype(materialType)::value>(shadeOrder[k], bounce);
+              }
+            });
+          });
+        }
+      });
+
+      Timed("shadow", statistics.shadowSeconds, [&] {
+        std::atomic<uint64_t> traced = 0;
+        ParallelFor(pool, 0, active, GRAIN_SIZE, [&](int64_t first, int64_t last) {
+          uint64_t chunkTraced = 0;
+          for (int64_t i = first; i < last; i++) {
+            const glm::vec3 contribution = {
+              shadows.contributionR[i], shadows.contributionG[i], shadows.contributionB[i]};
+            if (contribution == glm::vec3(0)) {
+              continue;
+            }
+            chunkTraced++;
+            const glm::vec3 origin = {shadows.originX[i], shadows.originY[i], shadows.originZ[i]};
+            if (!scene.AnyHit(Ray{origin, sky.sunDirection})) {
+              radiance[paths.sample[i]] += contribution;
+            }
+          }
+          traced.fetch_add(chunkTraced, std::memory_order_relaxed);
+        });
+        statistics.shadowRays += traced.load(std::memory_order_relaxed);
+      });
+    }
+
+    // Several samples of one pixel can be in the same batch, so they are added by a single thread
+    Timed("accumulate", statistics.accumulateSeconds, [&] {
+      const ProfileScope scope(ProfileStage::Accumulation);
+      for (size_t i = 0; i < count; i++) {
+        const SamplePixel &pixel = samplePixels[begin + i];
+        accumulation.AddSample(pixel.x, pixel.y, radiance[i]);
+        if (features) {
+          features->Add(pixel.x, pixel.y, sampleFeatures[i]);
+        }
+      }
+    });
+  }
+
+  // Counting sort of the active paths into shadeOrder: the misses, then the hits of each MaterialType in turn. Group g
+  // is shadeOrder[groupBegin[g], groupBegin[g + 1]).
+  void GroupByMaterial(size_t active) {
+    auto group = [&](size_t i) {
+      return hitIndex[i] < 0 ? 0 : 1 + static_cast<size_t>(scene.MaterialTypeOf(Hit(i)));
+    };
+    groupBegin.fill(0);
+    for (size_t i = 0; i < active; i++) {
+      groupBegin[group(i) + 1]++;
+    }
+    for (size_t g = 1; g < groupBegin.size(); g++) {
+      groupBegin[g] += groupBegin[g - 1];
+    }
+    std::array<size_t, SHADE_GROUPS> next;
+    std::copy_n(groupBegin.begin(), SHADE_GROUPS, next.begin());
+    shadeOrder.resize(active);
+    for (size_t i = 0; i < active; i++) {
+      shadeOrder[next[group(i)]++] = static_cast<uint32_t>(i);
+    }
+  }
+
+  // Only valid for paths that hit something
+  SceneHit Hit(size_t i) const { return {hitT[i], static_cast<uint32_t>(hitIndex[i]), hitInstance[i]}; }
+
+  void ShadeMiss(size_t i, int bounce) {
+    const ProfileScope scope(ProfileStage::Shading);
+    const glm::vec3    skyRadiance = sky.Radiance(paths.GetRay(i).direction);
+    shadows.contributionR[i] = shadows.contributionG[i] = shadows.contributionB[i] = 0;
+    radiance[paths.sample[i]] += paths.Throughput(i) * skyRadiance;
+    if (features && bounce == 0) {
+      sampleFeatures[paths.sample[i]] = {skyRadiance, glm::vec3(0), 0.0f};
+    }
+    alive[i] = false;
+  }
+
+  template<MaterialType Type>
+  void ShadeHit(size_t i, int bounce) {
+    const ProfileScope scope(ProfileStage::Shading);
+    const Ray           ray        = paths.GetRay(i);
+    const glm::vec3     throughput = paths.Throughput(i);
+    const SceneHit      hit        = Hit(i);
+    const SceneView    &geometry   = scene.HitGeometry(hit);
+    const glm::vec3     point      = ray.origin + hit.t * ray.direction;
+    const glm::vec3     normal     = scene.Normal(hit, point);
+    const SurfaceSample surface    = SampleSurface<Type>(
+      geometry.materials, geometry.material[hit.index], ray.direction, normal, sky.sunDirection,
+      paths.sampler[i].Next2D());
+    if (features && bounce == 0) {
+      sampleFeatures[paths.sample[i]] = {geometry.materials.Color(geometry.material[hit.index]), normal, hit.t};
+    }
+
+    // Only diffuse surfaces sample the sun and only emitters emit, the other kernels skip those stores altogether
+    glm::vec3 sun = glm::vec3(0);
+    if constexpr (Type == MaterialType::Diffuse) {
+      sun = throughput * (surface.sunWeight * sky.sunIrradiance);
+    }
+    if constexpr (Type == MaterialType::Emissive) {
+      radiance[paths.sample[i]] += throughput * surface.emitted;
+    }
+    shadows.originX[i]       = point.x;
+    shadows.originY[i]       = point.y;
+    shadows.originZ[i]       = point.z;
+    shadows.contributionR[i] = sun.x;
+    shadows.contributionG[i] = sun.y;
+    shadows.contributionB[i] = sun.z;
+
+    paths.SetRay(i, {point, surface.direction});
+    paths.SetThroughput(i, throughput * surface.weight);
+    alive[i] = bounce < MAX_BOUNCES && surface.weight != glm::vec3(0);
+  }
+
+  // Moves the surviving paths to the front of the queue, ordered by (direction octant, origin cell), and returns their
+  // number
+  size_t CompactAndSort(size_t active) {
+    sortKeys.clear();
+    AABB bounds;
+    for (size_t i = 0; i < active; i++) {
+      if (alive[i]) {
+        bounds.Grow(glm::vec3(paths.originX[i], paths.originY[i], paths.originZ[i]));
+      }
+    }
+    const glm::vec3 extent = glm::max(bounds.max - bounds.min, glm::vec3(1e-6f));
+    const glm::vec3 scale  = static_cast<float>(ORIGIN_CELLS - 1) / extent;
+    for (size_t i = 0; i < active; i++) {
+      if (!alive[i]) {
+        continue;
+      }
+      uint64_t key = i;
+      if (sortRays) {
+        const glm::vec3 cell =
+          (glm::vec3(paths.originX[i], paths.originY[i], paths.originZ[i]) - bounds.min) * scale;
+        const uint32_t octant = DirectionOctant({paths.directionX[i], paths.directionY[i], paths.directionZ[i]});
+        const uint32_t morton = MortonCode3D(
+          static_cast<uint32_t>(cell.x), static_cast<uint32_t>(cell.y), static_cast<uint32_t>(cell.z));
+        key |= static_cast<uint64_t>((octant << 18) | morton) << 32;
+      }
+      sortKeys.push_back(key);
+    }
+    if (sortRays) {
+      RadixSortHighBits(sortKeys, sortScratch);
+    }
+
+    const size_t survivors = sortKeys.size();
+    ParallelFor(pool, 0, survivors, GRAIN_SIZE, [&](int64_t first, int64_t last) {
+      for (int64_t i = first; i < last; i++) {
+        nextPaths.Copy(i, paths, static_cast<uint32_t>(sortKeys[i]));
+      }
+    });
+    std::swap(paths, nextPaths);
+    return survivors;
+  }
+
+  // Stable LSD radix sort on the 21 key bits above the path index, in two passes of 11 bits
+  static void RadixSortHighBits(std::vector<uint64_t> &keys, std::vector<uint64_t> &scratch) {
+    constexpr int RADIX_BITS = 11;
+    scratch.resize(keys.size());
+    for (int shift = 32; shift < 32 + 21; shift += RADIX_BITS) {
+      size_t offsets[1 << RADIX_BITS] = {};
+      for (uint64_t key: keys) {
+        offsets[(key >> shift) & ((1 << RADIX_BITS) - 1)]++;
+      }
+      size_t total = 0;
+      for (size_t &offset: offsets) {
+        const size_t bucketSize = offset;
+        offset                  = total;
+        total += bucketSize;
+      }
+      for (uint64_t key: keys) {
+        scratch[offsets[(key >> shift) & ((1 << RADIX_BITS) - 1)]++] = key;
+      }
+      keys.swap(scratch);
+    }
+  }
+
+  // Also shows up in the Chrome trace while profiling
+  template<typename Function>
+  static void Timed(const char *name, double &seconds, Function &&function) {
+    const ProfileTraceScope trace(name);
+    const auto              start = std::chrono::steady_clock::now();
+    function();
+    const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    seconds += elapsed.count();
+  }
+
+  SceneView   scene;
+  const Sky  &sky;
+  ThreadPool &pool;
+
+  Arena                                frameArena; // per RenderPass() scratch of the calling thread
+  std::vector<SamplePixel>             samplePixels;
+  PathQueue                            paths;
+  PathQueue                            nextPaths;
+  ShadowQueue                          shadows;
+  std::vector<float>                   hitT;
+  std::vector<int32_t>                 hitIndex;
+  std::vector<uint32_t>                hitInstance;
+  std::vector<uint8_t>                 alive;
+  std::vector<uint32_t>                shadeOrder; // active paths grouped by what they hit, see GroupByMaterial()
+  std::array<size_t, SHADE_GROUPS + 1> groupBegin{}; // starts of the groups in shadeOrder
+  std::vector<glm::vec3>               radiance; // per pixel sample of the batch
+  std::vector<PathFeatures>            sampleFeatures; // per pixel sample of the batch, when `features` is set
+  std::vector<uint64_t>                sortKeys; // (octant, origin cell) in the high half, path index in the low half
+  std::vector<uint64_t>                sortScratch;
+  WavefrontStatistics                  statistics;
+};
+
+#endif // WAVEFRONT_H
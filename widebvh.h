@@ -0,0 +1,304 @@
+#ifndef WIDEBVH_H
+#define WIDEBVH_H
+#include <algorithm>
+#include <cstdint>
+#include <glm/glm.hpp>
+#include <limits>
+#include <vector>
+
+#include "bvh.h"
+#include "ray.h"
+#include "simd.h"
+
+
+enum class BVHLayout {
+  Binary,
+  Wide4, // one SSE slab test per node
+  Wide8, // one AVX2 slab test per node
+};
+
+// Node with up to Width children whose boxes are stored as structure of arrays, so one ray is tested against all of
+// them at once. Unused child slots have `child` set to INVALID and are skipped by the traversal.
+template<int Width>
+struct alignas(64) WideBVHNode {
+  static constexpr uint32_t INVALID = std::numeric_limits<uint32_t>::max();
+
+  float    minX[Width], minY[Width], minZ[Width];
+  float    maxX[Width], maxY[Width], maxZ[Width];
+  uint32_t child[Width]; // inner child: node index, leaf child: first primitive
+  uint32_t count[Width]; // primitives of a leaf child, 0 for inner children
+};
+
+
+// Ray/box tests of one ray against all children of a node. Bit i of the result is set when child i is entered within
+// (tMin, tMax); its entry distance is written to tEnter[i].
+inline uint32_t IntersectWideNodeScalar(
+  const float *minX, const float *minY, const float *minZ, const float *maxX, const float *maxY, const float *maxZ,
+  int width, const TraversalRay &ray, float tMin, float tMax, float *tEnter) {
+  uint32_t mask = 0;
+  for (int i = 0; i < width; i++) {
+    tEnter[i] = IntersectAABB({minX[i], minY[i], minZ[i]}, {maxX[i], maxY[i], maxZ[i]}, ray, tMin, tMax);
+    if (tEnter[i] != AABB_MISS) {
+      mask |= 1u << i;
+    }
+  }
+  return mask;
+}
+
+#if TRACER_SIMD_X86
+inline uint32_t IntersectWideNodeSSE2(
+  const float *minX, const float *minY, const float *minZ, const float *maxX, const float *maxY, const float *maxZ,
+  const TraversalRay &ray, float tMin, float tMax, float *tEnter) {
+  const __m128 ox = _mm_set1_ps(ray.origin.x), oy = _mm_set1_ps(ray.origin.y), oz = _mm_set1_ps(ray.origin.z);
+  const __m128 ix = _mm_set1_ps(ray.inverseDirection.x), iy = _mm_set1_ps(ray.inverseDirection.y),
+               iz = _mm_set1_ps(ray.inverseDirection.z);
+  const __m128 tx0   = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(minX), ox), ix);
+  const __m128 tx1   = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(maxX), ox), ix);
+  const __m128 ty0   = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(minY), oy), iy);
+  const __m128 ty1   = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(maxY), oy), iy);
+  const __m128 tz0   = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(minZ), oz), iz);
+  const __m128 tz1   = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(maxZ), oz), iz);
+  const __m128 enter = _mm_max_ps(
+    _mm_max_ps(_mm_min_ps(tx0, tx1), _mm_min_ps(ty0, ty1)), _mm_max_ps(_mm_min_ps(tz0, tz1), _mm_set1_ps(tMin)));
+  const __m128 exit = _mm_min_ps(
+    _mm_min_ps(_mm_max_ps(tx0, tx1), _mm_max_ps(ty0, ty1)), _mm_min_ps(_mm_max_ps(tz0, tz1), _mm_set1_ps(tMax)));
+  _mm_storeu_ps(tEnter, enter);
+  return static_cast<uint32_t>(_mm_movemask_ps(_mm_cmple_ps(enter, exit)));
+}
+
+TRACER_TARGET("avx2")
+inline uint32_t IntersectWideNodeAVX2(
+  const float *minX, const float *minY, const float *minZ, const float *maxX, const float *maxY, const float *maxZ,
+  const TraversalRay &ray, float tMin, float tMax, float *tEnter) {
+  const __m256 ox = _mm256_set1_ps(ray.origin.x), oy = _mm256_set1_ps(ray.origin.y), oz = _mm256_set1_ps(ray.origin.z);
+  const __m256 ix = _mm256_set1_ps(ray.inverseDirection.x), iy = _mm256_set1_ps(ray.inverseDirection.y),
+               iz = _mm256_set1_ps(ray.inverseDirection.z);
+  const __m256 tx0   = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(minX), ox), ix);
+  const __m256 tx1   = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(maxX), ox), ix);
+  const __m256 ty0   = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(minY), oy), iy);
+  const __m256 ty1   = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(maxY), oy), iy);
+  const __m256 tz0   = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(minZ), oz), iz);
+  const __m256 tz1   = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(maxZ), oz), iz);
+  const __m256 enter = _mm256_max_ps(
+    _mm256_max_ps(_mm256_min_ps(tx0, tx1), _mm256_min_ps(ty0, ty1)),
+    _mm256_max_ps(_mm256_min_ps(tz0, tz1), _mm256_set1_ps(tMin)));
+  const __m256 exit = _mm256_min_ps(
+    _mm256_min_ps(_mm256_max_ps(tx0, tx1), _mm256_max_ps(ty0, ty1)),
+    _mm256_min_ps(_mm256_max_ps(tz0, tz1), _mm256_set1_ps(tMax)));
+  _mm256_storeu_ps(tEnter, enter);
+  return static_cast<uint32_t>(_mm256_movemask_ps(_mm256_cmp_ps(enter, exit, _CMP_LE_OQ)));
+}
+#endif // TRACER_SIMD_X86
+
+
+// Wide BVH collapsed from a binary one. Leaves keep the binary tree's primitive ranges, so a collapsed hierarchy
+// indexes the same primitive order as the BVH it was built from.
+template<int Width>
+struct WideBVH {
+  static_assert(Width == 4 || Width == 8, "wide BVH nodes are 4 or 8 children wide");
+  static constexpr int MAX_TRAVERSAL_STACK_SIZE = BVH::MAX_TRAVERSAL_STACK_SIZE * (Width - 1);
+
+  using Node = WideBVHNode<Width>;
+
+  std::vector<Node> nodes;
+  // A binary tree that is a single leaf has no inner node to collapse into a wide node
+  uint32_t rootFirst = 0;
+  uint32_t rootCount = 0;
+
+  bool Empty() const { return nodes.empty() && rootCount == 0; }
+
+  void Clear() {
+    nodes.clear();
+    rootFirst = rootCount = 0;
+  }
+
+  // Each wide node greedily opens the child with the largest surface area until all Width slots are used
+  void Build(const BVH &bvh) {
+    Clear();
+    if (bvh.Empty()) {
+      return;
+    }
+    if (bvh.nodes[0].IsLeaf()) {
+      rootFirst = bvh.nodes[0].leftOrFirst;
+      rootCount = bvh.nodes[0].count;
+      return;
+    }
+    nodes.reserve(bvh.nodes.size() / (Width - 1) + 1);
+    Collapse(bvh, 0);
+  }
+
+  template<typename LeafFunction>
+  float TraverseClosest(const Ray &ray, float tMin, float tMax, LeafFunction &&leaf) const {
+    if (nodes.empty()) {
+      return rootCount > 0 ? leaf(rootFirst, rootCount, tMax) : tMax;
+    }
+    const TraversalRay traversalRay(ray);
+    const auto         intersect = NodeIntersector();
+
+    uint32_t stack[MAX_TRAVERSAL_STACK_SIZE];
+    float    stackDistance[MAX_TRAVERSAL_STACK_SIZE];
+    int      stackSize = 1;
+    stack[0]           = 0;
+    stackDistance[0]   = tMin;
+    alignas(32) float tEnter[Width];
+    while (stackSize > 0) {
+      stackSize--;
+      if (stackDistance[stackSize] > tMax) {
+        continue;
+      }
+      const Node &node = nodes[stack[stackSize]];
+      uint32_t    mask = intersect(node, traversalRay, tMin, tMax, tEnter);
+
+      // Leaves are intersected right away, inner children are pushed far to near so the nearest is popped first
+      const int stackBase = stackSize;
+      while (mask) {
+        const int i = __builtin_ctz(mask);
+        mask &= mask - 1;
+        if (node.child[i] == Node::INVALID) {
+          continue;
+        }
+        if (node.count[i] > 0) {
+          tMax = leaf(node.child[i], node.count[i], tMax);
+          continue;
+        }
+        int slot = stackSize++;
+        while (slot > stackBase && stackDistance[slot - 1] < tEnter[i]) {
+          stack[slot]         = stack[slot - 1];
+          stackDistance[slot] = stackDistance[slot - 1];
+          slot--;
+        }
+        stack[slot]         = node.child[i];
+        stackDistance[slot] = tEnter[i];
+      }
+    }
+    return tMax;
+  }
+
+  template<typename LeafFunction>
+  bool TraverseAny(const Ray &ray, float tMin, float tMax, LeafFunction &&leaf) const {
+    if (nodes.empty()) {
+      return rootCount > 0 && leaf(rootFirst, rootCount);
+    }
+    const TraversalRay traversalRay(ray);
+    const auto         intersect = NodeIntersector();
+
+    uint32_t stack[MAX_TRAVERSAL_STACK_SIZE];
+    int      stackSize = 1;
+    stack[0]           = 0;
+    alignas(32) float tEnter[Width];
+    while (stackSize > 0) {
+      const Node &node = nodes[stack[--stackSize]];
+      uint32_t    mask = intersect(node, traversalRay, tMin, tMax, tEnter);
+      while (mask) {
+        const int i = __builtin_ctz(mask);
+        mask &= mask - 1;
+        if (node.child[i] == Node::INVALID) {
+          continue;
+        }
+        if (node.count[i] == 0) {
+          stack[stackSize++] = node.child[i];
+        } else if (leaf(node.child[i], node.count[i])) {
+          return true;
+        }
+      }
+    }
+    return false;
+  }
+
+private:
+  using NodeIntersectFunction = uint32_t (*)(const Node &, const TraversalRay &, float, float, float *);
+
+  static uint32_t IntersectScalar(const Node &n, const TraversalRay &ray, float tMin, float tMax, float *tEnter) {
+    return IntersectWideNodeScalar(n.minX, n.minY, n.minZ, n.maxX, n.maxY, n.maxZ, Width, ray, tMin, tMax, tEnter);
+  }
+
+#if TRACER_SIMD_X86
+  static uint32_t IntersectSSE2(const Node &n, const TraversalRay &ray, float tMin, float tMax, float *tEnter) {
+    uint32_t mask = 0;
+    for (int offset = 0; offset < Width; offset += 4) {
+      mask |= IntersectWideNodeSSE2(
+                n.minX + offset, n.minY + offset, n.minZ + offset, n.maxX + offset, n.maxY + offset, n.maxZ + offset,
+                ray, tMin, tMax, tEnter + offset)
+              << offset;
+    }
+    return mask;
+  }
+
+  static uint32_t IntersectAVX2(const Node &n, const TraversalRay &ray, float tMin, float tMax, float *tEnter) {
+    return IntersectWideNodeAVX2(n.minX, n.minY, n.minZ, n.maxX, n.maxY, n.maxZ, ray, tMin, tMax, tEnter);
+  }
+#endif
+
+  // 4 wide nodes always use SSE, 8 wide nodes use AVX2 when the CPU has it and two SSE tests otherwise
+  static NodeIntersectFunction NodeIntersector() {
+    static const NodeIntersectFunction function = [] {
+#if TRACER_SIMD_X86
+      const SimdLevel level = DetectSimdLevel();
+      if (Width == 8 && (level == SimdLevel::AVX2 || level == SimdLevel::AVX512)) {
+        return static_cast<NodeIntersectFunction>(IntersectAVX2);
+      }
+      return static_cast<NodeIntersectFunction>(IntersectSSE2);
+#else
+      return static_cast<NodeIntersectFunction>(IntersectScalar);
+#endif
+    }();
+    return function;
+  }
+
+  uint32_t Collapse(const BVH &bvh, uint32_t binaryIndex) {
+    // Gather up to Width children by repeatedly opening the inner child with the largest surface area
+    uint32_t children[Width];
+    int      childCount = 2;
+    children[0]         = binaryIndex + 1;
+    children[1]         = bvh.nodes[binaryIndex].leftOrFirst;
+    while (childCount < Width) {
+      int   largest     = -1;
+      float largestArea = -1;
+      for (int i = 0; i < childCount; i++) {
+        const float area = bvh.NodeBounds(children[i]).SurfaceArea();
+        if (!bvh.nodes[children[i]].IsLeaf() && area > largestArea) {
+          largest     = i;
+          largestArea = area;
+        }
+      }
+      if (largest < 0) {
+        break;
+      }
+      const uint32_t opened   = children[largest];
+      children[largest]       = opened + 1;
+      children[childCount++] = bvh.nodes[opened].leftOrFirst;
+    }
+
+    const uint32_t index = static_cast<uint32_t>(nodes.size());
+    nodes.emplace_back();
+    for (int i = 0; i < Width; i++) {
+      Node &node = nodes[index];
+      if (i >= childCount) {
+        node.minX[i] = node.minY[i] = node.minZ[i] = std::numeric_limits<float>::infinity();
+        node.maxX[i] = node.maxY[i] = node.maxZ[i] = -std::numeric_limits<float>::infinity();
+        node.child[i]                              = Node::INVALID;
+        node.count[i]                              = 0;
+        continue;
+      }
+      const BVHNode &binary = bvh.nodes[children[i]];
+      node.minX[i]          = binary.boundsMin.x;
+      node.minY[i]          = binary.boundsMin.y;
+      node.minZ[i]          = binary.boundsMin.z;
+      node.maxX[i]          = binary.boundsMax.x;
+      node.maxY[i]          = binary.boundsMax.y;
+      node.maxZ[i]          = binary.boundsMax.z;
+      if (binary.IsLeaf()) {
+        node.child[i] = binary.leftOrFirst;
+        node.count[i] = binary.count;
+      } else {
+        // Collapse may grow `nodes`, so the reference above is refreshed on every iteration
+        const uint32_t childIndex = Collapse(bvh, children[i]);
+        nodes[index].child[i]     = childIndex;
+        nodes[index].count[i]     = 0;
+      }
+    }
+    return index;
+  }
+};
+
+#endif // WIDEBVH_H